@@ -11,6 +11,7 @@
 #endif
 
 #include <BeamDoseCalc.h>
+#include <PlanXmlFile.h>
 
 #include "SeriesDicomImporter.h"
 #include "PlanSetupDlg.h"
@@ -170,12 +171,57 @@ void CBrimstoneDoc::Dump(CDumpContext& dc) const
 /////////////////////////////////////////////////////////////////////////////
 BOOL CBrimstoneDoc::OnOpenDocument(LPCTSTR lpszPathName) 
 {
+	// a plan container is read onto the current series, so the contents are
+	//	not deleted first
+	CStringA strPathName(lpszPathName);
+	dH::PlanXmlReader::Pointer pReader = dH::PlanXmlReader::New();
+	if (pReader->CanReadFile(strPathName))
+	{
+		pReader->SetSeries(m_pSeries);
+		pReader->SetFilename(strPathName);
+		try
+		{
+			pReader->GenerateOutputInformation();
+		}
+		catch (itk::ExceptionObject& e)
+		{
+			AfxMessageBox(CString(e.GetDescription()));
+			return FALSE;
+		}
+		m_pPlan = pReader->GetOutputObject();
+
+#ifdef USE_RTOPT
+		m_pOptimizer.reset(new dH::PlanOptimizer(m_pPlan));
+#endif
+		SetModifiedFlag(FALSE);
+
+		return TRUE;
+	}
+
 	if (!CDocument::OnOpenDocument(lpszPathName))
 		return FALSE;
 
 	return TRUE;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+BOOL CBrimstoneDoc::OnSaveDocument(LPCTSTR lpszPathName) 
+{
+	// the plan is saved as a container, with its beamlets and dose
+	CStringA strPathName(lpszPathName);
+	dH::PlanXmlWriter::Pointer pWriter = dH::PlanXmlWriter::New();
+	pWriter->SetObject(m_pPlan);
+	pWriter->SetFilename(strPathName);
+	if (!pWriter->WriteFile())
+	{
+		AfxMessageBox(_T("Unable to save the plan"));
+		return FALSE;
+	}
+	SetModifiedFlag(FALSE);
+
+	return TRUE;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 void CBrimstoneDoc::OnGenbeamlets() 
 {
@@ -273,6 +319,7 @@ void CBrimstoneDoc::OnFileImportDcm()
 				}
 			}
 		}
+		m_pSeries->GetDensity()->Modified();
 #endif
 
 		if (this->m_pSeries->GetStructureCount() > 0)
@@ -40,6 +40,7 @@ public:
 	public:
 	virtual void Serialize(CArchive& ar);
 	virtual BOOL OnOpenDocument(LPCTSTR lpszPathName);
+	virtual BOOL OnSaveDocument(LPCTSTR lpszPathName);
 	virtual void DeleteContents();
 	//}}AFX_VIRTUAL
 
@@ -81,6 +81,28 @@ BOOL
 	return CView::PreCreateWindow(cs);
 }
 
+/////////////////////////////////////////////////////////////////////////////
+CDataSeries *
+	CBrimstoneView::GetIterDataSeries(int nLevel)
+	// returns the iteration series for a level, adding series up to it
+{
+	static const COLORREF arrColors[] = 
+	{
+		RGB(255, 0, 0), RGB(0, 255, 0), RGB(0, 0, 255), RGB(255, 0, 255),
+	};
+	const int nColors = sizeof(arrColors) / sizeof(arrColors[0]);
+
+	while ((int) m_pIterDS.size() <= nLevel)
+	{
+		CDataSeries::Pointer pSeries = CDataSeries::New();
+		pSeries->SetColor(arrColors[m_pIterDS.size() % nColors]);
+		m_graphIterations.AddDataSeries(pSeries);
+		m_pIterDS.push_back(pSeries);
+	}
+
+	return m_pIterDS[nLevel];
+}
+
 /////////////////////////////////////////////////////////////////////////////
 void 
 	CBrimstoneView::AddHistogram(dH::Structure * pStruct)
@@ -301,8 +323,7 @@ void CBrimstoneView::OnDvhMessage(const std::wstring & msg)
 			if (newType == dH::Structure::eNONE)
 			{
 				if (pV != NULL)
-					for (int lvl = 0; lvl < dH::PlanPyramid::MAX_SCALES; lvl++)
-						pOpt->GetPrescription(lvl)->RemoveStructureTerm(pStruct);
+					pOpt->RemoveStructureTerm(pStruct);
 				RemoveHistogram(pStruct);
 			}
 			else if (pV == NULL)
@@ -429,16 +450,8 @@ int
 	m_graphIterations.Create(NULL, NULL, WS_BORDER | WS_VISIBLE | WS_CHILD | WS_CLIPSIBLINGS,
 		CRect(0, 200, 200, 400), this, /* nID */ 114);
 
-	for (int nD = 0; nD < dH::Structure::MAX_SCALES; nD++)
-		m_pIterDS[nD] = CDataSeries::New();
-	m_pIterDS[0]->SetColor(RGB(255, 0, 0));
-	m_graphIterations.AddDataSeries(m_pIterDS[0]);
-	m_pIterDS[1]->SetColor(RGB(0, 255, 0));
-	m_graphIterations.AddDataSeries(m_pIterDS[1]);
-	m_pIterDS[2]->SetColor(RGB(0, 0, 255));
-	m_graphIterations.AddDataSeries(m_pIterDS[2]);
-	m_pIterDS[3]->SetColor(RGB(255, 0, 255));
-	m_graphIterations.AddDataSeries(m_pIterDS[3]);
+	// series for the default four levels; deeper plans add more
+	GetIterDataSeries(3);
 
 	// WebView2 iteration/convergence chart. Placeholder geometry here; the real
 	//	rectangle (bottom-right quadrant) is set in OnSize. Phase 1: load a
@@ -556,7 +569,7 @@ void
 
 		// clear iteration data matrix
 		CMatrixNxM<> mEmpty;
-		for (int nL = 0; nL < dH::Structure::MAX_SCALES; nL++)
+		for (int nL = 0; nL < (int) m_pIterDS.size(); nL++)
 			m_pIterDS[nL]->SetDataMatrix(mEmpty);
 
 		// clear the WebView2 convergence chart
@@ -603,7 +616,7 @@ LRESULT
 		if (pOID->m_ofvalue > 0.0)
 		{
 			const double yVal = -log10(pOID->m_ofvalue);
-			m_pIterDS[pOID->m_nLevel]->AddDataPoint(MakeVector<2>(m_nTotalIter, yVal));
+			GetIterDataSeries(pOID->m_nLevel)->AddDataPoint(MakeVector<2>(m_nTotalIter, yVal));
 
 			// feed the same point to the WebView2 convergence chart
 			CString strJs;
@@ -51,8 +51,10 @@ public:
 	// WebView2-hosted DVH view: DVH chart + the Target/OAR/None structure editor
 	CWebView2Host m_webDVH;
 
-	// stores data series for iteration graph
-	CDataSeries::Pointer m_pIterDS[dH::Structure::MAX_SCALES];
+	// stores data series for iteration graph, one per pyramid level; the
+	//		plan sets the number of levels, so they are added as needed
+	std::vector<CDataSeries::Pointer> m_pIterDS;
+	CDataSeries *GetIterDataSeries(int nLevel);
 
 	// generates a histogram for the specified structure
 	void AddHistogram(dH::Structure * pStruct);
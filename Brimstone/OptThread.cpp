@@ -64,8 +64,12 @@ BOOL
 	COptIterData *pOID = NULL;
 
 	// now find the level that we are at
-	for (int nLevel = dH::PlanPyramid::MAX_SCALES-1; nLevel >= 0; nLevel--)
+	for (int nLevel = pPlanOpt->GetLevelCount()-1; nLevel >= 0; nLevel--)
 	{
+		// (don't build a level just to compare)
+		if (!pPlanOpt->IsLevelBuilt(nLevel))
+			continue;
+
 		DynamicCovarianceOptimizer *pOptLevel = pPlanOpt->GetOptimizer(nLevel);			
 		if (pOpt == pOptLevel)
 		{
@@ -63,14 +63,26 @@ UINT __cdecl CalculateBeamlets( LPVOID pParam )
 {
 	CPlanSetupDlg *pPSD = (CPlanSetupDlg *) pParam;
 
+	if (pPSD->m_pPlanPyramid->GetDirectBeamlets())
+	{
+		// the coarsest level is calculated directly (the others when the 
+		//	optimizer reaches them), and the finest in the background, so 
+		//	optimization can start before the finest is done
+		pPSD->m_pPlanPyramid->CalcLevelBeamlets(
+			pPSD->m_pPlanPyramid->GetLevelCount()-1);
+		pPSD->m_pPlanPyramid->StartLevelBeamlets(0);
+
+		pPSD->PostMessage(WM_DOSECALC_DONE, NULL, NULL);
+		return 0;
+	}
+
 	for (int nAtBeam = pPSD->m_arrBDC.GetCount()-1; nAtBeam >= 0; nAtBeam--)
 	{
 		CBeamDoseCalc *pDoseCalc = pPSD->m_arrBDC[nAtBeam];
 
 		// iterate for level 0 beamlets
-		int nBeamletCount = // 5; //3; // 0;
-			19;		// TODO: set beamlet count based on spacing and dose calc region
-			// TODO: reconcile this with nBeamletCount used in PlanPyramid
+		int nBeamletCount = pPSD->m_pPlanPyramid->GetPlan()->GetMaxBeamletShift();
+			// TODO: set beamlet count based on spacing and dose calc region
 		for (int nAtBeamlet = -nBeamletCount; nAtBeamlet <= nBeamletCount; nAtBeamlet++)
 		{
 			pPSD->PostMessage(WM_DOSECALC_UPDATE, (WPARAM) nAtBeam, (LPARAM) nAtBeamlet);
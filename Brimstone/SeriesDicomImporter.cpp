@@ -242,6 +242,10 @@ void CSeriesDicomImporter::ResampleNextDicomImage()
 		}
 
 		delete pImage;
+
+		// the buffer was written directly, so flag the change for anything
+		//	cached from the density (e.g. the series mass density)
+		m_pSeries->GetDensity()->Modified();
 	}
 
 	// now remove image from vector
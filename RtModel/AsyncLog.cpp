@@ -0,0 +1,503 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#include "stdafx.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <AsyncLog.h>
+
+namespace dH
+{
+
+// per-thread ring size; a full ring drops records rather than block
+static const size_t LOG_RING_BYTES = 256 * 1024;
+
+// the drain thread runs at least this often
+static const int LOG_DRAIN_INTERVAL_MS = 50;
+
+///////////////////////////////////////////////////////////////////////////////
+static int
+	ReadLogLevel()
+	// BRIMSTONE_LOG_LEVEL, 0 (none) to 3 (trace); default is info
+{
+	const char *pEnv = getenv("BRIMSTONE_LOG_LEVEL");
+	return (pEnv != NULL) ? atoi(pEnv) : LOG_LEVEL_INFO;
+}
+
+std::atomic<int> g_nLogLevel(ReadLogLevel());
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	SetLogLevel(int nLevel)
+{
+	g_nLogLevel.store(nLevel, std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	GetLogLevel()
+{
+	return g_nLogLevel.load(std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+LogRing::LogRing(size_t nCapacity)
+	: m_bRetired(false)
+	, m_nThread(0)
+	, m_nHead(0)
+	, m_nTail(0)
+	, m_nReservedHead(0)
+	, m_nOpenSections(0)
+	, m_nDropped(0)
+{
+	// round up to a power of two, so positions wrap with a mask
+	size_t nSize = LOG_RECORD_ALIGN * 2;
+	while (nSize < nCapacity)
+		nSize *= 2;
+	m_arrBuffer.resize(nSize);
+	m_nMask = nSize - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+char *
+	LogRing::Reserve(int nType, int nLevel, size_t nPayload)
+	// called only by the owning thread
+{
+	const size_t nRecord = (sizeof(LogRecordHeader) + nPayload + LOG_RECORD_ALIGN - 1)
+		& ~(LOG_RECORD_ALIGN - 1);
+	const size_t nCapacity = m_arrBuffer.size();
+	if (nRecord > nCapacity / 2)
+	{
+		m_nDropped++;
+		return NULL;
+	}
+
+	// a record doesn't wrap: if it won't fit before the end, pad to the end
+	unsigned long long nHead = m_nHead.load(std::memory_order_relaxed);
+	const size_t nOffset = (size_t) (nHead & m_nMask);
+	const size_t nToEnd = nCapacity - nOffset;
+	const size_t nPad = (nToEnd < nRecord) ? nToEnd : 0;
+	// room is kept for the ends of the open sections, so that a section that
+	//	was begun is always ended, and the XML stays well-formed
+	//	(one more than are open, for the end of a section this record begins)
+	const size_t nKeep = (nType == LOG_RECORD_END_SECTION)
+		? 0 : (m_nOpenSections + 1) * LOG_RECORD_ALIGN;
+	if (nHead + nPad + nRecord + nKeep - m_nTail.load(std::memory_order_acquire) > nCapacity)
+	{
+		m_nDropped++;
+		return NULL;
+	}
+
+	if (nType == LOG_RECORD_BEGIN_SECTION)
+		m_nOpenSections++;
+	else if (nType == LOG_RECORD_END_SECTION && m_nOpenSections > 0)
+		m_nOpenSections--;
+
+	if (nPad > 0)
+	{
+		LogRecordHeader *pPad = (LogRecordHeader *) &m_arrBuffer[nOffset];
+		pPad->m_nBytes = (unsigned int) nPad;
+		pPad->m_nType = LOG_RECORD_PAD;
+		pPad->m_nLevel = 0;
+		pPad->m_nTicks = 0;
+		nHead += nPad;
+	}
+
+	LogRecordHeader *pHeader = (LogRecordHeader *) &m_arrBuffer[(size_t) (nHead & m_nMask)];
+	pHeader->m_nBytes = (unsigned int) nRecord;
+	pHeader->m_nType = (unsigned short) nType;
+	pHeader->m_nLevel = (unsigned short) nLevel;
+	pHeader->m_nTicks = (unsigned long long)
+		std::chrono::steady_clock::now().time_since_epoch().count();
+	m_nReservedHead = nHead + nRecord;
+
+	return (char *) (pHeader + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	LogRing::Commit()
+{
+	m_nHead.store(m_nReservedHead, std::memory_order_release);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+XmlLogSink::XmlLogSink(const char *pszFileName)
+	: m_pFile(NULL)
+{
+	if (pszFileName != NULL
+		&& fopen_s(&m_pFile, pszFileName, "w") != 0)
+	{
+		m_pFile = NULL;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+XmlLogSink::~XmlLogSink()
+{
+	if (m_pFile != NULL)
+		fclose(m_pFile);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	XmlLogSink::Output(const char *pszText)
+{
+	if (m_pFile != NULL)
+	{
+		fputs(pszText, m_pFile);
+	}
+	else
+	{
+#ifdef _WIN32
+		OutputDebugStringA(pszText);
+#else
+		fputs(pszText, stderr);
+#endif
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	XmlLogSink::Write(int nThread, const LogRecordHeader& header, const char *pPayload)
+	// formats one record
+{
+	char strText[512];
+	switch (header.m_nType)
+	{
+	case LOG_RECORD_BEGIN_SECTION:
+		sprintf_s(strText, sizeof(strText), "<log_section name=\"%s\">", pPayload);
+		Output(strText);
+		break;
+
+	case LOG_RECORD_END_SECTION:
+		Output("</log_section>\n");
+		break;
+
+	case LOG_RECORD_MESSAGE:
+		Output(pPayload);
+		break;
+
+	case LOG_RECORD_VECTOR:
+		{
+			LogVectorHeader vectorHeader;
+			memcpy(&vectorHeader, pPayload, sizeof(vectorHeader));
+			const char *pszLabel = pPayload + sizeof(vectorHeader);
+			const double *pValues =
+				(const double *) (pPayload + sizeof(vectorHeader) + vectorHeader.m_nLabelBytes);
+			const int nCount = (int) vectorHeader.m_nCount;
+
+			// same text as TraceVector wrote
+			m_arrText.clear();
+			sprintf_s(strText, sizeof(strText), "%s[%d] =\t<", pszLabel, nCount);
+			m_arrText.insert(m_arrText.end(), strText, strText + strlen(strText));
+#ifdef TRACE_VECTOR_NUMERIC
+			for (int nAt = 0; nAt < nCount; nAt++)
+			{
+				sprintf_s(strText, sizeof(strText), "% .4lf|", pValues[nAt]);
+				m_arrText.insert(m_arrText.end(), strText, strText + strlen(strText));
+			}
+#else
+			double maxElement = -1e-20;
+			for (int nAt = 0; nAt < nCount; nAt++)
+				maxElement = std::max(maxElement, pValues[nAt]);
+
+			sprintf_s(strText, sizeof(strText), "% .4lf", maxElement);
+			m_arrText.insert(m_arrText.end(), strText, strText + strlen(strText));
+			for (int nAt = 0; nAt < nCount; nAt++)
+			{
+				if (pValues[nAt] < maxElement * 0.1)
+					m_arrText.push_back(' ');
+				else if (pValues[nAt] < maxElement * 0.25)
+					m_arrText.push_back('.');
+				else if (pValues[nAt] < maxElement * 0.85)
+					m_arrText.push_back(':');
+				else
+					m_arrText.push_back('|');
+			}
+#endif
+			m_arrText.push_back('>');
+			m_arrText.push_back('\n');
+			m_arrText.push_back('\0');
+			Output(&m_arrText[0]);
+		}
+		break;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	XmlLogSink::Flush()
+{
+	if (m_pFile != NULL)
+		fflush(m_pFile);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+BinaryLogSink::BinaryLogSink(const char *pszFileName)
+	: m_pFile(NULL)
+{
+	if (fopen_s(&m_pFile, pszFileName, "wb") != 0)
+		m_pFile = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+BinaryLogSink::~BinaryLogSink()
+{
+	if (m_pFile != NULL)
+		fclose(m_pFile);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	BinaryLogSink::Write(int nThread, const LogRecordHeader& header, const char *pPayload)
+	// thread index, then the record as it sat in the ring
+{
+	if (m_pFile == NULL)
+		return;
+
+	fwrite(&nThread, sizeof(nThread), 1, m_pFile);
+	fwrite(&header, sizeof(header), 1, m_pFile);
+	fwrite(pPayload, 1, header.m_nBytes - sizeof(header), m_pFile);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	BinaryLogSink::Flush()
+{
+	if (m_pFile != NULL)
+		fflush(m_pFile);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+AsyncLog&
+	AsyncLog::GetInstance()
+{
+	static AsyncLog s_log;
+	return s_log;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+AsyncLog::AsyncLog()
+	: m_nNextThread(0)
+	, m_nRetiredDropped(0)
+	, m_bStop(false)
+{
+	const char *pszFileName = getenv("BRIMSTONE_LOG_FILE");
+	const size_t nLength = (pszFileName != NULL) ? strlen(pszFileName) : 0;
+	if (nLength > 4 && strcmp(pszFileName + nLength - 4, ".bin") == 0)
+		m_pSink.reset(new BinaryLogSink(pszFileName));
+	else
+		m_pSink.reset(new XmlLogSink(pszFileName));
+
+	m_drainThread = std::thread(&AsyncLog::DrainLoop, this);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+AsyncLog::~AsyncLog()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutexWake);
+		m_bStop = true;
+	}
+	m_cvWake.notify_one();
+	if (m_drainThread.joinable())
+		m_drainThread.join();
+
+	Flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	AsyncLog::SetSink(std::unique_ptr<LogSink> pSink)
+{
+	Flush();
+
+	std::lock_guard<std::mutex> lock(m_mutexDrain);
+	m_pSink = std::move(pSink);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	AsyncLog::BeginSection(int nLevel, const char *pszName)
+{
+	return WriteString(LOG_RECORD_BEGIN_SECTION, nLevel, pszName);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	AsyncLog::BeginSection(int nLevel, const wchar_t *pszName)
+{
+	return WriteString(LOG_RECORD_BEGIN_SECTION, nLevel, pszName);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	AsyncLog::EndSection(int nLevel)
+{
+	LogRing *pRing = GetThreadRing();
+	if (pRing->Reserve(LOG_RECORD_END_SECTION, nLevel, 0) != NULL)
+	{
+		pRing->Commit();
+		OnCommit(pRing);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	AsyncLog::Message(int nLevel, const char *pszText)
+{
+	WriteString(LOG_RECORD_MESSAGE, nLevel, pszText);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	AsyncLog::Message(int nLevel, const wchar_t *pszText)
+{
+	WriteString(LOG_RECORD_MESSAGE, nLevel, pszText);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	AsyncLog::MessageV(int nLevel, const char *pszFormat, va_list args)
+	// formats straight into the ring
+{
+	char strText[1024];
+	vsnprintf(strText, sizeof(strText), pszFormat, args);
+	WriteString(LOG_RECORD_MESSAGE, nLevel, strText);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	LogMessageFormat(int nLevel, const char *pszFormat, ...)
+	// called through LogMessageF, which has checked the level
+{
+	va_list args;
+	va_start(args, pszFormat);
+	AsyncLog::GetInstance().MessageV(nLevel, pszFormat, args);
+	va_end(args);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// holds a thread's ring; retires it when the thread exits, so rings of the
+//	short-lived ParallelForChunks workers don't accumulate
+///////////////////////////////////////////////////////////////////////////////
+struct LogRingHolder
+{
+	~LogRingHolder()
+	{
+		if (m_pRing)
+			m_pRing->m_bRetired.store(true);
+	}
+
+	std::shared_ptr<LogRing> m_pRing;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+LogRing *
+	AsyncLog::GetThreadRing()
+{
+	static thread_local LogRingHolder s_holder;
+	if (!s_holder.m_pRing)
+	{
+		s_holder.m_pRing.reset(new LogRing(LOG_RING_BYTES));
+
+		std::lock_guard<std::mutex> lock(m_mutexRings);
+		s_holder.m_pRing->m_nThread = m_nNextThread++;
+		m_arrRings.push_back(s_holder.m_pRing);
+	}
+
+	return s_holder.m_pRing.get();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	AsyncLog::OnCommit(LogRing *pRing)
+	// wakes the drain thread early once a ring is half full
+{
+	if (pRing->GetPending() > pRing->GetCapacity() / 2)
+		m_cvWake.notify_one();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	AsyncLog::DrainLoop()
+{
+	std::unique_lock<std::mutex> lock(m_mutexWake);
+	while (!m_bStop)
+	{
+		m_cvWake.wait_for(lock, std::chrono::milliseconds(LOG_DRAIN_INTERVAL_MS));
+
+		lock.unlock();
+		DrainAll();
+		lock.lock();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	AsyncLog::DrainAll()
+	// drains every ring, and frees the retired ones that are now empty
+{
+	std::vector< std::shared_ptr<LogRing> > arrRings;
+	{
+		std::lock_guard<std::mutex> lock(m_mutexRings);
+		arrRings = m_arrRings;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutexDrain);
+	for (size_t nAt = 0; nAt < arrRings.size(); nAt++)
+	{
+		LogRing *pRing = arrRings[nAt].get();
+		LogSink *pSink = m_pSink.get();
+		const int nThread = pRing->m_nThread;
+		pRing->Drain([pSink, nThread](const LogRecordHeader& header, const char *pPayload)
+		{
+			if (pSink != NULL)
+				pSink->Write(nThread, header, pPayload);
+		});
+	}
+
+	// a retired ring gets no more records, so once drained it can go
+	{
+		std::lock_guard<std::mutex> lockRings(m_mutexRings);
+		std::vector< std::shared_ptr<LogRing> >::iterator iter = std::partition(
+			m_arrRings.begin(), m_arrRings.end(),
+			[](const std::shared_ptr<LogRing>& pRing)
+			{
+				return !pRing->m_bRetired.load() || pRing->GetPending() > 0;
+			});
+		for (std::vector< std::shared_ptr<LogRing> >::iterator iterRetired = iter;
+			iterRetired != m_arrRings.end(); iterRetired++)
+		{
+			m_nRetiredDropped += (*iterRetired)->GetDroppedCount();
+		}
+		m_arrRings.erase(iter, m_arrRings.end());
+	}
+
+	if (m_pSink)
+		m_pSink->Flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	AsyncLog::Flush()
+{
+	DrainAll();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+unsigned long long
+	AsyncLog::GetDroppedCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutexRings);
+	unsigned long long nDropped = m_nRetiredDropped;
+	for (size_t nAt = 0; nAt < m_arrRings.size(); nAt++)
+		nDropped += m_arrRings[nAt]->GetDroppedCount();
+	return nDropped;
+}
+
+}	// namespace dH
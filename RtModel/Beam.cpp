@@ -18,6 +18,8 @@ Beam::Beam()
 		, m_gantryAngle(PI)
 		, m_bRecalcDose(TRUE)
 		, m_bRecalcBeamlets(true)
+		, m_nSourceBeam(0)
+		, m_nSourceLevel(0)
 {
 	m_vBeamletWeights = IntensityMap::New();
 	m_dose = VolumeReal::New();
@@ -105,18 +107,112 @@ int
 	return (int) m_arrBeamlets.size(); 
 }	
 
+///////////////////////////////////////////////////////////////////////////////
+void 
+	Beam::AddBeamlets(const std::vector<VolumeReal::Pointer>& arrBeamlets)
+	// appends calculated beamlets
+{
+	std::lock_guard<std::mutex> lock(m_mutexBeamlets);
+	m_arrBeamlets.insert(m_arrBeamlets.end(), arrBeamlets.begin(), arrBeamlets.end());
+
+	// flag dose recalc
+	m_bRecalcDose = TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void 
+	Beam::ReleaseBeamlets()
+	// frees the voxels of the loaded beamlets; the beamlets stay in place, as
+	//	histograms may refer to them
+{
+	std::lock_guard<std::mutex> lock(m_mutexBeamlets);
+	for (size_t nAt = 0; nAt < m_arrBeamlets.size(); nAt++)
+	{
+		if (!m_arrBeamlets[nAt].IsNull())
+			ReleaseImage<VOXEL_REAL,3>(m_arrBeamlets[nAt]);
+	}
+}
+
 /////////////////////////////////////////////////////////////////////////////// 
 VolumeReal * 
 	Beam::GetBeamlet(int nShift)
 {
-	int nBeamletAt = nShift + GetBeamletCount() / 2;
-	if (nBeamletAt >= 0 
-		&& nBeamletAt < m_arrBeamlets.size())
+	return GetBeamletAt(nShift + GetBeamletCount() / 2);
+}
+
+/////////////////////////////////////////////////////////////////////////////// 
+const SparseBeamlet * 
+	Beam::GetSparseBeamlet(int nShift)
+{
+	return GetSparseBeamletAt(nShift + GetBeamletCount() / 2);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void 
+	Beam::SetBeamletSource(std::shared_ptr<BeamletSource> pSource,
+			int nBeam, int nLevel, int nCount)
+	// sets up nCount empty slots, filled from the source on first access
+{
+	std::lock_guard<std::mutex> lock(m_mutexBeamlets);
+
+	m_pBeamletSource = pSource;
+	m_nSourceBeam = nBeam;
+	m_nSourceLevel = nLevel;
+	m_arrBeamlets.assign(nCount, VolumeReal::Pointer());
+	m_arrSparseBeamlets.assign(nCount, SparseBeamlet());
+
+	// flag dose recalc
+	m_bRecalcDose = TRUE;
+
+	// flag that change has occurred
+	Modified();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+VolumeReal * 
+	Beam::GetBeamletAt(int nAt)
+	// returns beamlet nAt, loading it from the beamlet source if needed
+{
+	if (nAt < 0 
+		|| nAt >= (int) m_arrBeamlets.size())
+	{
+		return NULL;
+	}
+
+	if (m_pBeamletSource)
+	{
+		std::lock_guard<std::mutex> lock(m_mutexBeamlets);
+		if (m_arrBeamlets[nAt].IsNull())
+		{
+			m_arrBeamlets[nAt] = m_pBeamletSource->LoadBeamlet(
+				m_nSourceBeam, m_nSourceLevel, nAt);
+		}
+	}
+
+	return m_arrBeamlets[nAt];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+const SparseBeamlet * 
+	Beam::GetSparseBeamletAt(int nAt)
+	// returns a view of sparse beamlet nAt, if the beamlet source has one
+{
+	if (!m_pBeamletSource
+		|| nAt < 0 
+		|| nAt >= (int) m_arrSparseBeamlets.size())
 	{
-		return m_arrBeamlets[nBeamletAt];
+		return NULL;
 	}
 
-	return NULL;
+	std::lock_guard<std::mutex> lock(m_mutexBeamlets);
+	if (m_arrSparseBeamlets[nAt].m_pGrid.IsNull()
+		&& !m_pBeamletSource->LoadSparseBeamlet(
+			m_nSourceBeam, m_nSourceLevel, nAt, m_arrSparseBeamlets[nAt]))
+	{
+		return NULL;
+	}
+
+	return &m_arrSparseBeamlets[nAt];
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -152,7 +248,9 @@ void
 	// set up the number of beamelts
 	if (m_vBeamletWeights->GetBufferedRegion().GetSize()[0] != m_arrBeamlets.size())
 	{
+		m_pBeamletSource.reset();
 		m_arrBeamlets.clear();
+		m_arrSparseBeamlets.clear();
 		for (int nAt = 0; nAt < m_vBeamletWeights->GetBufferedRegion().GetSize()[0]; nAt++)
 			m_arrBeamlets.push_back(VolumeReal::New());
 	}
@@ -164,6 +262,16 @@ void
 	Modified();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+void 
+	Beam::OnBeamletsChanged() 
+{
+	// the dose is a sum of the beamlets
+	m_bRecalcDose = TRUE;
+
+	Modified();
+}
+
 //////////////////////////////////////////////////////////////////////
 VolumeReal *
 	Beam::GetDoseMatrix()
@@ -173,17 +281,30 @@ VolumeReal *
 		 && m_vBeamletWeights->GetBufferedRegion().GetSize()[0] == m_arrBeamlets.size())
 		 // && m_vBeamletWeights.GetDim() == m_arrBeamlets.size())
 	{ 
+		// sparse beamlets are summed as they are, without expanding them
+		const SparseBeamlet *pSparse = GetSparseBeamletAt(0);
+
 		// set dose matrix size
-		ConformTo<VOXEL_REAL,3>(m_arrBeamlets[0], m_dose);
+		if (pSparse)
+			ConformTo<VOXEL_REAL,3>(pSparse->m_pGrid, m_dose);
+		else
+			ConformTo<VOXEL_REAL,3>(GetBeamletAt(0), m_dose);
 
 		// clear voxels for accumulation
 		m_dose->FillBuffer(0.0);
 
 		for (int nAt = 0; nAt < m_arrBeamlets.size(); nAt++)
 		{
-			VolumeReal *pBeamlet = m_arrBeamlets[nAt];
+			const REAL weight = m_vBeamletWeights->GetBufferPointer()[nAt];
+			if (pSparse)
+			{
+				GetSparseBeamletAt(nAt)->Accumulate(weight, m_dose);
+				continue;
+			}
+
+			VolumeReal *pBeamlet = GetBeamletAt(nAt);
 			ConformTo<VOXEL_REAL,3>(m_dose, m_doseAccumBuffer);
-			Accumulate3D<VOXEL_REAL>(pBeamlet, m_vBeamletWeights->GetBufferPointer()[nAt], m_dose, 
+			Accumulate3D<VOXEL_REAL>(pBeamlet, weight, m_dose, 
 				m_doseAccumBuffer); 
 		}
 
@@ -195,4 +316,24 @@ VolumeReal *
 
 }
 
+///////////////////////////////////////////////////////////////////////////////
+void
+	Beam::AccountMemory(MemoryReport& report, int nLevel, int nBeam)
+	// adds the loaded beamlets and the dose to a memory report
+{
+	const MemoryOwner owner(nLevel, nBeam);
+
+	{
+		// don't load anything -- just count what is already there
+		std::lock_guard<std::mutex> lock(m_mutexBeamlets);
+		for (size_t nAt = 0; nAt < m_arrBeamlets.size(); nAt++)
+		{
+			report.AddImage(MEMORY_BEAMLETS, owner, m_arrBeamlets[nAt].GetPointer());
+		}
+	}
+
+	report.AddImage(MEMORY_DOSE, owner, m_dose.GetPointer());
+	report.AddImage(MEMORY_DOSE, owner, m_doseAccumBuffer.GetPointer());
+}
+
 }
@@ -17,7 +17,8 @@ using namespace itk;
 CBeamDoseCalc::CBeamDoseCalc(CBeam *pBeam, CEnergyDepKernel *pKernel)
 :	m_pBeam(pBeam),
 		m_pKernel(pKernel),
-		m_raysPerVoxel(12)
+		m_raysPerVoxel(12),
+		m_beamletSpacing(4.0)
 {
 }	// CBeamDoseCalc::CBeamDoseCalc
 
@@ -37,32 +38,16 @@ void
 	// TODO: check that dose matrix is initialized
 	ASSERT(m_pBeam->m_dose->GetBufferedRegion().GetSize()[0] > 0);
 
-	m_densityRep = VolumeReal::New();
-	ConformTo<VOXEL_REAL,3>(m_pBeam->m_dose, m_densityRep);
-	m_densityRep->FillBuffer(0.0); 
-
-	VolumeReal *pMassDensity = m_pBeam->GetPlan()->GetMassDensity();
-	// ::Resample(pMassDensity, m_densityRep, TRUE); 
-	// Resample3D(pMassDensity, m_densityRep, TRUE); 
-	itk::ResampleImageFilter<VolumeReal, VolumeReal>::Pointer resampler = 
-		itk::ResampleImageFilter<VolumeReal, VolumeReal>::New();
-	resampler->SetInput(pMassDensity);
-
-	typedef itk::AffineTransform<REAL, 3> TransformType;
-	TransformType::Pointer transform = TransformType::New();
-	transform->SetIdentity();
-	resampler->SetTransform(transform);
-
-	typedef itk::LinearInterpolateImageFunction<VolumeReal, REAL> InterpolatorType;
-	InterpolatorType::Pointer interpolator = InterpolatorType::New();
-	resampler->SetInterpolator( interpolator );
-
-	VolumeReal::Pointer pPointToVolume = static_cast<VolumeReal*>(m_densityRep);
-	resampler->SetOutputParametersFromImage(pPointToVolume);
-	resampler->Update();
-	CopyImage<VOXEL_REAL, 3>(resampler->GetOutput(), m_densityRep);
+	// the mass density on the dose grid is shared by all beams (and pyramid
+	//	levels) on the same grid, so it is resampled only once per grid
+	m_densityRep = m_pBeam->GetPlan()->GetSeries()->GetMassDensityConformTo(m_pBeam->m_dose);
 
 #ifdef USE_2D
+	// the shared resample must not be modified, so replicate slices in a copy
+	VolumeReal::Pointer pDensityShared = m_densityRep;
+	m_densityRep = VolumeReal::New();
+	CopyImage<VOXEL_REAL, 3>(pDensityShared, m_densityRep);
+
 	// TODO: now, replicate slices
 	for (int nZ = 1; nZ < m_densityRep->GetBufferedRegion().GetSize()[2]; nZ++)
 	{
@@ -95,17 +80,30 @@ void
 	m_vSource_vxl = m_vIsocenter_vxl;
 	m_vSource_vxl[0] -= 1000.0 / m_pBeam->GetPlan()->GetDoseResolution();
 
+	// the beamlet spacing, kept so that the beamlets can be calculated on 
+	//	another thread without reading the plan
+	m_beamletSpacing = m_pBeam->GetPlan()->GetBeamletSpacing();
+
 	// clear existing beamlets
 	//m_pBeam->m_arrBeamletsSub[0].clear();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////
 void CBeamDoseCalc::CalcBeamlet(int nBeamlet)
+{
+	// set pencil beam; through the beam, which locks and flags the dose
+	std::vector<VolumeReal::Pointer> arrBeamlets(1, CalcBeamletDose(nBeamlet));
+	m_pBeam->AddBeamlets(arrBeamlets);
+
+}	// CBeamDoseCalc::CalcBeamlet
+
+///////////////////////////////////////////////////////////////////////////////////////
+VolumeReal::Pointer 
+	CBeamDoseCalc::CalcBeamletDose(int nBeamlet)
+	// calculates the dose for the beamlet at shift nBeamlet
 {
 	// determine beamlet spacing
-	// TODO: fix this
-	// TODO: reconcile with beamlet spacing in PlanPyramid
-	REAL beamletSpacing = 4.0;  
+	REAL beamletSpacing = m_beamletSpacing;
 
 	// set beamlet size
 	Vector<REAL,2> vMin = MakeVector<2>(((REAL) nBeamlet - 0.5) * beamletSpacing, -10.0); // -5.0);
@@ -116,11 +114,9 @@ void CBeamDoseCalc::CalcBeamlet(int nBeamlet)
 	CalcTerma();
 
 	// convolve terma with energy deposition kernel to form dose
-	int nSlice = Round<int>(m_vIsocenter_vxl[2]);
-	CString strSlice;
-	strSlice.Format(_T("Calc dose for slice %i\n"), nSlice);
-	TRACE(strSlice);
-	// ::AfxMessageBox(strSlice);
+	// runs on the background workers, so nothing is formatted unless traced
+	LogMessageF(dH::LOG_LEVEL_TRACE, "Calc dose for slice %i", 
+		Round<int>(m_vIsocenter_vxl[2]));
 	m_pEnergy = m_pKernel->CalcSphereConvolve(m_densityRep, m_pTerma, Round<int>(m_vIsocenter_vxl[2]));
 
 #ifdef USE_2D
@@ -143,12 +139,14 @@ void CBeamDoseCalc::CalcBeamlet(int nBeamlet)
 	}
 #endif
 
-	// set pencil beam
-	m_pBeam->m_arrBeamlets.push_back(m_pEnergy); // m_pTerma); // // pEnergy2D);
+	// the pencil beam
+	VolumeReal::Pointer pBeamlet = m_pEnergy; // m_pTerma); // // pEnergy2D);
 	m_pEnergy = NULL;
 	m_pTerma = NULL;	// reset so that new one will be generated
 
-}	// CBeamDoseCalc::CalcBeamlet
+	return pBeamlet;
+
+}	// CBeamDoseCalc::CalcBeamletDose
 
 
 // consts for index positions
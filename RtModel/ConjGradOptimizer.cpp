@@ -11,6 +11,8 @@
 #include <vector>
 #include <algorithm>
 
+#include <Profiler.h>
+
 ///////////////////////////////////////////////////////////////////////////////
 class LineProjectionFunction : public vnl_cost_function
 {
@@ -105,6 +107,10 @@ DynamicCovarianceOptimizer::DynamicCovarianceOptimizer(DynamicCovarianceCostFunc
 	, m_bComputeFreeEnergy(false)
 	, m_Entropy(0.0)
 	, m_FreeEnergy(0.0)
+	, m_MaxIterations(ITER_MAX)
+	, m_KeepAdaptiveVariance(false)
+	, m_pCheckpoint(NULL)
+	, m_nResumeIteration(-1)
 {
 }	// CConjGradOptimizer::CConjGradOptimizer
 
@@ -119,39 +125,68 @@ vnl_nonlinear_minimizer::ReturnCodes
 	vnl_brent_minimizer m_optimizeBrent(m_lineFunction);
 	m_optimizeBrent.set_x_tolerance(GetLineOptimizerTolerance());
 
-	// initialize, if we are calculating adaptive variance?
-	InitializeDynamicCovariance(vInit.size());
-
-	// store the initial parameter vector
-	// m_vFinalParam.SetDim(vInit.GetDim());
-	m_FinalParameter = vInit; // const_cast<CVectorN<>&>(vInit).GetVnlVector();
-
-	// set the dimension of the current direction
-	m_vGrad.set_size(vInit.size());		// TODO: is this needed (check logic of compute)
+	// a restored state is only for a minimize of its own dimension
+	if (m_nResumeIteration >= 0 && m_FinalParameter.size() != vInit.size())
+	{
+		LogMessageF(dH::LOG_LEVEL_INFO, "checkpoint dimension %d doesn't match %d",
+			(int) m_FinalParameter.size(), (int) vInit.size());
+		m_nResumeIteration = -1;
+	}
 
-	// evaluate the function at the initial point, storing
-	//		the gradient as the current direction
-	m_pCostFunction->compute(m_FinalParameter, &m_FinalValue, &m_vGrad);
-	m_vGrad *= R(-1.0);
+	// profiled events before the first iteration are tagged -1
+	dH::Profiler::GetInstance().SetIteration(-1);
 
-	// if we are too short,
-	if (m_vGrad.magnitude() < 1e-8)
+	// resuming, the parameters, directions and AV were restored by 
+	//	SetResumeState
+	int nFirstIteration = 0;
+	if (m_nResumeIteration >= 0)
 	{
-		Log(_T("Gradient too small -- adding length"));
-		// NOTE: must be a step large enough for the line minimizer's initial
-		//	bracket to produce a distinguishable function value -- get_x_tolerance()
-		//	is a convergence tolerance, not a usable step scale, and using it here
-		//	made the bracket's two initial probes tie, tripping vxl's fb < fa assert.
-		RandomVector(R(1.0), &m_vGrad[0], m_vGrad.size());
+		nFirstIteration = m_nResumeIteration;
+		m_nResumeIteration = -1;
 	}
+	else
+	{
+		// initialize, if we are calculating adaptive variance? (unless continuing
+		//	from the last call's)
+		if (!GetKeepAdaptiveVariance() 
+			|| m_vAdaptVariance.GetDim() != (int) vInit.size())
+		{
+			InitializeDynamicCovariance(vInit.size());
+		}
 
-	// set the initial (steepest descent) direction
-	m_vDir = m_vGrad;
+		// store the initial parameter vector
+		// m_vFinalParam.SetDim(vInit.GetDim());
+		m_FinalParameter = vInit; // const_cast<CVectorN<>&>(vInit).GetVnlVector();
+
+		// set the dimension of the current direction
+		m_vGrad.set_size(vInit.size());		// TODO: is this needed (check logic of compute)
+
+		// evaluate the function at the initial point, storing
+		//		the gradient as the current direction
+		m_pCostFunction->compute(m_FinalParameter, &m_FinalValue, &m_vGrad);
+		m_vGrad *= R(-1.0);
+
+		// if we are too short,
+		if (m_vGrad.magnitude() < 1e-8)
+		{
+			Log(_T("Gradient too small -- adding length"));
+			// NOTE: must be a step large enough for the line minimizer's initial
+			//	bracket to produce a distinguishable function value -- get_x_tolerance()
+			//	is a convergence tolerance, not a usable step scale, and using it here
+			//	made the bracket's two initial probes tie, tripping vxl's fb < fa assert.
+			RandomVector(R(1.0), &m_vGrad[0], m_vGrad.size());
+		}
+
+		// set the initial (steepest descent) direction
+		m_vDir = m_vGrad;
+	}
 
 	BOOL bConvergence = FALSE;
 	ReturnCodes retCode = FAILED_TOO_MANY_ITERATIONS;
-	for (num_iterations_ = 0; (num_iterations_ < ITER_MAX) && !bConvergence; num_iterations_++)
+	for (num_iterations_ = nFirstIteration; (num_iterations_ < GetMaxIterations()) && !bConvergence; num_iterations_++)
 	{
+		dH::Profiler::GetInstance().SetIteration(num_iterations_);
+
 		///////////////////////////////////////////////////////////////////////////////
 		// line minimization
 
@@ -172,8 +207,13 @@ vnl_nonlinear_minimizer::ReturnCodes
 		m_lineFunction.SetDirection(vLineDir);
 
 		// now launch a line optimization
-		REAL lambda = m_optimizeBrent.minimize(0);
-		REAL new_fv = m_optimizeBrent.f_at_last_minimum();
+		REAL lambda = 0.0;
+		REAL new_fv = 0.0;
+		{
+			PROFILE_SCOPE("vnl_brent_minimizer::minimize");
+			lambda = m_optimizeBrent.minimize(0);
+			new_fv = m_optimizeBrent.f_at_last_minimum();
+		}
 
 		// guard against a degenerate/tied bracket -- vnl_bracket_minimum can
 		//	return a flat bracket when the objective doesn't change over a
@@ -233,12 +273,8 @@ vnl_nonlinear_minimizer::ReturnCodes
 		m_vGrad *= -1.0;								// g_{k+1} = -grad F(x_{k+1})
 
 		const REAL gradNorm = m_vGrad.magnitude();		// |grad F| at the new point
-		{
-			CString __logMsg;
-			__logMsg.Format(_T("iter %d: F=%.6g |gradF|=%.6g"),
-				num_iterations_, (double) m_FinalValue, (double) gradNorm);
-			Log(__logMsg);
-		}
+		LogMessageF(dH::LOG_LEVEL_INFO, "iter %d: F=%.6g |gradF|=%.6g",
+			num_iterations_, (double) m_FinalValue, (double) gradNorm);
 
 		// choose the convergence criterion: gradient-norm if BRIMSTONE_GRAD_TOL
 		//	is set (scale-invariant to the objective's additive offset), else the
@@ -272,6 +308,15 @@ vnl_nonlinear_minimizer::ReturnCodes
 			// otherwise, update the direction: d = g + beta*d
 			m_vDir *= beta;
 			m_vDir += m_vGrad;
+
+			// everything the next iteration needs is in place, so this is
+			//	where a snapshot can be taken
+			if (m_pCheckpoint != NULL && m_pCheckpoint->IsDue(num_iterations_))
+			{
+				dH::OptimizerState state;
+				GetState(state, num_iterations_ + 1);
+				m_pCheckpoint->Write(state);
+			}
 		}
 		else
 		{
@@ -312,6 +357,84 @@ void
 }	// CConjGradOptimizer::SetAdaptiveVariance
 
 
+//////////////////////////////////////////////////////////////////////////////
+void
+	DynamicCovarianceOptimizer::RestoreAdaptiveVariance(const CVectorN<>& vAdaptVariance)
+	// initializes the AV from a previous run's, for a warm start
+{
+	InitializeDynamicCovariance(vAdaptVariance.GetDim());
+	if (!m_bCalcVar)
+		return;
+
+	for (int nN = 0; nN < m_vAdaptVariance.GetDim(); nN++)
+	{
+		m_vAdaptVariance[nN] = __min(__max(vAdaptVariance[nN], m_varMin), m_varMax);
+	}
+
+}	// DynamicCovarianceOptimizer::RestoreAdaptiveVariance
+
+
+//////////////////////////////////////////////////////////////////////////////
+void
+	DynamicCovarianceOptimizer::GetState(dH::OptimizerState& state, int nIterations) const
+	// the state after nIterations iterations, for a checkpoint
+{
+	state.m_nIteration = nIterations;
+	state.m_vParam = m_FinalParameter;
+	state.m_finalValue = m_FinalValue;
+	state.m_vGrad = m_vGrad;
+	state.m_vDir = m_vDir;
+
+	state.m_bCalcVar = m_bCalcVar;
+	state.m_varMin = m_varMin;
+	state.m_varMax = m_varMax;
+	if (m_bCalcVar)
+	{
+		// only the columns searched so far differ from the identity
+		const int nCols = __min(nIterations, (int) m_mSearchedDir.columns());
+		state.m_mSearchedDir = m_mSearchedDir.extract(m_mSearchedDir.rows(), nCols, 0, 0);
+
+		state.m_vAdaptVariance.set_size(m_vAdaptVariance.GetDim());
+		for (int nN = 0; nN < m_vAdaptVariance.GetDim(); nN++)
+			state.m_vAdaptVariance[nN] = m_vAdaptVariance[nN];
+	}
+
+	state.m_entropy = m_Entropy;
+	state.m_freeEnergy = m_FreeEnergy;
+
+}	// DynamicCovarianceOptimizer::GetState
+
+
+//////////////////////////////////////////////////////////////////////////////
+void
+	DynamicCovarianceOptimizer::SetResumeState(const dH::OptimizerState& state)
+	// restores a checkpointed state, for the next minimize
+{
+	m_FinalParameter = state.m_vParam;
+	m_FinalValue = state.m_finalValue;
+	m_vGrad = state.m_vGrad;
+	m_vDir = state.m_vDir;
+
+	SetAdaptiveVariance(state.m_bCalcVar, state.m_varMin, state.m_varMax);
+	InitializeDynamicCovariance(state.m_vParam.size());
+	if (m_bCalcVar)
+	{
+		// (the orthogonal basis is rebuilt from these on the next iteration)
+		for (int nCol = 0; nCol < (int) state.m_mSearchedDir.columns(); nCol++)
+			m_mSearchedDir.set_column(nCol, state.m_mSearchedDir.get_column(nCol));
+
+		for (int nN = 0; nN < m_vAdaptVariance.GetDim(); nN++)
+			m_vAdaptVariance[nN] = state.m_vAdaptVariance[nN];
+	}
+
+	m_Entropy = state.m_entropy;
+	m_FreeEnergy = state.m_freeEnergy;
+
+	m_nResumeIteration = state.m_nIteration;
+
+}	// DynamicCovarianceOptimizer::SetResumeState
+
+
 //////////////////////////////////////////////////////////////////////////////
 void
 	DynamicCovarianceOptimizer::SetComputeFreeEnergy(bool bComputeFreeEnergy)
@@ -382,6 +505,25 @@ void
 	m_pCostFunction->SetAdaptiveVariance(&m_vAdaptVariance, m_varMin, m_varMax);
 }
 
+//////////////////////////////////////////////////////////////////////////////
+void 
+	DynamicCovarianceOptimizer::AccountMemory(dH::MemoryReport& report, 
+			const dH::MemoryOwner& owner) const
+	// adds the covariance matrices and vectors to a memory report
+{
+	// the two nDim x nDim matrices dominate
+	report.Add(dH::MEMORY_OPTIMIZER, owner, m_mOrthoBasis.data_block(), 
+		m_mOrthoBasis.size() * sizeof(REAL));
+	report.Add(dH::MEMORY_OPTIMIZER, owner, m_mSearchedDir.data_block(), 
+		m_mSearchedDir.size() * sizeof(REAL));
+
+	report.Add(dH::MEMORY_OPTIMIZER, owner, m_vGrad.data_block(), m_vGrad.size() * sizeof(REAL));
+	report.Add(dH::MEMORY_OPTIMIZER, owner, m_vGradPrev.data_block(), m_vGradPrev.size() * sizeof(REAL));
+	report.Add(dH::MEMORY_OPTIMIZER, owner, m_vDir.data_block(), m_vDir.size() * sizeof(REAL));
+	report.Add(dH::MEMORY_OPTIMIZER, owner, m_vLambdaScaled.data_block(), 
+		m_vLambdaScaled.size() * sizeof(REAL));
+}
+
 //////////////////////////////////////////////////////////////////////////////
 void 
 	DynamicCovarianceOptimizer::UpdateDynamicCovariance()
@@ -389,6 +531,8 @@ void
 	if (!m_bCalcVar)
 		return;
 
+	PROFILE_SCOPE("DynamicCovarianceOptimizer::UpdateDynamicCovariance");
+
 	// add direction to orthogonal basis
 	vnl_vector<REAL> vDirNorm = m_vDir;
 	vDirNorm.normalize();
@@ -460,12 +604,8 @@ void
 		// note: m_FinalValue contains the KL divergence sum (expected log likelihood term)
 		m_FreeEnergy = m_FinalValue - m_Entropy;
 
-		{
-			CString __logMsg;
-			__logMsg.Format(_T("Iteration %d: KL=%.6f, Entropy=%.6f, FreeEnergy=%.6f"),
-				num_iterations_, m_FinalValue, m_Entropy, m_FreeEnergy);
-			Log(__logMsg);
-		}
+		LogMessageF(dH::LOG_LEVEL_INFO, "Iteration %d: KL=%.6f, Entropy=%.6f, FreeEnergy=%.6f",
+			num_iterations_, (double) m_FinalValue, (double) m_Entropy, (double) m_FreeEnergy);
 	}
 
 	// now reset the final value, using the new AV vector
@@ -0,0 +1,236 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+
+#include <HUDensityCalibration.h>
+#include <ParallelFor.h>
+
+namespace dH
+{
+
+// source of version numbers; global, so that every change to any curve gets a
+//	distinct version and equal versions imply equal curves
+static std::atomic<unsigned long> g_nCalibrationVersion(0);
+
+///////////////////////////////////////////////////////////////////////////////
+HUDensityCalibration::HUDensityCalibration()
+	: m_minHU(0.0f)
+	, m_maxHU(0.0f)
+	, m_nVersion(0)
+{
+	// the historical conversion: linear from air to water, flat above water
+	AddPoint(-1024.0f, 0.0f);
+	AddPoint(0.0f, 1.0f);
+	AddPoint(1024.0f, 1.0f);
+
+}	// HUDensityCalibration::HUDensityCalibration
+
+///////////////////////////////////////////////////////////////////////////////
+const HUDensityCalibration&
+	HUDensityCalibration::GetDefault()
+	// the default curve; BRIMSTONE_HU_CALIBRATION names a calibration file to
+	//	use instead of the built-in points
+{
+	static const HUDensityCalibration s_default = []() -> HUDensityCalibration
+	{
+		HUDensityCalibration calib;
+		const char *pEnv = getenv("BRIMSTONE_HU_CALIBRATION");
+		if (pEnv != NULL && !calib.ReadFromFile(pEnv))
+		{
+			// fall back to the built-in curve
+			calib = HUDensityCalibration();
+		}
+		return calib;
+	}();
+
+	return s_default;
+
+}	// HUDensityCalibration::GetDefault
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	HUDensityCalibration::GetPointCount() const
+{
+	return (int) m_arrHU.size();
+
+}	// HUDensityCalibration::GetPointCount
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	HUDensityCalibration::GetPoint(int nAt, float *pHU, float *pDensity) const
+{
+	(*pHU) = m_arrHU.at(nAt);
+	(*pDensity) = m_arrDensity.at(nAt);
+
+}	// HUDensityCalibration::GetPoint
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	HUDensityCalibration::ClearPoints()
+{
+	m_arrHU.clear();
+	m_arrDensity.clear();
+	UpdateLUT();
+
+}	// HUDensityCalibration::ClearPoints
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	HUDensityCalibration::AddPoint(float hu, float density)
+	// inserts a point, keeping the curve sorted by HU; a point at an existing
+	//	HU replaces the old density
+{
+	std::vector<float>::iterator iterHU =
+		std::lower_bound(m_arrHU.begin(), m_arrHU.end(), hu);
+	size_t nAt = iterHU - m_arrHU.begin();
+	if (iterHU != m_arrHU.end() && (*iterHU) == hu)
+	{
+		m_arrDensity[nAt] = density;
+	}
+	else
+	{
+		m_arrHU.insert(iterHU, hu);
+		m_arrDensity.insert(m_arrDensity.begin() + nAt, density);
+	}
+	UpdateLUT();
+
+}	// HUDensityCalibration::AddPoint
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	HUDensityCalibration::ReadFromFile(const char *pszFileName)
+	// reads the curve from a text file of "HU density" pairs, one per line.
+	//	Leaves the curve unchanged if the file cannot be read or has no points.
+{
+	FILE *pFile = NULL;
+	if (fopen_s(&pFile, pszFileName, "rt") != 0 || pFile == NULL)
+		return false;
+
+	std::vector<float> arrHU;
+	std::vector<float> arrDensity;
+
+	char szLine[256];
+	while (fgets(szLine, sizeof(szLine), pFile) != NULL)
+	{
+		// strip comments
+		char *pComment = strchr(szLine, '#');
+		if (pComment != NULL)
+			(*pComment) = '\0';
+
+		float hu = 0.0f;
+		float density = 0.0f;
+		if (sscanf_s(szLine, "%f %f", &hu, &density) == 2)
+		{
+			arrHU.push_back(hu);
+			arrDensity.push_back(density);
+		}
+	}
+	fclose(pFile);
+
+	if (arrHU.empty())
+		return false;
+
+	m_arrHU.clear();
+	m_arrDensity.clear();
+	for (size_t nAt = 0; nAt < arrHU.size(); nAt++)
+	{
+		AddPoint(arrHU[nAt], arrDensity[nAt]);
+	}
+
+	return true;
+
+}	// HUDensityCalibration::ReadFromFile
+
+///////////////////////////////////////////////////////////////////////////////
+float
+	HUDensityCalibration::Convert(float hu) const
+{
+	float density = 0.0f;
+	Convert(&hu, &density, 1);
+	return density;
+
+}	// HUDensityCalibration::Convert
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	HUDensityCalibration::Convert(const float *pHU, float *pDensity, int nCount) const
+	// converts by linear interpolation in the 1-HU table.  The inner loop has
+	//	no branches (the clamp compiles to min/max, the NaN test to a select), 
+	//	so it vectorizes.  Non-finite HU maps to minHU: the clamp would pass 
+	//	NaN through, and (int) NaN is undefined.
+{
+	if (m_arrLUT.empty())
+	{
+		std::fill(pDensity, pDensity + nCount, 0.0f);
+		return;
+	}
+
+	const float *pLUT = &m_arrLUT[0];
+	const float minHU = m_minHU;
+	const float maxHU = m_maxHU;
+
+	ParallelForChunks(nCount, [=](int nBegin, int nEnd)
+	{
+		for (int nAt = nBegin; nAt < nEnd; nAt++)
+		{
+			const float hu = std::isfinite(pHU[nAt]) ? pHU[nAt] : minHU;
+			const float x = std::min(std::max(hu, minHU), maxHU) - minHU;
+			const int nIndex = (int) x;
+			const float frac = x - (float) nIndex;
+			pDensity[nAt] = pLUT[nIndex] + frac * (pLUT[nIndex + 1] - pLUT[nIndex]);
+		}
+	});
+
+}	// HUDensityCalibration::Convert
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	HUDensityCalibration::UpdateLUT()
+	// samples the piecewise linear curve at every integer HU
+{
+	m_nVersion = ++g_nCalibrationVersion;
+
+	m_arrLUT.clear();
+	if (m_arrHU.empty())
+		return;
+
+	m_minHU = m_arrHU.front();
+	m_maxHU = m_arrHU.back();
+
+	const int nEntries = (int) ceil(m_maxHU - m_minHU) + 1;
+	m_arrLUT.resize(nEntries + 1);
+
+	size_t nSegment = 0;
+	for (int nAt = 0; nAt < nEntries; nAt++)
+	{
+		// the last sample lands exactly on the top point, even for a
+		//	fractional range
+		const float hu = std::min(m_minHU + (float) nAt, m_maxHU);
+		while (nSegment + 1 < m_arrHU.size() - 1 && hu > m_arrHU[nSegment + 1])
+			nSegment++;
+
+		if (m_arrHU.size() == 1)
+		{
+			m_arrLUT[nAt] = m_arrDensity[0];
+		}
+		else
+		{
+			const float t = (hu - m_arrHU[nSegment])
+				/ (m_arrHU[nSegment + 1] - m_arrHU[nSegment]);
+			m_arrLUT[nAt] = m_arrDensity[nSegment]
+				+ std::min(t, 1.0f) * (m_arrDensity[nSegment + 1] - m_arrDensity[nSegment]);
+		}
+	}
+
+	// guard entry: the clamped top of the range interpolates against itself
+	m_arrLUT[nEntries] = m_arrLUT[nEntries - 1];
+
+}	// HUDensityCalibration::UpdateLUT
+
+}	// namespace dH
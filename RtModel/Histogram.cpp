@@ -3,6 +3,8 @@
 #include "stdafx.h"
 #include "Histogram.h"
 
+#include <Profiler.h>
+
 //#ifdef USE_IPP
 //#include <ippi.h>
 //#endif
@@ -556,6 +558,10 @@ const CVectorN<>&
 	CHistogram::GetBins() const
 	// retrieves the bins for this histogram
 {
+	// reads the volume and the region
+	PROFILE_SCOPE_BYTES("CHistogram::GetBins",
+		2 * sizeof(VOXEL_REAL) * GetVolume()->GetBufferedRegion().GetNumberOfPixels());
+
 	if (true) // m_bRecomputeBins)
 	{
 		// calculate all binning volumes
@@ -713,6 +719,137 @@ const CVectorN<>&
 
 }	// CHistogram::GetGBinMeans
 
+//////////////////////////////////////////////////////////////////////
+void 
+	CHistogram::GetGBinsBatch(const std::vector<VolumeReal::Pointer>& arrVolumes,
+			const std::vector<VolumeReal::Pointer>& arrVarFracLo,
+			const std::vector<VolumeReal::Pointer>& arrVarFracHi,
+			std::vector< CVectorN<> >& arrGBins) const
+	// bins a batch of volumes in one sweep of the region
+{
+	const int nPoints = (int) arrVolumes.size();
+	ASSERT(arrVarFracLo.size() == arrVolumes.size() 
+		&& arrVarFracHi.size() == arrVolumes.size());
+
+	const int nVoxels = (int) m_pRegion->GetBufferedRegion().GetNumberOfPixels();
+
+	// reads the region, and each point's volume and fraction volumes
+	PROFILE_SCOPE_BYTES("CHistogram::GetGBinsBatch",
+		(3 * nPoints + 1) * sizeof(VOXEL_REAL) * nVoxels);
+
+	arrGBins.resize(nPoints);
+	if (nPoints == 0)
+		return;
+
+	std::vector<const VOXEL_REAL *> arrValues(nPoints);
+	std::vector<const VOXEL_REAL *> arrFracLo(nPoints);
+	std::vector<const VOXEL_REAL *> arrFracHi(nPoints);
+	for (int nAt = 0; nAt < nPoints; nAt++)
+	{
+		ASSERT(arrVolumes[nAt]->GetBufferedRegion().GetNumberOfPixels() == nVoxels);
+		arrValues[nAt] = arrVolumes[nAt]->GetBufferPointer();
+		arrFracLo[nAt] = arrVarFracLo[nAt]->GetBufferPointer();
+		arrFracHi[nAt] = arrVarFracHi[nAt]->GetBufferPointer();
+	}
+
+	// each point's max value (which sizes its bins, as in GetBins), and its
+	//	var max / min bins, grown as the sweep reaches higher bins
+	std::vector<REAL> arrMax(nPoints);
+	std::vector< std::vector<REAL> > arrBinsVarMax(nPoints);
+	std::vector< std::vector<REAL> > arrBinsVarMin(nPoints);
+	for (int nAt = 0; nAt < nPoints; nAt++)
+	{
+		arrMax[nAt] = nVoxels > 0 ? arrValues[nAt][0] : 0.0;
+	}
+
+	// the arithmetic is CalcBinningVolumes' and GetBins', voxel by voxel 
+	//	(with the intermediate volumes' VOXEL_REAL precision), so a point's
+	//	bins match those of an evaluation at that point
+	const VOXEL_REAL *pRegion = m_pRegion->GetBufferPointer();
+	REAL calcSum = 0.0;
+	for (int nVoxel = 0; nVoxel < nVoxels; nVoxel++)
+	{
+		const VOXEL_REAL region = pRegion[nVoxel];
+		calcSum += region;
+
+		for (int nAt = 0; nAt < nPoints; nAt++)
+		{
+			const VOXEL_REAL value = arrValues[nAt][nVoxel];
+			if (value > arrMax[nAt])
+				arrMax[nAt] = value;
+
+			// voxels outside the region add nothing
+			if (region == 0.0)
+				continue;
+
+			const VOXEL_REAL binScaled = 
+				(VOXEL_REAL) ((VOXEL_REAL) (value - m_minValue) * (1.0 / m_binWidth));
+			const short nLowBin = (short) floor(binScaled);
+			if (nLowBin < 0)
+				continue;
+
+			const VOXEL_REAL binFracHi = -(binScaled - (VOXEL_REAL) nLowBin);
+			const VOXEL_REAL binFracLo = (VOXEL_REAL) (binFracHi + 1.0);
+			const VOXEL_REAL regionVarFracHi = arrFracHi[nAt][nVoxel] * region;
+			const VOXEL_REAL regionVarFracLo = arrFracLo[nAt][nVoxel] * region;
+
+			std::vector<REAL>& binsVarMax = arrBinsVarMax[nAt];
+			std::vector<REAL>& binsVarMin = arrBinsVarMin[nAt];
+			if ((int) binsVarMax.size() < nLowBin + 2)
+			{
+				binsVarMax.resize(nLowBin + 2, 0.0);
+				binsVarMin.resize(nLowBin + 2, 0.0);
+			}
+
+			binsVarMax[nLowBin] += binFracLo * regionVarFracHi;
+			binsVarMin[nLowBin] += binFracLo * regionVarFracLo;
+
+			binsVarMax[nLowBin+1] -= binFracHi * regionVarFracHi;
+			binsVarMin[nLowBin+1] -= binFracHi * regionVarFracLo;
+		}
+	}
+
+	// now convolve and normalize each point's bins, as GetBins does
+	CVectorN<> vBinsVarMax;
+	CVectorN<> vBinsVarMin;
+	CVectorN<> vGBinsVarMin;
+	for (int nAt = 0; nAt < nPoints; nAt++)
+	{
+		const int nBins = GetBinForValue(arrMax[nAt]) + 2;
+		vBinsVarMax.SetDim(nBins);
+		vBinsVarMax.SetZero();
+		vBinsVarMin.SetDim(nBins);
+		vBinsVarMin.SetZero();
+		const int nBinned = __min(nBins, (int) arrBinsVarMax[nAt].size());
+		for (int nAtBin = 0; nAtBin < nBinned; nAtBin++)
+		{
+			vBinsVarMax[nAtBin] = arrBinsVarMax[nAt][nAtBin];
+			vBinsVarMin[nAtBin] = arrBinsVarMin[nAt][nAtBin];
+		}
+
+		CVectorN<>& vGBins = arrGBins[nAt];
+		if (sqrt(m_varMax) > 0.0)
+		{
+			ConvGauss(vBinsVarMax, m_binKernelVarMax, vGBins);
+			ConvGauss(vBinsVarMin, m_binKernelVarMin, vGBinsVarMin);
+			vGBins += vGBinsVarMin;
+
+			if (calcSum > 0.0)
+			{
+				vGBins *= R(1.0 / ((double) calcSum));
+			}
+		}
+		else
+		{
+			// without a kernel, GetGBins returns the plain bins
+			vGBins.SetDim(nBins);
+			vGBins = vBinsVarMax;
+			vGBins += vBinsVarMin;
+		}
+	}
+
+}	// CHistogram::GetGBinsBatch
+
 ///////////////////////////////////////////////////////////////////////////////
 void 
 	CHistogram::ConvGauss(const CVectorN<>& buffer_in, const CVectorN<>& kernel_in,
@@ -772,6 +909,8 @@ void
 	CHistogram::OnVolumeChange() // CObservableEvent *pSource, void *)
 	// triggers update of histogram
 {
+	PROFILE_SCOPE("CHistogram::OnVolumeChange");
+
 	// flag recomputation
 	m_bRecomputeBins = TRUE;
 	m_bRecomputeCumBins = TRUE;
@@ -827,4 +966,68 @@ void
 	}
 }
 
+//////////////////////////////////////////////////////////////////////
+void 
+	CHistogram::AccountMemory(dH::MemoryReport& report, 
+			const dH::MemoryOwner& owner) const
+	// adds the helper volumes to a memory report
+{
+	// the volume and region belong to the prescription and structure
+	report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_volBinScaled.GetPointer());
+	report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_volBinLoInt.GetPointer());
+
+	report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_volBinFracHi.GetPointer());
+	report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_volBinFracHi_x_VarFracLo.GetPointer());
+	report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_volBinFracHi_x_VarFracHi.GetPointer());
+
+	report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_volBinFracLo.GetPointer());
+	report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_volBinFracLo_x_VarFracLo.GetPointer());
+	report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_volBinFracLo_x_VarFracHi.GetPointer());
+
+	report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_volRegion_x_VarFracHi.GetPointer());
+	report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_volRegion_x_VarFracLo.GetPointer());
+
+}	// CHistogram::AccountMemory
+
+
+//////////////////////////////////////////////////////////////////////
+size_t 
+	CHistogram::EstimateHelperBytes(size_t nVoxels)
+	// bytes the helper volumes take; must list the same volumes as 
+	//		AccountMemory
+{
+	const size_t nVoxelBytes = 
+		sizeof(VOXEL_REAL)			// m_volBinScaled
+		+ sizeof(short)				// m_volBinLoInt
+		+ 3 * sizeof(VOXEL_REAL)	// m_volBinFracHi, _x_VarFracLo, _x_VarFracHi
+		+ 3 * sizeof(VOXEL_REAL)	// m_volBinFracLo, _x_VarFracLo, _x_VarFracHi
+		+ 2 * sizeof(VOXEL_REAL);	// m_volRegion_x_VarFracHi, _x_VarFracLo
+
+	return nVoxels * nVoxelBytes;
+
+}	// CHistogram::EstimateHelperBytes
+
+//////////////////////////////////////////////////////////////////////
+void 
+	CHistogram::ReleaseHelperVolumes()
+	// frees the helper volumes; they are recomputed on next use
+{
+	// CalcBinningVolumes recomputes all of these on each call.  The
+	//	region x var frac volumes are only formed when the region or the
+	//	var fractions are set, so they stay
+	ReleaseImage<VOXEL_REAL,3>(m_volBinScaled);
+	ReleaseImage<short,3>(m_volBinLoInt);
+
+	ReleaseImage<VOXEL_REAL,3>(m_volBinFracHi);
+	ReleaseImage<VOXEL_REAL,3>(m_volBinFracHi_x_VarFracLo);
+	ReleaseImage<VOXEL_REAL,3>(m_volBinFracHi_x_VarFracHi);
+
+	ReleaseImage<VOXEL_REAL,3>(m_volBinFracLo);
+	ReleaseImage<VOXEL_REAL,3>(m_volBinFracLo_x_VarFracLo);
+	ReleaseImage<VOXEL_REAL,3>(m_volBinFracLo_x_VarFracHi);
+
+	m_bRecomputeBinScaledVolume = TRUE;
+
+}	// CHistogram::ReleaseHelperVolumes
+
 
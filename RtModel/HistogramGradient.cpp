@@ -2,6 +2,7 @@
 // $Id: HistogramGradient.cpp 619 2009-03-01 17:43:35Z dglane001 $
 #include "StdAfx.h"
 #include "HistogramGradient.h"
+#include <Profiler.h>
 #include <SigmoidParams.h>
 #include <itkResampleImageFilter.h>
 #include <itkAffineTransform.h>
@@ -14,8 +15,11 @@
 CHistogramWithGradient::CHistogramWithGradient()
 : vInput(NULL)
 , vInputTrans(NULL)
+, m_bLean(false)
+, m_nAt_dVolume_x_Region(-1)
 {
 	m_groupVolBinScaled = VolumeReal::New();
+	m_vol_dVolume_x_Region = VolumeReal::New();
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -65,8 +69,38 @@ VolumeReal *
 int 
 	CHistogramWithGradient::Add_dVolume(VolumeReal *p_dVolume, int nGroup)
 	// adds another dVolume
+{
+	return Insert_dVolume(p_dVolume, nGroup, NULL);
+
+}	// CHistogramWithGradient::Add_dVolume
+
+//////////////////////////////////////////////////////////////////////
+int 
+	CHistogramWithGradient::Add_dVolume(const dH::SparseBeamlet& beamlet, int nGroup)
+	// adds a sparse beamlet as a dVolume
+{
+	return Insert_dVolume(beamlet.m_pGrid, nGroup, &beamlet);
+
+}	// CHistogramWithGradient::Add_dVolume
+
+//////////////////////////////////////////////////////////////////////
+const dH::SparseBeamlet *
+	CHistogramWithGradient::Get_dVolumeSparse(int nAt) const
+	// the dVolume's sparse form, or NULL if it is dense
+{
+	return m_arr_dVolumesSparse[nAt].m_pGrid.IsNull() 
+		? NULL : &m_arr_dVolumesSparse[nAt];
+
+}	// CHistogramWithGradient::Get_dVolumeSparse
+
+//////////////////////////////////////////////////////////////////////
+int 
+	CHistogramWithGradient::Insert_dVolume(VolumeReal *p_dVolume, int nGroup,
+			const dH::SparseBeamlet *pSparse)
+	// adds another dVolume
 {
 	m_arr_dVolumes.push_back(p_dVolume); 
+	m_arr_dVolumesSparse.push_back(pSparse ? *pSparse : dH::SparseBeamlet());
 	int nNewVolumeIndex = (int) m_arr_dVolumes.size()-1; 
 	m_arrVolumeGroups.Add(nGroup);
 	while (m_groupVolBinLoInt.size() <= (size_t) nGroup)
@@ -114,9 +148,13 @@ int
 	// set flag for computing bins for new dVolume
 	m_arr_bRecompute_dBins.Add(TRUE);
 
-	// add new product volume
+	// add new product volume (allocated on first use, in lean mode or for a 
+	//	sparse dVolume not at all)
 	VolumeReal::Pointer p_dVolume_x_Region = VolumeReal::New();
-	ConformTo<VOXEL_REAL,3>(p_dVolume, p_dVolume_x_Region);
+	if (!m_bLean && pSparse == NULL)
+	{
+		ConformTo<VOXEL_REAL,3>(p_dVolume, p_dVolume_x_Region);
+	}
 	m_arr_dVolumes_x_Region.push_back(p_dVolume_x_Region); 
 
 	// add the derivative bins
@@ -128,7 +166,123 @@ int
 
 	return nNewVolumeIndex;
 
-}	// CHistogramWithGradient::Add_dVolume
+}	// CHistogramWithGradient::Insert_dVolume
+
+//////////////////////////////////////////////////////////////////////
+void 
+	CHistogramWithGradient::SetLean(bool bLean)
+	// sets lean mode, freeing the stored products when entering it
+{
+	if (bLean == m_bLean)
+	{
+		return;
+	}
+
+	std::lock_guard<std::recursive_mutex> lock(m_mutex_dBins);
+
+	m_bLean = bLean;
+	for (size_t nAt = 0; nAt < m_arr_dVolumes_x_Region.size(); nAt++)
+	{
+		// either way, the stored products are no longer current
+		ReleaseImage<VOXEL_REAL,3>(m_arr_dVolumes_x_Region[nAt]);
+		m_arr_bRecompute_dVolumes_x_Region[(int) nAt] = TRUE;
+	}
+
+	ReleaseImage<VOXEL_REAL,3>(m_vol_dVolume_x_Region);
+	m_nAt_dVolume_x_Region = -1;
+
+}	// CHistogramWithGradient::SetLean
+
+//////////////////////////////////////////////////////////////////////
+bool 
+	CHistogramWithGradient::IsLean() const
+{
+	return m_bLean;
+
+}	// CHistogramWithGradient::IsLean
+
+//////////////////////////////////////////////////////////////////////
+void 
+	CHistogramWithGradient::AccountMemory(dH::MemoryReport& report, 
+			const dH::MemoryOwner& owner) const
+	// adds the helper volumes to a memory report
+{
+	CHistogram::AccountMemory(report, owner);
+
+	report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_groupVolBinScaled.GetPointer());
+	for (size_t nGroup = 0; nGroup < m_groupVolBinLoInt.size(); nGroup++)
+	{
+		report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_groupVolRegion[nGroup].GetPointer());
+		report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_groupVolBinLoInt[nGroup].GetPointer());
+		report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_groupVolBinFracHi[nGroup].GetPointer());
+		report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_groupVolBinFracLo[nGroup].GetPointer());
+		report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_groupVolBinFracHi_x_dVolume[nGroup].GetPointer());
+		report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_groupVolBinFracLo_x_dVolume[nGroup].GetPointer());
+	}
+
+	for (size_t nAt = 0; nAt < m_arr_dVolumes_x_Region.size(); nAt++)
+	{
+		report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_arr_dVolumes_x_Region[nAt].GetPointer());
+	}
+	report.AddImage(dH::MEMORY_HISTOGRAM, owner, m_vol_dVolume_x_Region.GetPointer());
+
+}	// CHistogramWithGradient::AccountMemory
+
+//////////////////////////////////////////////////////////////////////
+size_t 
+	CHistogramWithGradient::EstimateHelperBytes(size_t nVoxels, int nGroups, 
+			int n_dVolumes, bool bLean)
+	// bytes the helper volumes take; must list the same volumes as 
+	//		AccountMemory
+{
+	const size_t nGroupVoxelBytes = 
+		sizeof(VOXEL_REAL)			// m_groupVolRegion
+		+ sizeof(short)				// m_groupVolBinLoInt
+		+ 2 * sizeof(VOXEL_REAL)	// m_groupVolBinFracHi, Lo
+		+ 2 * sizeof(VOXEL_REAL);	// m_groupVolBinFracHi, Lo_x_dVolume
+
+	// m_arr_dVolumes_x_Region, or the one m_vol_dVolume_x_Region if lean
+	const size_t nProducts = bLean ? 1 : n_dVolumes;
+
+	return CHistogram::EstimateHelperBytes(nVoxels)
+		+ nVoxels * sizeof(VOXEL_REAL)		// m_groupVolBinScaled
+		+ nGroups * nVoxels * nGroupVoxelBytes
+		+ nProducts * nVoxels * sizeof(VOXEL_REAL);
+
+}	// CHistogramWithGradient::EstimateHelperBytes
+
+//////////////////////////////////////////////////////////////////////
+void 
+	CHistogramWithGradient::ReleaseHelperVolumes()
+	// frees the helper volumes; they are recomputed on next use
+{
+	std::lock_guard<std::recursive_mutex> lock(m_mutex_dBins);
+
+	CHistogram::ReleaseHelperVolumes();
+
+	// the group binning volumes are recomputed on every GetBinVolume; the
+	//	group regions are only formed in Add_dVolume, so they stay
+	ReleaseImage<VOXEL_REAL,3>(m_groupVolBinScaled);
+	for (size_t nGroup = 0; nGroup < m_groupVolBinLoInt.size(); nGroup++)
+	{
+		ReleaseImage<short,3>(m_groupVolBinLoInt[nGroup]);
+		ReleaseImage<VOXEL_REAL,3>(m_groupVolBinFracHi[nGroup]);
+		ReleaseImage<VOXEL_REAL,3>(m_groupVolBinFracLo[nGroup]);
+		ReleaseImage<VOXEL_REAL,3>(m_groupVolBinFracHi_x_dVolume[nGroup]);
+		ReleaseImage<VOXEL_REAL,3>(m_groupVolBinFracLo_x_dVolume[nGroup]);
+		m_arr_bRecomputeBinVolume[(int) nGroup] = TRUE;
+	}
+
+	for (size_t nAt = 0; nAt < m_arr_dVolumes_x_Region.size(); nAt++)
+	{
+		ReleaseImage<VOXEL_REAL,3>(m_arr_dVolumes_x_Region[nAt]);
+		m_arr_bRecompute_dVolumes_x_Region[(int) nAt] = TRUE;
+	}
+
+	ReleaseImage<VOXEL_REAL,3>(m_vol_dVolume_x_Region);
+	m_nAt_dVolume_x_Region = -1;
+
+}	// CHistogramWithGradient::ReleaseHelperVolumes
 
 
 //////////////////////////////////////////////////////////////////////
@@ -136,9 +290,15 @@ const CVectorN<>&
 	CHistogramWithGradient::Get_dBins(int nAt_dBin) const
 	// computes and returns the d/dx bins
 {
+	std::lock_guard<std::recursive_mutex> lock(m_mutex_dBins);
+
 	// recompute dBins if needed
 	if (m_arr_bRecompute_dBins[nAt_dBin])
 	{
+		// reads the dVolume and the region
+		PROFILE_SCOPE_BYTES("CHistogramWithGradient::Get_dBins",
+			2 * sizeof(VOXEL_REAL) * GetVolume()->GetBufferedRegion().GetNumberOfPixels());
+
 		// set size of dBins & dGBins
 
 		// initialize reference to proper dBins and zero
@@ -149,7 +309,32 @@ const CVectorN<>&
 		arr_dBins.SetZero();
 
 		// now compute bins
-		if (GetRegion())
+		const dH::SparseBeamlet *pSparse = Get_dVolumeSparse(nAt_dBin);
+		if (GetRegion() && pSparse)
+		{
+			// only the beamlet's non-zero voxels contribute, so the bin fracs
+			//	are scaled by region x beamlet here, voxel by voxel
+			const short *pBinVoxels = GetBinVolume(nAt_dBin)->GetBufferPointer();
+
+			int nGroup = m_arrVolumeGroups[nAt_dBin];
+			const VOXEL_REAL *pRegion = m_groupVolRegion[nGroup]->GetBufferPointer();
+			const VOXEL_REAL *pFracHi = m_groupVolBinFracHi[nGroup]->GetBufferPointer();
+			const VOXEL_REAL *pFracLo = m_groupVolBinFracLo[nGroup]->GetBufferPointer();
+			for (size_t nAt = 0; nAt < pSparse->m_nCount; nAt++)
+			{
+				const int nVoxel = pSparse->m_pVoxels[nAt];
+				int nBin = pBinVoxels[nVoxel];
+				if (nBin < 0 || nBin + 1 >= nBins)
+				{
+					continue;
+				}
+
+				const VOXEL_REAL dVolume_x_Region = pRegion[nVoxel] * pSparse->m_pValues[nAt];
+				arr_dBins[nBin] -= pFracLo[nVoxel] * dVolume_x_Region;
+				arr_dBins[nBin+1] += pFracHi[nVoxel] * dVolume_x_Region;
+			}
+		}
+		else if (GetRegion())
 		{
 			// get dVoxels * Region
 			Get_dVolume_x_Region(nAt_dBin);
@@ -187,6 +372,15 @@ const CVectorN<>&
 				}
 			}
 		}
+		else if (pSparse)
+		{
+			const short *pBinVolumeVoxels = GetBinVolume(nAt_dBin)->GetBufferPointer(); 
+			for (size_t nAt = 0; nAt < pSparse->m_nCount; nAt++)
+			{
+				int nBin = pBinVolumeVoxels[pSparse->m_pVoxels[nAt]];
+				arr_dBins[nBin] += -pSparse->m_pValues[nAt];
+			}
+		}
 		else
 		{
 			/// TODO: extend this to non-zed planar / 3D
@@ -208,8 +402,9 @@ const CVectorN<>&
 		REAL binKernelSigma = sqrt(m_varMax);
 		if (binKernelSigma > 0.0)
 		{	
-			static CVectorN<> arr_dGBinsVarMin;
-			static CVectorN<> arr_dGBinsVarMax;
+			// were function statics, shared by every histogram
+			CVectorN<>& arr_dGBinsVarMin = m_arr_dGBinsVarMin;
+			CVectorN<>& arr_dGBinsVarMax = m_arr_dGBinsVarMax;
 
 			Conv_dGauss(arr_dBins, m_bin_dKernelVarMax, arr_dGBinsVarMax);
 			Conv_dGauss(arr_dBins, m_bin_dKernelVarMin, arr_dGBinsVarMin);
@@ -294,6 +489,8 @@ const CVectorN<>&
 	CHistogramWithGradient::Get_dGBins(int nAt/*dBin*/) const
 	// computes and returns the d/dx GHistogram
 {
+	std::lock_guard<std::recursive_mutex> lock(m_mutex_dBins);
+
 	if (m_varMax == 0.0)
 	{
 		ASSERT(FALSE);	// not OK, because we need to normalize
@@ -312,14 +509,26 @@ const VolumeReal *
 	CHistogramWithGradient::Get_dVolume_x_Region(int nAt/*Group*/) const
 	// calculates / returns the masked dVolume
 {
-	if (m_arr_bRecompute_dVolumes_x_Region[nAt])
+	// a sparse dVolume has no voxels to multiply
+	ASSERT(Get_dVolumeSparse(nAt) == NULL);
+
+	// in lean mode, the one product volume holds the most recent dVolume
+	VolumeReal *p_dVolume_x_Region = m_bLean 
+		? m_vol_dVolume_x_Region.GetPointer() 
+		: m_arr_dVolumes_x_Region[nAt].GetPointer();
+
+	if (m_arr_bRecompute_dVolumes_x_Region[nAt]
+		|| (m_bLean && m_nAt_dVolume_x_Region != nAt))
 	{
 		int nGroup = m_arrVolumeGroups[nAt];
 
+		// (re)allocates the product if it was released, or is shared
+		ConformTo<VOXEL_REAL,3>(Get_dVolume(nAt), p_dVolume_x_Region);
+
 		typedef itk::ImageRegionConstIterator< VolumeReal > ConstIteratorType;
 		typedef itk::ImageRegionIterator< VolumeReal > IteratorType;
 
-		IteratorType dstIt( m_arr_dVolumes_x_Region[nAt], m_arr_dVolumes_x_Region[nAt]->GetBufferedRegion() );
+		IteratorType dstIt( p_dVolume_x_Region, p_dVolume_x_Region->GetBufferedRegion() );
 		ConstIteratorType groupVolRegionIt( m_groupVolRegion[nGroup], m_groupVolRegion[nGroup]->GetBufferedRegion() );
 		ConstIteratorType dVolIt( Get_dVolume(nAt), Get_dVolume(nAt)->GetBufferedRegion() );
 		for ( dstIt.GoToBegin(), groupVolRegionIt.GoToBegin(), dVolIt.GoToBegin(); 
@@ -341,9 +550,13 @@ const VolumeReal *
 		//}
 
 		m_arr_bRecompute_dVolumes_x_Region[nAt] = FALSE;
+		if (m_bLean)
+		{
+			m_nAt_dVolume_x_Region = nAt;
+		}
 	}
 
-	return m_arr_dVolumes_x_Region[nAt];
+	return p_dVolume_x_Region;
 
 }	// CHistogramWithGradient::Get_dVolume_x_Region
 
@@ -487,6 +700,14 @@ const VolumeShort *
 		//		MakeIppiSize<3>(m_groupVolRegion[nGroup]->GetBufferedRegion())) );
 		//}
 
+		// a sparse dVolume is scaled by region x beamlet in Get_dBins, over
+		//	just its non-zero voxels
+		if (Get_dVolumeSparse(nAt) != NULL)
+		{
+			m_arr_bRecomputeBinVolume[nGroup] = TRUE;
+			return m_groupVolBinLoInt[nGroup];
+		}
+
 		////////////////////////////////////////////////////////////////////
 		// now get final bin frac volume
 
@@ -552,6 +773,9 @@ void CHistogramWithGradient::Conv_dGauss(const CVectorN<>& buffer_in,
 										 const CVectorN<>& kernel_in,
 										 CVectorN<>& buffer_out) const
 {
+	PROFILE_SCOPE_BYTES("CHistogramWithGradient::Conv_dGauss",
+		2 * sizeof(REAL) * (buffer_in.GetDim() + kernel_in.GetDim()));
+
 	buffer_out.SetDim(buffer_in.GetDim() + kernel_in.GetDim() - 1);
 	buffer_out.SetZero();
 
@@ -0,0 +1,495 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <math.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <InfluenceMatrix.h>
+#include <Series.h>
+#include <Structure.h>
+
+namespace dH
+{
+
+// file identification: 'DHIM', then the format version
+static const unsigned int INFLUENCE_MAGIC = 0x4d494844;
+static const unsigned int INFLUENCE_VERSION = 1;
+
+// written last, so a truncated file is recognized
+static const unsigned int INFLUENCE_END = 0x444e4521;
+
+// spacing of the compact grid (mm); only the voxel count matters
+static const REAL COMPACT_SPACING = 1.0;
+
+///////////////////////////////////////////////////////////////////////////////
+// binary helpers: values are little-endian, as written by numpy
+///////////////////////////////////////////////////////////////////////////////
+template<class TYPE>
+static bool
+	ReadValue(FILE *pFile, TYPE& value)
+{
+	return fread(&value, sizeof(TYPE), 1, pFile) == 1;
+}
+
+template<class TYPE>
+static bool
+	ReadArray(FILE *pFile, std::vector<TYPE>& arrValues, int nCount)
+{
+	arrValues.resize(nCount);
+	return nCount == 0 
+		|| fread(&arrValues[0], sizeof(TYPE), nCount, pFile) == (size_t) nCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+InfluenceMatrix::InfluenceMatrix()
+	: m_nVoxels(0)
+	, m_nBeams(0)
+	, m_nCompactVoxels(0)
+	, m_nPlanBeamletCount(0)
+{
+	m_arrColumnStart.push_back(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	InfluenceMatrix::Read(const char *pszFileName)
+	// reads the structures, then streams the columns, keeping only the
+	//		structure voxels' entries
+{
+	const std::chrono::steady_clock::time_point start = 
+		std::chrono::steady_clock::now();
+
+	FILE *pFile = NULL;
+	if (fopen_s(&pFile, pszFileName, "rb") != 0 || pFile == NULL)
+	{
+		return false;
+	}
+
+	unsigned int nMagic = 0;
+	unsigned int nVersion = 0;
+	int nVoxels = 0;
+	int nBeamlets = 0;
+	int nStructures = 0;
+	bool bOK = ReadValue(pFile, nMagic) && nMagic == INFLUENCE_MAGIC
+		&& ReadValue(pFile, nVersion) && nVersion == INFLUENCE_VERSION
+		&& ReadValue(pFile, nVoxels) && nVoxels > 0
+		&& ReadValue(pFile, nBeamlets) && nBeamlets > 0
+		&& ReadValue(pFile, nStructures) && nStructures > 0;
+
+	// the structures, marking their voxels
+	std::vector<StructureVoxels> arrStructures(bOK ? nStructures : 0);
+	std::vector<int> arrCompact(bOK ? nVoxels : 0, -1);
+	for (int nAt = 0; bOK && nAt < nStructures; nAt++)
+	{
+		int nNameLength = 0;
+		std::vector<char> arrName;
+		int nVoxelCount = 0;
+		bOK = ReadValue(pFile, nNameLength) && nNameLength >= 0
+			&& ReadArray(pFile, arrName, nNameLength)
+			&& ReadValue(pFile, arrStructures[nAt].m_nType)
+			&& ReadValue(pFile, nVoxelCount) && nVoxelCount >= 0
+			&& ReadArray(pFile, arrStructures[nAt].m_arrVoxels, nVoxelCount);
+		if (!bOK)
+			break;
+
+		arrStructures[nAt].m_strName.assign(arrName.begin(), arrName.end());
+		std::vector<int>& arrVoxels = arrStructures[nAt].m_arrVoxels;
+		for (int nAtVoxel = 0; bOK && nAtVoxel < nVoxelCount; nAtVoxel++)
+		{
+			bOK = arrVoxels[nAtVoxel] >= 0 && arrVoxels[nAtVoxel] < nVoxels;
+			if (bOK)
+				arrCompact[arrVoxels[nAtVoxel]] = 0;
+		}
+	}
+
+	// number the marked voxels in file order, which keeps neighbors near, 
+	//	and renumber the structures' voxels
+	int nCompactVoxels = 0;
+	for (int nVoxel = 0; bOK && nVoxel < nVoxels; nVoxel++)
+	{
+		if (arrCompact[nVoxel] == 0)
+			arrCompact[nVoxel] = nCompactVoxels++;
+		else
+			arrCompact[nVoxel] = -1;
+	}
+	for (int nAt = 0; bOK && nAt < nStructures; nAt++)
+	{
+		std::vector<int>& arrVoxels = arrStructures[nAt].m_arrVoxels;
+		for (size_t nAtVoxel = 0; nAtVoxel < arrVoxels.size(); nAtVoxel++)
+			arrVoxels[nAtVoxel] = arrCompact[arrVoxels[nAtVoxel]];
+		std::sort(arrVoxels.begin(), arrVoxels.end());
+	}
+
+	// beam of each beamlet
+	std::vector<int> arrBeamOf;
+	bOK = bOK && ReadArray(pFile, arrBeamOf, nBeamlets);
+	int nBeams = 0;
+	for (int nAt = 0; bOK && nAt < nBeamlets; nAt++)
+	{
+		bOK = arrBeamOf[nAt] >= 0;
+		nBeams = __max(nBeams, arrBeamOf[nAt] + 1);
+	}
+
+	// stream the columns, one at a time
+	std::vector<size_t> arrColumnStart(1, 0);
+	std::vector<int> arrRows;
+	std::vector<float> arrValues;
+	std::vector<int> arrColumnRows;
+	std::vector<float> arrColumnValues;
+	for (int nColumn = 0; bOK && nColumn < nBeamlets; nColumn++)
+	{
+		int nCount = 0;
+		bOK = ReadValue(pFile, nCount) && nCount >= 0 && nCount <= nVoxels
+			&& ReadArray(pFile, arrColumnRows, nCount)
+			&& ReadArray(pFile, arrColumnValues, nCount);
+
+		for (int nAt = 0; bOK && nAt < nCount; nAt++)
+		{
+			const int nRow = arrColumnRows[nAt];
+			bOK = nRow >= 0 && nRow < nVoxels;
+			if (bOK && arrCompact[nRow] >= 0 && arrColumnValues[nAt] != 0.0f)
+			{
+				arrRows.push_back(arrCompact[nRow]);
+				arrValues.push_back(arrColumnValues[nAt]);
+			}
+		}
+		arrColumnStart.push_back(arrRows.size());
+	}
+
+	unsigned int nEnd = 0;
+	bOK = bOK && ReadValue(pFile, nEnd) && nEnd == INFLUENCE_END;
+	fclose(pFile);
+
+	if (!bOK)
+	{
+		LogMessageF(LOG_LEVEL_INFO, "unable to read influence matrix %s\n", pszFileName);
+		return false;
+	}
+
+	m_nVoxels = nVoxels;
+	m_nCompactVoxels = nCompactVoxels;
+	m_arrStructures.swap(arrStructures);
+	m_arrBeamOf.swap(arrBeamOf);
+	m_nBeams = nBeams;
+	m_arrColumnStart.swap(arrColumnStart);
+	m_arrRows.swap(arrRows);
+	m_arrValues.swap(arrValues);
+
+	// the beams' columns, padded to a common odd count for the plan
+	m_arrBeamColumns.assign(m_nBeams, std::vector<int>());
+	for (int nAt = 0; nAt < nBeamlets; nAt++)
+		m_arrBeamColumns[m_arrBeamOf[nAt]].push_back(nAt);
+	m_nPlanBeamletCount = 0;
+	for (int nBeam = 0; nBeam < m_nBeams; nBeam++)
+		m_nPlanBeamletCount = __max(m_nPlanBeamletCount, (int) m_arrBeamColumns[nBeam].size());
+	m_nPlanBeamletCount |= 1;
+
+	m_arrPlanElement.assign(nBeamlets, -1);
+	for (int nBeam = 0; nBeam < m_nBeams; nBeam++)
+	{
+		for (size_t nAt = 0; nAt < m_arrBeamColumns[nBeam].size(); nAt++)
+		{
+			m_arrPlanElement[m_arrBeamColumns[nBeam][nAt]] = 
+				nBeam * m_nPlanBeamletCount + (int) nAt;
+		}
+	}
+
+	const double elapsed = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count();
+	LogMessageF(LOG_LEVEL_INFO, 
+		"influence matrix %s: %d voxels (%d in structures), %d beamlets in %d beams, "
+		"%llu non-zeros, read in %.2f s\n", 
+		pszFileName, m_nVoxels, m_nCompactVoxels, nBeamlets, m_nBeams, 
+		(unsigned long long) GetNonZeroCount(), elapsed);
+
+	return true;
+
+}	// InfluenceMatrix::Read
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	InfluenceMatrix::GetVoxelCount() const
+{
+	return m_nVoxels;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	InfluenceMatrix::GetCompactVoxelCount() const
+{
+	return m_nCompactVoxels;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	InfluenceMatrix::GetBeamletCount() const
+{
+	return (int) m_arrBeamOf.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	InfluenceMatrix::GetBeamCount() const
+{
+	return m_nBeams;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	InfluenceMatrix::GetBeamOf(int nBeamlet) const
+{
+	return m_arrBeamOf[nBeamlet];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t
+	InfluenceMatrix::GetNonZeroCount() const
+{
+	return m_arrValues.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	InfluenceMatrix::GetStructureCount() const
+{
+	return (int) m_arrStructures.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+const std::string&
+	InfluenceMatrix::GetStructureName(int nAt) const
+{
+	return m_arrStructures[nAt].m_strName;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	InfluenceMatrix::GetStructureType(int nAt) const
+{
+	return m_arrStructures[nAt].m_nType;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+const std::vector<int>&
+	InfluenceMatrix::GetStructureVoxels(int nAt) const
+{
+	return m_arrStructures[nAt].m_arrVoxels;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	InfluenceMatrix::ShapeGrid(VolumeReal *pVolume) const
+	// shapes the volume as a box holding the compact voxels, as near cubic
+	//		as possible so that the region pyramid has room to shrink
+{
+	const int nSide = __max((int) ceil(pow((double) m_nCompactVoxels, 1.0 / 3.0)), 1);
+	const int nSlices = __max((m_nCompactVoxels + nSide * nSide - 1) / (nSide * nSide), 1);
+
+	pVolume->SetRegions(MakeSize(nSide, nSide, nSlices));
+	pVolume->SetOrigin(MakePoint<3>(MakeVector<3>(0.0, 0.0, 0.0)));
+	pVolume->SetSpacing(MakeVector<3>(COMPACT_SPACING, COMPACT_SPACING, COMPACT_SPACING));
+
+}	// InfluenceMatrix::ShapeGrid
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	InfluenceMatrix::FormGrid(VolumeReal *pVolume) const
+	// the compact grid, allocated and zeroed
+{
+	ShapeGrid(pVolume);
+	pVolume->Allocate();
+	pVolume->FillBuffer(0.0);
+
+}	// InfluenceMatrix::FormGrid
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	InfluenceMatrix::ExpandBeamlet(int nBeamlet, VolumeReal *pVolume) const
+	// scatters one column on to the compact grid
+{
+	FormGrid(pVolume);
+
+	VOXEL_REAL *pVoxels = pVolume->GetBufferPointer();
+	for (size_t nAt = m_arrColumnStart[nBeamlet]; nAt < m_arrColumnStart[nBeamlet+1]; nAt++)
+	{
+		pVoxels[m_arrRows[nAt]] = (VOXEL_REAL) m_arrValues[nAt];
+	}
+	pVolume->Modified();
+
+}	// InfluenceMatrix::ExpandBeamlet
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	InfluenceMatrix::GetSparseBeamlet(int nBeamlet, SparseBeamlet& beamlet) const
+	// the column's entries, in place
+{
+	const size_t nStart = m_arrColumnStart[nBeamlet];
+	beamlet.m_nCount = m_arrColumnStart[nBeamlet+1] - nStart;
+	beamlet.m_pVoxels = beamlet.m_nCount > 0 ? &m_arrRows[nStart] : NULL;
+	beamlet.m_pValues = beamlet.m_nCount > 0 ? &m_arrValues[nStart] : NULL;
+
+}	// InfluenceMatrix::GetSparseBeamlet
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	InfluenceMatrix::FormRegion(int nStructure, VolumeReal *pRegion) const
+	// a binary region, from the structure's voxels
+{
+	FormGrid(pRegion);
+
+	VOXEL_REAL *pVoxels = pRegion->GetBufferPointer();
+	const std::vector<int>& arrVoxels = GetStructureVoxels(nStructure);
+	for (size_t nAt = 0; nAt < arrVoxels.size(); nAt++)
+	{
+		pVoxels[arrVoxels[nAt]] = 1.0;
+	}
+	pRegion->Modified();
+
+}	// InfluenceMatrix::FormRegion
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	InfluenceMatrix::SetupPlan(std::shared_ptr<const InfluenceMatrix> pMatrix, Plan *pPlan)
+	// sets up the plan's series and beams on the compact grid
+{
+	Series *pSeries = pPlan->GetSeries();
+	if (pSeries == NULL 
+		|| pMatrix->GetBeamCount() == 0
+		|| pPlan->GetBeamCount() > 0)
+	{
+		return false;
+	}
+
+	// the density is only the grid; the dose comes from the matrix
+	VolumeReal::Pointer pDensity = VolumeReal::New();
+	pMatrix->FormGrid(pDensity);
+	pDensity->FillBuffer(1.0);
+	pSeries->SetDensity(pDensity);
+
+	for (int nAt = 0; nAt < pMatrix->GetStructureCount(); nAt++)
+	{
+		Structure::Pointer pStruct = Structure::New();
+		pStruct->SetName(pMatrix->GetStructureName(nAt));
+		pStruct->SetType((Structure::StructType) pMatrix->GetStructureType(nAt));
+		pSeries->AddStructure(pStruct);
+
+		VolumeReal::Pointer pRegion = VolumeReal::New();
+		pMatrix->FormRegion(nAt, pRegion);
+		pStruct->SetRegion(pRegion);
+	}
+
+	// there are no coarser levels to calculate beamlets for
+	pPlan->SetPyramidLevels(1);
+	pPlan->SetDoseResolution(COMPACT_SPACING);
+
+	// the isocenter at the middle of the grid, where the histograms' slice is
+	const VolumeReal::SizeType size = pDensity->GetBufferedRegion().GetSize();
+	const itk::Vector<REAL> vIsocenter = MakeVector<3>(
+		(REAL) (size[0] / 2) * COMPACT_SPACING,
+		(REAL) (size[1] / 2) * COMPACT_SPACING,
+		(REAL) (size[2] / 2) * COMPACT_SPACING);
+
+	std::shared_ptr<BeamletSource> pSource(new InfluenceBeamletSource(pMatrix));
+	const int nBeamletCount = pMatrix->GetPlanBeamletCount();
+	for (int nBeam = 0; nBeam < pMatrix->GetBeamCount(); nBeam++)
+	{
+		CBeam::Pointer pBeam = CBeam::New();
+		pBeam->SetIsocenter(vIsocenter);
+		pPlan->AddBeam(pBeam);
+
+		CVectorN<> vWeights(nBeamletCount);
+		vWeights.SetZero();
+		pBeam->SetIntensityMap(vWeights);
+		pBeam->SetBeamletSource(pSource, nBeam, 0, nBeamletCount);
+	}
+
+	return true;
+
+}	// InfluenceMatrix::SetupPlan
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	InfluenceMatrix::GetPlanBeamletCount() const
+{
+	return m_nPlanBeamletCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	InfluenceMatrix::GetPlanColumn(int nBeam, int nAt) const
+{
+	return (nAt < (int) m_arrBeamColumns[nBeam].size())
+		? m_arrBeamColumns[nBeam][nAt] : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	InfluenceMatrix::GetPlanElement(int nBeamlet) const
+{
+	return m_arrPlanElement[nBeamlet];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	InfluenceMatrix::AccountMemory(MemoryReport& report) const
+	// the compressed columns count as beamlets, not attributed to a beam
+{
+	const MemoryOwner owner;
+	if (!m_arrRows.empty())
+	{
+		report.Add(MEMORY_BEAMLETS, owner, &m_arrRows[0], m_arrRows.size() * sizeof(int));
+		report.Add(MEMORY_BEAMLETS, owner, &m_arrValues[0], m_arrValues.size() * sizeof(float));
+	}
+	report.Add(MEMORY_BEAMLETS, owner, &m_arrColumnStart[0], 
+		m_arrColumnStart.size() * sizeof(size_t));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+InfluenceBeamletSource::InfluenceBeamletSource(std::shared_ptr<const InfluenceMatrix> pMatrix)
+	: m_pMatrix(pMatrix)
+{
+	m_pGrid = VolumeReal::New();
+	m_pMatrix->ShapeGrid(m_pGrid);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+VolumeReal::Pointer
+	InfluenceBeamletSource::LoadBeamlet(int nBeam, int nLevel, int nAt)
+	// expands the beamlet's column; padding beamlets are empty
+{
+	if (nLevel != 0 || nBeam < 0 || nBeam >= m_pMatrix->GetBeamCount())
+		return NULL;
+
+	VolumeReal::Pointer pBeamlet = VolumeReal::New();
+	const int nColumn = m_pMatrix->GetPlanColumn(nBeam, nAt);
+	if (nColumn >= 0)
+		m_pMatrix->ExpandBeamlet(nColumn, pBeamlet);
+	else
+		m_pMatrix->FormGrid(pBeamlet);
+
+	return pBeamlet;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	InfluenceBeamletSource::LoadSparseBeamlet(int nBeam, int nLevel, int nAt,
+		SparseBeamlet& beamlet)
+	// a view of the beamlet's column; padding beamlets are empty
+{
+	if (nLevel != 0 || nBeam < 0 || nBeam >= m_pMatrix->GetBeamCount())
+		return false;
+
+	beamlet = SparseBeamlet();
+	beamlet.m_pGrid = m_pGrid;
+	const int nColumn = m_pMatrix->GetPlanColumn(nBeam, nAt);
+	if (nColumn >= 0)
+		m_pMatrix->GetSparseBeamlet(nColumn, beamlet);
+
+	return true;
+}
+
+}	// namespace dH
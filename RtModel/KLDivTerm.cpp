@@ -4,6 +4,8 @@
 
 #include "KLDivTerm.h"
 
+#include <Profiler.h>
+
 namespace dH
 {
 
@@ -219,98 +221,20 @@ REAL
 	KLDivTerm::Eval(CVectorN<> *pvGrad, const CArray<BOOL, BOOL>& arrInclude)
 	// evaluates the term (and optionally gradient)
 {
+	PROFILE_SCOPE("KLDivTerm::Eval");
+
 	// trigger update of targets
 	OnHistogramBinningChange(); // NULL, NULL);
 
-	REAL sum = 0.0;
-
 	// get the calculated histogram bins
 	const CVectorN<>& calcGPDF = GetHistogram()->GetGBins();
 
+	// the divergence from the target
+	const REAL value = EvalGBins(calcGPDF);
+
 	// get the target bins
 	const CVectorN<>& targetGPDF = GetTargetGBins();
 
-	if (!m_bTargetCrossEntropy)
-	{	
-		for (int nAtBin = 0; nAtBin < calcGPDF.GetDim(); nAtBin++)
-		{
-			if (nAtBin < targetGPDF.GetDim())
-			{
-				// ASSERT(targetGPDF[nAtBin] >= 0.0);
-				sum += calcGPDF[nAtBin] * log(calcGPDF[nAtBin] / (targetGPDF[nAtBin] + EPS) + EPS);
-			}
-			else
-			{
-				sum += calcGPDF[nAtBin] * log(calcGPDF[nAtBin] / (EPS) + EPS);	
-				ASSERT(_finite(sum));
-			}
-		}
-	}
-	else // if (m_bTargetCrossEntropy)
-	{
-//#define IPP_CALC_KLDIV
-#ifdef IPP_CALC_KLDIV
-		if (m_vCalc_EPS.GetDim() < calcGPDF.GetDim())
-		{
-			m_vCalc_EPS.SetDim(calcGPDF.GetDim());
-		}
-		m_vCalc_EPS.SetZero();
-		SumValues<REAL>(&m_vCalc_EPS[0], &calcGPDF[0], EPS, calcGPDF.GetDim());
-
-		if (m_vTarget_div_Calc.GetDim() < targetGPDF.GetDim())
-		{
-			m_vTarget_div_Calc.SetDim(targetGPDF.GetDim());
-		}
-		m_vTarget_div_Calc.SetZero();
-
-		// CAREFUL about the order of operands for DivValues
-		DivValues<REAL>(&m_vTarget_div_Calc[0], &m_vCalc_EPS[0], 
-			&targetGPDF[0], __min(calcGPDF.GetDim(), targetGPDF.GetDim()));
-		if (calcGPDF.GetDim() < targetGPDF.GetDim())
-		{
-			DivValues<REAL>(&m_vTarget_div_Calc[calcGPDF.GetDim()], 
-				&targetGPDF[calcGPDF.GetDim()], EPS, targetGPDF.GetDim() - calcGPDF.GetDim());
-		}
-
-		if (m_vTarget_div_Calc_EPS.GetDim() < targetGPDF.GetDim())
-		{
-			m_vTarget_div_Calc_EPS.SetDim(targetGPDF.GetDim());
-		}
-		m_vTarget_div_Calc_EPS.SetZero();
-		SumValues<REAL>(&m_vTarget_div_Calc_EPS[0], &m_vTarget_div_Calc[0], EPS, targetGPDF.GetDim());
-
-		if (m_vLogTarget_div_Calc.GetDim() < targetGPDF.GetDim())
-		{
-			m_vLogTarget_div_Calc.SetDim(targetGPDF.GetDim());
-		}
-		m_vLogTarget_div_Calc.SetZero();
-		// ::ippsLn_64f(&m_vTarget_div_Calc_EPS[0], &m_vLogTarget_div_Calc[0], targetGPDF.GetDim());
-		for (int nN = 0; nN < targetGPDF.GetDim(); nN++)
-			m_vLogTarget_div_Calc[nN] = log(m_vTarget_div_Calc_EPS[nN]);
-		MultValues<REAL>(&m_vLogTarget_div_Calc[0], &targetGPDF[0], targetGPDF.GetDim());
-
-		// now sum all values
-		// ::ippsSum_64f(&m_vLogTarget_div_Calc[0], targetGPDF.GetDim(), &sum); 
-		sum = 0.0;
-		for (int nN = 0; nN < targetGPDF.GetDim(); nN++)
-			sum += m_vLogTarget_div_Calc[nN];
-#else
-		for (int nAtBin = 0; nAtBin < targetGPDF.GetDim(); nAtBin++)
-		{
-			if (nAtBin < calcGPDF.GetDim())
-			{
-				sum += targetGPDF[nAtBin] 
-					* log(targetGPDF[nAtBin] / (calcGPDF[nAtBin] + EPS) + EPS);
-			}
-			else
-			{
-				sum += targetGPDF[nAtBin] 
-					* log(targetGPDF[nAtBin] / (EPS) + EPS);
-			}
-		}
-#endif
-	}
-
 	// if a gradient is needed
 	if (pvGrad)
 	{
@@ -455,6 +379,120 @@ REAL
 		(*pvGrad) *= GetWeight();
 	}
 
+	return value;
+
+}	// KLDivTerm::Eval
+
+///////////////////////////////////////////////////////////////////////////////
+void 
+	KLDivTerm::EvalBatch(const std::vector< CVectorN<> >& arrCalcGBins,
+			CVectorN<>& vValues)
+	// evaluates the term at each of a batch of calculated GBins
+{
+	PROFILE_SCOPE("KLDivTerm::EvalBatch");
+
+	// the target is the same for the whole batch
+	OnHistogramBinningChange(); // NULL, NULL);
+
+	vValues.SetDim((int) arrCalcGBins.size());
+	for (int nAt = 0; nAt < (int) arrCalcGBins.size(); nAt++)
+	{
+		vValues[nAt] = EvalGBins(arrCalcGBins[nAt]);
+	}
+
+}	// KLDivTerm::EvalBatch
+
+///////////////////////////////////////////////////////////////////////////////
+REAL 
+	KLDivTerm::EvalGBins(const CVectorN<>& calcGPDF)
+	// the weighted divergence of calculated GBins from the target
+{
+	REAL sum = 0.0;
+
+	// get the target bins
+	const CVectorN<>& targetGPDF = GetTargetGBins();
+
+	if (!m_bTargetCrossEntropy)
+	{	
+		for (int nAtBin = 0; nAtBin < calcGPDF.GetDim(); nAtBin++)
+		{
+			if (nAtBin < targetGPDF.GetDim())
+			{
+				// ASSERT(targetGPDF[nAtBin] >= 0.0);
+				sum += calcGPDF[nAtBin] * log(calcGPDF[nAtBin] / (targetGPDF[nAtBin] + EPS) + EPS);
+			}
+			else
+			{
+				sum += calcGPDF[nAtBin] * log(calcGPDF[nAtBin] / (EPS) + EPS);	
+				ASSERT(_finite(sum));
+			}
+		}
+	}
+	else // if (m_bTargetCrossEntropy)
+	{
+//#define IPP_CALC_KLDIV
+#ifdef IPP_CALC_KLDIV
+		if (m_vCalc_EPS.GetDim() < calcGPDF.GetDim())
+		{
+			m_vCalc_EPS.SetDim(calcGPDF.GetDim());
+		}
+		m_vCalc_EPS.SetZero();
+		SumValues<REAL>(&m_vCalc_EPS[0], &calcGPDF[0], EPS, calcGPDF.GetDim());
+
+		if (m_vTarget_div_Calc.GetDim() < targetGPDF.GetDim())
+		{
+			m_vTarget_div_Calc.SetDim(targetGPDF.GetDim());
+		}
+		m_vTarget_div_Calc.SetZero();
+
+		// CAREFUL about the order of operands for DivValues
+		DivValues<REAL>(&m_vTarget_div_Calc[0], &m_vCalc_EPS[0], 
+			&targetGPDF[0], __min(calcGPDF.GetDim(), targetGPDF.GetDim()));
+		if (calcGPDF.GetDim() < targetGPDF.GetDim())
+		{
+			DivValues<REAL>(&m_vTarget_div_Calc[calcGPDF.GetDim()], 
+				&targetGPDF[calcGPDF.GetDim()], EPS, targetGPDF.GetDim() - calcGPDF.GetDim());
+		}
+
+		if (m_vTarget_div_Calc_EPS.GetDim() < targetGPDF.GetDim())
+		{
+			m_vTarget_div_Calc_EPS.SetDim(targetGPDF.GetDim());
+		}
+		m_vTarget_div_Calc_EPS.SetZero();
+		SumValues<REAL>(&m_vTarget_div_Calc_EPS[0], &m_vTarget_div_Calc[0], EPS, targetGPDF.GetDim());
+
+		if (m_vLogTarget_div_Calc.GetDim() < targetGPDF.GetDim())
+		{
+			m_vLogTarget_div_Calc.SetDim(targetGPDF.GetDim());
+		}
+		m_vLogTarget_div_Calc.SetZero();
+		// ::ippsLn_64f(&m_vTarget_div_Calc_EPS[0], &m_vLogTarget_div_Calc[0], targetGPDF.GetDim());
+		for (int nN = 0; nN < targetGPDF.GetDim(); nN++)
+			m_vLogTarget_div_Calc[nN] = log(m_vTarget_div_Calc_EPS[nN]);
+		MultValues<REAL>(&m_vLogTarget_div_Calc[0], &targetGPDF[0], targetGPDF.GetDim());
+
+		// now sum all values
+		// ::ippsSum_64f(&m_vLogTarget_div_Calc[0], targetGPDF.GetDim(), &sum); 
+		sum = 0.0;
+		for (int nN = 0; nN < targetGPDF.GetDim(); nN++)
+			sum += m_vLogTarget_div_Calc[nN];
+#else
+		for (int nAtBin = 0; nAtBin < targetGPDF.GetDim(); nAtBin++)
+		{
+			if (nAtBin < calcGPDF.GetDim())
+			{
+				sum += targetGPDF[nAtBin] 
+					* log(targetGPDF[nAtBin] / (calcGPDF[nAtBin] + EPS) + EPS);
+			}
+			else
+			{
+				sum += targetGPDF[nAtBin] 
+					* log(targetGPDF[nAtBin] / (EPS) + EPS);
+			}
+		}
+#endif
+	}
+
 	// now adjust or integral 
 	sum *= GetHistogram()->GetBinWidth();
 
@@ -463,7 +501,7 @@ REAL
 
 	return sum;
 
-}	// KLDivTerm::Eval
+}	// KLDivTerm::EvalGBins
 
 ///////////////////////////////////////////////////////////////////////////////
 VOITerm *
@@ -0,0 +1,174 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#include "stdafx.h"
+
+#include <stdlib.h>
+
+#include <atomic>
+
+#include <MemoryAccount.h>
+
+namespace dH
+{
+
+///////////////////////////////////////////////////////////////////////////////
+const char *
+	GetMemoryCategoryName(int nCategory)
+{
+	static const char *arrNames[MEMORY_CATEGORY_COUNT] =
+	{
+		"beamlets",
+		"dose",
+		"histogram",
+		"region",
+		"resample_cache",
+		"optimizer",
+	};
+
+	return (nCategory >= 0 && nCategory < MEMORY_CATEGORY_COUNT)
+		? arrNames[nCategory] : "unknown";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+MemoryReport::MemoryReport()
+	: m_nTotal(0)
+{
+	for (int nAt = 0; nAt < MEMORY_CATEGORY_COUNT; nAt++)
+		m_arrCategoryTotals[nAt] = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	MemoryReport::Add(int nCategory, const MemoryOwner& owner,
+			const void *pBuffer, size_t nBytes)
+{
+	if (pBuffer == NULL || nBytes == 0
+		|| nCategory < 0 || nCategory >= MEMORY_CATEGORY_COUNT)
+		return;
+
+	// counted already, through another owner?
+	if (!m_setBuffers.insert(pBuffer).second)
+		return;
+
+	std::pair<size_t, int>& item = m_mapItems[std::make_pair(nCategory, owner)];
+	item.first += nBytes;
+	item.second++;
+
+	m_arrCategoryTotals[nCategory] += nBytes;
+	m_nTotal += nBytes;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t
+	MemoryReport::GetTotal() const
+{
+	return m_nTotal;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t
+	MemoryReport::GetTotal(int nCategory) const
+{
+	return (nCategory >= 0 && nCategory < MEMORY_CATEGORY_COUNT)
+		? m_arrCategoryTotals[nCategory] : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	MemoryReport::GetItems(std::vector<Item>& arrItems) const
+{
+	arrItems.clear();
+
+	std::map<std::pair<int, MemoryOwner>, std::pair<size_t, int> >::const_iterator iter;
+	for (iter = m_mapItems.begin(); iter != m_mapItems.end(); ++iter)
+	{
+		Item item;
+		item.m_nCategory = iter->first.first;
+		item.m_owner = iter->first.second;
+		item.m_nBytes = iter->second.first;
+		item.m_nBuffers = iter->second.second;
+		arrItems.push_back(item);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::string
+	MemoryReport::Format() const
+{
+	const double MB = 1024.0 * 1024.0;
+
+	std::string strReport;
+	char strLine[256];
+	sprintf_s(strLine, sizeof(strLine), "%-16s %5s %5s %-24s %8s %12s\n",
+		"category", "level", "beam", "structure", "buffers", "MB");
+	strReport += strLine;
+
+	std::vector<Item> arrItems;
+	GetItems(arrItems);
+	for (size_t nAt = 0; nAt < arrItems.size(); nAt++)
+	{
+		const Item& item = arrItems[nAt];
+		sprintf_s(strLine, sizeof(strLine), "%-16s %5d %5d %-24s %8d %12.2f\n",
+			GetMemoryCategoryName(item.m_nCategory),
+			item.m_owner.m_nLevel, item.m_owner.m_nBeam,
+			item.m_owner.m_strStructure.c_str(),
+			item.m_nBuffers, (double) item.m_nBytes / MB);
+		strReport += strLine;
+	}
+
+	for (int nCategory = 0; nCategory < MEMORY_CATEGORY_COUNT; nCategory++)
+	{
+		std::string strLabel = std::string("total ") + GetMemoryCategoryName(nCategory);
+		sprintf_s(strLine, sizeof(strLine), "%-22s %52.2f\n",
+			strLabel.c_str(), (double) m_arrCategoryTotals[nCategory] / MB);
+		strReport += strLine;
+	}
+
+	sprintf_s(strLine, sizeof(strLine), "%-22s %52.2f\n", "total", (double) m_nTotal / MB);
+	strReport += strLine;
+
+	const size_t nBudget = GetMemoryBudget();
+	if (nBudget > 0)
+	{
+		sprintf_s(strLine, sizeof(strLine), "%-22s %52.2f\n", "budget", (double) nBudget / MB);
+		strReport += strLine;
+	}
+
+	return strReport;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static size_t
+	ReadMemoryBudget()
+	// BRIMSTONE_MEMORY_BUDGET_MB, in megabytes
+{
+	const char *pEnv = getenv("BRIMSTONE_MEMORY_BUDGET_MB");
+	const double budgetMB = (pEnv != NULL) ? atof(pEnv) : 0.0;
+	return (budgetMB > 0.0) ? (size_t) (budgetMB * 1024.0 * 1024.0) : 0;
+}
+
+static std::atomic<size_t> g_nMemoryBudget(ReadMemoryBudget());
+
+///////////////////////////////////////////////////////////////////////////////
+size_t
+	GetMemoryBudget()
+{
+	return g_nMemoryBudget.load();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	SetMemoryBudget(size_t nBytes)
+{
+	g_nMemoryBudget.store(nBytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	IsOverMemoryBudget(size_t nBytes)
+{
+	const size_t nBudget = GetMemoryBudget();
+	return nBudget > 0 && nBytes > nBudget;
+}
+
+}	// namespace dH
@@ -14,6 +14,7 @@
 DynamicCovarianceCostFunction::DynamicCovarianceCostFunction(/*BOOL bHasGradientInfo*/)
 	: /*m_bHasGradientInfo(bHasGradientInfo)
 	, */m_pAV(NULL)
+	, m_nEvaluations(0)
 {
 }	// CObjectiveFunction::CObjectiveFunction
 
@@ -22,6 +23,8 @@ void
 	DynamicCovarianceCostFunction::compute(vnl_vector<double> const& x, 
 			double *f, vnl_vector<double>* g)
 {
+	m_nEvaluations++;
+
 	CVectorN<REAL> vX(x.size());
 	CopyElements<REAL>(&vX[0], &x[0], x.size());
 
@@ -42,6 +45,21 @@ void
 	{
 		(*f) = (*this)(vX);
 	}
+
+	// apply the linear correction, if one is set for this dimension
+	if (m_vLinearCorrection.GetDim() == (int) x.size())
+	{
+		if (f != NULL)
+		{
+			for (int nAt = 0; nAt < m_vLinearCorrection.GetDim(); nAt++)
+				(*f) -= m_vLinearCorrection[nAt] * x[nAt];
+		}
+		if (g != NULL)
+		{
+			for (int nAt = 0; nAt < m_vLinearCorrection.GetDim(); nAt++)
+				(*g)[nAt] -= m_vLinearCorrection[nAt];
+		}
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -146,3 +164,31 @@ void
 
 }	// CObjectiveFunction::SetAdaptiveVariance
 
+///////////////////////////////////////////////////////////////////////////////
+void 
+	DynamicCovarianceCostFunction::SetLinearCorrection(const CVectorN<>& vCorrection)
+	// sets the linear term subtracted by compute
+{
+	m_vLinearCorrection.SetDim(vCorrection.GetDim());
+	for (int nAt = 0; nAt < vCorrection.GetDim(); nAt++)
+		m_vLinearCorrection[nAt] = vCorrection[nAt];
+
+}	// DynamicCovarianceCostFunction::SetLinearCorrection
+
+///////////////////////////////////////////////////////////////////////////////
+int 
+	DynamicCovarianceCostFunction::GetEvaluationCount() const
+	// evaluations through compute since the last reset
+{
+	return m_nEvaluations;
+
+}	// DynamicCovarianceCostFunction::GetEvaluationCount
+
+///////////////////////////////////////////////////////////////////////////////
+void 
+	DynamicCovarianceCostFunction::ResetEvaluationCount()
+{
+	m_nEvaluations = 0;
+
+}	// DynamicCovarianceCostFunction::ResetEvaluationCount
+
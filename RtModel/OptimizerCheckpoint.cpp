@@ -0,0 +1,419 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#include "stdafx.h"
+
+#include <stdio.h>
+
+#include <chrono>
+
+#include <OptimizerCheckpoint.h>
+#include <KLDivTerm.h>
+#include <Structure.h>
+
+namespace dH
+{
+
+// file identification: 'DHCK', then the format version
+static const unsigned int CHECKPOINT_MAGIC = 0x4b434844;
+static const unsigned int CHECKPOINT_VERSION = 2;
+
+// written last, so a truncated file is recognized
+static const unsigned int CHECKPOINT_END = 0x444e4521;
+
+///////////////////////////////////////////////////////////////////////////////
+// binary helpers: values are written as in memory, and read back on the
+//	same platform
+///////////////////////////////////////////////////////////////////////////////
+template<class TYPE>
+static bool
+	WriteValue(FILE *pFile, const TYPE& value)
+{
+	return fwrite(&value, sizeof(TYPE), 1, pFile) == 1;
+}
+
+template<class TYPE>
+static bool
+	ReadValue(FILE *pFile, TYPE& value)
+{
+	return fread(&value, sizeof(TYPE), 1, pFile) == 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static bool
+	WriteReals(FILE *pFile, const REAL *pValues, int nCount)
+{
+	double value = 0.0;
+	for (int nAt = 0; nAt < nCount; nAt++)
+	{
+		value = (double) pValues[nAt];
+		if (!WriteValue(pFile, value))
+			return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static bool
+	ReadReals(FILE *pFile, REAL *pValues, int nCount)
+{
+	double value = 0.0;
+	for (int nAt = 0; nAt < nCount; nAt++)
+	{
+		if (!ReadValue(pFile, value))
+			return false;
+		pValues[nAt] = (REAL) value;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static bool
+	WriteVector(FILE *pFile, const vnl_vector<REAL>& v)
+{
+	const int nCount = (int) v.size();
+	return WriteValue(pFile, nCount) 
+		&& WriteReals(pFile, v.data_block(), nCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static bool
+	ReadVector(FILE *pFile, vnl_vector<REAL>& v)
+{
+	int nCount = 0;
+	if (!ReadValue(pFile, nCount) || nCount < 0)
+		return false;
+	v.set_size(nCount);
+	return ReadReals(pFile, v.data_block(), nCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static bool
+	WriteString(FILE *pFile, const std::string& str)
+{
+	const int nLength = (int) str.size();
+	return WriteValue(pFile, nLength)
+		&& (nLength == 0 || fwrite(str.data(), 1, nLength, pFile) == (size_t) nLength);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static bool
+	ReadString(FILE *pFile, std::string& str)
+{
+	int nLength = 0;
+	if (!ReadValue(pFile, nLength) || nLength < 0 || nLength > 4096)
+		return false;
+	str.resize(nLength);
+	return nLength == 0 || fread(&str[0], 1, nLength, pFile) == (size_t) nLength;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+OptimizerCheckpoint::OptimizerCheckpoint(const std::string& strFileName, int nInterval)
+	: m_strFileName(strFileName)
+	, m_nInterval(__max(nInterval, 1))
+	, m_nLevel(0)
+	, m_nSchedule(0)
+	, m_nWritten(0)
+	, m_nDropped(0)
+	, m_bFailed(false)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+OptimizerCheckpoint::~OptimizerCheckpoint()
+{
+	Flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	OptimizerCheckpoint::SetLevel(int nLevel, int nSchedule, 
+			const std::vector<VOITerm*>& arrTerms)
+	// sets the level and schedule, and captures the terms' parameters
+{
+	m_nLevel = nLevel;
+	m_nSchedule = nSchedule;
+
+	m_arrTerms.clear();
+	for (int nAt = 0; nAt < (int) arrTerms.size(); nAt++)
+	{
+		CheckpointTerm term;
+		term.m_strStructure = arrTerms[nAt]->GetVOI()->GetName();
+		term.m_weight = arrTerms[nAt]->GetWeight();
+
+		const KLDivTerm *pKLDT = dynamic_cast<const KLDivTerm *>(arrTerms[nAt]);
+		if (pKLDT != NULL)
+		{
+			const CMatrixNxM<>& mDVPs = pKLDT->GetDVPs();
+			for (int nAtDVP = 0; nAtDVP < mDVPs.GetCols(); nAtDVP++)
+			{
+				term.m_arrDVPs.push_back(mDVPs[nAtDVP][0]);
+				term.m_arrDVPs.push_back(mDVPs[nAtDVP][1]);
+			}
+		}
+
+		m_arrTerms.push_back(term);
+	}
+
+}	// OptimizerCheckpoint::SetLevel
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	OptimizerCheckpoint::IsDue(int nIteration) const
+	// true if a snapshot is due once iteration nIteration is done
+{
+	return (nIteration + 1) % m_nInterval == 0;
+
+}	// OptimizerCheckpoint::IsDue
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	OptimizerCheckpoint::CollectWrite()
+	// collects the result of a finished write
+{
+	if (m_futureWrite.valid())
+	{
+		if (m_futureWrite.get())
+			m_nWritten++;
+		else
+			m_bFailed = true;
+	}
+
+}	// OptimizerCheckpoint::CollectWrite
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	OptimizerCheckpoint::Write(OptimizerState& state)
+	// hands a state to the worker thread
+{
+	// the optimizer doesn't wait for the disk: a snapshot that comes while the
+	//	last is still being written is dropped, and the next one due is written
+	if (m_futureWrite.valid()
+		&& m_futureWrite.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+	{
+		m_nDropped++;
+		return;
+	}
+	CollectWrite();
+
+	// the worker has its own copy, so the optimizer can go on with its state
+	std::swap(m_stateWriting, state);
+	m_stateWriting.m_nLevel = m_nLevel;
+	m_stateWriting.m_nSchedule = m_nSchedule;
+	m_stateWriting.m_arrTerms = m_arrTerms;
+
+	m_futureWrite = std::async(std::launch::async, 
+		[this]() { return WriteFile(m_strFileName, m_stateWriting); });
+
+}	// OptimizerCheckpoint::Write
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	OptimizerCheckpoint::Flush()
+	// waits for the write in progress
+{
+	CollectWrite();
+	if (m_bFailed)
+	{
+		LogMessageF(LOG_LEVEL_INFO, "unable to write checkpoint %s\n", m_strFileName.c_str());
+	}
+	return !m_bFailed;
+
+}	// OptimizerCheckpoint::Flush
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	OptimizerCheckpoint::WriteFile(const std::string& strFileName, const OptimizerState& state)
+	// writes a temporary, then replaces the file with it
+{
+	const std::string strTempName = strFileName + ".tmp";
+
+	FILE *pFile = NULL;
+	if (fopen_s(&pFile, strTempName.c_str(), "wb") != 0 || pFile == NULL)
+		return false;
+
+	bool bOK = WriteValue(pFile, CHECKPOINT_MAGIC)
+		&& WriteValue(pFile, CHECKPOINT_VERSION)
+		&& WriteValue(pFile, state.m_nLevel)
+		&& WriteValue(pFile, state.m_nSchedule)
+		&& WriteValue(pFile, state.m_nIteration)
+		&& WriteReals(pFile, &state.m_finalValue, 1)
+		&& WriteVector(pFile, state.m_vParam)
+		&& WriteVector(pFile, state.m_vGrad)
+		&& WriteVector(pFile, state.m_vDir)
+		&& WriteValue(pFile, (int) state.m_bCalcVar)
+		&& WriteReals(pFile, &state.m_varMin, 1)
+		&& WriteReals(pFile, &state.m_varMax, 1);
+
+	// the searched directions, column by column
+	const int nRows = (int) state.m_mSearchedDir.rows();
+	const int nCols = (int) state.m_mSearchedDir.columns();
+	bOK = bOK && WriteValue(pFile, nRows) && WriteValue(pFile, nCols);
+	for (int nCol = 0; bOK && nCol < nCols; nCol++)
+	{
+		const vnl_vector<REAL> vCol = state.m_mSearchedDir.get_column(nCol);
+		bOK = WriteReals(pFile, vCol.data_block(), nRows);
+	}
+
+	bOK = bOK && WriteVector(pFile, state.m_vAdaptVariance)
+		&& WriteReals(pFile, &state.m_entropy, 1)
+		&& WriteReals(pFile, &state.m_freeEnergy, 1);
+
+	// the term parameters
+	const int nTerms = (int) state.m_arrTerms.size();
+	bOK = bOK && WriteValue(pFile, nTerms);
+	for (int nAt = 0; bOK && nAt < nTerms; nAt++)
+	{
+		const CheckpointTerm& term = state.m_arrTerms[nAt];
+		const int nDVPs = (int) term.m_arrDVPs.size();
+		bOK = WriteString(pFile, term.m_strStructure)
+			&& WriteReals(pFile, &term.m_weight, 1)
+			&& WriteValue(pFile, nDVPs)
+			&& (nDVPs == 0 || WriteReals(pFile, &term.m_arrDVPs[0], nDVPs));
+	}
+
+	bOK = bOK && WriteValue(pFile, CHECKPOINT_END);
+
+	// the snapshot has to be on disk before it replaces the last one
+	bOK = (fflush(pFile) == 0) && bOK;
+	bOK = (fclose(pFile) == 0) && bOK;
+	if (!bOK)
+	{
+		remove(strTempName.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	return MoveFileExA(strTempName.c_str(), strFileName.c_str(), 
+		MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(strTempName.c_str(), strFileName.c_str()) == 0;
+#endif
+
+}	// OptimizerCheckpoint::WriteFile
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	OptimizerCheckpoint::ReadFile(const std::string& strFileName, OptimizerState& state)
+	// reads a snapshot
+{
+	FILE *pFile = NULL;
+	if (fopen_s(&pFile, strFileName.c_str(), "rb") != 0 || pFile == NULL)
+		return false;
+
+	unsigned int nMagic = 0;
+	unsigned int nVersion = 0;
+	int nCalcVar = 0;
+	bool bOK = ReadValue(pFile, nMagic) && nMagic == CHECKPOINT_MAGIC
+		&& ReadValue(pFile, nVersion) && nVersion == CHECKPOINT_VERSION
+		&& ReadValue(pFile, state.m_nLevel)
+		&& ReadValue(pFile, state.m_nSchedule)
+		&& ReadValue(pFile, state.m_nIteration)
+		&& ReadReals(pFile, &state.m_finalValue, 1)
+		&& ReadVector(pFile, state.m_vParam)
+		&& ReadVector(pFile, state.m_vGrad)
+		&& ReadVector(pFile, state.m_vDir)
+		&& ReadValue(pFile, nCalcVar)
+		&& ReadReals(pFile, &state.m_varMin, 1)
+		&& ReadReals(pFile, &state.m_varMax, 1);
+	state.m_bCalcVar = (nCalcVar != 0);
+
+	int nRows = 0;
+	int nCols = 0;
+	bOK = bOK && ReadValue(pFile, nRows) && ReadValue(pFile, nCols)
+		&& nRows >= 0 && nCols >= 0 && nCols <= nRows;
+	if (bOK)
+	{
+		state.m_mSearchedDir.set_size(nRows, nCols);
+		vnl_vector<REAL> vCol(nRows);
+		for (int nCol = 0; bOK && nCol < nCols; nCol++)
+		{
+			bOK = ReadReals(pFile, vCol.data_block(), nRows);
+			state.m_mSearchedDir.set_column(nCol, vCol);
+		}
+	}
+
+	bOK = bOK && ReadVector(pFile, state.m_vAdaptVariance)
+		&& ReadReals(pFile, &state.m_entropy, 1)
+		&& ReadReals(pFile, &state.m_freeEnergy, 1);
+
+	int nTerms = 0;
+	bOK = bOK && ReadValue(pFile, nTerms) && nTerms >= 0;
+	state.m_arrTerms.clear();
+	for (int nAt = 0; bOK && nAt < nTerms; nAt++)
+	{
+		CheckpointTerm term;
+		int nDVPs = 0;
+		bOK = ReadString(pFile, term.m_strStructure)
+			&& ReadReals(pFile, &term.m_weight, 1)
+			&& ReadValue(pFile, nDVPs) && nDVPs >= 0 && nDVPs % 2 == 0;
+		if (bOK && nDVPs > 0)
+		{
+			term.m_arrDVPs.resize(nDVPs);
+			bOK = ReadReals(pFile, &term.m_arrDVPs[0], nDVPs);
+		}
+		state.m_arrTerms.push_back(term);
+	}
+
+	unsigned int nEnd = 0;
+	bOK = bOK && ReadValue(pFile, nEnd) && nEnd == CHECKPOINT_END;
+
+	// the vectors have to agree
+	bOK = bOK && state.m_vGrad.size() == state.m_vParam.size()
+		&& state.m_vDir.size() == state.m_vParam.size()
+		&& (!state.m_bCalcVar 
+			|| (nRows == (int) state.m_vParam.size()
+				&& state.m_vAdaptVariance.size() == state.m_vParam.size()));
+
+	fclose(pFile);
+
+	if (!bOK)
+	{
+		LogMessageF(LOG_LEVEL_INFO, "checkpoint %s is incomplete or of another version\n", 
+			strFileName.c_str());
+	}
+	return bOK;
+
+}	// OptimizerCheckpoint::ReadFile
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	OptimizerCheckpoint::ApplyTerms(const OptimizerState& state, 
+			const std::vector<VOITerm*>& arrTerms)
+	// applies a snapshot's term parameters to the terms of the same structures
+{
+	for (int nAt = 0; nAt < (int) state.m_arrTerms.size(); nAt++)
+	{
+		const CheckpointTerm& term = state.m_arrTerms[nAt];
+
+		VOITerm *pVOIT = NULL;
+		for (int nAtTerm = 0; nAtTerm < (int) arrTerms.size() && pVOIT == NULL; nAtTerm++)
+		{
+			if (arrTerms[nAtTerm]->GetVOI()->GetName() == term.m_strStructure)
+				pVOIT = arrTerms[nAtTerm];
+		}
+
+		if (pVOIT == NULL)
+		{
+			LogMessageF(LOG_LEVEL_INFO, "checkpoint term for %s has no structure\n", 
+				term.m_strStructure.c_str());
+			continue;
+		}
+
+		pVOIT->SetWeight(term.m_weight);
+
+		KLDivTerm *pKLDT = dynamic_cast<KLDivTerm *>(pVOIT);
+		if (pKLDT != NULL && !term.m_arrDVPs.empty())
+		{
+			CMatrixNxM<> mDVPs((int) term.m_arrDVPs.size() / 2, 2);
+			for (int nAtDVP = 0; nAtDVP < mDVPs.GetCols(); nAtDVP++)
+			{
+				mDVPs[nAtDVP][0] = term.m_arrDVPs[nAtDVP * 2];
+				mDVPs[nAtDVP][1] = term.m_arrDVPs[nAtDVP * 2 + 1];
+			}
+			pKLDT->SetDVPs(mDVPs);
+		}
+	}
+
+}	// OptimizerCheckpoint::ApplyTerms
+
+}	// namespace dH
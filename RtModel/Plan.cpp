@@ -14,12 +14,13 @@ Plan::Plan()
 	: m_pSeries(NULL)
 	, m_DoseResolution(4.0) // 
 		// 2.0)
+	, m_PyramidLevels(4)
+	, m_MaxBeamletShift(19)
+	, m_BeamletSpacing(4.0)
 {
 	m_pKernel = new CEnergyDepKernel(6.0); // 
 		// 15.0);
 
-	m_pMassDensity = VolumeReal::New();
-
 	m_pDose = VolumeReal::New();
 	m_pBeamDoseRot = VolumeReal::New();
 	m_pTempBuffer = VolumeReal::New();
@@ -261,34 +262,36 @@ VolumeReal *
 	Plan::GetMassDensity()
 	// used to format the mass density array, conformant to dose matrix
 {
-	// fix mass density
-	ConformTo<VOXEL_REAL,3>(GetSeries()->GetDensity(), m_pMassDensity);
-	m_pMassDensity->FillBuffer(0.0); 
-
-	// lookup values
-	VOXEL_REAL *pCTVoxels = GetSeries()->GetDensity()->GetBufferPointer(); 
-	VOXEL_REAL *pMDVoxels = m_pMassDensity->GetBufferPointer(); 
-	int nVoxels = m_pMassDensity->GetBufferedRegion().GetNumberOfPixels();
-	for (int nAtVoxel = 0; nAtVoxel < nVoxels; nAtVoxel++)
+	// the series converts through its scanner calibration, and keeps the 
+	//	result until the CT changes
+	return GetSeries()->GetMassDensity();
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	Plan::AccountMemory(MemoryReport& report, int nLevel)
+	// adds the beams, dose and histograms to a memory report
+{
+	for (int nBeam = 0; nBeam < GetBeamCount(); nBeam++)
 	{
-		if (pCTVoxels[nAtVoxel] < 0.0)
-		{
-			pMDVoxels[nAtVoxel] =
-				(VOXEL_REAL)(0.0 + 1.0 * (pCTVoxels[nAtVoxel] - -1024.0) / 1024.0);
-		}
-		else if (pCTVoxels[nAtVoxel] < 1024.0)
-		{
-			pMDVoxels[nAtVoxel] = 
-				(VOXEL_REAL)(1.0 + 0.0/*0.5*/ * pCTVoxels[nAtVoxel] / 1024.0);
-		}
-		else
-		{
-			pMDVoxels[nAtVoxel] = 1.0/*1.5*/;
-		}
+		GetBeamAt(nBeam)->AccountMemory(report, nLevel, nBeam);
 	}
 
-	return m_pMassDensity;
+	const MemoryOwner owner(nLevel);
+	report.AddImage(MEMORY_DOSE, owner, m_pDose.GetPointer());
+	report.AddImage(MEMORY_DOSE, owner, m_pTempBuffer.GetPointer());
+	report.AddImage(MEMORY_DOSE, owner, m_pBeamDoseRot.GetPointer());
 
+	POSITION pos = m_mapHistograms.GetStartPosition();
+	CString strName;
+	CHistogram *pHisto;
+	while (pos != NULL)
+	{
+		m_mapHistograms.GetNextAssoc(pos, strName, pHisto);
+		pHisto->AccountMemory(report, 
+			MemoryOwner(nLevel, -1, std::string((LPCSTR) CStringA(strName))));
+	}
 }
 
 }	// namespace dH
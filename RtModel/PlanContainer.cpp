@@ -0,0 +1,517 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#include "stdafx.h"
+
+#include <string.h>
+
+#include <PlanContainer.h>
+
+namespace dH
+{
+
+// file header: magic, version, then the index location
+static const char PLAN_CONTAINER_MAGIC[8] = { 'D', 'H', 'P', 'L', 'A', 'N', '0', '1' };
+static const unsigned int PLAN_CONTAINER_VERSION = 1;
+static const int PLAN_CONTAINER_HEADER_BYTES = 64;
+
+///////////////////////////////////////////////////////////////////////////////
+static int
+	SeekTo(FILE *pFile, unsigned long long nOffset)
+	// 64-bit seek; containers of fine-grid beamlets pass 2 GB
+{
+#ifdef _MSC_VER
+	return _fseeki64(pFile, (__int64) nOffset, SEEK_SET);
+#else
+	return fseeko(pFile, (off_t) nOffset, SEEK_SET);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static unsigned long long
+	FileSize(FILE *pFile)
+	// 64-bit size of an open file; moves the file position to the end
+{
+#ifdef _MSC_VER
+	if (_fseeki64(pFile, 0, SEEK_END) != 0)
+		return 0;
+	const __int64 nSize = _ftelli64(pFile);
+#else
+	if (fseeko(pFile, 0, SEEK_END) != 0)
+		return 0;
+	const off_t nSize = ftello(pFile);
+#endif
+	return nSize > 0 ? (unsigned long long) nSize : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+unsigned long long
+	PlanContainer::Hash(const void *pData, size_t nBytes, unsigned long long nSeed)
+	// 64-bit FNV-1a
+{
+	const unsigned char *pBytes = (const unsigned char *) pData;
+	unsigned long long nHash = nSeed;
+	for (size_t nAt = 0; nAt < nBytes; nAt++)
+	{
+		nHash ^= pBytes[nAt];
+		nHash *= 1099511628211ULL;
+	}
+	return nHash;
+
+}	// PlanContainer::Hash
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	PlanContainer::EncodeSparseFloats(const float *pData, size_t nCount,
+			std::vector<char>& arrEncoded)
+	// encodes as runs of (zero count, literal count, literal values); only
+	//	exact zeros are dropped, so the encoding is lossless
+{
+	arrEncoded.clear();
+	size_t nAt = 0;
+	while (nAt < nCount)
+	{
+		unsigned int nZeros = 0;
+		while (nAt < nCount && pData[nAt] == 0.0f && nZeros < 0xffffffffU)
+		{
+			nZeros++;
+			nAt++;
+		}
+
+		const size_t nLiteralBegin = nAt;
+		while (nAt < nCount && pData[nAt] != 0.0f
+			&& nAt - nLiteralBegin < 0xffffffffU)
+		{
+			nAt++;
+		}
+		const unsigned int nLiterals = (unsigned int) (nAt - nLiteralBegin);
+
+		const size_t nOldSize = arrEncoded.size();
+		arrEncoded.resize(nOldSize + 2 * sizeof(unsigned int) + nLiterals * sizeof(float));
+		char *pOut = &arrEncoded[nOldSize];
+		memcpy(pOut, &nZeros, sizeof(unsigned int));
+		memcpy(pOut + sizeof(unsigned int), &nLiterals, sizeof(unsigned int));
+		if (nLiterals > 0)
+		{
+			memcpy(pOut + 2 * sizeof(unsigned int), &pData[nLiteralBegin],
+				nLiterals * sizeof(float));
+		}
+	}
+
+}	// PlanContainer::EncodeSparseFloats
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanContainer::DecodeSparseFloats(const char *pEncoded, size_t nBytes,
+			float *pData, size_t nCount)
+	// inverse of EncodeSparseFloats; false if the runs don't fill nCount exactly
+{
+	size_t nAt = 0;
+	size_t nAtByte = 0;
+	while (nAtByte + 2 * sizeof(unsigned int) <= nBytes)
+	{
+		unsigned int nZeros;
+		unsigned int nLiterals;
+		memcpy(&nZeros, pEncoded + nAtByte, sizeof(unsigned int));
+		memcpy(&nLiterals, pEncoded + nAtByte + sizeof(unsigned int), sizeof(unsigned int));
+		nAtByte += 2 * sizeof(unsigned int);
+
+		if (nAt + nZeros + nLiterals > nCount
+			|| nAtByte + nLiterals * sizeof(float) > nBytes)
+		{
+			return false;
+		}
+
+		memset(pData + nAt, 0, nZeros * sizeof(float));
+		nAt += nZeros;
+		memcpy(pData + nAt, pEncoded + nAtByte, nLiterals * sizeof(float));
+		nAt += nLiterals;
+		nAtByte += nLiterals * sizeof(float);
+	}
+
+	return nAt == nCount && nAtByte == nBytes;
+
+}	// PlanContainer::DecodeSparseFloats
+
+///////////////////////////////////////////////////////////////////////////////
+PlanContainerWriter::PlanContainerWriter()
+	: m_pFile(NULL)
+	, m_nOffset(0)
+	, m_bOK(false)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+PlanContainerWriter::~PlanContainerWriter()
+{
+	if (m_pFile != NULL)
+		Close();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanContainerWriter::Open(const char *pszFileName)
+	// creates the file, and reserves the header (written by Close); opened for
+	//	reading too, so that IsStored can compare chunks
+{
+	m_mapIndex.clear();
+	m_mapStored.clear();
+
+	if (fopen_s(&m_pFile, pszFileName, "w+b") != 0 || m_pFile == NULL)
+	{
+		m_pFile = NULL;
+		return false;
+	}
+
+	char header[PLAN_CONTAINER_HEADER_BYTES] = { 0 };
+	m_bOK = fwrite(header, 1, sizeof(header), m_pFile) == sizeof(header);
+	m_nOffset = sizeof(header);
+
+	return m_bOK;
+
+}	// PlanContainerWriter::Open
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanContainerWriter::WriteChunk(const std::string& strKey,
+			const void *pData, size_t nBytes)
+	// stores the bytes as-is
+{
+	std::vector<char> arrStored((const char *) pData, (const char *) pData + nBytes);
+	return AddChunk(strKey, PlanContainer::Hash(pData, nBytes), arrStored,
+		nBytes, 0, PlanContainer::CODEC_RAW);
+
+}	// PlanContainerWriter::WriteChunk
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanContainerWriter::WriteFloatChunk(const std::string& strKey,
+			const void *pHeader, size_t nHeaderBytes,
+			const float *pData, size_t nCount)
+	// stores the header raw, and the floats zero-run encoded if that saves space
+{
+	// the content address is of the decoded bytes, so it doesn't depend on codec
+	const size_t nDataBytes = nCount * sizeof(float);
+	unsigned long long nHash = PlanContainer::Hash(pHeader, nHeaderBytes);
+	nHash = PlanContainer::Hash(pData, nDataBytes, nHash);
+
+	std::vector<char> arrEncoded;
+	PlanContainer::EncodeSparseFloats(pData, nCount, arrEncoded);
+
+	std::vector<char> arrStored((const char *) pHeader, (const char *) pHeader + nHeaderBytes);
+	unsigned int nCodec;
+	if (arrEncoded.size() < nDataBytes)
+	{
+		arrStored.insert(arrStored.end(), arrEncoded.begin(), arrEncoded.end());
+		nCodec = PlanContainer::CODEC_SPARSE_FLOAT;
+	}
+	else
+	{
+		arrStored.insert(arrStored.end(), (const char *) pData, (const char *) pData + nDataBytes);
+		nCodec = PlanContainer::CODEC_RAW;
+	}
+
+	return AddChunk(strKey, nHash, arrStored, nHeaderBytes + nDataBytes,
+		(unsigned int) nHeaderBytes, nCodec);
+
+}	// PlanContainerWriter::WriteFloatChunk
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanContainerWriter::AddChunk(const std::string& strKey, unsigned long long nHash,
+			const std::vector<char>& arrStored, unsigned long long nRawBytes,
+			unsigned int nHeaderBytes, unsigned int nCodec)
+	// writes the chunk at the next aligned offset, unless identical content is
+	//	already stored
+{
+	if (m_pFile == NULL)
+		return false;
+
+	typedef std::multimap<unsigned long long, PlanContainer::Entry>::iterator StoredIter;
+	std::pair<StoredIter, StoredIter> range = m_mapStored.equal_range(nHash);
+	for (StoredIter iter = range.first; iter != range.second; ++iter)
+	{
+		if (iter->second.m_nRawBytes == nRawBytes
+			&& iter->second.m_nHeaderBytes == nHeaderBytes
+			&& IsStored(iter->second, arrStored, nCodec))
+		{
+			m_mapIndex[strKey] = iter->second;
+			return true;
+		}
+	}
+	if (!m_bOK)
+		return false;
+
+	// pad to the alignment
+	static const char padding[PlanContainer::CHUNK_ALIGN] = { 0 };
+	const size_t nPad = (size_t) ((PlanContainer::CHUNK_ALIGN
+		- m_nOffset % PlanContainer::CHUNK_ALIGN) % PlanContainer::CHUNK_ALIGN);
+	if (nPad > 0 && fwrite(padding, 1, nPad, m_pFile) != nPad)
+	{
+		m_bOK = false;
+		return false;
+	}
+	m_nOffset += nPad;
+
+	if (!arrStored.empty()
+		&& fwrite(&arrStored[0], 1, arrStored.size(), m_pFile) != arrStored.size())
+	{
+		m_bOK = false;
+		return false;
+	}
+
+	PlanContainer::Entry entry;
+	entry.m_nHash = nHash;
+	entry.m_nOffset = m_nOffset;
+	entry.m_nStoredBytes = arrStored.size();
+	entry.m_nRawBytes = nRawBytes;
+	entry.m_nHeaderBytes = nHeaderBytes;
+	entry.m_nCodec = nCodec;
+	m_nOffset += arrStored.size();
+
+	m_mapStored.insert(std::make_pair(nHash, entry));
+	m_mapIndex[strKey] = entry;
+
+	return true;
+
+}	// PlanContainerWriter::AddChunk
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanContainerWriter::IsStored(const PlanContainer::Entry& entry,
+			const std::vector<char>& arrStored, unsigned int nCodec)
+	// reads the stored chunk back and compares its bytes; the codec choice is
+	//	deterministic, so identical content encodes identically
+{
+	if (entry.m_nCodec != nCodec
+		|| entry.m_nStoredBytes != arrStored.size())
+	{
+		return false;
+	}
+	if (arrStored.empty())
+		return true;
+
+	std::vector<char> arrOnDisk(arrStored.size());
+	const bool bSame = SeekTo(m_pFile, entry.m_nOffset) == 0
+		&& fread(&arrOnDisk[0], 1, arrOnDisk.size(), m_pFile) == arrOnDisk.size()
+		&& memcmp(&arrOnDisk[0], &arrStored[0], arrStored.size()) == 0;
+
+	// back to the end, for the next chunk
+	if (SeekTo(m_pFile, m_nOffset) != 0)
+		m_bOK = false;
+
+	return bSame;
+
+}	// PlanContainerWriter::IsStored
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanContainerWriter::Close()
+	// appends the index, then fills in the header
+{
+	if (m_pFile == NULL)
+		return false;
+
+	bool bOK = m_bOK;
+	const unsigned long long nIndexOffset = m_nOffset;
+
+	unsigned int nEntries = (unsigned int) m_mapIndex.size();
+	bOK = bOK && fwrite(&nEntries, sizeof(nEntries), 1, m_pFile) == 1;
+	unsigned long long nIndexBytes = sizeof(nEntries);
+
+	std::map<std::string, PlanContainer::Entry>::const_iterator iter;
+	for (iter = m_mapIndex.begin(); iter != m_mapIndex.end(); iter++)
+	{
+		const unsigned int nKeyLength = (unsigned int) iter->first.size();
+		const PlanContainer::Entry& entry = iter->second;
+		bOK = bOK && fwrite(&nKeyLength, sizeof(nKeyLength), 1, m_pFile) == 1;
+		bOK = bOK && fwrite(iter->first.c_str(), 1, nKeyLength, m_pFile) == nKeyLength;
+		bOK = bOK && fwrite(&entry.m_nHash, sizeof(entry.m_nHash), 1, m_pFile) == 1;
+		bOK = bOK && fwrite(&entry.m_nOffset, sizeof(entry.m_nOffset), 1, m_pFile) == 1;
+		bOK = bOK && fwrite(&entry.m_nStoredBytes, sizeof(entry.m_nStoredBytes), 1, m_pFile) == 1;
+		bOK = bOK && fwrite(&entry.m_nRawBytes, sizeof(entry.m_nRawBytes), 1, m_pFile) == 1;
+		bOK = bOK && fwrite(&entry.m_nHeaderBytes, sizeof(entry.m_nHeaderBytes), 1, m_pFile) == 1;
+		bOK = bOK && fwrite(&entry.m_nCodec, sizeof(entry.m_nCodec), 1, m_pFile) == 1;
+		nIndexBytes += sizeof(nKeyLength) + nKeyLength + 4 * sizeof(unsigned long long)
+			+ 2 * sizeof(unsigned int);
+	}
+
+	// now the header
+	char header[PLAN_CONTAINER_HEADER_BYTES] = { 0 };
+	memcpy(header, PLAN_CONTAINER_MAGIC, sizeof(PLAN_CONTAINER_MAGIC));
+	memcpy(header + 8, &PLAN_CONTAINER_VERSION, sizeof(PLAN_CONTAINER_VERSION));
+	memcpy(header + 16, &nIndexOffset, sizeof(nIndexOffset));
+	memcpy(header + 24, &nIndexBytes, sizeof(nIndexBytes));
+	bOK = bOK && SeekTo(m_pFile, 0) == 0;
+	bOK = bOK && fwrite(header, 1, sizeof(header), m_pFile) == sizeof(header);
+
+	bOK = (fclose(m_pFile) == 0) && bOK;
+	m_pFile = NULL;
+
+	return bOK;
+
+}	// PlanContainerWriter::Close
+
+///////////////////////////////////////////////////////////////////////////////
+PlanContainerReader::PlanContainerReader()
+	: m_pFile(NULL)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+PlanContainerReader::~PlanContainerReader()
+{
+	if (m_pFile != NULL)
+		fclose(m_pFile);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanContainerReader::Open(const char *pszFileName)
+	// checks the header and reads the index; the chunks stay on disk.  Sizes 
+	//	read from the file are checked against the file size before anything is
+	//	allocated from them, so a corrupt container fails rather than throws
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_pFile != NULL)
+		fclose(m_pFile);
+	m_mapIndex.clear();
+
+	if (fopen_s(&m_pFile, pszFileName, "rb") != 0 || m_pFile == NULL)
+	{
+		m_pFile = NULL;
+		return false;
+	}
+
+	// closes the file on any failure, so that the reader is left empty
+	auto fail = [this]() -> bool
+	{
+		fclose(m_pFile);
+		m_pFile = NULL;
+		m_mapIndex.clear();
+		return false;
+	};
+
+	const unsigned long long nFileBytes = FileSize(m_pFile);
+
+	char header[PLAN_CONTAINER_HEADER_BYTES];
+	if (SeekTo(m_pFile, 0) != 0
+		|| fread(header, 1, sizeof(header), m_pFile) != sizeof(header)
+		|| memcmp(header, PLAN_CONTAINER_MAGIC, sizeof(PLAN_CONTAINER_MAGIC)) != 0)
+	{
+		return fail();
+	}
+
+	unsigned int nVersion;
+	unsigned long long nIndexOffset;
+	memcpy(&nVersion, header + 8, sizeof(nVersion));
+	memcpy(&nIndexOffset, header + 16, sizeof(nIndexOffset));
+	if (nVersion > PLAN_CONTAINER_VERSION
+		|| nIndexOffset > nFileBytes
+		|| SeekTo(m_pFile, nIndexOffset) != 0)
+	{
+		return fail();
+	}
+
+	unsigned int nEntries;
+	if (fread(&nEntries, sizeof(nEntries), 1, m_pFile) != 1)
+		return fail();
+
+	for (unsigned int nAt = 0; nAt < nEntries; nAt++)
+	{
+		unsigned int nKeyLength;
+		if (fread(&nKeyLength, sizeof(nKeyLength), 1, m_pFile) != 1
+			|| nKeyLength > nFileBytes - nIndexOffset)
+		{
+			return fail();
+		}
+
+		std::string strKey(nKeyLength, '\0');
+		PlanContainer::Entry entry;
+		bool bOK = nKeyLength == 0 || fread(&strKey[0], 1, nKeyLength, m_pFile) == nKeyLength;
+		bOK = bOK && fread(&entry.m_nHash, sizeof(entry.m_nHash), 1, m_pFile) == 1;
+		bOK = bOK && fread(&entry.m_nOffset, sizeof(entry.m_nOffset), 1, m_pFile) == 1;
+		bOK = bOK && fread(&entry.m_nStoredBytes, sizeof(entry.m_nStoredBytes), 1, m_pFile) == 1;
+		bOK = bOK && fread(&entry.m_nRawBytes, sizeof(entry.m_nRawBytes), 1, m_pFile) == 1;
+		bOK = bOK && fread(&entry.m_nHeaderBytes, sizeof(entry.m_nHeaderBytes), 1, m_pFile) == 1;
+		bOK = bOK && fread(&entry.m_nCodec, sizeof(entry.m_nCodec), 1, m_pFile) == 1;
+
+		// the chunk must lie within the file
+		bOK = bOK && entry.m_nStoredBytes <= nFileBytes
+			&& entry.m_nOffset <= nFileBytes - entry.m_nStoredBytes;
+		if (!bOK)
+			return fail();
+
+		m_mapIndex[strKey] = entry;
+	}
+
+	return true;
+
+}	// PlanContainerReader::Open
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanContainerReader::HasChunk(const std::string& strKey) const
+{
+	return m_mapIndex.find(strKey) != m_mapIndex.end();
+
+}	// PlanContainerReader::HasChunk
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanContainerReader::ReadChunk(const std::string& strKey, std::vector<char>& arrData)
+	// reads the stored bytes, decodes them, and checks the content hash
+{
+	std::map<std::string, PlanContainer::Entry>::const_iterator iter = m_mapIndex.find(strKey);
+	if (iter == m_mapIndex.end())
+		return false;
+	const PlanContainer::Entry& entry = iter->second;
+
+	std::vector<char> arrStored((size_t) entry.m_nStoredBytes);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_pFile == NULL
+			|| SeekTo(m_pFile, entry.m_nOffset) != 0
+			|| (!arrStored.empty()
+				&& fread(&arrStored[0], 1, arrStored.size(), m_pFile) != arrStored.size()))
+		{
+			return false;
+		}
+	}
+
+	if (entry.m_nCodec == PlanContainer::CODEC_RAW)
+	{
+		arrData.swap(arrStored);
+	}
+	else if (entry.m_nCodec == PlanContainer::CODEC_SPARSE_FLOAT)
+	{
+		const size_t nHeaderBytes = entry.m_nHeaderBytes;
+		if (nHeaderBytes > arrStored.size()
+			|| (entry.m_nRawBytes - nHeaderBytes) % sizeof(float) != 0)
+		{
+			return false;
+		}
+
+		arrData.resize((size_t) entry.m_nRawBytes);
+		std::copy(arrStored.begin(), arrStored.begin() + nHeaderBytes, arrData.begin());
+		const size_t nCount = (size_t) (entry.m_nRawBytes - nHeaderBytes) / sizeof(float);
+		if (!PlanContainer::DecodeSparseFloats(
+				arrStored.empty() ? NULL : &arrStored[0] + nHeaderBytes,
+				arrStored.size() - nHeaderBytes,
+				nCount > 0 ? (float *) &arrData[nHeaderBytes] : NULL, nCount))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		return false;
+	}
+
+	return arrData.size() == entry.m_nRawBytes
+		&& PlanContainer::Hash(arrData.empty() ? NULL : &arrData[0], arrData.size())
+			== entry.m_nHash;
+
+}	// PlanContainerReader::ReadChunk
+
+}	// namespace dH
@@ -4,6 +4,8 @@
 #include "PlanOptimizer.h"
 
 #include <ConjGradOptimizer.h>
+#include <Profiler.h>
+#include <SigmoidParams.h>
 
 
 namespace dH
@@ -32,31 +34,106 @@ REAL
 const CString GBINSIGMA_KEY		= _T("GBinSigma");
 const REAL DEFAULT_GBINSIGMA	= 0.2;
 
+// per-level sigma: a geometric sequence from level 0, as 
+//	SigmaEstimator::GeneratePyramidSequence forms (the table this replaces,
+//	{8.0, 3.2, 1.3, 0.5, 0.25}, was this sequence rounded), so any number 
+//	of levels has a default
 const CString LEVELSIGMA_KEY	= _T("LevelSigma%i");
-const REAL DEFAULT_LEVELSIGMA[] = {8.0, 3.2, 1.3, 0.5, 0.25}; // { 8.0, 4.0, 2.0, 1.0, 0.5 };
+const REAL DEFAULT_LEVELSIGMA_FINEST = 8.0;
+const REAL DEFAULT_LEVELSIGMA_RATIO = 0.4;
 
 const CString CGTOL_KEY			= _T("CGTolerance%i");
 const CString LINETOL_KEY		= _T("Tolerance%i");
 
-// Per-level convergence tolerances, indexed by nLevel. IMPORTANT: level 0 is
-//	the FINEST resolution (0.5mm) and level MAX_SCALES-1 is the COARSEST (8mm)
-//	-- see PlanPyramid, where m_arrPlans[0] is the base plan and each higher
-//	index doubles the dose resolution. So index 0 must hold the tightest
-//	tolerance: the finest level is optimized last and determines final plan
-//	quality, so it must be the most thoroughly converged, while the coarse
-//	levels only warm-start and can stop early. (A previous version had these
-//	reversed -- {1e-3,...,1e-6} -- which gave the finest level the LOOSEST
-//	tolerance and made it converge prematurely, the opposite of the intent.)
-const REAL DEFAULT_CG_TOLERANCE[]	= {1e-6, 1e-5, 1e-4, 1e-3, 1e-3};
-const REAL DEFAULT_LINE_TOLERANCE[] = {1e-6, 1e-5, 1e-4, 1e-3, 1e-3};
+// Per-level convergence tolerances: 10x looser per level, up to a limit.
+//	IMPORTANT: level 0 is the FINEST resolution (0.5mm) and the last level 
+//	used is the COARSEST (8mm at the default depth) -- see PlanPyramid, where
+//	m_arrPlans[0] is the base plan and each higher index doubles the dose 
+//	resolution. So level 0 must have the tightest tolerance: the finest level
+//	is optimized last and determines final plan quality, so it must be the 
+//	most thoroughly converged, while the coarse levels only warm-start and 
+//	can stop early. (A previous version had these reversed -- {1e-3,...,1e-6}
+//	-- which gave the finest level the LOOSEST tolerance and made it converge
+//	prematurely, the opposite of the intent.)
+const REAL DEFAULT_TOLERANCE_FINEST = 1e-6;
+const REAL DEFAULT_TOLERANCE_COARSEST = 1e-3;
+
+///////////////////////////////////////////////////////////////////////////////
+static REAL
+	GetDefaultLevelSigma(int nLevel)
+{
+	return DEFAULT_LEVELSIGMA_FINEST * pow(DEFAULT_LEVELSIGMA_RATIO, nLevel);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static REAL
+	GetDefaultTolerance(int nLevel)
+	// {1e-6, 1e-5, 1e-4, 1e-3, 1e-3, ...}
+{
+	return __min(DEFAULT_TOLERANCE_FINEST * pow(10.0, nLevel), 
+		DEFAULT_TOLERANCE_COARSEST);
+}
+
+// multigrid defaults
+const int DEFAULT_SMOOTHING_ITERATIONS = 3;
+const int DEFAULT_MAX_CYCLES = 20;
+
+// iterations between checkpoint snapshots
+const int DEFAULT_CHECKPOINT_INTERVAL = 10;
+
+///////////////////////////////////////////////////////////////////////////////
+static int
+	GetEnvInt(const char *pszName, int nDefault)
+	// an integer setting from the environment, or the default
+{
+	const char *pEnv = getenv(pszName);
+	return (pEnv != NULL) ? atoi(pEnv) : nDefault;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static int
+	GetDefaultMultigrid()
+	// BRIMSTONE_MULTIGRID = V or W; unset (or anything else) is one-way
+{
+	const char *pEnv = getenv("BRIMSTONE_MULTIGRID");
+	if (pEnv != NULL && toupper(pEnv[0]) == 'V')
+		return PlanOptimizer::MULTIGRID_V;
+	if (pEnv != NULL && toupper(pEnv[0]) == 'W')
+		return PlanOptimizer::MULTIGRID_W;
+	return PlanOptimizer::MULTIGRID_NONE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static void
+	ClampWeights(CVectorN<>& vWeights)
+	// keeps restricted / interpolated weights inside the range of the 
+	//		sigmoid transform, so they can be inverse transformed
+{
+	const REAL weightMin = GetSigmoidScale() * 1e-6;
+	const REAL weightMax = GetSigmoidScale() * (1.0 - 1e-6);
+	for (int nAt = 0; nAt < vWeights.GetDim(); nAt++)
+		vWeights[nAt] = __min(__max(vWeights[nAt], weightMin), weightMax);
+}
 
 
 
 ///////////////////////////////////////////////////////////////////////////////
 PlanOptimizer::PlanOptimizer(CPlan *pPlan)
 	: m_pPlan(pPlan)
+	, m_Multigrid(GetDefaultMultigrid())
+	, m_SmoothingIterations(GetEnvInt("BRIMSTONE_MG_SMOOTH", DEFAULT_SMOOTHING_ITERATIONS))
+	, m_MaxCycles(GetEnvInt("BRIMSTONE_MG_CYCLES", DEFAULT_MAX_CYCLES))
+	, m_ReleaseLevels(GetEnvInt("BRIMSTONE_RELEASE_LEVELS", 1) != 0)
 {
 	SetupPrescription();
+
+	// BRIMSTONE_CHECKPOINT names the snapshot file
+	const char *pszCheckpoint = getenv("BRIMSTONE_CHECKPOINT");
+	if (pszCheckpoint != NULL)
+	{
+		SetCheckpoint(pszCheckpoint, 
+			GetEnvInt("BRIMSTONE_CHECKPOINT_INTERVAL", DEFAULT_CHECKPOINT_INTERVAL));
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -68,16 +145,41 @@ PlanOptimizer::~PlanOptimizer(void)
 		delete m_arrPrescriptions[nAt].second;
 	}
 
+	for (int nAt = 0; nAt < (int) m_arrPendingTerms.size(); nAt++)
+	{
+		delete m_arrPendingTerms[nAt];
+	}
+
 	delete m_pPyramid;
 
 	/// TODO: delete the plan???
 }
 
+///////////////////////////////////////////////////////////////////////////////
+int
+	PlanOptimizer::GetLevelCount()
+	// number of levels in the pyramid
+{
+	return GetPyramid()->GetLevelCount();
+
+}	// PlanOptimizer::GetLevelCount
+
 ///////////////////////////////////////////////////////////////////////////////
 Prescription *
 	PlanOptimizer::GetPrescription(int nLevel)
 	// returns the given level of the pyramid
 {
+	if (!IsLevelBuilt(nLevel))
+	{
+		BuildLevel(nLevel);
+	}
+
+	// the finest level is only complete once it has all the terms
+	if (nLevel == 0 && !m_arrPendingTerms.empty())
+	{
+		BindPendingTerms();
+	}
+
 	return m_arrPrescriptions[nLevel].first;
 
 }	// PlanOptimizer::GetPrescription
@@ -87,10 +189,50 @@ DynamicCovarianceOptimizer *
 	PlanOptimizer::GetOptimizer(int nLevel)
 	// returns the given level of the pyramid
 {
+	if (!IsLevelBuilt(nLevel))
+	{
+		BuildLevel(nLevel);
+	}
+
+	if (nLevel == 0 && !m_arrPendingTerms.empty())
+	{
+		BindPendingTerms();
+	}
+
 	return m_arrPrescriptions[nLevel].second;
 
 }	// PlanOptimizer::GetOptimizer
 
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanOptimizer::IsLevelBuilt(int nLevel) const
+	// true if the level's prescription and optimizer exist
+{
+	return nLevel >= 0 && nLevel < (int) m_arrPrescriptions.size()
+		&& m_arrPrescriptions[nLevel].first != NULL;
+
+}	// PlanOptimizer::IsLevelBuilt
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	PlanOptimizer::ReleaseLevel(int nLevel)
+	// frees a coarse level; the finest level is the plan's, so it is kept
+{
+	ASSERT(nLevel > 0);
+	if (!IsLevelBuilt(nLevel))
+	{
+		return;
+	}
+
+	delete m_arrPrescriptions[nLevel].first;
+	delete m_arrPrescriptions[nLevel].second;
+	m_arrPrescriptions[nLevel].first = NULL;
+	m_arrPrescriptions[nLevel].second = NULL;
+
+	GetPyramid()->ReleaseLevel(nLevel);
+
+}	// PlanOptimizer::ReleaseLevel
+
 ///////////////////////////////////////////////////////////////////////////////
 void 
 	PlanOptimizer::AddStructureTerm(VOITerm *pST)
@@ -98,14 +240,213 @@ void
 	// these need to be generated first, before the call to AddStructureTerm
 	// GetPyramid()->CalcPencilSubBeamlets();
 
-	for (int nLevel = 0; nLevel < PlanPyramid::MAX_SCALES; nLevel++)
+	// if the new term's histograms would exceed the memory budget, they
+	//	don't keep a dVolume x region product per beamlet
+	bool bLean = false;
+	if (GetMemoryBudget() > 0)
 	{
-		GetPrescription(nLevel)->AddStructureTerm(pST);
-		pST = pST->Clone();
+		const size_t nHeld = GetMemoryReport().GetTotal();
+		if (IsOverMemoryBudget(nHeld + EstimateStructureTermBytes(false)))
+		{
+			bLean = true;
+			EnforceMemoryBudget(EstimateStructureTermBytes(true));
+		}
+	}
+
+	if (bLean)
+	{
+		pST->GetHistogram()->SetLean(true);
+	}
+
+	// the finest level's terms conform to its beamlets, so while they are
+	//	being calculated in the background the term waits for them
+	if (GetPyramid()->IsLevelPending(0))
+	{
+		m_arrPendingTerms.push_back(pST);
+	}
+	else
+	{
+		GetPrescription(0)->AddStructureTerm(pST);
+	}
+
+	// coarse levels not yet built clone the term when they are
+	for (int nLevel = 1; nLevel < GetLevelCount(); nLevel++)
+	{
+		if (IsLevelBuilt(nLevel))
+		{
+			VOITerm *pClone = pST->Clone();
+			if (bLean)
+			{
+				pClone->GetHistogram()->SetLean(true);
+			}
+			GetPrescription(nLevel)->AddStructureTerm(pClone);
+		}
 	}
 
 }	// PlanOptimizer::AddStructureTerm
 
+///////////////////////////////////////////////////////////////////////////////
+void 
+	PlanOptimizer::RemoveStructureTerm(Structure *pStruct)
+	// removes the structure's term from the levels that have been built
+{
+	for (int nAt = (int) m_arrPendingTerms.size()-1; nAt >= 0; nAt--)
+	{
+		if (m_arrPendingTerms[nAt]->GetVOI() == pStruct)
+		{
+			delete m_arrPendingTerms[nAt];
+			m_arrPendingTerms.erase(m_arrPendingTerms.begin() + nAt);
+		}
+	}
+
+	for (int nLevel = 0; nLevel < (int) m_arrPrescriptions.size(); nLevel++)
+	{
+		if (IsLevelBuilt(nLevel))
+		{
+			m_arrPrescriptions[nLevel].first->RemoveStructureTerm(pStruct);
+		}
+	}
+
+}	// PlanOptimizer::RemoveStructureTerm
+
+///////////////////////////////////////////////////////////////////////////////
+size_t
+	PlanOptimizer::EstimateStructureTermBytes(bool bLean)
+	// estimates the bytes a new structure term's histograms add
+{
+	size_t nBytes = 0;
+	for (int nLevel = 0; nLevel < GetLevelCount(); nLevel++)
+	{
+		// an unbuilt level gets its term when it is built
+		if (!IsLevelBuilt(nLevel))
+		{
+			continue;
+		}
+
+		CPlan *pPlan = GetPyramid()->GetPlan(nLevel);
+		if (pPlan->GetBeamCount() == 0)
+		{
+			continue;
+		}
+
+		// the histogram's volumes all conform to the beamlets
+		CBeam *pBeam = pPlan->GetBeamAt(pPlan->GetBeamCount()-1);
+		const SparseBeamlet *pSparse = pBeam->GetSparseBeamlet(0);
+		const VolumeReal *pBeamlet = pSparse ? pSparse->m_pGrid.GetPointer() : pBeam->GetBeamlet(0);
+		if (pBeamlet == NULL)
+		{
+			continue;
+		}
+
+		// one histogram group per beam, and one dVolume per beamlet; sparse
+		//	dVolumes have no products
+		nBytes += CHistogramWithGradient::EstimateHelperBytes(
+			pBeamlet->GetBufferedRegion().GetNumberOfPixels(),
+			pPlan->GetBeamCount(), 
+			pSparse ? 0 : pPlan->GetTotalBeamletCount(), 
+			bLean && !pSparse);
+	}
+
+	return nBytes;
+
+}	// PlanOptimizer::EstimateStructureTermBytes
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	PlanOptimizer::AccountMemory(MemoryReport& report)
+	// adds the memory held at every level to a report
+{
+	// the beams first, so the beamlets are attributed to them rather than to
+	//	the histograms that use them
+	for (int nLevel = 0; nLevel < GetLevelCount(); nLevel++)
+	{
+		GetPyramid()->GetPlan(nLevel)->AccountMemory(report, nLevel);
+	}
+
+	for (int nLevel = 0; nLevel < (int) m_arrPrescriptions.size(); nLevel++)
+	{
+		if (!IsLevelBuilt(nLevel))
+		{
+			continue;
+		}
+
+		// (without binding pending terms, which would wait for them)
+		m_arrPrescriptions[nLevel].first->AccountMemory(report, nLevel);
+		m_arrPrescriptions[nLevel].second->AccountMemory(report, MemoryOwner(nLevel));
+	}
+
+}	// PlanOptimizer::AccountMemory
+
+///////////////////////////////////////////////////////////////////////////////
+MemoryReport
+	PlanOptimizer::GetMemoryReport()
+	// forms a report of the memory held at every level
+{
+	MemoryReport report;
+	AccountMemory(report);
+	return report;
+
+}	// PlanOptimizer::GetMemoryReport
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanOptimizer::EnforceMemoryBudget(size_t nReserve)
+	// sheds memory until the budget is met
+{
+	// no budget, so nothing to walk
+	if (GetMemoryBudget() == 0)
+	{
+		return true;
+	}
+
+	if (!IsOverMemoryBudget(GetMemoryReport().GetTotal() + nReserve))
+	{
+		return true;
+	}
+
+	// first free the coarse levels' helper volumes, which are recomputed if
+	//	the level is evaluated again
+	for (int nLevel = (int) m_arrPrescriptions.size()-1; nLevel >= 1; nLevel--)
+	{
+		if (IsLevelBuilt(nLevel))
+		{
+			GetPrescription(nLevel)->ReleaseCaches();
+		}
+	}
+	if (!IsOverMemoryBudget(GetMemoryReport().GetTotal() + nReserve))
+	{
+		return true;
+	}
+
+	// then stop keeping the per-beamlet products, coarsest level first; this
+	//	trades memory for a product per beamlet per evaluation
+	for (int nLevel = (int) m_arrPrescriptions.size()-1; nLevel >= 0; nLevel--)
+	{
+		if (!IsLevelBuilt(nLevel))
+		{
+			continue;
+		}
+		GetPrescription(nLevel)->SetLean(true);
+		if (!IsOverMemoryBudget(GetMemoryReport().GetTotal() + nReserve))
+		{
+			LogMessageF(LOG_LEVEL_INFO, "memory budget: lean histograms for levels %d and above\n", 
+				nLevel);
+			return true;
+		}
+	}
+
+	// nothing else to shed -- what remains is beamlets, dose and regions
+	MemoryReport report = GetMemoryReport();
+	LogMessageF(LOG_LEVEL_INFO, "memory budget of %.1f MB exceeded (%.1f MB held, %.1f MB needed)\n",
+		(double) GetMemoryBudget() / (1024.0 * 1024.0),
+		(double) report.GetTotal() / (1024.0 * 1024.0),
+		(double) nReserve / (1024.0 * 1024.0));
+	LogMessage(LOG_LEVEL_INFO, report.Format().c_str());
+
+	return false;
+
+}	// PlanOptimizer::EnforceMemoryBudget
+
 ///////////////////////////////////////////////////////////////////////////////
 static void
 	RunGradCheck(dH::Prescription *pPresc, const CVectorN<>& x0)
@@ -136,27 +477,45 @@ static void
 	const REAL kl0 = pPresc->GetLastKL();
 	const REAL H0 = pPresc->GetLastEntropy();
 
-	// central-difference numerical gradient. xp/xm are copy-constructed from x0
-	//	so they carry x0's dimension and values; perturb one component, evaluate,
-	//	then restore it (a fresh CVectorN + operator= would NOT resize, leaving a
-	//	dim-0 vector and an out-of-bounds write).
+	// central-difference numerical gradient, evaluated as batches of the 
+	//	2 * nBlock points x0 +/- eps e_i for a block of components: each batch
+	//	forms its doses in one pass over the beamlets and bins them in one 
+	//	sweep of each VOI. EvaluateBatch holds five dose-grid volumes per 
+	//	point, so the block is kept small. The points are copy-constructed 
+	//	from x0 so they carry x0's dimension and values (a fresh CVectorN + 
+	//	operator= would NOT resize, leaving a dim-0 vector and an 
+	//	out-of-bounds write).
 	const REAL eps = (REAL) 1e-5;
+	const int nBlock = 4;
 	double diff2 = 0.0, ana2 = 0.0, num2 = 0.0, maxabs = 0.0;
-	CVectorN<> xp(x0v), xm(x0v);
-	for (int i = 0; i < n; i++)
-	{
-		xp[i] = x0v[i] + eps;
-		xm[i] = x0v[i] - eps;
-		const REAL fp = (*pPresc)(xp, NULL);
-		const REAL fm = (*pPresc)(xm, NULL);
-		xp[i] = x0v[i];		// restore for the next iteration
-		xm[i] = x0v[i];
-		const REAL gi = (fp - fm) / (2 * eps);
-		const double d = (double) gAna[i] - (double) gi;
-		diff2 += d * d;
-		ana2 += (double) gAna[i] * (double) gAna[i];
-		num2 += (double) gi * (double) gi;
-		if (fabs(d) > maxabs) maxabs = fabs(d);
+	std::vector< CVectorN<> > arrPoints;
+	CVectorN<> vValues;
+	for (int nBegin = 0; nBegin < n; nBegin += nBlock)
+	{
+		const int nEnd = __min(nBegin + nBlock, n);
+
+		// points 2k and 2k+1 are x0 +/- eps along component nBegin + k 
+		//	(cleared first so every point is copy-constructed, not assigned)
+		arrPoints.clear();
+		arrPoints.resize(2 * (nEnd - nBegin), x0v);
+		for (int i = nBegin; i < nEnd; i++)
+		{
+			arrPoints[2 * (i - nBegin)][i] = x0v[i] + eps;
+			arrPoints[2 * (i - nBegin) + 1][i] = x0v[i] - eps;
+		}
+		pPresc->EvaluateBatch(arrPoints, vValues);
+
+		for (int i = nBegin; i < nEnd; i++)
+		{
+			const REAL fp = vValues[2 * (i - nBegin)];
+			const REAL fm = vValues[2 * (i - nBegin) + 1];
+			const REAL gi = (fp - fm) / (2 * eps);
+			const double d = (double) gAna[i] - (double) gi;
+			diff2 += d * d;
+			ana2 += (double) gAna[i] * (double) gAna[i];
+			num2 += (double) gi * (double) gi;
+			if (fabs(d) > maxabs) maxabs = fabs(d);
+		}
 	}
 	const double normwise = sqrt(diff2) / (sqrt(ana2) + sqrt(num2) + 1e-30);
 
@@ -177,21 +536,65 @@ bool
 	PlanOptimizer::Optimize(CVectorN<>& vInit, OptimizerCallback *pFunc, void *pParam)
 	// performs multi-level optimization
 {
-	// make sure pencil subbeamlets are properly generated
-	GetPyramid()->CalcPencilSubBeamlets();
-
-	// make sure prescription terms are synched
-	for (int nLevel = 1; nLevel < m_arrPrescriptions.size(); nLevel++)
-		GetPrescription(nLevel)->UpdateTerms(GetPrescription(0));
+	// each optimization profiled from BRIMSTONE_PROFILE gets its own trace
+	if (getenv("BRIMSTONE_PROFILE") != NULL)
+		dH::Profiler::GetInstance().Reset();
+
+	// a resumed optimization starts at the checkpointed level, with the 
+	//	optimizer's state from the snapshot
+	std::unique_ptr<OptimizerState> pResume(m_pResumeState.release());
+	const int nStartLevel = (pResume != NULL) ? pResume->m_nLevel : GetLevelCount()-1;
+
+	// if over the memory budget, shed what can be recomputed; past that the
+	//	optimization still runs, as the report has been logged
+	EnforceMemoryBudget();
+
+	// count the evaluations per level, to compare schedules
+	for (int nLevel = 0; nLevel < m_arrPrescriptions.size(); nLevel++)
+		if (IsLevelBuilt(nLevel))
+			m_arrPrescriptions[nLevel].first->ResetEvaluationCount();
+
+	// directly calculated levels don't depend on each other, so the finer 
+	//	levels' beamlets are calculated on worker threads while the coarser
+	//	ones are optimized; each level waits only for its own, when the loop
+	//	below reaches it
+	if (GetPyramid()->GetDirectBeamlets())
+	{
+		for (int nLevel = nStartLevel-1; nLevel >= 0; nLevel--)
+			GetPyramid()->StartLevelBeamlets(nLevel);
+	}
 
-	// compute the starting point
-	GetInitStateVector(vInit);
+	if (pResume != NULL)
+	{
+		// the snapshot's weights (the optimizer takes its exact parameters 
+		//	from the state)
+		GetPyramid()->CalcLevelBeamlets(nStartLevel);
+		vInit.SetDim((int) pResume->m_vParam.size());
+		for (int nAt = 0; nAt < vInit.GetDim(); nAt++)
+			vInit[nAt] = pResume->m_vParam[nAt];
+		GetPrescription(nStartLevel)->Transform(&vInit);
+	}
+	else
+	{
+		// compute the starting point (this builds the coarsest level)
+		GetInitStateVector(vInit);
+	}
 
-	for (int nLevel = m_arrPrescriptions.size()-1; nLevel >= 0; nLevel--)
+	for (int nLevel = nStartLevel; nLevel >= 0; nLevel--)
 	{
+		// the level's beamlets, and then its prescription, are computed only
+		//	now that the optimization reaches it
+		GetPyramid()->CalcLevelBeamlets(nLevel);
 		dH::Prescription *pPresc = GetPrescription(nLevel);
 		DynamicCovarianceOptimizer *pOpt = GetOptimizer(nLevel);
 
+		// make sure prescription terms are synched
+		if (nLevel > 0)
+			UpdateLevelTerms(nLevel);
+
+		// tag profiled events with the level
+		dH::Profiler::GetInstance().SetLevel(nLevel);
+
 		// update the histogram regions
 		pPresc->UpdateHistogramRegions();
 
@@ -236,7 +639,42 @@ bool
 		// NOTE: this needs to be in the form of an initializer,
 		//	or else SetDim needs to be called for vRes before the call
 		// CVectorN<> vRes = pOpt->Optimize(vInit);
-		pOpt->minimize(vInit.GetVnlVector());
+		const bool bResume = (pResume != NULL && nLevel == nStartLevel);
+		if (bResume)
+		{
+			pOpt->SetResumeState(*pResume);
+		}
+
+		if (nLevel == 0 && GetSchedule() != MULTIGRID_NONE)
+		{
+			// cycle back through the coarser levels, rather than one long run;
+			//	the position within the cycles isn't snapshotted, so a stop
+			//	from here resumes from the last coarse level snapshot and 
+			//	repeats the cycles from the start (Resume only takes a 
+			//	snapshot of the same schedule, so it can't go on one-way)
+			if (m_pCheckpoint != NULL)
+			{
+				LogMessageF(LOG_LEVEL_INFO, "checkpoint %s: %s aren't snapshotted; "
+					"resuming repeats them from the last coarse level snapshot\n", 
+					m_pCheckpoint->GetFileName().c_str(),
+					GetMultigrid() == MULTIGRID_V ? "V-cycles" : "W-cycles");
+			}
+			MultigridOptimize(vInit);
+		}
+		else
+		{
+			// snapshots are of the long runs
+			if (m_pCheckpoint != NULL)
+			{
+				vector<VOITerm*> arrTerms;
+				GetBaseTerms(arrTerms);
+				m_pCheckpoint->SetLevel(nLevel, GetSchedule(), arrTerms);
+				pOpt->SetCheckpoint(m_pCheckpoint.get());
+			}
+
+			pOpt->minimize(vInit.GetVnlVector());
+			pOpt->SetCheckpoint(NULL);
+		}
 		CVectorN<> vRes = vInit;
 
 		// check for problem with optimization
@@ -248,9 +686,26 @@ bool
 		// compute final state vector
 		pPresc->Transform(&vRes);
 
+		// the coarser level is only needed again by multigrid cycles, so it 
+		//	can go now if asked, or if memory is short
+		if (nLevel+1 < GetLevelCount() && GetMultigrid() == MULTIGRID_NONE
+			&& (GetReleaseLevels() 
+				|| (GetMemoryBudget() > 0 
+					&& IsOverMemoryBudget(GetMemoryReport().GetTotal()))))
+		{
+			ReleaseLevel(nLevel+1);
+		}
+
 		// if we are not at the last level,
 		if (nLevel > 0)
 		{
+			// this level is done, so its helper volumes can go if memory is short
+			if (GetMemoryBudget() > 0 
+				&& IsOverMemoryBudget(GetMemoryReport().GetTotal()))
+			{
+				pPresc->ReleaseCaches();
+			}
+
 			// then inverse filter to the next level
 			InvFilterStateVector(nLevel, vRes, vInit);
 		}
@@ -261,17 +716,399 @@ bool
 		}
 	}
 
+	for (int nLevel = 0; nLevel < m_arrPrescriptions.size(); nLevel++)
+	{
+		if (!IsLevelBuilt(nLevel))
+			continue;
+		LogMessageF(LOG_LEVEL_INFO, "level %d: %d evaluations (%s)\n", 
+			nLevel, GetEvaluationCount(nLevel), 
+			GetMultigrid() == MULTIGRID_V ? "V-cycles" 
+				: GetMultigrid() == MULTIGRID_W ? "W-cycles" : "one-way");
+	}
+
+	// a finished optimization isn't to be resumed
+	if (m_pCheckpoint != NULL)
+	{
+		m_pCheckpoint->Flush();
+		remove(m_pCheckpoint->GetFileName().c_str());
+	}
+
+	// if profiling from BRIMSTONE_PROFILE, write the trace and log the summary
+	const char *pszProfile = getenv("BRIMSTONE_PROFILE");
+	if (pszProfile != NULL && dH::IsProfileEnabled())
+	{
+		dH::Profiler& profiler = dH::Profiler::GetInstance();
+		profiler.SetLevel(-1);
+		profiler.SetIteration(-1);
+		if (!profiler.WriteChromeTrace(pszProfile))
+			LogMessageF(dH::LOG_LEVEL_INFO, "unable to write profile %s", pszProfile);
+		dH::LogMessage(dH::LOG_LEVEL_INFO, profiler.GetSummary().c_str());
+	}
+
 	return true;
 
 }	// PlanOptimizer::Optimize
 
+///////////////////////////////////////////////////////////////////////////////
+void
+	PlanOptimizer::SetCheckpoint(const std::string& strFileName, int nInterval)
+	// sets up the snapshots, or turns them off for an empty name
+{
+	m_pCheckpoint.reset(strFileName.empty() 
+		? NULL : new OptimizerCheckpoint(strFileName, nInterval));
+
+}	// PlanOptimizer::SetCheckpoint
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanOptimizer::Resume(CVectorN<>& vResult, OptimizerCallback *pFunc, void *pParam)
+	// continues the optimization the checkpoint was written from
+{
+	if (m_pCheckpoint == NULL)
+		return false;
+
+	std::unique_ptr<OptimizerState> pState(new OptimizerState());
+	if (!OptimizerCheckpoint::ReadFile(m_pCheckpoint->GetFileName(), *pState))
+		return false;
+
+	// the snapshot has to be of this plan's pyramid
+	if (pState->m_nLevel < 0 || pState->m_nLevel >= GetLevelCount()
+		|| (int) pState->m_vParam.size() 
+			!= GetPyramid()->GetPlan(pState->m_nLevel)->GetTotalBeamletCount())
+	{
+		LogMessageF(LOG_LEVEL_INFO, "checkpoint %s doesn't match the plan\n", 
+			m_pCheckpoint->GetFileName().c_str());
+		return false;
+	}
+
+	// nor can a run go on under another schedule than it was taken under: 
+	//	a level 0 snapshot is of a one-way run, and multigrid cycles don't 
+	//	write one, so resumed under cycles it would diverge
+	if (pState->m_nSchedule != GetSchedule()
+		|| (pState->m_nLevel == 0 && GetSchedule() != MULTIGRID_NONE))
+	{
+		LogMessageF(LOG_LEVEL_INFO, "checkpoint %s (level %d, multigrid %d) "
+			"can't be resumed under multigrid %d; not resuming\n", 
+			m_pCheckpoint->GetFileName().c_str(), pState->m_nLevel,
+			pState->m_nSchedule, GetSchedule());
+		return false;
+	}
+
+	// the prescription as it was when the snapshot was taken
+	vector<VOITerm*> arrTerms;
+	GetBaseTerms(arrTerms);
+	OptimizerCheckpoint::ApplyTerms(*pState, arrTerms);
+
+	LogMessageF(LOG_LEVEL_INFO, "resuming level %d at iteration %d\n", 
+		pState->m_nLevel, pState->m_nIteration);
+
+	m_pResumeState.reset(pState.release());
+	return Optimize(vResult, pFunc, pParam);
+
+}	// PlanOptimizer::Resume
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	PlanOptimizer::GetSchedule()
+	// the Multigrid setting, or none if there is only one level
+{
+	return GetLevelCount() > 1 ? GetMultigrid() : MULTIGRID_NONE;
+
+}	// PlanOptimizer::GetSchedule
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanOptimizer::ReOptimize(CVectorN<>& vState, const CVectorN<>& vAdaptVariance,
+			int nChanged, const vector<Structure*> *pChangedStructures,
+			OptimizerCallback *pFunc, void *pParam, int nStartLevel)
+	// re-optimizes from a previous solution, after the given changes
+{
+	nStartLevel = __max(0, __min(nStartLevel, GetLevelCount()-1));
+
+	EnforceMemoryBudget();
+
+	for (int nLevel = 0; nLevel < m_arrPrescriptions.size(); nLevel++)
+		if (IsLevelBuilt(nLevel))
+			m_arrPrescriptions[nLevel].first->ResetEvaluationCount();
+
+	// every beamlet depends on the density, so they are all recalculated 
+	//	(in place, so the histograms still refer to them)
+	if (nChanged & CHANGE_DENSITY)
+		GetPyramid()->RecalcBeamlets();
+
+	// set up the levels to be optimized: beamlets, terms and the regions 
+	//	of the changed structures
+	for (int nLevel = nStartLevel; nLevel >= 0; nLevel--)
+	{
+		GetPyramid()->CalcLevelBeamlets(nLevel);
+		Prescription *pPresc = GetPrescription(nLevel);
+		if (nLevel > 0)
+		{
+			UpdateLevelTerms(nLevel);
+
+			// (left over from a multigrid cycle)
+			pPresc->SetLinearCorrection(CVectorN<>());
+		}
+
+		// (new beamlet doses need every histogram's products recalculated)
+		if ((nChanged & CHANGE_DENSITY) 
+			|| ((nChanged & CHANGE_STRUCTURE) && pChangedStructures == NULL))
+		{
+			pPresc->UpdateHistogramRegions();
+		}
+		else if (nChanged & CHANGE_STRUCTURE)
+		{
+			for (int nAt = 0; nAt < (int) pChangedStructures->size(); nAt++)
+				pPresc->UpdateHistogramRegion((*pChangedStructures)[nAt]);
+		}
+	}
+
+	// the previous weights, restricted to the starting level
+	CVectorN<> vWeights = vState;
+	for (int nLevel = 1; nLevel <= nStartLevel; nLevel++)
+	{
+		CVectorN<> vCoarseWeights;
+		FilterStateVector(nLevel, vWeights, vCoarseWeights, true);
+		vWeights = vCoarseWeights;
+	}
+	ClampWeights(vWeights);
+
+	for (int nLevel = nStartLevel; nLevel >= 0; nLevel--)
+	{
+		Prescription *pPresc = GetPrescription(nLevel);
+		DynamicCovarianceOptimizer *pOpt = GetOptimizer(nLevel);
+
+		dH::Profiler::GetInstance().SetLevel(nLevel);
+
+		pOpt->SetCallback(pFunc, pParam);
+
+		CVectorN<> vX = vWeights;
+		pPresc->InvTransform(&vX);
+
+		// the previous run's variance carries over, at the level it was 
+		//	taken at, so the first steps aren't at the maximum variance
+		const bool bKeepAdaptVariance = pOpt->GetKeepAdaptiveVariance();
+		if (nLevel == 0 && vAdaptVariance.GetDim() == vX.GetDim())
+		{
+			pOpt->RestoreAdaptiveVariance(vAdaptVariance);
+			pOpt->SetKeepAdaptiveVariance(true);
+		}
+
+		pOpt->minimize(vX.GetVnlVector());
+		pOpt->SetKeepAdaptiveVariance(bKeepAdaptVariance);
+
+		// check for problem with optimization
+		if (pOpt->get_num_iterations() == -1)
+		{
+			return false;
+		}
+
+		CVectorN<> vRes = vX;
+		pPresc->Transform(&vRes);
+
+		if (nLevel > 0)
+			InvFilterStateVector(nLevel, vRes, vWeights);
+		else
+			vState = vRes;
+	}
+
+	for (int nLevel = nStartLevel; nLevel >= 0; nLevel--)
+	{
+		LogMessageF(LOG_LEVEL_INFO, "re-optimize level %d: %d evaluations\n", 
+			nLevel, GetEvaluationCount(nLevel));
+	}
+
+	return true;
+
+}	// PlanOptimizer::ReOptimize
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	PlanOptimizer::GetEvaluationCount(int nLevel)
+	// objective evaluations at a level, during the last Optimize
+{
+	return IsLevelBuilt(nLevel) ? GetPrescription(nLevel)->GetEvaluationCount() : 0;
+
+}	// PlanOptimizer::GetEvaluationCount
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanOptimizer::MultigridOptimize(CVectorN<>& vX)
+	// multigrid cycles at the finest level.  Each coarse level was optimized
+	//		on the way down, so its adaptive variance is a converged one; that 
+	//		(and the finest level's own, once its first pass sets it up) is 
+	//		kept from pass to pass, so each level's objective stays fixed
+{
+	for (int nLevel = 0; nLevel < GetLevelCount(); nLevel++)
+		GetOptimizer(nLevel)->SetKeepAdaptiveVariance(true);
+
+	DynamicCovarianceOptimizer *pOpt = GetOptimizer(0);
+	const REAL ZEPS = 1e-10;
+
+	bool bContinue = true;
+	REAL fPrev = 0.0;
+	for (int nCycle = 0; nCycle < GetMaxCycles() && bContinue; nCycle++)
+	{
+		bContinue = MultigridCycle(0, vX);
+
+		// the cycle ends with a smoothing pass, so the optimizer holds F at vX;
+		//	stop on the same relative change as the optimizer's own test
+		const REAL f = pOpt->GetFinalValue();
+		LogMessageF(LOG_LEVEL_INFO, "multigrid cycle %d: F=%.6g\n", nCycle, (double) f);
+		if (nCycle > 0 && 2.0 * fabs(fPrev - f) 
+				<= pOpt->get_x_tolerance() * (fabs(fPrev) + fabs(f) + ZEPS))
+			break;
+		fPrev = f;
+	}
+
+	for (int nLevel = 0; nLevel < GetLevelCount(); nLevel++)
+		GetOptimizer(nLevel)->SetKeepAdaptiveVariance(false);
+
+	return bContinue;
+
+}	// PlanOptimizer::MultigridOptimize
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanOptimizer::MultigridCycle(int nLevel, CVectorN<>& vX)
+	// one cycle at nLevel (MG/OPT): smooth, solve the coarser level corrected
+	//		so that its gradient at the restricted point is the restricted 
+	//		gradient of this one, interpolate the coarse change back as a 
+	//		search step, and smooth again.  Restriction and interpolation act 
+	//		on the beamlet weights, so the parameters pass through each 
+	//		level's transform
+{
+	// the coarsest level is cheap, so solve it to its tolerance
+	if (nLevel == GetLevelCount()-1)
+		return Smooth(nLevel, vX, 0);
+
+	if (!Smooth(nLevel, vX, GetSmoothingIterations()))
+		return false;
+
+	Prescription *pPresc = GetPrescription(nLevel);
+	Prescription *pCoarse = GetPrescription(nLevel+1);
+
+	// restrict the weights, for the coarse starting point
+	CVectorN<> vWeights = vX;
+	pPresc->Transform(&vWeights);
+	CVectorN<> vCoarseWeights;
+	FilterStateVector(nLevel+1, vWeights, vCoarseWeights, true);
+	ClampWeights(vCoarseWeights);
+	CVectorN<> vCoarseX = vCoarseWeights;
+	pCoarse->InvTransform(&vCoarseX);
+
+	// the gradient here, with respect to the weights, restricted by the 
+	//	transpose of the interpolation and taken back to coarse parameters
+	CVectorN<> vGrad;
+	const REAL f0 = EvaluateLevel(nLevel, vX, &vGrad);
+	CVectorN<> vdTransform = vX;
+	pPresc->dTransform(&vdTransform);
+	for (int nAt = 0; nAt < vGrad.GetDim(); nAt++)
+		vGrad[nAt] = (vdTransform[nAt] > 1e-12) ? vGrad[nAt] / vdTransform[nAt] : 0.0;
+	CVectorN<> vCoarseGrad;
+	FilterStateVector(nLevel+1, vGrad, vCoarseGrad, false);
+	CVectorN<> vCoarsedTransform = vCoarseX;
+	pCoarse->dTransform(&vCoarsedTransform);
+	for (int nAt = 0; nAt < vCoarseGrad.GetDim(); nAt++)
+		vCoarseGrad[nAt] *= vCoarsedTransform[nAt];
+
+	// correct the coarse objective by the difference of the gradients
+	pCoarse->SetLinearCorrection(CVectorN<>());
+	CVectorN<> vCorrection;
+	EvaluateLevel(nLevel+1, vCoarseX, &vCorrection);
+	vCorrection -= vCoarseGrad;
+	pCoarse->SetLinearCorrection(vCorrection);
+
+	bool bContinue = true;
+	CVectorN<> vCoarseY = vCoarseX;
+	for (int nVisit = 0; nVisit < GetMultigrid() && bContinue; nVisit++)
+		bContinue = MultigridCycle(nLevel+1, vCoarseY);
+
+	pCoarse->SetLinearCorrection(CVectorN<>());
+	if (!bContinue)
+		return false;
+
+	// interpolate the coarse change in weights
+	CVectorN<> vCoarseStep = vCoarseY;
+	pCoarse->Transform(&vCoarseStep);
+	vCoarseStep -= vCoarseWeights;
+	CVectorN<> vStep;
+	InvFilterStateVector(nLevel+1, vCoarseStep, vStep);
+
+	// take the step if it decreases F, backtracking twice before giving up
+	REAL alpha = 1.0;
+	for (int nTry = 0; nTry < 3; nTry++, alpha *= 0.5)
+	{
+		CVectorN<> vTrial = vStep;
+		vTrial *= alpha;
+		vTrial += vWeights;
+		ClampWeights(vTrial);
+		pPresc->InvTransform(&vTrial);
+		if (EvaluateLevel(nLevel, vTrial, NULL) < f0)
+		{
+			vX = vTrial;
+			break;
+		}
+	}
+
+	return Smooth(nLevel, vX, GetSmoothingIterations());
+
+}	// PlanOptimizer::MultigridCycle
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanOptimizer::Smooth(int nLevel, CVectorN<>& vX, int nIterations)
+	// a CG pass at a level, of at most nIterations (0 for the optimizer's
+	//		own limit); false if the callback requested termination
+{
+	dH::Profiler::GetInstance().SetLevel(nLevel);
+
+	DynamicCovarianceOptimizer *pOpt = GetOptimizer(nLevel);
+	const int nMaxIterations = pOpt->GetMaxIterations();
+	if (nIterations > 0)
+		pOpt->SetMaxIterations(nIterations);
+	const vnl_nonlinear_minimizer::ReturnCodes retCode = pOpt->minimize(vX.GetVnlVector());
+	pOpt->SetMaxIterations(nMaxIterations);
+
+	return retCode != vnl_nonlinear_minimizer::FAILED_USER_REQUEST;
+
+}	// PlanOptimizer::Smooth
+
+///////////////////////////////////////////////////////////////////////////////
+REAL
+	PlanOptimizer::EvaluateLevel(int nLevel, const CVectorN<>& vX, CVectorN<> *pGrad)
+	// the level's objective (and gradient), through compute so that any 
+	//		correction applies and the evaluation is counted
+{
+	vnl_vector<REAL> x(vX.GetDim());
+	CopyElements<REAL>(&x[0], &vX[0], vX.GetDim());
+
+	REAL f = 0.0;
+	if (pGrad != NULL)
+	{
+		vnl_vector<REAL> g(vX.GetDim());
+		GetPrescription(nLevel)->compute(x, &f, &g);
+		pGrad->SetDim(vX.GetDim());
+		CopyElements<REAL>(&(*pGrad)[0], &g[0], vX.GetDim());
+	}
+	else
+	{
+		GetPrescription(nLevel)->compute(x, &f, NULL);
+	}
+
+	return f;
+
+}	// PlanOptimizer::EvaluateLevel
+
 ///////////////////////////////////////////////////////////////////////////////
 void 
 	PlanOptimizer::GetInitStateVector(CVectorN<>&vInit)
 {
-	Prescription *pLevelMax = GetPrescription(PlanPyramid::MAX_SCALES-1);
+	const int nLevelMax = GetLevelCount()-1;
+	GetPyramid()->CalcLevelBeamlets(nLevelMax);
+	Prescription *pLevelMax = GetPrescription(nLevelMax);
 
-	vInit.SetDim(GetPyramid()->GetPlan(PlanPyramid::MAX_SCALES-1)->GetTotalBeamletCount());
+	vInit.SetDim(GetPyramid()->GetPlan(nLevelMax)->GetTotalBeamletCount());
 	for (int nAt = 0; nAt < vInit.GetDim(); nAt++)
 	{
 		if (pLevelMax->m_arrIncludeElement[nAt])
@@ -374,83 +1211,188 @@ void
 
 }	// PlanOptimizer::InvFilterStateVector
 
+///////////////////////////////////////////////////////////////////////////////
+void 
+	PlanOptimizer::FilterStateVector(int nScale, const CVectorN<>& vIn, CVectorN<>& vOut, 
+		bool bAverage)
+	// transfers beamlet weights (or gradients) from level n-1 to level n
+{
+	ASSERT(&vIn != &vOut);
+
+	CBeam::IntensityMap::Pointer intMapIn = CBeam::IntensityMap::New();
+	ConformTo<VOXEL_REAL, 1>(GetPyramid()->GetPlan(nScale-1)->GetBeamAt(0)->GetIntensityMap(), intMapIn);
+
+	CBeam::IntensityMap::Pointer intMapOut = CBeam::IntensityMap::New();
+	ConformTo<VOXEL_REAL, 1>(GetPyramid()->GetPlan(nScale)->GetBeamAt(0)->GetIntensityMap(), intMapOut);
+
+	for (int nAtBeam = 0; nAtBeam < GetPlan()->GetBeamCount(); nAtBeam++)
+	{
+		StateVectorToIntensityMap(nScale-1, nAtBeam, vIn, intMapIn); 
+		GetPyramid()->RestrictIntensityMap(nScale, intMapIn, intMapOut, bAverage);
+		IntensityMapToStateVector(nScale, nAtBeam, intMapOut, vOut);
+	} 
+
+}	// PlanOptimizer::FilterStateVector
+
 
 ///////////////////////////////////////////////////////////////////////////////
 void
 	PlanOptimizer::SetupPrescription()
-	// returns the given level of the pyramid
+	// creates the pyramid, and the finest level's prescription
 {
-	USES_CONVERSION;
-
 	// create the pyramid
 	SetPyramid(new dH::PlanPyramid(GetPlan()));
 
-	// get main sigma parameter from registry
-	const REAL GBinSigma = GetProfileReal(W2A(REG_KEY), W2A(GBINSIGMA_KEY), DEFAULT_GBINSIGMA);
-
-	// form vector with levels of the presc object
+	// the coarse levels are built when they are first accessed
 	m_arrPrescriptions.clear();
-	for (int nLevel = 0; nLevel < PlanPyramid::MAX_SCALES; nLevel++)
-	{
-		// create a new prescription object
-		Prescription * pPresc = new dH::Prescription(GetPlan());
-		pPresc->SetPlan(GetPyramid()->GetPlan(nLevel));		// TODO: why is this called here?
+	BuildLevel(0);
 
-		/// TODO: set up slice
-		///		or just in Presc::AddStructTerm
+}	// PlanOptimizer::SetupPrescription
 
-		// calculate the variance range for this level
-		const REAL sigma = GetProfileRealAt(LEVELSIGMA_KEY, nLevel, DEFAULT_LEVELSIGMA[nLevel]);
-		const REAL binVar = pow(GBinSigma / sigma, 2);
-		const REAL varMin = binVar * 0.25;
-		// widened to cover the true peak of varSlope^2*varWeight^2 (~1.405x at S=2/3,
-		//	see Prescription::CalcSumSigmoid), so the actVar clamp isn't discarding
-		//	routine excursions above binVar
-		const REAL varMax = binVar * 1.5;
+///////////////////////////////////////////////////////////////////////////////
+void
+	PlanOptimizer::BuildLevel(int nLevel)
+	// creates the prescription and optimizer for a level, with clones of
+	//		the finest level's terms
+{
+	USES_CONVERSION;
 
-		// set the variance range in the objective function
-		// NOTE: this has to be done after the Optimizer->SetAdaptiveVariance, because
-		//		it will over-ride some of those settings
-		// pPresc->SetGBinVar(varMin, varMax);
+	ASSERT(nLevel >= 0 && nLevel < GetLevelCount());
+	if ((int) m_arrPrescriptions.size() <= nLevel)
+	{
+		m_arrPrescriptions.resize(nLevel+1, 
+			std::pair<Prescription*, DynamicCovarianceOptimizer*>(NULL, NULL));
+	}
 
-		// construct the optimizer
-		DynamicCovarianceOptimizer *pOptimizer = new DynamicCovarianceOptimizer(pPresc);
+	// the terms conform to the level's beamlets, so they are needed first
+	if (nLevel > 0)
+	{
+		GetPyramid()->CalcLevelBeamlets(nLevel);
+	}
 
-		// set the variance range for the optimizer
-		pOptimizer->SetAdaptiveVariance(true, varMin, varMax);
+	// get main sigma parameter from registry
+	const REAL GBinSigma = GetProfileReal(W2A(REG_KEY), W2A(GBINSIGMA_KEY), DEFAULT_GBINSIGMA);
 
-		// NOTE: the search-direction-covariance "free energy" diagnostic
-		//	(SetComputeFreeEnergy) is intentionally left OFF here. The objective
-		//	F = KL - w*softmax-entropy is now formed inside Prescription::operator()
-		//	with a true per-parameter entropy gradient, so it actually steers the
-		//	optimization; the covariance-entropy diagnostic is a different quantity
-		//	and would only waste an eigendecomposition per iteration.
+	// create a new prescription object
+	Prescription * pPresc = new dH::Prescription(GetPlan());
+	pPresc->SetPlan(GetPyramid()->GetPlan(nLevel));		// TODO: why is this called here?
+
+	/// TODO: set up slice
+	///		or just in Presc::AddStructTerm
+
+	// calculate the variance range for this level
+	const REAL sigma = GetProfileRealAt(LEVELSIGMA_KEY, nLevel, GetDefaultLevelSigma(nLevel));
+	const REAL binVar = pow(GBinSigma / sigma, 2);
+	const REAL varMin = binVar * 0.25;
+	// widened to cover the true peak of varSlope^2*varWeight^2 (~1.405x at S=2/3,
+	//	see Prescription::CalcSumSigmoid), so the actVar clamp isn't discarding
+	//	routine excursions above binVar
+	const REAL varMax = binVar * 1.5;
+
+	// set the variance range in the objective function
+	// NOTE: this has to be done after the Optimizer->SetAdaptiveVariance, because
+	//		it will over-ride some of those settings
+	// pPresc->SetGBinVar(varMin, varMax);
+
+	// construct the optimizer
+	DynamicCovarianceOptimizer *pOptimizer = new DynamicCovarianceOptimizer(pPresc);
+
+	// set the variance range for the optimizer
+	pOptimizer->SetAdaptiveVariance(true, varMin, varMax);
+
+	// NOTE: the search-direction-covariance "free energy" diagnostic
+	//	(SetComputeFreeEnergy) is intentionally left OFF here. The objective
+	//	F = KL - w*softmax-entropy is now formed inside Prescription::operator()
+	//	with a true per-parameter entropy gradient, so it actually steers the
+	//	optimization; the covariance-entropy diagnostic is a different quantity
+	//	and would only waste an eigendecomposition per iteration.
+
+	// set the tolerances
+	//pOptimizer->SetLineToleranceEqual(false);
+
+	// set the line tolerance
+	const REAL cgTolerance = GetProfileRealAt(CGTOL_KEY, nLevel, GetDefaultTolerance(nLevel));
+	pOptimizer->set_x_tolerance/*SetTolerance*/(cgTolerance);
+
+	// set the CG tolerance
+	const REAL lineTolerance = GetProfileRealAt(LINETOL_KEY, nLevel, GetDefaultTolerance(nLevel));
+	// pOptimizer->GetBrentOptimizer().set_x_tolerance(lineTolerance);
+	pOptimizer->SetLineOptimizerTolerance(lineTolerance);
+
+	// do not apply transform slope variance for lowest-res level
+	if (nLevel == GetLevelCount()-1)
+		pPresc->SetTransformSlopeVariance(false);
+
+	// set the variance range in the objective function
+	// NOTE: this has to be done after the Optimizer->SetAdaptiveVariance, because
+	//		it will over-ride some of those settings
+	pPresc->SetGBinVar(varMin, varMax);
+
+	m_arrPrescriptions[nLevel] = std::pair<Prescription*, DynamicCovarianceOptimizer*>(pPresc, pOptimizer);
+
+	// a coarse level is built after the terms were added to the finest (or
+	//	held back for it)
+	if (nLevel > 0)
+	{
+		pPresc->CloneTerms(m_arrPrescriptions[0].first);
+		for (int nAt = 0; nAt < (int) m_arrPendingTerms.size(); nAt++)
+		{
+			VOITerm *pClone = m_arrPendingTerms[nAt]->Clone();
+			if (m_arrPendingTerms[nAt]->GetHistogram()->IsLean())
+			{
+				pClone->GetHistogram()->SetLean(true);
+			}
+			pPresc->AddStructureTerm(pClone);
+		}
+	}
 
-		// set the tolerances
-		//pOptimizer->SetLineToleranceEqual(false);
+}	// PlanOptimizer::BuildLevel
 
-		// set the line tolerance
-		const REAL cgTolerance = GetProfileRealAt(CGTOL_KEY, nLevel, DEFAULT_CG_TOLERANCE[nLevel]);
-		pOptimizer->set_x_tolerance/*SetTolerance*/(cgTolerance);
+///////////////////////////////////////////////////////////////////////////////
+void
+	PlanOptimizer::BindPendingTerms()
+	// adds the held back terms to the finest level, once its beamlets are in
+{
+	GetPyramid()->WaitLevelBeamlets(0);
 
-		// set the CG tolerance
-		const REAL lineTolerance = GetProfileRealAt(LINETOL_KEY, nLevel, DEFAULT_LINE_TOLERANCE[nLevel]);
-		// pOptimizer->GetBrentOptimizer().set_x_tolerance(lineTolerance);
-		pOptimizer->SetLineOptimizerTolerance(lineTolerance);
+	for (int nAt = 0; nAt < (int) m_arrPendingTerms.size(); nAt++)
+	{
+		m_arrPrescriptions[0].first->AddStructureTerm(m_arrPendingTerms[nAt]);
+	}
+	m_arrPendingTerms.clear();
 
-		// do not apply transform slope variance for lowest-res level
-		if (nLevel == PlanPyramid::MAX_SCALES-1)
-			pPresc->SetTransformSlopeVariance(false);
+}	// PlanOptimizer::BindPendingTerms
 
-		// set the variance range in the objective function
-		// NOTE: this has to be done after the Optimizer->SetAdaptiveVariance, because
-		//		it will over-ride some of those settings
-		pPresc->SetGBinVar(varMin, varMax);
+///////////////////////////////////////////////////////////////////////////////
+void
+	PlanOptimizer::UpdateLevelTerms(int nLevel)
+	// updates a coarse level's terms from the finest level's, without 
+	//		waiting for pending terms to be bound
+{
+	Prescription *pPresc = GetPrescription(nLevel);
+	pPresc->UpdateTerms(m_arrPrescriptions[0].first);
 
-		m_arrPrescriptions.push_back(std::pair<Prescription*, DynamicCovarianceOptimizer*>(pPresc, pOptimizer));
+	for (int nAt = 0; nAt < (int) m_arrPendingTerms.size(); nAt++)
+	{
+		VOITerm *pVOIT = pPresc->GetStructureTerm(m_arrPendingTerms[nAt]->GetVOI());
+		if (pVOIT != NULL)
+		{
+			pVOIT->UpdateFrom(m_arrPendingTerms[nAt]);
+		}
 	}
 
-}	// PlanOptimizer::SetupPrescription
+}	// PlanOptimizer::UpdateLevelTerms
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	PlanOptimizer::GetBaseTerms(vector<VOITerm*>& arrTerms)
+	// the finest level's terms, and the pending ones, without waiting for 
+	//		them to be bound
+{
+	m_arrPrescriptions[0].first->GetStructureTerms(arrTerms);
+	arrTerms.insert(arrTerms.end(), m_arrPendingTerms.begin(), m_arrPendingTerms.end());
+
+}	// PlanOptimizer::GetBaseTerms
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -461,20 +1403,18 @@ void
 {
 	CPlan *pPlan = GetPyramid()->GetPlan(nScale);
 	int nBeamletCount = pPlan->GetBeamAt(nBeam/*0*/)->GetBeamletCount();
-	int nBeamletOffset = nBeamletCount / 2;
 	ConformTo<VOXEL_REAL>(pPlan->GetBeamAt(nBeam)->GetIntensityMap(), 
 		pIntensityMap);		// TODO: make this an ASSERT, as caller should be responsible for this
 	ASSERT(nBeamletCount == pIntensityMap->GetBufferedRegion().GetSize()[0]);
 
-	for (int nAtElem = 0; nAtElem < vState.GetDim(); nAtElem++)
+	// the beam's elements are contiguous (as Prescription::GetBeamletFromSVElem),
+	//	so this doesn't need the level's prescription to be built
+	for (int nAtBeamlet = 0; nAtBeamlet < nBeamletCount; nAtBeamlet++)
 	{
-		int nCurrBeam;
-		int nCurrBeamlet;
-
-		GetPrescription(nScale)->GetBeamletFromSVElem(nAtElem, &nCurrBeam, &nCurrBeamlet);
-		if (nCurrBeam == nBeam)
+		const int nAtElem = nBeam * nBeamletCount + nAtBeamlet;
+		if (nAtElem < vState.GetDim())
 		{
-			pIntensityMap->GetBufferPointer()[nCurrBeamlet + nBeamletOffset] = vState[nAtElem];
+			pIntensityMap->GetBufferPointer()[nAtBeamlet] = vState[nAtElem];
 		}
 	}
 
@@ -488,20 +1428,16 @@ void
 	CPlan *pPlan = GetPyramid()->GetPlan(nScale);
 	int nBeamletCount = pPlan->GetBeamAt(nBeam/*0*/)->GetBeamletCount();
 
-	int nBeamletOffset = nBeamletCount / 2;
-
 	if (vState.GetDim() != pPlan->GetTotalBeamletCount())
 		vState.SetDim(pPlan->GetTotalBeamletCount());
 
-	for (int nAtElem = 0; nAtElem < vState.GetDim(); nAtElem++)
+	// the beam's elements are contiguous, as for StateVectorToIntensityMap
+	for (int nAtBeamlet = 0; nAtBeamlet < nBeamletCount; nAtBeamlet++)
 	{
-		int nCurrBeam;
-		int nCurrBeamlet;
-
-		GetPrescription(nScale)->GetBeamletFromSVElem(nAtElem, &nCurrBeam, &nCurrBeamlet);
-		if (nCurrBeam == nBeam)
+		const int nAtElem = nBeam * nBeamletCount + nAtBeamlet;
+		if (nAtElem < vState.GetDim())
 		{
-			vState[nAtElem] = pIntensityMap->GetBufferPointer()[nCurrBeamlet + nBeamletOffset];
+			vState[nAtElem] = pIntensityMap->GetBufferPointer()[nAtBeamlet];
 		}
 	}
 
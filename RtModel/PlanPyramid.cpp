@@ -8,12 +8,24 @@
 #include "itkAffineTransform.h"
 #include "itkLinearInterpolateImageFunction.h"
 
+#include <BeamDoseCalc.h>
+
 
 namespace dH
 {
 
+///////////////////////////////////////////////////////////////////////////////
+static bool
+	GetDefaultDirectBeamlets()
+	// BRIMSTONE_DIRECT_BEAMLETS = 1 calculates the coarse levels directly
+{
+	const char *pEnv = getenv("BRIMSTONE_DIRECT_BEAMLETS");
+	return pEnv != NULL && atoi(pEnv) != 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 PlanPyramid::PlanPyramid(CPlan *pPlan)
+	: m_DirectBeamlets(GetDefaultDirectBeamlets())
 {
 	SetPlan(pPlan);
 
@@ -29,7 +41,12 @@ PlanPyramid::PlanPyramid(CPlan *pPlan)
 ///////////////////////////////////////////////////////////////////////////////
 PlanPyramid::~PlanPyramid(void)
 {
-	for (int nLevel = 1; nLevel < MAX_SCALES; nLevel++)
+	// the background calculations use the beams
+	for (int nLevel = 0; nLevel < (int) m_arrFutureBeamlets.size(); nLevel++)
+		if (m_arrFutureBeamlets[nLevel].valid())
+			m_arrFutureBeamlets[nLevel].wait();
+
+	for (int nLevel = 1; nLevel < (int) m_arrPlans.size(); nLevel++)
 		delete m_arrPlans[nLevel];
 }
 
@@ -39,96 +56,114 @@ void
 {
 	m_pPlan = pPlan;
 
-
-	// generate sub-plans
-	CPlan *pPrevPlan = GetPlan();
 	if (m_arrPlans.size() == 0)
-		m_arrPlans.push_back(pPrevPlan);
-
-	REAL doseResolution = pPlan->GetDoseResolution();
-	for (int nLevel = 1; nLevel < MAX_SCALES; nLevel++)
 	{
-		doseResolution *= 2.0;
-		CPlan *pNextPlan = NULL; 
-		if (m_arrPlans.size() <= nLevel)
-		{
-			pNextPlan = new CPlan();
-			m_arrPlans.push_back(pNextPlan);
-		}
-		else
-		{
-			pNextPlan = m_arrPlans[nLevel];
-		}
+		m_arrPlans.push_back(pPlan);
+		m_arrCurrent.resize(1);
+	}
 
-		pNextPlan->SetSeries(m_pPlan->GetSeries());
-		pNextPlan->SetDoseResolution(doseResolution);
-		for (int nAt = 0; nAt < GetPlan()->GetBeamCount(); nAt++)
-		{
-			CBeam *pPrevBeam = pPrevPlan->GetBeamAt(nAt);
-			CBeam::Pointer pNextBeam;
-			if (pNextPlan->GetBeamCount() <= nAt)
-			{
-				pNextBeam = dH::Beam::New(); // CBeam(/*pPrevBeam*/);
-				// need to add the beam first, because the plan is needed to set gantry angle
-				pNextPlan->AddBeam(pNextBeam);
-			}
-			else
-			{
-				pNextBeam = pNextPlan->GetBeamAt(nAt);
-			}
+	// re-sync the sub-plans set up so far; the others are set up when first
+	//	used
+	for (int nLevel = 1; nLevel < (int) m_arrPlans.size(); nLevel++)
+		SetupLevel(nLevel);
 
-			pNextBeam->SetGantryAngle(pPrevBeam->GetGantryAngle());
-			pNextBeam->SetIsocenter(pPrevBeam->GetIsocenter());
+}	// PlanPyramid::SetPlan
 
-		}
-		ASSERT(pPrevPlan->GetBeamCount() == pNextPlan->GetBeamCount());
+///////////////////////////////////////////////////////////////////////////////
+int
+	PlanPyramid::GetLevelCount()
+	// the plan's PyramidLevels, within the levels the beamlets allow
+{
+	return GetLevelCount(GetPlan());
 
-		pPrevPlan = pNextPlan;
-	}
+}	// PlanPyramid::GetLevelCount
 
-}	// PlanPyramid::SetPlan
+///////////////////////////////////////////////////////////////////////////////
+int
+	PlanPyramid::GetLevelCount(CPlan *pPlan)
+	// the plan's PyramidLevels, within the levels the beamlets allow: each
+	//	level halves the beamlets either side of the central one, and the 
+	//	coarsest keeps at least one
+{
+	int nMaxLevels = 1;
+	while ((pPlan->GetMaxBeamletShift() >> nMaxLevels) >= 1)
+		nMaxLevels++;
+
+	return __min(__max(pPlan->GetPyramidLevels(), 1), nMaxLevels);
+
+}	// PlanPyramid::GetLevelCount
 
 ///////////////////////////////////////////////////////////////////////////////
 CPlan *
 	PlanPyramid::GetPlan(int nLevel)
 {
+	// set up the level (and those above it) on first use, or if beams have
+	//	been added to the plan since
+	for (int nAt = 1; nAt <= nLevel; nAt++)
+	{
+		if (nAt >= (int) m_arrPlans.size()
+			|| m_arrPlans[nAt]->GetBeamCount() != GetPlan()->GetBeamCount())
+		{
+			SetupLevel(nAt);
+		}
+	}
+
 	return m_arrPlans[nLevel];
 
-}	// PlanPyramid::SetPlan
+}	// PlanPyramid::GetPlan
 
 ///////////////////////////////////////////////////////////////////////////////
-void 
-	PlanPyramid::CalcPencilSubBeamlets(int nBeam)
+void
+	PlanPyramid::SetupLevel(int nLevel)
+	// sets up a level's plan and beams to match the level above
 {
-	// make sure pencil subbeamlets are properly generated
-	for (int nAt = ((nBeam == -1) ? (GetPlan()->GetBeamCount()-1) : nBeam); nAt >= ((nBeam == -1) ? 0 : nBeam); nAt--)
+	CPlan *pPrevPlan = m_arrPlans[nLevel-1];
+	if ((int) m_arrPlans.size() <= nLevel)
 	{
-		CBeam *pBeam = GetPlan()->GetBeamAt(nAt);
+		m_arrPlans.push_back(new CPlan());
+		m_arrCurrent.resize(m_arrPlans.size());
+	}
+	CPlan *pNextPlan = m_arrPlans[nLevel];
 
-		// only recalc if they need to be
-		if (!pBeam->m_bRecalcBeamlets)
-			return;
+	pNextPlan->SetSeries(m_pPlan->GetSeries());
+	pNextPlan->SetDoseResolution(pPrevPlan->GetDoseResolution() * 2.0);
 
-			// stores beamlet count for level N
-		int nBeamletCount = 19;
-		// TODO: reconcile this with nBeamletCount used in PlanPyramid
+	// each level halves the number of beamlets, and doubles their spacing
+	//	(the level's plan holds it, for a direct dose calc on the level)
+	const REAL beamletSpacing = GetPlan()->GetBeamletSpacing() * (REAL) (1 << nLevel);
+	pNextPlan->SetBeamletSpacing(beamletSpacing);
 
-		REAL beamletSpacing = 4.0; // 2.0;
-		// TODO: reconcile this with beamletSpacing used in BeamDoseCalc
+	// new beams have nothing filtered to them yet
+	m_arrCurrent[nLevel].resize(GetPlan()->GetBeamCount(), false);
 
-		// now generate level 1..n beamlets
-		for (int nAtScale = 1; nAtScale < MAX_SCALES; nAtScale++)
+	for (int nAt = 0; nAt < GetPlan()->GetBeamCount(); nAt++)
+	{
+		CBeam *pPrevBeam = pPrevPlan->GetBeamAt(nAt);
+		CBeam::Pointer pNextBeam;
+		if (pNextPlan->GetBeamCount() <= nAt)
+		{
+			pNextBeam = dH::Beam::New(); // CBeam(/*pPrevBeam*/);
+			// need to add the beam first, because the plan is needed to set gantry angle
+			pNextPlan->AddBeam(pNextBeam);
+		}
+		else
 		{
-			CBeam *pBeamSub = m_arrPlans[nAtScale]->GetBeamAt(nAt);
-			CBeam *pBeamSubPrev = m_arrPlans[nAtScale-1]->GetBeamAt(nAt);
+			pNextBeam = pNextPlan->GetBeamAt(nAt);
+		}
 
-			// each level halves the number of beamlets
-			nBeamletCount /= 2;
-			beamletSpacing *= 2.0;
+		pNextBeam->SetGantryAngle(pPrevBeam->GetGantryAngle());
+		pNextBeam->SetIsocenter(pPrevBeam->GetIsocenter());
 
-			// set up the beams beamlets; do this by defining the intensity map parameters
-			CBeam::IntensityMap *pIM = pBeamSub->GetIntensityMap();
+		// half the level above's beamlets, if it has them (a plan read from a
+		//	file has its own count), else from the plan's parameters
+		const int nBeamletCount = (pPrevBeam->GetBeamletCount() > 0)
+			? (pPrevBeam->GetBeamletCount() / 2) / 2
+			: GetPlan()->GetMaxBeamletShift() >> nLevel;
 
+		// set up the beams beamlets; do this by defining the intensity map parameters
+		CBeam::IntensityMap *pIM = pNextBeam->GetIntensityMap();
+		if (pIM->GetBufferedRegion().GetSize()[0] != nBeamletCount*2 + 1)
+		{
 			// set up the intensity map indexing
 			CBeam::IntensityMap::RegionType region;
 			itk::Index<1> index = {{-nBeamletCount}};
@@ -146,73 +181,348 @@ void
 			pIM->FillBuffer(0);
 
 			// this will allocate the necessary beamlets
-			pBeamSub->OnIntensityMapChanged();
+			pNextBeam->OnIntensityMapChanged();
+			m_arrCurrent[nLevel][nAt] = false;
+		}
+	}
+	ASSERT(pPrevPlan->GetBeamCount() == pNextPlan->GetBeamCount());
+
+}	// PlanPyramid::SetupLevel
+
+///////////////////////////////////////////////////////////////////////////////
+void 
+	PlanPyramid::CalcPencilSubBeamlets(int nBeam)
+	// calculates every level's beamlets
+{
+	CalcLevelBeamlets(GetLevelCount()-1, nBeam);
+
+}	// PlanPyramid::CalcPencilSubBeamlets
+
+///////////////////////////////////////////////////////////////////////////////
+void 
+	PlanPyramid::CalcLevelBeamlets(int nLevel, int nBeam)
+	// calculates the beamlets of levels 1..nLevel that aren't current (only
+	//		nLevel, if calculated directly)
+{
+	// the level's own background calculation, and for filtered levels the
+	//	finest level's
+	WaitLevelBeamlets(nLevel);
+	if (!GetDirectBeamlets())
+		WaitLevelBeamlets(0);
+
+	// make sure the levels are set up
+	GetPlan(nLevel);
+
+	for (int nAt = ((nBeam == -1) ? (GetPlan()->GetBeamCount()-1) : nBeam); nAt >= ((nBeam == -1) ? 0 : nBeam); nAt--)
+	{
+		CBeam *pBeam = GetPlan()->GetBeamAt(nAt);
+
+		// new level 0 beamlets make all the levels' stale, and may change 
+		//	their number
+		/// TODO: move this flag to PlanPyramid::m_bRecalcBeamlets
+		if (pBeam->m_bRecalcBeamlets)
+		{
+			for (int nAtScale = 1; nAtScale < (int) m_arrPlans.size(); nAtScale++)
+			{
+				// (direct levels are only stale if their size changed)
+				SetupLevel(nAtScale);
+				if (!GetDirectBeamlets())
+					m_arrCurrent[nAtScale][nAt] = false;
+			}
+			pBeam->m_bRecalcBeamlets = false;
+		}
+
+		// now generate level 1..n beamlets, each from the one above, or just
+		//	level n on its own grid
+		for (int nAtScale = GetDirectBeamlets() ? __max(nLevel, 1) : 1; 
+			nAtScale <= nLevel; nAtScale++)
+		{
+			if (!m_arrCurrent[nAtScale][nAt])
+			{
+				if (GetDirectBeamlets())
+					CalcDirectBeamlets(nAtScale, nAt);
+				else
+					CalcSubBeamlets(nAtScale, nAt);
+				m_arrCurrent[nAtScale][nAt] = true;
+			}
+		}
+	}
+
+}	// PlanPyramid::CalcLevelBeamlets
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanPyramid::IsLevelCurrent(int nLevel)
+	// true if a level's beamlets are current for all beams
+{
+	if (nLevel == 0)
+		return true;
+
+	if (nLevel >= (int) m_arrPlans.size()
+		|| m_arrPlans[nLevel]->GetBeamCount() != GetPlan()->GetBeamCount())
+		return false;
+
+	for (int nAt = 0; nAt < GetPlan()->GetBeamCount(); nAt++)
+	{
+		if (GetPlan()->GetBeamAt(nAt)->m_bRecalcBeamlets
+			|| !m_arrCurrent[nLevel][nAt])
+			return false;
+	}
+
+	return true;
+
+}	// PlanPyramid::IsLevelCurrent
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	PlanPyramid::ReleaseLevel(int nLevel)
+	// frees a level's beamlets
+{
+	if (nLevel < 1 || nLevel >= (int) m_arrPlans.size())
+		return;
+
+	// (a pending calculation would refill it)
+	WaitLevelBeamlets(nLevel);
+
+	CPlan *pPlan = m_arrPlans[nLevel];
+	for (int nAt = 0; nAt < pPlan->GetBeamCount(); nAt++)
+	{
+		pPlan->GetBeamAt(nAt)->ReleaseBeamlets();
+		m_arrCurrent[nLevel][nAt] = false;
+	}
+
+}	// PlanPyramid::ReleaseLevel
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	PlanPyramid::StartLevelBeamlets(int nLevel)
+	// calculates a level's beamlets on a background thread
+{
+	// one calculation per level at a time
+	if (IsLevelPending(nLevel))
+		return;
 
-			typedef itk::MultiResolutionPyramidImageFilter<VolumeReal, VolumeReal> PyramidType;
-			PyramidType::Pointer pPyramid = PyramidType::New();
-			pPyramid->SetNumberOfLevels(2);
+	// the coarse levels are only independent if calculated directly
+	ASSERT(nLevel == 0 || GetDirectBeamlets());
+	if (nLevel > 0 && !GetDirectBeamlets())
+		return;
+
+	// the dose calcs are set up here, so the worker only reads the beams
+	CPlan *pPlanLevel = GetPlan(nLevel);
+	if (nLevel >= (int) m_arrFutureBeamlets.size())
+	{
+		m_arrFutureBeamlets.resize(nLevel+1);
+		m_arrPendingBeams.resize(nLevel+1);
+	}
+	vector< std::shared_ptr<CBeamDoseCalc> > arrDoseCalc;
+	vector<int> arrShifts;
+	m_arrPendingBeams[nLevel].clear();
+	for (int nAt = 0; nAt < pPlanLevel->GetBeamCount(); nAt++)
+	{
+		CBeam *pBeam = pPlanLevel->GetBeamAt(nAt);
+		if ((nLevel == 0) ? (pBeam->GetBeamletCount() > 0) : (bool) m_arrCurrent[nLevel][nAt])
+			continue;
+
+		std::shared_ptr<CBeamDoseCalc> pDoseCalc(
+			new CBeamDoseCalc(pBeam, pPlanLevel->m_pKernel));
+		pDoseCalc->InitCalcBeamlets();
+		arrDoseCalc.push_back(pDoseCalc);
+		arrShifts.push_back((nLevel == 0) 
+			? GetPlan()->GetMaxBeamletShift() : pBeam->GetBeamletCount() / 2);
+		m_arrPendingBeams[nLevel].push_back(nAt);
+	}
+
+	if (arrDoseCalc.empty())
+		return;
+
+	m_arrFutureBeamlets[nLevel] = std::async(std::launch::async, 
+		[arrDoseCalc, arrShifts]() -> vector< vector<VolumeReal::Pointer> >
+		{
+			vector< vector<VolumeReal::Pointer> > arrBeamlets(arrDoseCalc.size());
+			for (size_t nAt = 0; nAt < arrDoseCalc.size(); nAt++)
+			{
+				for (int nAtBeamlet = -arrShifts[nAt]; nAtBeamlet <= arrShifts[nAt]; nAtBeamlet++)
+					arrBeamlets[nAt].push_back(arrDoseCalc[nAt]->CalcBeamletDose(nAtBeamlet));
+			}
+			return arrBeamlets;
+		});
+
+}	// PlanPyramid::StartLevelBeamlets
 
-			VolumeReal::Pointer beamlet = // const_cast<VolumeReal*>(pPyramid->GetInput()); // 
-				VolumeReal::New();
-			pPyramid->SetInput(beamlet);
-			VolumeReal::Pointer beamletAccum = VolumeReal::New();
+///////////////////////////////////////////////////////////////////////////////
+bool
+	PlanPyramid::IsLevelPending(int nLevel) const
+	// true while a level's background calculation hasn't been collected
+{
+	return nLevel >= 0 && nLevel < (int) m_arrFutureBeamlets.size()
+		&& m_arrFutureBeamlets[nLevel].valid();
 
-			ConformTo<VOXEL_REAL,3>(pBeamSubPrev->GetBeamlet(0), beamlet);
-			ConformTo<VOXEL_REAL,3>(pBeamSubPrev->GetBeamlet(0), beamletAccum);
+}	// PlanPyramid::IsLevelPending
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	PlanPyramid::WaitLevelBeamlets(int nLevel)
+	// collects a level's background calculation
+{
+	if (!IsLevelPending(nLevel))
+		return;
 
-			// generate beamlets for base scale
+	vector< vector<VolumeReal::Pointer> > arrBeamlets = m_arrFutureBeamlets[nLevel].get();
+	for (size_t nAt = 0; nAt < m_arrPendingBeams[nLevel].size(); nAt++)
+	{
+		const int nBeam = m_arrPendingBeams[nLevel][nAt];
+		CBeam *pBeam = m_arrPlans[nLevel]->GetBeamAt(nBeam);
+		if (nLevel == 0)
+		{
+			pBeam->AddBeamlets(arrBeamlets[nAt]);
+
+			// the levels filtered from them are stale
+			pBeam->m_bRecalcBeamlets = true;
+		}
+		else if (pBeam->GetBeamletCount() == (int) arrBeamlets[nAt].size())
+		{
+			// copied into the existing beamlets, which histograms may refer 
+			//	to (unless the level was set up again meanwhile)
+			const int nBeamletCount = pBeam->GetBeamletCount() / 2;
 			for (int nAtShift = -nBeamletCount; nAtShift <= nBeamletCount; nAtShift++)
 			{
-				// helpers for calculating sub beamlets
-				beamlet->FillBuffer(0.0);
-
-				VolumeReal * pPrevBeamletLow = pBeamSubPrev->GetBeamlet(nAtShift * 2 - 1);
-				VolumeReal * pPrevBeamletHigh = pBeamSubPrev->GetBeamlet(nAtShift * 2 + 1);
-				if (pPrevBeamletLow != NULL)
-				{
-					// NOTE: these are all * 2.0 because there are only half as many sub-beamlets 
-					//		contributing; this means that the intensity map interpolation needs 
-					//		no scaling
-					Accumulate3D<VOXEL_REAL>(pPrevBeamletLow, 
-						(pPrevBeamletHigh != NULL) 
-						? 2.0 * m_vWeightFilter[0] 
-						: 2.0 * m_vWeightFilter[0] /*/ 0.75*/, 
-						beamlet, beamletAccum);
-				}
-
-				Accumulate3D<VOXEL_REAL>(pBeamSubPrev->GetBeamlet(nAtShift * 2 + 0), 
-					(pPrevBeamletHigh != NULL && pPrevBeamletLow != NULL) 
-						? 2.0 * m_vWeightFilter[1] 
-						: 2.0 * m_vWeightFilter[1] /*/ 0.75*/, 
-					beamlet, beamletAccum); 
-
-
-				if (pPrevBeamletHigh != NULL)
-				{
-					Accumulate3D<VOXEL_REAL>(pPrevBeamletHigh, 
-						(pPrevBeamletLow != NULL) 
-						? 2.0 * m_vWeightFilter[2] 
-						: 2.0 * m_vWeightFilter[2] /*/ 0.75*/,
-						beamlet, beamletAccum);
-				}
-				// pPyramid->ResetPipeline();
-				pPyramid->SetNumberOfLevels(2); // ->Update();
-				pPyramid->Modified();
-				pPyramid->GetOutput(0)->Update();
-				// TODO: investigate whether resulting filtered beamlet is scaled properly
-
-				CopyImage<VOXEL_REAL,3>(pPyramid->GetOutput(0), pBeamSub->GetBeamlet(nAtShift));
-
-				// check that resolution is correct
-				ASSERT(pBeamSub->GetBeamlet(nAtShift)->GetSpacing()[0] == pBeamSub->GetPlan()->GetDoseResolution());
+				CopyImage<VOXEL_REAL,3>(arrBeamlets[nAt][nAtShift + nBeamletCount], 
+					pBeam->GetBeamlet(nAtShift));
 			}
+			m_arrCurrent[nLevel][nBeam] = true;
+		}
+	}
+	m_arrPendingBeams[nLevel].clear();
+
+}	// PlanPyramid::WaitLevelBeamlets
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	PlanPyramid::RecalcBeamlets()
+	// recalculates the finest level's beamlets in place
+{
+	// nothing may be filling the beamlets meanwhile
+	for (int nLevel = 0; nLevel < (int) m_arrFutureBeamlets.size(); nLevel++)
+		WaitLevelBeamlets(nLevel);
+
+	for (int nAt = 0; nAt < GetPlan()->GetBeamCount(); nAt++)
+	{
+		CBeam *pBeam = GetPlan()->GetBeamAt(nAt);
+
+		// (beams without beamlets are calculated as usual, when first needed)
+		if (pBeam->GetBeamletCount() > 0)
+		{
+			// the images stay the same, so the histograms that refer to them
+			//	don't need to be set up again
+			CalcDirectBeamlets(0, nAt);
+			pBeam->OnBeamletsChanged();
 		}
 
-		/// TODO: move this flag to PlanPyramid::m_bRecalcBeamlets
-		pBeam->m_bRecalcBeamlets = false;
+		for (int nLevel = 1; nLevel < (int) m_arrCurrent.size(); nLevel++)
+		{
+			if (nAt < (int) m_arrCurrent[nLevel].size())
+				m_arrCurrent[nLevel][nAt] = false;
+		}
 	}
 
-}	// PlanPyramid::CalcPencilSubBeamlets
+}	// PlanPyramid::RecalcBeamlets
+
+///////////////////////////////////////////////////////////////////////////////
+void 
+	PlanPyramid::CalcSubBeamlets(int nLevel, int nBeam)
+	// filters one beam's beamlets from level nLevel-1 to nLevel
+{
+	CBeam *pBeamSub = m_arrPlans[nLevel]->GetBeamAt(nBeam);
+	CBeam *pBeamSubPrev = m_arrPlans[nLevel-1]->GetBeamAt(nBeam);
+	const int nBeamletCount = pBeamSub->GetBeamletCount() / 2;
+
+	typedef itk::MultiResolutionPyramidImageFilter<VolumeReal, VolumeReal> PyramidType;
+	PyramidType::Pointer pPyramid = PyramidType::New();
+	pPyramid->SetNumberOfLevels(2);
+
+	VolumeReal::Pointer beamlet = // const_cast<VolumeReal*>(pPyramid->GetInput()); // 
+		VolumeReal::New();
+	pPyramid->SetInput(beamlet);
+	VolumeReal::Pointer beamletAccum = VolumeReal::New();
+
+	ConformTo<VOXEL_REAL,3>(pBeamSubPrev->GetBeamlet(0), beamlet);
+	ConformTo<VOXEL_REAL,3>(pBeamSubPrev->GetBeamlet(0), beamletAccum);
+
+	// generate beamlets for base scale
+	for (int nAtShift = -nBeamletCount; nAtShift <= nBeamletCount; nAtShift++)
+	{
+		// helpers for calculating sub beamlets
+		beamlet->FillBuffer(0.0);
+
+		VolumeReal * pPrevBeamletLow = pBeamSubPrev->GetBeamlet(nAtShift * 2 - 1);
+		VolumeReal * pPrevBeamletHigh = pBeamSubPrev->GetBeamlet(nAtShift * 2 + 1);
+		if (pPrevBeamletLow != NULL)
+		{
+			// NOTE: these are all * 2.0 because there are only half as many sub-beamlets 
+			//		contributing; this means that the intensity map interpolation needs 
+			//		no scaling
+			Accumulate3D<VOXEL_REAL>(pPrevBeamletLow, 
+				(pPrevBeamletHigh != NULL) 
+				? 2.0 * m_vWeightFilter[0] 
+				: 2.0 * m_vWeightFilter[0] /*/ 0.75*/, 
+				beamlet, beamletAccum);
+		}
+
+		Accumulate3D<VOXEL_REAL>(pBeamSubPrev->GetBeamlet(nAtShift * 2 + 0), 
+			(pPrevBeamletHigh != NULL && pPrevBeamletLow != NULL) 
+				? 2.0 * m_vWeightFilter[1] 
+				: 2.0 * m_vWeightFilter[1] /*/ 0.75*/, 
+			beamlet, beamletAccum); 
+
+
+		if (pPrevBeamletHigh != NULL)
+		{
+			Accumulate3D<VOXEL_REAL>(pPrevBeamletHigh, 
+				(pPrevBeamletLow != NULL) 
+				? 2.0 * m_vWeightFilter[2] 
+				: 2.0 * m_vWeightFilter[2] /*/ 0.75*/,
+				beamlet, beamletAccum);
+		}
+		// pPyramid->ResetPipeline();
+		pPyramid->SetNumberOfLevels(2); // ->Update();
+		pPyramid->Modified();
+		pPyramid->GetOutput(0)->Update();
+		// TODO: investigate whether resulting filtered beamlet is scaled properly
+
+		CopyImage<VOXEL_REAL,3>(pPyramid->GetOutput(0), pBeamSub->GetBeamlet(nAtShift));
+
+		// check that resolution is correct
+		ASSERT(pBeamSub->GetBeamlet(nAtShift)->GetSpacing()[0] == pBeamSub->GetPlan()->GetDoseResolution());
+	}
+
+}	// PlanPyramid::CalcSubBeamlets
+
+///////////////////////////////////////////////////////////////////////////////
+void 
+	PlanPyramid::CalcDirectBeamlets(int nLevel, int nBeam)
+	// calculates one beam's beamlets on the level's own dose grid
+{
+	CPlan *pPlanLevel = m_arrPlans[nLevel];
+	CBeam *pBeam = pPlanLevel->GetBeamAt(nBeam);
+	const int nBeamletCount = pBeam->GetBeamletCount() / 2;
+
+	// the level's plan has the coarser dose grid and the wider beamlet 
+	//	spacing (SetupLevel), so this is the finest level's calculation at
+	//	roughly an eighth of the cost per level
+	CBeamDoseCalc doseCalc(pBeam, pPlanLevel->m_pKernel);
+	doseCalc.InitCalcBeamlets();
+
+	for (int nAtShift = -nBeamletCount; nAtShift <= nBeamletCount; nAtShift++)
+	{
+		// copied into the existing beamlet, which histograms may refer to
+		VolumeReal::Pointer pBeamletDose = doseCalc.CalcBeamletDose(nAtShift);
+		CopyImage<VOXEL_REAL,3>(pBeamletDose, pBeam->GetBeamlet(nAtShift));
+
+		// check that resolution is correct
+		ASSERT(pBeam->GetBeamlet(nAtShift)->GetSpacing()[0] == pPlanLevel->GetDoseResolution());
+	}
+
+}	// PlanPyramid::CalcDirectBeamlets
 
 ///////////////////////////////////////////////////////////////////////////////
 void
@@ -276,4 +586,60 @@ PlanPyramid::InvFiltIntensityMap(int nLevel, const CBeam::IntensityMap * vWeight
 
 }	// PlanPyramid::InvFiltIntensityMap
 
+///////////////////////////////////////////////////////////////////////////////
+void
+PlanPyramid::RestrictIntensityMap(int nLevel, const CBeam::IntensityMap * vFineWeights,
+								CBeam::IntensityMap * vWeights, bool bAverage)
+{
+	const int nFineWeightsSize = (int) vFineWeights->GetBufferedRegion().GetSize()[0];
+	const int nWeightsSize = (int) vWeights->GetBufferedRegion().GetSize()[0];
+
+	ASSERT(nWeightsSize == GetPlan(nLevel)->GetBeamAt(0)->GetBeamletCount());
+	ASSERT(nFineWeightsSize == GetPlan(nLevel-1)->GetBeamAt(0)->GetBeamletCount());
+
+	// as for InvFiltIntensityMap, don't index past a mismatched buffer
+	if (nWeightsSize != GetPlan(nLevel)->GetBeamAt(0)->GetBeamletCount()
+		|| nFineWeightsSize != GetPlan(nLevel-1)->GetBeamAt(0)->GetBeamletCount())
+		return;
+
+	int nBeamletCountPrev = nWeightsSize / 2;
+	int nBeamletCountNext = nFineWeightsSize / 2;
+
+	// accumulate each fine element into the coarse elements it was 
+	//		interpolated from, with the same weights
+	vector<REAL> arrSum(nWeightsSize, 0.0);
+	vector<REAL> arrWeight(nWeightsSize, 0.0);
+	for (int nAtShift = -nBeamletCountNext; nAtShift <= nBeamletCountNext; nAtShift++)
+	{
+		const REAL fine = vFineWeights->GetBufferPointer()[nAtShift + nBeamletCountNext];
+		if (abs(nAtShift) % 2 == 0)
+		{
+			arrSum[nAtShift/2 + nBeamletCountPrev] += fine;
+			arrWeight[nAtShift/2 + nBeamletCountPrev] += 1.0;
+		}
+		else
+		{
+			int nLower = floor((double) nAtShift / 2.0);
+			int nHigher = ceil((double) nAtShift / 2.0);
+			if (nLower + nBeamletCountPrev >= 0)
+			{
+				arrSum[nLower + nBeamletCountPrev] += 0.5 * fine;
+				arrWeight[nLower + nBeamletCountPrev] += 0.5;
+			}
+			if (nHigher + nBeamletCountPrev < nWeightsSize)
+			{
+				arrSum[nHigher + nBeamletCountPrev] += 0.5 * fine;
+				arrWeight[nHigher + nBeamletCountPrev] += 0.5;
+			}
+		}
+	}
+
+	for (int nAt = 0; nAt < nWeightsSize; nAt++)
+	{
+		vWeights->GetBufferPointer()[nAt] = 
+			(bAverage && arrWeight[nAt] > 0.0) ? arrSum[nAt] / arrWeight[nAt] : arrSum[nAt];
+	}
+
+}	// PlanPyramid::RestrictIntensityMap
+
 }	// namespace dH
\ No newline at end of file
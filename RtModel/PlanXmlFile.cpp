@@ -2,48 +2,285 @@
 #include "PlanXmlFile.h"
 
 #include <itksys/SystemTools.hxx>
-#include <itkImageFileReader.h>
-#include <itkImageFileWriter.h>
+#include <itk_expat.h>
+
+#include <algorithm>
 
 namespace dH
 {
 
+// key of the chunk holding the plan XML
+static const char PLAN_XML_KEY[] = "plan.xml";
+
+// key of the chunk holding the plan dose
+static const char PLAN_DOSE_KEY[] = "plan_dose";
+
+//////////////////////////////////////////////////////////////////////////////
+// header of an image chunk: geometry of an image of up to three dimensions,
+//	followed in the chunk by its voxels
+//////////////////////////////////////////////////////////////////////////////
+struct ImageChunkHeader
+{
+	int m_nDimension;
+	int m_nSize[3];
+	double m_vOrigin[3];
+	double m_vSpacing[3];
+	double m_mDirection[9];
+};
+
+//////////////////////////////////////////////////////////////////////////////
+static std::string
+	FormatBeamletKey(int nBeam, int nBeamlet)
+{
+	char strKey[64];
+	sprintf_s(strKey, sizeof(strKey), "beam_%i/beamlet_%i", nBeam, nBeamlet);
+	return strKey;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+static std::string
+	FormatIntensityMapKey(int nBeam)
+{
+	char strKey[64];
+	sprintf_s(strKey, sizeof(strKey), "beam_%i/intensity_map", nBeam);
+	return strKey;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+template<unsigned int DIM>
+static bool
+	WriteImageChunk(PlanContainerWriter& container, const std::string& strKey,
+			const itk::Image<VOXEL_REAL, DIM> *pImage)
+	// writes the image's geometry and voxels as one chunk
+{
+	ImageChunkHeader header;
+	memset(&header, 0, sizeof(header));
+	header.m_nDimension = DIM;
+	for (int nD = 0; nD < 3; nD++)
+	{
+		header.m_nSize[nD] = 1;
+		header.m_vSpacing[nD] = 1.0;
+		header.m_mDirection[nD * 3 + nD] = 1.0;
+	}
+	for (unsigned int nD = 0; nD < DIM; nD++)
+	{
+		header.m_nSize[nD] = (int) pImage->GetBufferedRegion().GetSize()[nD];
+		header.m_vOrigin[nD] = pImage->GetOrigin()[nD];
+		header.m_vSpacing[nD] = pImage->GetSpacing()[nD];
+		for (unsigned int nD2 = 0; nD2 < DIM; nD2++)
+			header.m_mDirection[nD * 3 + nD2] = pImage->GetDirection()[nD][nD2];
+	}
+
+	return container.WriteFloatChunk(strKey, &header, sizeof(header),
+		pImage->GetBufferPointer(), pImage->GetBufferedRegion().GetNumberOfPixels());
+}
+
+//////////////////////////////////////////////////////////////////////////////
+template<unsigned int DIM>
+static bool
+	ReadImageChunk(PlanContainerReader& container, const std::string& strKey,
+			itk::Image<VOXEL_REAL, DIM> *pImage)
+	// reads an image written by WriteImageChunk, allocating it
+{
+	std::vector<char> arrData;
+	if (!container.ReadChunk(strKey, arrData)
+		|| arrData.size() < sizeof(ImageChunkHeader))
+	{
+		return false;
+	}
+
+	ImageChunkHeader header;
+	memcpy(&header, &arrData[0], sizeof(header));
+	if (header.m_nDimension != DIM)
+		return false;
+
+	typename itk::Image<VOXEL_REAL, DIM>::SizeType size;
+	typename itk::Image<VOXEL_REAL, DIM>::PointType origin;
+	typename itk::Image<VOXEL_REAL, DIM>::SpacingType spacing;
+	typename itk::Image<VOXEL_REAL, DIM>::DirectionType direction;
+	size_t nPixels = 1;
+	for (unsigned int nD = 0; nD < DIM; nD++)
+	{
+		size[nD] = header.m_nSize[nD];
+		origin[nD] = header.m_vOrigin[nD];
+		spacing[nD] = header.m_vSpacing[nD];
+		for (unsigned int nD2 = 0; nD2 < DIM; nD2++)
+			direction[nD][nD2] = header.m_mDirection[nD * 3 + nD2];
+		nPixels *= size[nD];
+	}
+	if (arrData.size() != sizeof(header) + nPixels * sizeof(VOXEL_REAL))
+		return false;
+
+	pImage->SetRegions(size);
+	pImage->SetOrigin(origin);
+	pImage->SetSpacing(spacing);
+	pImage->SetDirection(direction);
+	pImage->Allocate();
+	if (nPixels > 0)
+		memcpy(pImage->GetBufferPointer(), &arrData[sizeof(header)], nPixels * sizeof(VOXEL_REAL));
+	pImage->Modified();
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// class ContainerBeamletSource
+//
+// loads one beam's beamlets from a plan container, for Beam's lazy loading.
+//	the beamlets are found by the keys given in the XML, by index; a beamlet
+//	that wasn't written has an empty key, and loads as NULL
+//////////////////////////////////////////////////////////////////////////////
+class ContainerBeamletSource : public BeamletSource
+{
+public:
+	ContainerBeamletSource(std::shared_ptr<PlanContainerReader> pContainer,
+			const std::vector<std::string>& arrKeys)
+		: m_pContainer(pContainer)
+		, m_arrKeys(arrKeys)
+	{
+	}
+
+	virtual VolumeReal::Pointer LoadBeamlet(int nBeam, int nLevel, int nAt)
+	{
+		// only the finest level is stored
+		ASSERT(nLevel == 0);
+
+		if (nAt < 0 
+			|| nAt >= (int) m_arrKeys.size()
+			|| m_arrKeys[nAt].empty())
+		{
+			return NULL;
+		}
+
+		VolumeReal::Pointer pBeamlet = VolumeReal::New();
+		if (!ReadImageChunk<3>(*m_pContainer, m_arrKeys[nAt], pBeamlet))
+			return NULL;
+
+		return pBeamlet;
+	}
+
+private:
+	std::shared_ptr<PlanContainerReader> m_pContainer;
+
+	// chunk key of each beamlet, by index
+	std::vector<std::string> m_arrKeys;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// expat callbacks, forwarding to the reader
+//////////////////////////////////////////////////////////////////////////////
+static void
+	StartElementThunk(void *pUserData, const char *name, const char **atts)
+{
+	static_cast<PlanXmlReader *>(pUserData)->StartElement(name, atts);
+}
+
+static void
+	EndElementThunk(void *pUserData, const char *name)
+{
+	static_cast<PlanXmlReader *>(pUserData)->EndElement(name);
+}
+
+static void
+	CharacterDataThunk(void *pUserData, const char *inData, int inLength)
+{
+	static_cast<PlanXmlReader *>(pUserData)->CharacterDataHandler(inData, inLength);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+PlanXmlReader::PlanXmlReader()
+	: m_pSeries(NULL)
+	, m_nCurrentBeam(-1)
+	, m_nCurrentBeamlet(0)
+{
+}
+
 //////////////////////////////////////////////////////////////////////////////
 int 
 	PlanXmlReader::CanReadFile(const char* name)
 {
-	return itksys::SystemTools::FileExists(name) 
-		&& !itksys::SystemTools::FileIsDirectory(name)
-		&& itksys::SystemTools::FileLength(name) != 0;
+	PlanContainerReader container;
+	return container.Open(name) && container.HasChunk(PLAN_XML_KEY);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+void 
+	PlanXmlReader::GenerateOutputInformation()
+	// opens the container and parses the plan XML chunk
+{
+	m_pContainer.reset(new PlanContainerReader());
+	std::vector<char> arrXml;
+	if (!m_pContainer->Open(m_Filename.c_str())
+		|| !m_pContainer->ReadChunk(PLAN_XML_KEY, arrXml)
+		|| arrXml.empty())
+	{
+		itkExceptionMacro(<< "unable to read plan container " << m_Filename);
+	}
+
+	XML_Parser parser = XML_ParserCreate(NULL);
+	XML_SetUserData(parser, this);
+	XML_SetElementHandler(parser, &StartElementThunk, &EndElementThunk);
+	XML_SetCharacterDataHandler(parser, &CharacterDataThunk);
+	const int nResult = XML_Parse(parser, &arrXml[0], (int) arrXml.size(), 1);
+	XML_ParserFree(parser);
+
+	if (nResult == 0)
+	{
+		itkExceptionMacro(<< "unable to parse plan XML in " << m_Filename);
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////
 const char *
 	FindAttributeValue(const char **atts, const char * name)
+	// attributes come as name / value pairs
 {
 	for (const char **currentAttribute = atts; 
-		(*currentAttribute) != NULL; currentAttribute++)
+		(*currentAttribute) != NULL; currentAttribute += 2)
 	{
-		if (itksys::SystemTools::Strucmp((*currentAttribute),name))
-			return (*currentAttribute);
+		if (itksys::SystemTools::Strucmp((*currentAttribute),name) == 0)
+			return currentAttribute[1];
 	}
+
+	return NULL;
 }
 
 //////////////////////////////////////////////////////////////////////////////
 void 
 	PlanXmlReader::StartElement(const char * name,const char **atts)
 {
-	if (itksys::SystemTools::Strucmp(name,"BEAM") == 0)
+	m_currentCharacterData = "";
+
+	if (itksys::SystemTools::Strucmp(name,"PLAN") == 0)
+	{
+		m_pPlan = Plan::New();
+		if (GetSeries() != NULL)
+			m_pPlan->SetSeries(GetSeries());
+		SetOutputObject(m_pPlan);
+	}
+	else if (itksys::SystemTools::Strucmp(name,"BEAM") == 0)
 	{
 		m_pCurrentBeam = CBeam::New();
-		GetOutputObject()->AddBeam(m_pCurrentBeam);
+		m_nCurrentBeam = GetOutputObject()->AddBeam(m_pCurrentBeam) - 1;
+		m_arrCurrentBeamletKeys.clear();
 	}
 	else if (itksys::SystemTools::Strucmp(name, "BEAMLET") == 0)
 	{
 		assert(!m_pCurrentBeam.IsNull());
 		const char *strPosition = FindAttributeValue(atts, "position");
-		sscanf_s(strPosition, "%lf\\%lf", 
-			m_currentBeamletPosition[0], m_currentBeamletPosition[1]);
+		if (strPosition != NULL)
+		{
+			sscanf_s(strPosition, "%lf\\%lf",
+				&m_currentBeamletPosition[0], &m_currentBeamletPosition[1]);
+		}
+
+		// files written before the index was stored have every beamlet, in order
+		m_nCurrentBeamlet = (int) m_arrCurrentBeamletKeys.size();
+		const char *strIndex = FindAttributeValue(atts, "index");
+		if (strIndex != NULL)
+		{
+			sscanf_s(strIndex, "%i", &m_nCurrentBeamlet);
+		}
 	}
 	else if (itksys::SystemTools::Strucmp(name, "TARGET") == 0)
 	{
@@ -62,7 +299,10 @@ void
 	{
 		REAL resolution;
 		sscanf_s(m_currentCharacterData.c_str(), "%lf", &resolution);
-		GetOutputObject()->SetDoseResolution(resolution);
+
+		// the dose matrix is sized from the series
+		if (GetSeries() != NULL)
+			GetOutputObject()->SetDoseResolution(resolution);
 	}
 	else if (itksys::SystemTools::Strucmp(name,"CONVOLUTION") == 0)
 	{
@@ -70,7 +310,7 @@ void
 	else if (itksys::SystemTools::Strucmp(name,"PHIANGLES") == 0)
 	{
 	}
-	if (itksys::SystemTools::Strucmp(name,"ISOCENTER") == 0)
+	else if (itksys::SystemTools::Strucmp(name,"ISOCENTER") == 0)
 	{
 		itk::Vector<REAL> vIsocenter;
 		sscanf_s(m_currentCharacterData.c_str(), "%lf\\%lf\\%lf", 
@@ -87,27 +327,50 @@ void
 	{
 		REAL gantry;
 		sscanf_s(m_currentCharacterData.c_str(), "%lf", &gantry);
-		m_pCurrentBeam->SetGantryAngle(gantry);
+
+		// the beam's dose matrix is set up from the plan's
+		if (GetSeries() != NULL)
+			m_pCurrentBeam->SetGantryAngle(gantry);
 	}
 	else if (itksys::SystemTools::Strucmp(name, "INTENSITYMAP") == 0)
 	{
-		ImageFileReader<Beam::IntensityMap>::Pointer reader = 
-			ImageFileReader<Beam::IntensityMap>::New();
-		reader->SetFileName(m_currentCharacterData.c_str());
-		reader->Update();
-		// m_pCurrentBeam->SetIntensityMap(reader->GetOutput());
+		if (!ReadImageChunk<1>(*m_pContainer, m_currentCharacterData,
+				m_pCurrentBeam->GetIntensityMap()))
+		{
+			itkExceptionMacro(<< "missing intensity map " << m_currentCharacterData);
+		}
 	}
 	else if (itksys::SystemTools::Strucmp(name, "BEAMLET") == 0)
 	{
-		ImageFileReader<VolumeReal>::Pointer reader = 
-			ImageFileReader<VolumeReal>::New();
-		reader->SetFileName(m_currentCharacterData.c_str());
-		reader->Update();
-		// m_pCurrentBeam->InsertBeamlet(m_currentBeamletPosition, reader->GetOutput());
+		// beamlets are loaded by the beam when first used, by the key given
+		if (!m_pContainer->HasChunk(m_currentCharacterData))
+		{
+			itkExceptionMacro(<< "missing beamlet " << m_currentCharacterData);
+		}
+		if (m_nCurrentBeamlet < 0)
+		{
+			itkExceptionMacro(<< "bad beamlet index " << m_nCurrentBeamlet);
+		}
+		if (m_nCurrentBeamlet >= (int) m_arrCurrentBeamletKeys.size())
+		{
+			m_arrCurrentBeamletKeys.resize(m_nCurrentBeamlet + 1);
+		}
+		m_arrCurrentBeamletKeys[m_nCurrentBeamlet] = m_currentCharacterData;
 	}
 	else if (itksys::SystemTools::Strucmp(name,"BEAM") == 0)
 	{
-		// add intensity map and beamlets to beam
+		// add intensity map and beamlets to beam; the intensity map sets the 
+		//	count, so that beamlets missing at the end still have their slots
+		int nBeamletCount = (int) m_arrCurrentBeamletKeys.size();
+		nBeamletCount = std::max(nBeamletCount, 
+			(int) m_pCurrentBeam->GetIntensityMap()->GetBufferedRegion().GetSize()[0]);
+		if (!m_arrCurrentBeamletKeys.empty())
+		{
+			std::shared_ptr<BeamletSource> pSource(
+				new ContainerBeamletSource(m_pContainer, m_arrCurrentBeamletKeys));
+			m_pCurrentBeam->SetBeamletSource(pSource,
+				m_nCurrentBeam, 0, nBeamletCount);
+		}
 
 		m_pCurrentBeam = NULL;
 	}
@@ -126,10 +389,8 @@ void
 void 
 	PlanXmlReader::CharacterDataHandler(const char *inData, int inLength)
 {
-	// store character data for subsequent processing
-	m_currentCharacterData = "";
-	for(int i = 0; i < inLength; i++)
-		m_currentCharacterData = m_currentCharacterData + inData[i];
+	// the parser may deliver an element's data in pieces, so accumulate
+	m_currentCharacterData.append(inData, inLength);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -150,14 +411,14 @@ int
 int 
 	PlanXmlWriter::WriteFile()
 {
-	m_output.open(m_Filename.c_str());
-	if(m_output.fail())
+	if (!m_container.Open(m_Filename.c_str()))
 	{
 		return FALSE;
 	}
 
-	XMLWriterBase<Plan>::WriteStartElement("?xml version=\"1.0\"?", m_output);
-	m_output << std::endl;
+	m_output.str("");
+	m_nLevel = 0;
+	m_output << "<?xml version=\"1.0\"?>" << std::endl;
 
 	WriteStartElement("Plan");
 
@@ -182,26 +443,19 @@ int
 		WriteOptimizationParameters(m_InputObject);
 
 		// now write the plan dose
-		WriteStartElement("PlanDose");
-
-			const char *strExtension = "dcm";
-			char strDoseFilePath[128];
-			sprintf_s(strDoseFilePath, sizeof(strDoseFilePath),
-				"%s\\total_plan_dose.%s", m_strPlanDataPath, strExtension);
-			XMLWriterBase<Plan>::WriteCharacterData(strDoseFilePath, m_output);
-
-		WriteEndElement("PlanDose");
-
-		typedef itk::ImageFileWriter<VolumeReal> WriterType;
-		WriterType::Pointer writer = WriterType::New();
-		writer->SetFileName(strDoseFilePath);
-		writer->SetInput(m_InputObject->GetDoseMatrix());
-		writer->Update();
+		WriteElement("PlanDose", PLAN_DOSE_KEY);
+		WriteImageChunk<3>(m_container, PLAN_DOSE_KEY, m_InputObject->GetDoseMatrix());
 
 		// and finally the DVHs
 		WriteDVHs(m_InputObject);
 
 	WriteEndElement("Plan");
+
+	// the XML goes in last, as a chunk like the rest
+	const std::string strXml = m_output.str();
+	m_container.WriteChunk(PLAN_XML_KEY, strXml.c_str(), strXml.size());
+
+	return m_container.Close() ? TRUE : FALSE;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -235,13 +489,18 @@ void
 	WriteIntensityMap(nBeam, pBeam->GetIntensityMap());
 
 	WriteStartElement("Beamlets");
-	for (int nAtBeamlet = 0; nAtBeamlet < pBeam->GetBeamletCount(); nAtBeamlet++)
+	const int nBeamletCount = pBeam->GetBeamletCount();
+	for (int nAtBeamlet = 0; nAtBeamlet < nBeamletCount; nAtBeamlet++)
 	{
 		Beam::IntensityMap::IndexType index;
 		index[0] = nAtBeamlet;
 		Beam::IntensityMap::PointType position;
 		pBeam->GetIntensityMap()->TransformIndexToPhysicalPoint(index, position);
-		WriteBeamlet(nBeam, position, nAtBeamlet, pBeam->GetBeamlet(nAtBeamlet));
+
+		// GetBeamlet takes the shift from the central beamlet
+		VolumeReal *pBeamlet = pBeam->GetBeamlet(nAtBeamlet - nBeamletCount / 2);
+		if (pBeamlet != NULL)
+			WriteBeamlet(nBeam, position, nAtBeamlet, pBeamlet);
 	}
 	WriteEndElement("Beamlets");
 
@@ -252,18 +511,9 @@ void
 void 
 	PlanXmlWriter::WriteIntensityMap(int nBeam, Beam::IntensityMap * pIM)
 {
-	const char *strExtension = "dcm";
-	char strIntensityMapFilePath[128];
-	sprintf_s(strIntensityMapFilePath, sizeof(strIntensityMapFilePath),
-		"%s\\beam_%i\\intensity_map.%s", m_strPlanDataPath, nBeam, strExtension);
-
-	WriteElement("IntensityMap", strIntensityMapFilePath);
-
-	ImageFileWriter<Beam::IntensityMap>::Pointer writer = 
-		ImageFileWriter<Beam::IntensityMap>::New();
-	writer->SetFileName(strIntensityMapFilePath);
-	writer->SetInput(pIM);
-	writer->Update();
+	const std::string strKey = FormatIntensityMapKey(nBeam);
+	WriteElement("IntensityMap", strKey.c_str());
+	WriteImageChunk<1>(m_container, strKey, pIM);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -275,22 +525,17 @@ void
 	char strPosition[128];
 	sprintf_s(strPosition, sizeof(strPosition), "%lf\\%lf", position[0], position[1]);
 
-	WriteStartElement("Beamlet", "position", strPosition);
-
-	const char *strExtension = "dcm";
-	char strBeamletFilePath[128];
-	sprintf_s(strBeamletFilePath, sizeof(strBeamletFilePath),
-		"%s\\beam_%i\\beamlet_%i.%s", m_strPlanDataPath, nBeam, nBeamlet, strExtension);
-	XMLWriterBase<Plan>::WriteCharacterData(strBeamletFilePath, m_output);
-
+	// the XML refers to the beamlet's chunk by key, and gives its index, as
+	//	beamlets that aren't loaded are skipped
+	char strIndex[32];
+	sprintf_s(strIndex, sizeof(strIndex), "%i", nBeamlet);
+	const std::string strKey = FormatBeamletKey(nBeam, nBeamlet);
+	WriteStartElement("Beamlet", "position", strPosition, "index", strIndex);
+	m_output << strKey;
 	WriteEndElement("Beamlet");
 
-	// now write out the beamlet to the file
-	ImageFileWriter<VolumeReal>::Pointer writer = 
-		ImageFileWriter<VolumeReal>::New();
-	writer->SetFileName(strBeamletFilePath);
-	writer->SetInput(pBeamlet);
-	writer->Update();
+	// identical beamlets (e.g. all-zero ones) are stored once
+	WriteImageChunk<3>(m_container, strKey, pBeamlet);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -299,6 +544,13 @@ void
 {
 	WriteStartElement("Prescription");
 
+	// no prescription, so an empty element
+	if (pPrescription == NULL)
+	{
+		WriteEndElement("Prescription");
+		return;
+	}
+
 	Series *pImageSeries = pPrescription->GetPlan()->GetSeries();
 	for (int nAt = 0; nAt < pImageSeries->GetStructureCount(); nAt++)
 	{
@@ -397,23 +649,23 @@ void
 //////////////////////////////////////////////////////////////////////////////
 void 
 	PlanXmlWriter::WriteStartElement(const char *name, const char *attribute, 
-			const char *attribute_value)
+			const char *attribute_value, const char *attribute2, 
+			const char *attribute2_value)
 {
 	// write tabs
 	for (int nAt = 0; nAt < m_nLevel; nAt++)
 		m_output << '\t';
 
-	char strElement[128];
-	if (strlen(attribute) == 0)
+	m_output << '<' << name;
+	if (strlen(attribute) != 0)
 	{
-		strcpy_s(strElement, sizeof(strElement), name);
+		m_output << ' ' << attribute << "=\"" << attribute_value << '"';
 	}
-	else
+	if (strlen(attribute2) != 0)
 	{
-		sprintf_s(strElement, sizeof(strElement), 
-			"%s %s=\"%s\"", name, attribute, attribute_value);
+		m_output << ' ' << attribute2 << "=\"" << attribute2_value << '"';
 	}
-	XMLWriterBase<Plan>::WriteStartElement(strElement, m_output);
+	m_output << '>';
 	m_bEolBeforeEndElement = false;
 
 	m_nLevel++;
@@ -433,8 +685,7 @@ void
 	for (int nAt = 0; nAt < m_nLevel; nAt++)
 		m_output << '\t';
 
-	XMLWriterBase<Plan>::WriteEndElement(name, m_output);
-	m_output << std::endl;
+	m_output << "</" << name << '>' << std::endl;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -442,7 +693,7 @@ void
 	PlanXmlWriter::WriteElement(const char *name, const char *character_data)
 {
 	WriteStartElement(name);
-	XMLWriterBase<Plan>::WriteCharacterData(character_data, m_output);
+	m_output << character_data;
 	WriteEndElement(name);
 }
 
@@ -455,4 +706,4 @@ void
 	WriteElement(name, strData);
 }
 
-}
\ No newline at end of file
+}
@@ -7,6 +7,7 @@
 
 #include <ConjGradOptimizer.h>
 #include <HistogramGradient.h>
+#include <Profiler.h>
 #include <SigmoidParams.h>
 
 namespace dH
@@ -115,6 +116,21 @@ VOITerm *
 
 }	// Prescription::GetStructureTerm
 
+///////////////////////////////////////////////////////////////////////////////
+void
+	Prescription::GetStructureTerms(vector<VOITerm*>& arrTerms) const
+{
+	arrTerms.clear();
+	for (POSITION pos = m_mapVOITs.GetStartPosition(); pos != NULL;)
+	{
+		Structure *pStruct = NULL;
+		VOITerm *pVOIT = NULL;
+		m_mapVOITs.GetNextAssoc(pos, pStruct, pVOIT);
+		arrTerms.push_back(pVOIT);
+	}
+
+}	// Prescription::GetStructureTerms
+
 //static REAL GetSliceMax(VolumeReal *pVol, int nSlice)
 //{
 //	typedef itk::ImageRegionConstIterator< VolumeReal > ConstIteratorType;
@@ -152,12 +168,15 @@ void
 	// get any beam (as an exemplar)
 	CBeam *pBeam = m_pPlan->GetBeamAt(m_pPlan->GetBeamCount()-1);
 
-	// initialize the sum volume, so as to coincide with the beamlets
-	VolumeReal *pBeamlet = pBeam/*m_pPlan->GetBeamAt(m_pPlan->GetBeamCount()-1)*/->GetBeamlet(0);
+	// initialize the sum volume, so as to coincide with the beamlets (a 
+	//	sparse beamlet's grid, so as not to expand it)
+	const SparseBeamlet *pSparse = pBeam->GetSparseBeamlet(0);
+	VolumeReal *pBeamlet = pSparse 
+		? pSparse->m_pGrid.GetPointer()
+		: pBeam/*m_pPlan->GetBeamAt(m_pPlan->GetBeamCount()-1)*/->GetBeamlet(0);
 	ConformTo<VOXEL_REAL,3>(pBeamlet, m_sumVolume);
 
 	// initialize the histogram region
-	// TODO: fix this memory leak
 	VolumeReal *pResampRegion = pVOIT->GetVOI()->GetConformRegion(m_sumVolume);
 
 	// set histogram options
@@ -197,6 +216,14 @@ void
 		int nBeamlet;
 		GetBeamletFromSVElem(nAtElem, &nBeam, &nBeamlet);
 
+		// sparse beamlets stay sparse
+		const SparseBeamlet *pSparse = m_pPlan->GetBeamAt(nBeam)->GetSparseBeamlet(nBeamlet);
+		if (pSparse)
+		{
+			pHisto->Add_dVolume(*pSparse, nBeam);
+			continue;
+		}
+
 		VolumeReal *pBeamlet = m_pPlan->GetBeamAt(nBeam)->GetBeamlet(nBeamlet);
 		pHisto->Add_dVolume(pBeamlet, nBeam);
 	}
@@ -244,6 +271,103 @@ void
 
 }	// Prescription::UpdateTerms
 
+///////////////////////////////////////////////////////////////////////////////
+void 
+	Prescription::CloneTerms(Prescription *pPresc)
+	// adds a clone of each term of another prescription object
+{
+	POSITION pos = pPresc->m_mapVOITs.GetStartPosition();
+	while (pos != NULL)
+	{
+		Structure * pStruct = NULL;
+		VOITerm *pVOIT = NULL;
+		pPresc->m_mapVOITs.GetNextAssoc(pos, pStruct, pVOIT);
+
+		// the clone conforms to this level's beamlets when it is added
+		VOITerm *pClone = pVOIT->Clone();
+		if (pVOIT->GetHistogram()->IsLean())
+		{
+			pClone->GetHistogram()->SetLean(true);
+		}
+		AddStructureTerm(pClone);
+	}
+
+}	// Prescription::CloneTerms
+
+///////////////////////////////////////////////////////////////////////////////
+void 
+	Prescription::AccountMemory(MemoryReport& report, int nLevel) const
+	// adds the volumes held for this level to a memory report
+{
+	const MemoryOwner owner(nLevel);
+	report.AddImage(MEMORY_DOSE, owner, m_sumVolume.GetPointer());
+
+	report.AddImage(MEMORY_HISTOGRAM, owner, m_volGroupMaxVar.GetPointer());
+	report.AddImage(MEMORY_HISTOGRAM, owner, m_volGroupMinVar.GetPointer());
+	report.AddImage(MEMORY_HISTOGRAM, owner, m_volGroupMainMaxVar.GetPointer());
+	report.AddImage(MEMORY_HISTOGRAM, owner, m_volGroupMainMinVar.GetPointer());
+	report.AddImage(MEMORY_HISTOGRAM, owner, m_volMainMinVar.GetPointer());
+	report.AddImage(MEMORY_HISTOGRAM, owner, m_volMainMaxVar.GetPointer());
+	report.AddImage(MEMORY_HISTOGRAM, owner, m_volTemp.GetPointer());
+
+	POSITION pos = m_mapVOITs.GetStartPosition();
+	while (pos != NULL)
+	{
+		Structure * pStruct = NULL;
+		VOITerm *pVOIT = NULL;
+		m_mapVOITs.GetNextAssoc(pos, pStruct, pVOIT);
+
+		pVOIT->GetHistogram()->AccountMemory(report, 
+			MemoryOwner(nLevel, -1, pStruct->GetName()));
+
+		// the structures are shared by the levels, so are only counted once
+		pStruct->AccountMemory(report);
+	}
+
+}	// Prescription::AccountMemory
+
+///////////////////////////////////////////////////////////////////////////////
+void 
+	Prescription::SetLean(bool bLean)
+	// sets lean mode on all the terms' histograms
+{
+	POSITION pos = m_mapVOITs.GetStartPosition();
+	while (pos != NULL)
+	{
+		Structure * pStruct = NULL;
+		VOITerm *pVOIT = NULL;
+		m_mapVOITs.GetNextAssoc(pos, pStruct, pVOIT);
+		pVOIT->GetHistogram()->SetLean(bLean);
+	}
+
+}	// Prescription::SetLean
+
+///////////////////////////////////////////////////////////////////////////////
+void 
+	Prescription::ReleaseCaches()
+	// frees the helper volumes; they are recomputed on the next evaluation
+{
+	// CalcSumSigmoid conforms all of these before use; the sum volume 
+	//	is the histograms' volume, so it stays
+	ReleaseImage<VOXEL_REAL,3>(m_volGroupMaxVar);
+	ReleaseImage<VOXEL_REAL,3>(m_volGroupMinVar);
+	ReleaseImage<VOXEL_REAL,3>(m_volGroupMainMaxVar);
+	ReleaseImage<VOXEL_REAL,3>(m_volGroupMainMinVar);
+	ReleaseImage<VOXEL_REAL,3>(m_volMainMinVar);
+	ReleaseImage<VOXEL_REAL,3>(m_volMainMaxVar);
+	ReleaseImage<VOXEL_REAL,3>(m_volTemp);
+
+	POSITION pos = m_mapVOITs.GetStartPosition();
+	while (pos != NULL)
+	{
+		Structure * pStruct = NULL;
+		VOITerm *pVOIT = NULL;
+		m_mapVOITs.GetNextAssoc(pos, pStruct, pVOIT);
+		pVOIT->GetHistogram()->ReleaseHelperVolumes();
+	}
+
+}	// Prescription::ReleaseCaches
+
 //////////////////////////////////////////////////////////////////////////////
 void 
 	Prescription::SetGBinVar(REAL varMin, REAL varMax)
@@ -287,8 +411,6 @@ REAL
 	Prescription::operator()(const CVectorN<>& vInput, CVectorN<> *pGrad ) const
 	// objective function evaluator
 {
-	USES_CONVERSION;
-
 	// initialize total sum of objective function
 	REAL totalSum = 0.0;
 
@@ -338,10 +460,8 @@ REAL
 
 		if (pVOIT->GetWeight() >= DEFAULT_EPSILON)
 		{
-			CString strMessage;
-			strMessage.Format(_T("VOI = %s\n"), 
-				A2W(pVOIT->GetVOI()->GetName().c_str()));
-			OutputDebugString(strMessage);
+			LogMessageF(LOG_LEVEL_TRACE, "VOI = %s\n", 
+				pVOIT->GetVOI()->GetName().c_str());
 
 			// set fractions to histo
 			pVOIT->GetHistogram()->SetVarFracVolumes(m_volMainMinVar, m_volMainMaxVar);
@@ -414,73 +534,271 @@ REAL
 	const REAL w = GetEntropyWeight();
 	if (w != 0.0)
 	{
-		const int nDim = vInput.GetDim();
-		REAL entropy = 0.0;
+		const REAL entropy = EvalEntropy(vInput, w, pGrad);
 
-		if (GetEntropySeparable())
+		// F = KL - w*H
+		totalSum -= w * entropy;
+		m_dLastEntropy = entropy;
+
+		ASSERT(_finite(totalSum));
+	}
+
+	EndLogSection();
+
+	return totalSum;
+
+}	// Prescription::operator()
+
+///////////////////////////////////////////////////////////////////////////////
+REAL 
+	Prescription::EvalEntropy(const CVectorN<>& vInput, REAL weight, 
+			CVectorN<> *pGrad) const
+	// the regularizer's entropy H (see operator()); with pGrad, subtracts 
+	//		weight * dH
+{
+	const int nDim = vInput.GetDim();
+	REAL entropy = 0.0;
+
+	if (GetEntropySeparable())
+	{
+		for (int i = 0; i < nDim; i++)
 		{
-			for (int i = 0; i < nDim; i++)
-			{
-				const REAL q = Sigmoid(vInput[i], m_inputScale);
-				const REAL qc = (REAL) 1.0 - q;
-				if (q > 1e-12 && qc > 1e-12)
-					entropy -= q * (REAL) log(q) + qc * (REAL) log(qc);
+			const REAL q = Sigmoid(vInput[i], m_inputScale);
+			const REAL qc = (REAL) 1.0 - q;
+			if (q > 1e-12 && qc > 1e-12)
+				entropy -= q * (REAL) log(q) + qc * (REAL) log(qc);
 
-				if (pGrad)
-				{
-					const REAL ql = __max(q, (REAL) 1e-12);
-					const REAL qcl = __max(qc, (REAL) 1e-12);
-					const REAL dH = (REAL) log(qcl / ql) * dSigmoid(vInput[i], m_inputScale);
-					(*pGrad)[i] -= w * dH;
-				}
+			if (pGrad)
+			{
+				const REAL ql = __max(q, (REAL) 1e-12);
+				const REAL qcl = __max(qc, (REAL) 1e-12);
+				const REAL dH = (REAL) log(qcl / ql) * dSigmoid(vInput[i], m_inputScale);
+				(*pGrad)[i] -= weight * dH;
 			}
 		}
-		else
+	}
+	else
+	{
+		// softmax with max-subtraction for numerical stability
+		REAL vMax = vInput[0];
+		for (int i = 1; i < nDim; i++)
+			vMax = __max(vMax, vInput[i]);
+
+		CVectorN<> p;
+		p.SetDim(nDim);
+		REAL Z = 0.0;
+		for (int i = 0; i < nDim; i++)
 		{
-			// softmax with max-subtraction for numerical stability
-			REAL vMax = vInput[0];
-			for (int i = 1; i < nDim; i++)
-				vMax = __max(vMax, vInput[i]);
-
-			CVectorN<> p;
-			p.SetDim(nDim);
-			REAL Z = 0.0;
-			for (int i = 0; i < nDim; i++)
-			{
-				p[i] = (REAL) exp(vInput[i] - vMax);
-				Z += p[i];
-			}
-			for (int i = 0; i < nDim; i++)
-			{
-				p[i] /= Z;
-				if (p[i] > 1e-300)
-					entropy -= p[i] * (REAL) log(p[i]);
-			}
+			p[i] = (REAL) exp(vInput[i] - vMax);
+			Z += p[i];
+		}
+		for (int i = 0; i < nDim; i++)
+		{
+			p[i] /= Z;
+			if (p[i] > 1e-300)
+				entropy -= p[i] * (REAL) log(p[i]);
+		}
 
-			if (pGrad)
+		if (pGrad)
+		{
+			for (int k = 0; k < nDim; k++)
 			{
-				for (int k = 0; k < nDim; k++)
-				{
-					const REAL logpk = (REAL) log(__max(p[k], (REAL) 1e-300));
-					const REAL dH = -p[k] * (logpk + entropy);
-					(*pGrad)[k] -= w * dH;
-				}
+				const REAL logpk = (REAL) log(__max(p[k], (REAL) 1e-300));
+				const REAL dH = -p[k] * (logpk + entropy);
+				(*pGrad)[k] -= weight * dH;
 			}
 		}
+	}
 
-		// F = KL - w*H
-		totalSum -= w * entropy;
-		m_dLastEntropy = entropy;
+	return entropy;
 
-		ASSERT(_finite(totalSum));
+}	// Prescription::EvalEntropy
+
+
+///////////////////////////////////////////////////////////////////////////////
+void 
+	Prescription::EvaluateBatch(const std::vector< CVectorN<> >& arrInputs,
+			CVectorN<>& vValues, std::vector< CVectorN<> > *pGrads) const
+	// evaluates the objective function at each of a batch of points
+{
+	PROFILE_SCOPE("Prescription::EvaluateBatch");
+
+	const int nPoints = (int) arrInputs.size();
+	vValues.SetDim(nPoints);
+	vValues.SetZero();
+	if (nPoints == 0)
+	{
+		return;
 	}
 
-	EndLogSection();
+	// the dBins behind a gradient are of one point at a time
+	if (pGrads)
+	{
+		pGrads->resize(nPoints);
+		for (int nAt = 0; nAt < nPoints; nAt++)
+		{
+			vValues[nAt] = (*this)(arrInputs[nAt], &(*pGrads)[nAt]);
+		}
+		return;
+	}
 
-	return totalSum;
+	// transform inputs for calc purposes
+	std::vector< CVectorN<> > arrInputTrans(arrInputs);
+	for (int nAt = 0; nAt < nPoints; nAt++)
+	{
+		Transform(&arrInputTrans[nAt]);
+	}
 
-}	// Prescription::operator()
+	// the points' sums and var fraction volumes, formed with the first VOIT
+	std::vector<VolumeReal::Pointer> arrSum;
+	std::vector<VolumeReal::Pointer> arrMinVar;
+	std::vector<VolumeReal::Pointer> arrMaxVar;
+	bool bCalcSum = true;
+
+	// the terms are summed in the same order as operator() sums them
+	std::vector< CVectorN<> > arrGBins;
+	CVectorN<> vTermValues;
+	POSITION pos = m_mapVOITs.GetStartPosition();
+	while (pos != NULL)
+	{
+		Structure *pStruct = NULL;
+		VOITerm *pVOIT = NULL;
+		m_mapVOITs.GetNextAssoc(pos, pStruct, pVOIT);
+
+		if (bCalcSum)
+		{
+			CalcSumSigmoidBatch(pVOIT->GetHistogram(), arrInputs, arrInputTrans, 
+				m_arrIncludeElement, arrSum, arrMinVar, arrMaxVar);
+			bCalcSum = false;
+		}
+
+		if (pVOIT->GetWeight() >= DEFAULT_EPSILON)
+		{
+			// all the points' histograms in one sweep of the region
+			pVOIT->GetHistogram()->GetGBinsBatch(arrSum, arrMinVar, arrMaxVar, arrGBins);
+			pVOIT->EvalBatch(arrGBins, vTermValues);
+			vValues += vTermValues;
+		}
+	}
+
+	m_dLastKL = vValues[nPoints-1];
+	m_dLastEntropy = 0.0;
+
+	// F = KL - w*H, as operator()
+	const REAL w = GetEntropyWeight();
+	if (w != 0.0)
+	{
+		for (int nAt = 0; nAt < nPoints; nAt++)
+		{
+			const REAL entropy = EvalEntropy(arrInputs[nAt], w, NULL);
+			vValues[nAt] -= w * entropy;
+			m_dLastEntropy = entropy;
+		}
+	}
+
+}	// Prescription::EvaluateBatch
+
+///////////////////////////////////////////////////////////////////////////////
+REAL 
+	Prescription::CalcActualVariance(int nElem, const CVectorN<>& vInput,
+			const CVectorN<>& vInputTrans) const
+	// a beamlet's variance, adjusted for the transform slope
+{
+	// check adaptive variance value
+	ASSERT((*m_pAV)[nElem] <= (m_varMax + 1e-6));
+	ASSERT((*m_pAV)[nElem] >= (m_varMin - 1e-6));
+
+	// determine variance using dSigmoid
+	REAL varSlope = 1.0;
+	REAL varWeight = 1.0;
+	if (GetTransformSlopeVariance())
+	{
+		// calculate variance adjustment due to sigmoid transform
+		varSlope = 
+			SIGMOID_SCALE * dSigmoid(vInput[nElem], m_inputScale);
+
+		// this is equivalent to scaling the level sigma's so that their current
+		//	value is the equal to that at optimizer value -4.0
+		varSlope /= SIGMOID_SCALE * dSigmoid(0.0, m_inputScale);
+
+		// compute the variance adjustment for the beamlet weight
+		varWeight = vInputTrans[nElem];
+
+		// normalize so that beamlet weight at scale / 2 is 1.0
+		varWeight /= SIGMOID_SCALE / 2.0;
+	}
+	REAL actVar = (*m_pAV)[nElem] * varSlope * varSlope * varWeight * varWeight;
+	actVar = __max(actVar, m_varMin);
+	actVar = __min(actVar, m_varMax);
+
+	return actVar;
+
+}	// Prescription::CalcActualVariance
+
+///////////////////////////////////////////////////////////////////////////////
+static void
+	ResampleToBasis(VolumeReal *pFrom, VolumeReal *pBasis, VolumeReal *pTo)
+	// resamples a group's volume to the main sumVolume basis
+{
+	ConformTo<VOXEL_REAL,3>(pBasis, pTo);
+	pTo->FillBuffer(0.0); 
+
+	itk::ResampleImageFilter<VolumeReal, VolumeReal>::Pointer resampler = 
+		itk::ResampleImageFilter<VolumeReal, VolumeReal>::New();
+	resampler->SetInput(pFrom);
+
+	typedef itk::AffineTransform<REAL, 3> TransformType;
+	TransformType::Pointer transform = TransformType::New();
+	transform->SetIdentity();
+	resampler->SetTransform(transform);
+
+	typedef itk::LinearInterpolateImageFunction<VolumeReal, REAL> InterpolatorType;
+	InterpolatorType::Pointer interpolator = InterpolatorType::New();
+	resampler->SetInterpolator( interpolator );
+
+	VolumeReal::Pointer pPointToVolume = pTo;
+	resampler->SetOutputParametersFromImage(pPointToVolume);
+	resampler->Update();
+	CopyImage<VOXEL_REAL, 3>(resampler->GetOutput(), pTo);
+
+}	// ResampleToBasis
 
+///////////////////////////////////////////////////////////////////////////////
+static void
+	AccumulateBatch(const VolumeReal *pVolume, const std::vector<REAL>& arrWeights,
+		const std::vector<VolumeReal *>& arrSrcDst)
+	// adds each weight times the volume to its volume, as Accumulate3D does,
+	//	reading the volume once
+{
+	const int nCount = (int) arrSrcDst.size();
+	const int nVoxels = (int) pVolume->GetBufferedRegion().GetNumberOfPixels();
+
+	std::vector<VOXEL_REAL *> arrVoxels(nCount);
+	for (int nAt = 0; nAt < nCount; nAt++)
+	{
+		ASSERT(arrSrcDst[nAt]->GetBufferedRegion().GetSize() 
+			== pVolume->GetBufferedRegion().GetSize());
+		arrVoxels[nAt] = arrSrcDst[nAt]->GetBufferPointer();
+	}
+
+	const VOXEL_REAL *pVoxels = pVolume->GetBufferPointer();
+	for (int nVoxel = 0; nVoxel < nVoxels; nVoxel++)
+	{
+		// a beamlet is zero over most of the grid
+		const VOXEL_REAL value = pVoxels[nVoxel];
+		if (value == 0.0)
+		{
+			continue;
+		}
+
+		for (int nAt = 0; nAt < nCount; nAt++)
+		{
+			arrVoxels[nAt][nVoxel] = 
+				(VOXEL_REAL) (arrVoxels[nAt][nVoxel] + arrWeights[nAt] * value);
+		}
+	}
+
+}	// AccumulateBatch
 
 ///////////////////////////////////////////////////////////////////////////////
 void 
@@ -494,6 +812,11 @@ void
 
 	// get the main volume
 	VolumeReal *pVolume = pHisto->GetVolume();
+
+	// reads each dVolume, writes the sum and the min/max variance volumes
+	PROFILE_SCOPE_BYTES("Prescription::CalcSumSigmoid",
+		(pHisto->Get_dVolumeCount() + 3) * sizeof(VOXEL_REAL)
+			* pVolume->GetBufferedRegion().GetNumberOfPixels());
 	pVolume->FillBuffer(0.0);
 
 	ConformTo<VOXEL_REAL,3>(pVolume, m_volMainMinVar);
@@ -539,32 +862,7 @@ void
 						m_ActualAV.SetZero();
 					}
 
-					// check adaptive variance value
-					ASSERT((*m_pAV)[nAt_dVolume] <= (m_varMax + 1e-6));
-					ASSERT((*m_pAV)[nAt_dVolume] >= (m_varMin - 1e-6));
-
-					// determine variance using dSigmoid
-					REAL varSlope = 1.0;
-					REAL varWeight = 1.0;
-					if (GetTransformSlopeVariance())
-					{
-						// calculate variance adjustment due to sigmoid transform
-						varSlope = 
-							SIGMOID_SCALE * dSigmoid(vInput[nAt_dVolume], m_inputScale);
-
-						// this is equivalent to scaling the level sigma's so that their current
-						//	value is the equal to that at optimizer value -4.0
-						varSlope /= SIGMOID_SCALE * dSigmoid(0.0, m_inputScale);
-
-						// compute the variance adjustment for the beamlet weight
-						varWeight = vInputTrans[nAt_dVolume];
-
-						// normalize so that beamlet weight at scale / 2 is 1.0
-						varWeight /= SIGMOID_SCALE / 2.0;
-					}
-					REAL actVar = (*m_pAV)[nAt_dVolume] * varSlope * varSlope * varWeight * varWeight;
-					actVar = __max(actVar, m_varMin);
-					actVar = __min(actVar, m_varMax);
+					const REAL actVar = CalcActualVariance(nAt_dVolume, vInput, vInputTrans);
 					m_ActualAV[nAt_dVolume] = actVar;
 
 					// calculate fractional parts
@@ -576,13 +874,23 @@ void
 
 					// calculate max part
 					const REAL weightMaxVar = vInputTrans[nAt_dVolume] * fracMax; 
+					const REAL weightMinVar = vInputTrans[nAt_dVolume] * fracMin; 
+
+					// a sparse beamlet adds just its non-zero voxels
+					const SparseBeamlet *pSparse = pHisto->Get_dVolumeSparse(nAt_dVolume);
+					if (pSparse)
+					{
+						pSparse->Accumulate(weightMaxVar, m_volGroupMaxVar);
+						pSparse->Accumulate(weightMinVar, m_volGroupMinVar);
+						continue;
+					}
+
 					ConformTo<VOXEL_REAL,3>(m_volGroupMaxVar, m_volTemp);
 					// Accumulate<VOXEL_REAL>(p_dVolume, weightMaxVar, 
 					Accumulate3D<VOXEL_REAL>(p_dVolume, weightMaxVar, 
 						m_volGroupMaxVar, m_volTemp); 
 
 					// calculate min part
-					const REAL weightMinVar = vInputTrans[nAt_dVolume] * fracMin; 
 					ConformTo<VOXEL_REAL,3>(m_volGroupMinVar, m_volTemp);
 					// Accumulate<VOXEL_REAL>(p_dVolume, weightMinVar,
 					Accumulate3D<VOXEL_REAL>(p_dVolume, weightMinVar,
@@ -592,55 +900,8 @@ void
 		}
 
 		// now rotate the groups sum to the main sumVolume basis
-		ConformTo<VOXEL_REAL,3>(pVolume, m_volGroupMainMaxVar);
-		m_volGroupMainMaxVar->FillBuffer(0.0); 
-		//Resample(m_volGroupMaxVar, m_volGroupMainMaxVar, TRUE);
-		//Resample3D(m_volGroupMaxVar, m_volGroupMainMaxVar, TRUE);
-		itk::ResampleImageFilter<VolumeReal, VolumeReal>::Pointer resamplerMax = 
-			itk::ResampleImageFilter<VolumeReal, VolumeReal>::New();
-		resamplerMax->SetInput(m_volGroupMaxVar);
-
-		typedef itk::AffineTransform<REAL, 3> TransformType;
-		TransformType::Pointer transform = TransformType::New();
-		transform->SetIdentity();
-		resamplerMax->SetTransform(transform);
-
-		typedef itk::LinearInterpolateImageFunction<VolumeReal, REAL> InterpolatorType;
-		InterpolatorType::Pointer interpolator = InterpolatorType::New();
-		resamplerMax->SetInterpolator( interpolator );
-
-		VolumeReal::Pointer pPointToVolume = static_cast<VolumeReal*>(m_volGroupMainMaxVar);
-		resamplerMax->SetOutputParametersFromImage(pPointToVolume);
-		resamplerMax->Update();
-		CopyImage<VOXEL_REAL, 3>(resamplerMax->GetOutput(), m_volGroupMainMaxVar);
-
-
-
-
-		ConformTo<VOXEL_REAL,3>(pVolume, m_volGroupMainMinVar);
-		m_volGroupMainMinVar->FillBuffer(0.0); 
-		//Resample(m_volGroupMinVar, m_volGroupMainMinVar, TRUE);
-		//Resample3D(m_volGroupMinVar, m_volGroupMainMinVar, TRUE);
-
-
-		itk::ResampleImageFilter<VolumeReal, VolumeReal>::Pointer resamplerMin = 
-			itk::ResampleImageFilter<VolumeReal, VolumeReal>::New();
-		resamplerMin->SetInput(m_volGroupMinVar);
-
-		//typedef itk::AffineTransform<REAL, 3> TransformType;
-		//TransformType::Pointer transform = TransformType::New();
-		//transform->SetIdentity();
-		resamplerMin->SetTransform(transform);
-
-		//typedef itk::LinearInterpolateImageFunction<VolumeReal, REAL> InterpolatorType;
-		//InterpolatorType::Pointer interpolator = InterpolatorType::New();
-		resamplerMin->SetInterpolator( interpolator );
-
-		/*VolumeReal::Pointer*/ pPointToVolume = static_cast<VolumeReal*>(m_volGroupMainMinVar);
-		resamplerMin->SetOutputParametersFromImage(pPointToVolume);
-		resamplerMin->Update();
-		CopyImage<VOXEL_REAL, 3>(resamplerMin->GetOutput(), m_volGroupMainMinVar);
-
+		ResampleToBasis(m_volGroupMaxVar, pVolume, m_volGroupMainMaxVar);
+		ResampleToBasis(m_volGroupMinVar, pVolume, m_volGroupMainMinVar);
 
 
 		/// TODO check this
@@ -684,6 +945,165 @@ void
 
 }	// Prescription::CalcSumSigmoid
 
+///////////////////////////////////////////////////////////////////////////////
+void 
+	Prescription::CalcSumSigmoidBatch(CHistogramWithGradient *pHisto, 
+			const std::vector< CVectorN<> >& arrInputs,
+			const std::vector< CVectorN<> >& arrInputTrans,
+			const CArray<BOOL, BOOL>& arrInclude,
+			std::vector<VolumeReal::Pointer>& arrSum,
+			std::vector<VolumeReal::Pointer>& arrMinVar,
+			std::vector<VolumeReal::Pointer>& arrMaxVar) const
+	// computes the sums of weights for a batch of input vectors
+{
+	const int nPoints = (int) arrInputs.size();
+
+	// the histogram's volume gives the main basis
+	VolumeReal *pVolume = pHisto->GetVolume();
+
+	// reads each dVolume once, writes each point's sum and min/max variance 
+	//	volumes
+	PROFILE_SCOPE_BYTES("Prescription::CalcSumSigmoidBatch",
+		(pHisto->Get_dVolumeCount() + 3 * nPoints) * sizeof(VOXEL_REAL)
+			* pVolume->GetBufferedRegion().GetNumberOfPixels());
+
+	// each point's volumes, and its group accumulators
+	arrSum.resize(nPoints);
+	arrMinVar.resize(nPoints);
+	arrMaxVar.resize(nPoints);
+	std::vector<VolumeReal::Pointer> arrGroupMaxVar(nPoints);
+	std::vector<VolumeReal::Pointer> arrGroupMinVar(nPoints);
+	for (int nAt = 0; nAt < nPoints; nAt++)
+	{
+		ASSERT(arrInputTrans[nAt].GetDim() == pHisto->Get_dVolumeCount());
+
+		arrSum[nAt] = VolumeReal::New();
+		ConformTo<VOXEL_REAL,3>(pVolume, arrSum[nAt]);
+		arrSum[nAt]->FillBuffer(0.0);
+
+		arrMinVar[nAt] = VolumeReal::New();
+		ConformTo<VOXEL_REAL,3>(pVolume, arrMinVar[nAt]);
+		arrMinVar[nAt]->FillBuffer(0.0);
+
+		arrMaxVar[nAt] = VolumeReal::New();
+		ConformTo<VOXEL_REAL,3>(pVolume, arrMaxVar[nAt]);
+		arrMaxVar[nAt]->FillBuffer(0.0);
+
+		arrGroupMaxVar[nAt] = VolumeReal::New();
+		arrGroupMinVar[nAt] = VolumeReal::New();
+	}
+
+	// a beamlet's weights for each point's max var group volume, then for 
+	//	each point's min var group volume
+	std::vector<REAL> arrWeights(2 * nPoints);
+	std::vector<VolumeReal *> arrGroupVolumes(2 * nPoints);
+	for (int nAt = 0; nAt < nPoints; nAt++)
+	{
+		arrGroupVolumes[nAt] = arrGroupMaxVar[nAt];
+		arrGroupVolumes[nPoints + nAt] = arrGroupMinVar[nAt];
+	}
+
+	int nMaxGroup = pHisto->GetGroupCount();
+	for (int nAtGroup = 0; nAtGroup < nMaxGroup; nAtGroup++)
+	{
+		bool bInitVolGroup = true;
+
+		for (int nAt_dVolume = 0; nAt_dVolume < pHisto->Get_dVolumeCount();
+			nAt_dVolume++)
+		{
+			int nGroup = 0;
+			VolumeReal *p_dVolume = pHisto->Get_dVolume(nAt_dVolume, &nGroup);
+			if (nGroup != nAtGroup)
+			{
+				continue;
+			}
+
+			if (bInitVolGroup)
+			{
+				for (int nAt = 0; nAt < 2 * nPoints; nAt++)
+				{
+					ConformTo<VOXEL_REAL,3>(p_dVolume, arrGroupVolumes[nAt]);
+					arrGroupVolumes[nAt]->FillBuffer(0.0);
+				}
+				bInitVolGroup = false;
+			}
+
+			if (!arrInclude[nAt_dVolume])
+			{
+				continue;
+			}
+
+			// the beamlet's weight at each point, split between the var 
+			//	max and min parts as in CalcSumSigmoid
+			for (int nAt = 0; nAt < nPoints; nAt++)
+			{
+				const REAL actVar = CalcActualVariance(nAt_dVolume, 
+					arrInputs[nAt], arrInputTrans[nAt]);
+				const REAL fracMax = (actVar - m_varMin) / (m_varMax - m_varMin);
+				const REAL fracMin = 1.0 - fracMax; 
+
+				arrWeights[nAt] = arrInputTrans[nAt][nAt_dVolume] * fracMax;
+				arrWeights[nPoints + nAt] = arrInputTrans[nAt][nAt_dVolume] * fracMin;
+			}
+
+			// and add it to all of the points' group volumes at once
+			const SparseBeamlet *pSparse = pHisto->Get_dVolumeSparse(nAt_dVolume);
+			if (pSparse)
+			{
+				pSparse->AccumulateBatch(&arrWeights[0], &arrGroupVolumes[0], 2 * nPoints);
+			}
+			else
+			{
+				AccumulateBatch(p_dVolume, arrWeights, arrGroupVolumes);
+			}
+		}
+
+		// a group without beamlets adds nothing
+		if (bInitVolGroup)
+		{
+			continue;
+		}
+
+		// now rotate each point's group sums to the main basis
+		for (int nAt = 0; nAt < nPoints; nAt++)
+		{
+			ResampleToBasis(arrGroupMaxVar[nAt], pVolume, m_volGroupMainMaxVar);
+			ResampleToBasis(arrGroupMinVar[nAt], pVolume, m_volGroupMainMinVar);
+
+			ConformTo<VOXEL_REAL,3>(arrMinVar[nAt], m_volTemp);	
+			Accumulate3D<VOXEL_REAL>(m_volGroupMainMinVar, 1.0,		
+				arrMinVar[nAt], m_volTemp);
+
+			ConformTo<VOXEL_REAL,3>(arrMaxVar[nAt], m_volTemp);	
+			Accumulate3D<VOXEL_REAL>(m_volGroupMainMaxVar, 1.0, 
+				arrMaxVar[nAt], m_volTemp); 
+		}
+	}
+
+	// and sum each point's volume, and calculate its fractions
+	for (int nAt = 0; nAt < nPoints; nAt++)
+	{
+		ConformTo<VOXEL_REAL,3>(pVolume, m_volTemp);
+		Accumulate3D<VOXEL_REAL>(arrMaxVar[nAt], 1.0,
+			arrSum[nAt], m_volTemp); 
+		Accumulate3D<VOXEL_REAL>(arrMinVar[nAt], 1.0, 
+			arrSum[nAt], m_volTemp); 
+
+		DivVoxels(arrMaxVar[nAt]->GetBufferPointer(), 
+			arrMaxVar[nAt]->GetBufferedRegion().GetSize()[0],
+			arrSum[nAt]->GetBufferPointer(), 
+			arrSum[nAt]->GetBufferedRegion().GetSize()[0], 
+			arrMaxVar[nAt]->GetBufferedRegion().GetSize()); 
+
+		DivVoxels(arrMinVar[nAt]->GetBufferPointer(),
+			arrMinVar[nAt]->GetBufferedRegion().GetSize()[0],
+			arrSum[nAt]->GetBufferPointer(), 
+			arrSum[nAt]->GetBufferedRegion().GetSize()[0], 
+			arrMinVar[nAt]->GetBufferedRegion().GetSize());
+	}
+
+}	// Prescription::CalcSumSigmoidBatch
+
 ///////////////////////////////////////////////////////////////////////////////
 void 
 	Prescription::Transform(CVectorN<> *pvInOut) const
@@ -745,6 +1165,22 @@ void
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////
+bool 
+	Prescription::UpdateHistogramRegion(Structure *pStruct)
+	// updates the histogram region of one structure's term
+{
+	VOITerm *pVOIT = NULL;
+	if (!m_mapVOITs.Lookup(pStruct, pVOIT))
+		return false;
+
+	// the conform region is resampled again if the structure's region changed
+	VolumeReal *pResampRegion = pStruct->GetConformRegion(m_sumVolume);
+	pVOIT->GetHistogram()->SetRegion(pResampRegion);
+
+	return true;
+}
+
 /// TODO: figure out where SetElementInclude is / should be called
 /// TODO: figure out where SetElementInclude is / should be called
 /// TODO: figure out where SetElementInclude is / should be called
@@ -0,0 +1,439 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#include "stdafx.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include <Profiler.h>
+
+namespace dH
+{
+
+// on if BRIMSTONE_PROFILE names a trace file
+std::atomic<bool> g_bProfileEnabled(getenv("BRIMSTONE_PROFILE") != NULL);
+
+///////////////////////////////////////////////////////////////////////////////
+static long long
+	GetNanos()
+	// steady_clock, in nanoseconds
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// interval over which the TSC is timed
+static const long long PROFILE_CALIBRATION_NANOS = 10000000;
+
+///////////////////////////////////////////////////////////////////////////////
+ProfileBuffer::ProfileBuffer()
+	: m_pHead(NULL)
+	, m_pTail(NULL)
+	, m_nNextFirst(0)
+	, m_nDiscarded(0)
+	, m_nThread(0)
+	, m_bRetired(false)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+ProfileBuffer::~ProfileBuffer()
+{
+	while (m_pHead != NULL)
+	{
+		ProfileBlock *pNext = m_pHead->m_pNext;
+		delete m_pHead;
+		m_pHead = pNext;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+unsigned long long
+	ProfileBuffer::GetPublishedCount() const
+{
+	if (m_pTail == NULL)
+		return m_nNextFirst;
+
+	return m_pTail->m_nFirst + m_pTail->m_nCount.load(std::memory_order_acquire);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	ProfileBuffer::FreeDiscardedBlocks(bool bIncludeTail)
+	// called under the profiler's lock
+{
+	while (m_pHead != NULL
+		&& (bIncludeTail || m_pHead != m_pTail)
+		&& m_pHead->m_nFirst + m_pHead->m_nCount.load(std::memory_order_acquire)
+			<= m_nDiscarded)
+	{
+		ProfileBlock *pNext = m_pHead->m_pNext;
+		if (m_pHead == m_pTail)
+			m_pTail = NULL;
+		delete m_pHead;
+		m_pHead = pNext;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Profiler::Profiler()
+	: m_nLevel(-1)
+	, m_nIteration(-1)
+	, m_nNextThread(0)
+{
+	m_ticksPerMicrosecond = CalibrateTicks();
+	m_nStartTicks = GetTicks();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+Profiler&
+	Profiler::GetInstance()
+{
+	static Profiler s_profiler;
+	return s_profiler;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	Profiler::Enable(bool bEnable)
+{
+	// constructs the profiler, so the trace clock starts no later than now
+	GetInstance();
+	g_bProfileEnabled.store(bEnable);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	Profiler::Reset()
+	// discards the events, and restarts the trace clock
+{
+	std::lock_guard<std::mutex> lock(m_mutexBuffers);
+	for (size_t nAt = 0; nAt < m_arrBuffers.size(); )
+	{
+		if (m_arrBuffers[nAt]->m_bRetired.load())
+		{
+			m_arrBuffers.erase(m_arrBuffers.begin() + nAt);
+		}
+		else
+		{
+			// the owning thread may be writing to the tail block, so its
+			//	events are marked discarded, and the block is freed later
+			ProfileBuffer *pBuffer = m_arrBuffers[nAt].get();
+			pBuffer->m_nDiscarded = pBuffer->GetPublishedCount();
+			pBuffer->FreeDiscardedBlocks(false);
+			nAt++;
+		}
+	}
+
+	m_nStartTicks = GetTicks();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	Profiler::SetLevel(int nLevel)
+{
+	m_nLevel.store(nLevel, std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	Profiler::SetIteration(int nIteration)
+{
+	m_nIteration.store(nIteration, std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	Profiler::GetLevel() const
+{
+	return m_nLevel.load(std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	Profiler::GetIteration() const
+{
+	return m_nIteration.load(std::memory_order_relaxed);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+unsigned long long
+	Profiler::GetTicks()
+{
+#ifdef _MSC_VER
+	return __rdtsc();
+#else
+	return (unsigned long long) GetNanos();
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+double
+	Profiler::GetTicksPerMicrosecond() const
+{
+	return m_ticksPerMicrosecond;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+double
+	Profiler::CalibrateTicks()
+	// the tick rate; the TSC's is invariant on every processor this is likely
+	//	to run on, so it is timed once
+{
+#ifdef _MSC_VER
+	const long long nStartNanos = GetNanos();
+	const unsigned long long nStartTicks = GetTicks();
+	long long nElapsedNanos;
+	do
+	{
+		nElapsedNanos = GetNanos() - nStartNanos;
+	} while (nElapsedNanos < PROFILE_CALIBRATION_NANOS);
+
+	return (double) (GetTicks() - nStartTicks) * 1000.0 / (double) nElapsedNanos;
+#else
+	return 1000.0;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// holds a thread's buffer; marks it retired when the thread exits, so empty
+//	buffers of the short-lived ParallelForChunks workers can be dropped
+///////////////////////////////////////////////////////////////////////////////
+struct ProfileBufferHolder
+{
+	~ProfileBufferHolder()
+	{
+		if (m_pBuffer)
+			m_pBuffer->m_bRetired.store(true);
+	}
+
+	std::shared_ptr<ProfileBuffer> m_pBuffer;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+ProfileBuffer *
+	Profiler::GetThreadBuffer()
+{
+	static thread_local ProfileBufferHolder s_holder;
+	if (!s_holder.m_pBuffer)
+	{
+		s_holder.m_pBuffer.reset(new ProfileBuffer());
+
+		std::lock_guard<std::mutex> lock(m_mutexBuffers);
+
+		// drop the buffers of exited threads that have no events to report
+		for (size_t nAt = 0; nAt < m_arrBuffers.size(); )
+		{
+			ProfileBuffer *pBuffer = m_arrBuffers[nAt].get();
+			if (pBuffer->m_bRetired.load() 
+				&& pBuffer->GetPublishedCount() == pBuffer->m_nDiscarded)
+				m_arrBuffers.erase(m_arrBuffers.begin() + nAt);
+			else
+				nAt++;
+		}
+
+		s_holder.m_pBuffer->m_nThread = m_nNextThread++;
+		m_arrBuffers.push_back(s_holder.m_pBuffer);
+	}
+
+	return s_holder.m_pBuffer.get();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	Profiler::Record(const ProfileEvent& event)
+	// no lock, except to add a block when the last is full
+{
+	ProfileBuffer *pBuffer = GetThreadBuffer();
+
+	ProfileBlock *pBlock = pBuffer->m_pTail;
+	size_t nCount = (pBlock != NULL)
+		? pBlock->m_nCount.load(std::memory_order_relaxed) : ProfileBlock::EVENT_COUNT;
+	if (nCount == ProfileBlock::EVENT_COUNT)
+	{
+		pBlock = AddBlock(pBuffer);
+		nCount = 0;
+	}
+
+	pBlock->m_arrEvents[nCount] = event;
+	pBlock->m_nCount.store(nCount + 1, std::memory_order_release);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+ProfileBlock *
+	Profiler::AddBlock(ProfileBuffer *pBuffer)
+	// called by the buffer's owning thread
+{
+	ProfileBlock *pBlock = new ProfileBlock();
+	pBlock->m_nCount.store(0, std::memory_order_relaxed);
+	pBlock->m_pNext = NULL;
+
+	std::lock_guard<std::mutex> lock(m_mutexBuffers);
+
+	// the full tail can go too, if it was reset
+	pBuffer->FreeDiscardedBlocks(true);
+
+	pBlock->m_nFirst = pBuffer->GetPublishedCount();
+	if (pBuffer->m_pTail != NULL)
+		pBuffer->m_pTail->m_pNext = pBlock;
+	else
+		pBuffer->m_pHead = pBlock;
+	pBuffer->m_pTail = pBlock;
+	pBuffer->m_nNextFirst = pBlock->m_nFirst + ProfileBlock::EVENT_COUNT;
+
+	return pBlock;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void
+	Profiler::CollectEvents(std::vector<std::pair<int, ProfileEvent> >& arrEvents)
+{
+	std::lock_guard<std::mutex> lock(m_mutexBuffers);
+	for (size_t nAt = 0; nAt < m_arrBuffers.size(); nAt++)
+	{
+		ProfileBuffer *pBuffer = m_arrBuffers[nAt].get();
+		for (ProfileBlock *pBlock = pBuffer->m_pHead; pBlock != NULL; pBlock = pBlock->m_pNext)
+		{
+			const size_t nCount = pBlock->m_nCount.load(std::memory_order_acquire);
+			for (size_t nEvent = 0; nEvent < nCount; nEvent++)
+			{
+				if (pBlock->m_nFirst + nEvent >= pBuffer->m_nDiscarded)
+				{
+					arrEvents.push_back(std::make_pair(pBuffer->m_nThread,
+						pBlock->m_arrEvents[nEvent]));
+				}
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+size_t
+	Profiler::GetEventCount()
+{
+	size_t nCount = 0;
+
+	std::lock_guard<std::mutex> lock(m_mutexBuffers);
+	for (size_t nAt = 0; nAt < m_arrBuffers.size(); nAt++)
+	{
+		nCount += (size_t) (m_arrBuffers[nAt]->GetPublishedCount()
+			- m_arrBuffers[nAt]->m_nDiscarded);
+	}
+
+	return nCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool
+	Profiler::WriteChromeTrace(const char *pszFileName)
+{
+	std::vector<std::pair<int, ProfileEvent> > arrEvents;
+	CollectEvents(arrEvents);
+	const double ticksPerMicro = GetTicksPerMicrosecond();
+
+	FILE *pFile = NULL;
+	if (fopen_s(&pFile, pszFileName, "w") != 0 || pFile == NULL)
+		return false;
+
+	fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	// name the threads, so the main thread is distinguishable from workers
+	int nMaxThread = -1;
+	for (size_t nAt = 0; nAt < arrEvents.size(); nAt++)
+		nMaxThread = std::max(nMaxThread, arrEvents[nAt].first);
+	const char *pszSep = "";
+	for (int nThread = 0; nThread <= nMaxThread; nThread++)
+	{
+		fprintf(pFile, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+			"\"args\":{\"name\":\"thread %d\"}}", pszSep, nThread, nThread);
+		pszSep = ",\n";
+	}
+
+	for (size_t nAt = 0; nAt < arrEvents.size(); nAt++)
+	{
+		const ProfileEvent& event = arrEvents[nAt].second;
+
+		// events begun before a reset are clamped to the start of the trace
+		const unsigned long long nStart = std::max(event.m_nStart, m_nStartTicks);
+		const unsigned long long nEnd = std::max(event.m_nEnd, nStart);
+		fprintf(pFile, "%s{\"name\":\"%s\",\"cat\":\"dH\",\"ph\":\"X\","
+			"\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,"
+			"\"args\":{\"level\":%d,\"iteration\":%d,\"bytes\":%llu}}",
+			pszSep, event.m_pszStage,
+			(double) (nStart - m_nStartTicks) / ticksPerMicro,
+			(double) (nEnd - nStart) / ticksPerMicro,
+			arrEvents[nAt].first, event.m_nLevel, event.m_nIteration,
+			event.m_nBytes);
+		pszSep = ",\n";
+	}
+
+	fprintf(pFile, "\n]}\n");
+	const bool bOK = (ferror(pFile) == 0);
+	fclose(pFile);
+
+	return bOK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::string
+	Profiler::GetSummary()
+{
+	std::vector<std::pair<int, ProfileEvent> > arrEvents;
+	CollectEvents(arrEvents);
+	const double ticksPerMicro = GetTicksPerMicrosecond();
+
+	struct StageStats
+	{
+		unsigned long long m_nCount;
+		double m_totalMicros;
+		double m_maxMicros;
+		unsigned long long m_nBytes;
+	};
+
+	// keyed on stage and level, so the levels of a stage list together
+	std::map<std::pair<std::string, int>, StageStats> mapStats;
+	for (size_t nAt = 0; nAt < arrEvents.size(); nAt++)
+	{
+		const ProfileEvent& event = arrEvents[nAt].second;
+		const double micros = (double) (event.m_nEnd - event.m_nStart) / ticksPerMicro;
+
+		// value-initialized, so zeroed, on first use
+		StageStats& stats = mapStats[std::make_pair(std::string(event.m_pszStage),
+			event.m_nLevel)];
+		stats.m_nCount++;
+		stats.m_totalMicros += micros;
+		stats.m_maxMicros = std::max(stats.m_maxMicros, micros);
+		stats.m_nBytes += event.m_nBytes;
+	}
+
+	std::string strSummary;
+	char strLine[256];
+	sprintf_s(strLine, sizeof(strLine), "%-32s %5s %10s %12s %12s %12s %12s\n",
+		"stage", "level", "count", "total ms", "mean us", "max us", "MB");
+	strSummary += strLine;
+
+	std::map<std::pair<std::string, int>, StageStats>::const_iterator iter;
+	for (iter = mapStats.begin(); iter != mapStats.end(); ++iter)
+	{
+		const StageStats& stats = iter->second;
+		sprintf_s(strLine, sizeof(strLine), "%-32s %5d %10llu %12.3f %12.3f %12.3f %12.3f\n",
+			iter->first.first.c_str(), iter->first.second, stats.m_nCount,
+			stats.m_totalMicros / 1000.0,
+			stats.m_totalMicros / (double) stats.m_nCount,
+			stats.m_maxMicros,
+			(double) stats.m_nBytes / (1024.0 * 1024.0));
+		strSummary += strLine;
+	}
+
+	return strSummary;
+}
+
+}	// namespace dH
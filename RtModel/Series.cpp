@@ -5,16 +5,23 @@
 #include <UtilMacros.h>
 
 #include <Series.h>
+#include <ParallelFor.h>
 
 namespace dH 
 {
 
 ///////////////////////////////////////////////////////////////////////////////
 Series::Series()
+	: m_densityCalibration(HUDensityCalibration::GetDefault())
+	, m_pMassDensitySource(NULL)
+	, m_nMassDensitySourceMTime(0)
+	, m_nMassDensityCalibVersion(0)
 {
 	BeginLogSection(_T("Series::Series"));
 
 	SetDensity(VolumeReal::New());
+	m_pMassDensity = VolumeReal::New();
+	m_pLabels = VolumeShort::New();
 
 	EndLogSection();
 }
@@ -34,6 +41,53 @@ void
 	m_pDensity = pValue; 
 }
 
+///////////////////////////////////////////////////////////////////////////////
+const HUDensityCalibration& 
+	Series::GetDensityCalibration() const
+{
+	return m_densityCalibration;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void 
+	Series::SetDensityCalibration(const HUDensityCalibration& calib)
+{
+	// the version check in GetMassDensity picks up the change
+	m_densityCalibration = calib;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+VolumeReal *
+	Series::GetMassDensity()
+	// converts the density (HU) to mass density, if it is out of date
+{
+	if (m_pMassDensitySource != m_pDensity.GetPointer()
+		|| m_nMassDensitySourceMTime < m_pDensity->GetMTime()
+		|| m_nMassDensityCalibVersion != m_densityCalibration.GetVersion())
+	{
+		ConformTo<VOXEL_REAL,3>(m_pDensity, m_pMassDensity);
+		m_densityCalibration.Convert(m_pDensity->GetBufferPointer(), 
+			m_pMassDensity->GetBufferPointer(), 
+			(int) m_pMassDensity->GetBufferedRegion().GetNumberOfPixels());
+
+		// bump the MTime so the resampled copies are refreshed
+		m_pMassDensity->Modified();
+
+		m_pMassDensitySource = m_pDensity;
+		m_nMassDensitySourceMTime = m_pDensity->GetMTime();
+		m_nMassDensityCalibVersion = m_densityCalibration.GetVersion();
+	}
+
+	return m_pMassDensity;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+VolumeReal *
+	Series::GetMassDensityConformTo(const itk::ImageBase<3> *pBasis)
+{
+	return m_massDensityResampled.GetResampled(GetMassDensity(), pBasis);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 int 
 	Series::GetStructureCount() const
@@ -67,15 +121,12 @@ Structure *
 void 
 	Series::AddStructure(Structure *pStruct)
 {
-	USES_CONVERSION;
-
 	BeginLogSection(_T("Series::AddStructure"));
 
 	// output the structure name
-	__formatMessage.Format(_T("<structure name=\"%s\" contours=\"%s\" />"), 
-		A2W(pStruct->GetName().c_str()),
+	LogMessageF(LOG_LEVEL_DEBUG, "<structure name=\"%s\" contours=\"%i\" />", 
+		pStruct->GetName().c_str(),
 		pStruct->GetContourCount());
-	Log(__formatMessage.GetBuffer());
 
 	pStruct->SetSeries(this);
 	m_arrStructures.push_back(pStruct);
@@ -83,4 +134,195 @@ void
 	EndLogSection();
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// number of scanlines per voxel row used to estimate partial-volume coverage
+static const int REGION_SUBROWS = 4;
+
+/////////////////////////////////////////////////////////////////////////////
+void 
+	Series::CalcRegions()
+	// forms the base region of every structure.  A voxel is shared out in 
+	//	priority order: each structure gets its coverage, less whatever is 
+	//	already taken by structures of higher priority (lower value).  
+	//	Structures of equal priority do not exclude each other.
+{
+	BeginLogSection(_T("Series::CalcRegions"));
+
+	const int nStructures = GetStructureCount();
+	const int nWidth = (int) m_pDensity->GetBufferedRegion().GetSize()[0];
+	const int nHeight = (int) m_pDensity->GetBufferedRegion().GetSize()[1];
+	const int nSlices = (int) m_pDensity->GetBufferedRegion().GetSize()[2];
+	const int nSliceSize = nWidth * nHeight;
+
+	// the structures, in order of priority
+	std::vector<Structure *> arrOrdered;
+	std::vector<int> arrIndex;
+	for (int nAt = 0; nAt < nStructures; nAt++)
+	{
+		arrIndex.push_back(nAt);
+	}
+	std::stable_sort(arrIndex.begin(), arrIndex.end(), 
+		[this](int nLeft, int nRight)
+		{
+			return m_arrStructures[nLeft]->GetPriority() 
+				< m_arrStructures[nRight]->GetPriority(); 
+		});
+
+	// set up regions, and bucket the contours by slice.  a structure without
+	//	contours, or with a region set explicitly, keeps the region it has 
+	//	(e.g. one loaded as a volume); if that is on the density grid it still
+	//	takes its share of the voxels
+	std::vector< std::vector< std::vector<RasterPolygon> > > arrSlicePolygons(nStructures);
+	std::vector<bool> arrRasterize(nStructures);
+	std::vector<bool> arrKeepRegion(nStructures);
+	for (int nAt = 0; nAt < nStructures; nAt++)
+	{
+		Structure *pStruct = GetStructureAt(arrIndex[nAt]);
+		arrOrdered.push_back(pStruct);
+		arrRasterize[nAt] = pStruct->GetContourCount() > 0 
+			&& !pStruct->m_bExplicitRegion;
+		if (arrRasterize[nAt])
+		{
+			ConformTo<VOXEL_REAL,3>(m_pDensity, pStruct->m_pRegion0);
+			pStruct->ContoursToSlicePolygons(m_pDensity, arrSlicePolygons[nAt]);
+		}
+		else
+		{
+			arrKeepRegion[nAt] = pStruct->m_pRegion0->GetBufferedRegion().GetSize()
+				== m_pDensity->GetBufferedRegion().GetSize();
+		}
+	}
+	ConformTo<short,3>(m_pDensity, m_pLabels);
+
+	ParallelForChunks(nSlices, [&](int nBegin, int nEnd)
+	{
+		// per-thread scratch
+		std::vector<float> arrTaken(nSliceSize);
+		std::vector<float> arrGroupTaken(nSliceSize);
+		std::vector< std::pair<double, double> > arrSpans;
+		std::vector<const RasterPolygon *> arrPolygons;
+
+		for (int nSlice = nBegin; nSlice < nEnd; nSlice++)
+		{
+			std::fill(arrTaken.begin(), arrTaken.end(), 0.0f);
+			short *pLabels = m_pLabels->GetBufferPointer() + nSlice * nSliceSize;
+			std::fill(pLabels, pLabels + nSliceSize, (short) 0);
+
+			for (int nAt = 0; nAt < nStructures; )
+			{
+				// structures of the same priority form a group
+				int nGroupEnd = nAt + 1;
+				while (nGroupEnd < nStructures 
+					&& arrOrdered[nGroupEnd]->GetPriority() == arrOrdered[nAt]->GetPriority())
+				{
+					nGroupEnd++;
+				}
+
+				bool bGroupCovers = false;
+				for (int nAtGroup = nAt; nAtGroup < nGroupEnd; nAtGroup++)
+				{
+					const short nLabel = (short) (arrIndex[nAtGroup] + 1);
+					if (!arrRasterize[nAtGroup])
+					{
+						if (!arrKeepRegion[nAtGroup])
+							continue;
+
+						// the kept region is only read
+						const VOXEL_REAL *pKept = arrOrdered[nAtGroup]->m_pRegion0->GetBufferPointer() 
+							+ nSlice * nSliceSize;
+						if (!bGroupCovers)
+						{
+							std::fill(arrGroupTaken.begin(), arrGroupTaken.end(), 0.0f);
+							bGroupCovers = true;
+						}
+						for (int nVoxel = 0; nVoxel < nSliceSize; nVoxel++)
+						{
+							if (pKept[nVoxel] > 0.0f)
+							{
+								arrGroupTaken[nVoxel] += pKept[nVoxel];
+								if (pLabels[nVoxel] == 0)
+									pLabels[nVoxel] = nLabel;
+							}
+						}
+						continue;
+					}
+
+					const std::vector<RasterPolygon>& arrSlice = arrSlicePolygons[nAtGroup][nSlice];
+					arrPolygons.clear();
+					for (size_t nAtPoly = 0; nAtPoly < arrSlice.size(); nAtPoly++)
+					{
+						arrPolygons.push_back(&arrSlice[nAtPoly]);
+					}
+
+					VOXEL_REAL *pRegion = arrOrdered[nAtGroup]->m_pRegion0->GetBufferPointer() 
+						+ nSlice * nSliceSize;
+					RasterizeCoverage(arrPolygons, nWidth, nHeight, pRegion, REGION_SUBROWS, arrSpans);
+					if (arrPolygons.empty())
+						continue;
+
+					if (!bGroupCovers)
+					{
+						std::fill(arrGroupTaken.begin(), arrGroupTaken.end(), 0.0f);
+						bGroupCovers = true;
+					}
+
+					// exclude what higher priorities have taken
+					for (int nVoxel = 0; nVoxel < nSliceSize; nVoxel++)
+					{
+						if (pRegion[nVoxel] > 0.0f)
+						{
+							pRegion[nVoxel] = std::min(pRegion[nVoxel], 1.0f - arrTaken[nVoxel]);
+							arrGroupTaken[nVoxel] += pRegion[nVoxel];
+							if (pRegion[nVoxel] > 0.0f && pLabels[nVoxel] == 0)
+								pLabels[nVoxel] = nLabel;
+						}
+					}
+				}
+
+				if (bGroupCovers)
+				{
+					for (int nVoxel = 0; nVoxel < nSliceSize; nVoxel++)
+					{
+						arrTaken[nVoxel] = std::min(arrTaken[nVoxel] + arrGroupTaken[nVoxel], 1.0f);
+					}
+				}
+
+				nAt = nGroupEnd;
+			}
+		}
+	}, 1);
+
+	m_pLabels->Modified();
+	for (int nAt = 0; nAt < nStructures; nAt++)
+	{
+		if (arrRasterize[nAt])
+		{
+			arrOrdered[nAt]->OnRegionCalculated();
+		}
+		else
+		{
+			// nothing to recalculate
+			arrOrdered[nAt]->m_bRecalcRegion = false;
+		}
+	}
+
+	EndLogSection();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+VolumeShort * 
+	Series::GetLabelVolume()
+{
+	for (int nAt = 0; nAt < GetStructureCount(); nAt++)
+	{
+		if (GetStructureAt(nAt)->m_bRecalcRegion)
+		{
+			CalcRegions();
+			break;
+		}
+	}
+
+	return m_pLabels;
+}
+
 }	// namespace dH
\ No newline at end of file
@@ -398,7 +398,9 @@ REAL SigmaEstimator::CalculateAvgDoseGradient(Structure* pStructure, VolumeReal*
 
 	std::vector<REAL> gradientMagnitudes;
 
-	// Get structure region at finest level
+	// Get structure region at finest level.  This scans the dose, not the 
+	// region geometry: a central difference per region voxel is already one
+	// pass with no neighbour search, so the distance map has nothing to offer
 	const VolumeReal* pRegion = pStructure->GetRegion(0);
 	if (!pRegion) return 0.0;
 
@@ -573,58 +575,32 @@ REAL SigmaEstimator::ApproximateSurfaceArea(Structure* pStructure, int level)
 {
 	if (!pStructure) return 0.0;
 
-	const VolumeReal* pRegion = pStructure->GetRegion(level);
-	if (!pRegion) return 0.0;
-
-	// Get voxel spacing
-	VolumeReal::SpacingType spacing = pRegion->GetSpacing();
-
-	// Count boundary voxels (voxels with at least one neighbor outside structure)
-	typedef itk::ImageRegionConstIteratorWithIndex<VolumeReal> Iterator;
-	Iterator it(pRegion, pRegion->GetLargestPossibleRegion());
-
-	int boundaryCount = 0;
-	VolumeReal::SizeType size = pRegion->GetLargestPossibleRegion().GetSize();
-
-	for (it.GoToBegin(); !it.IsAtEnd(); ++it) {
-		if (it.Get() > 0.5) {  // Inside structure
-			VolumeReal::IndexType idx = it.GetIndex();
-			bool isBoundary = false;
-
-			// Check 6-connected neighbors
-			for (int d = 0; d < 3; ++d) {
-				for (int delta = -1; delta <= 1; delta += 2) {
-					VolumeReal::IndexType neighborIdx = idx;
-					neighborIdx[d] += delta;
-
-					// Check bounds
-					if (neighborIdx[d] >= 0 && neighborIdx[d] < (long)size[d]) {
-						REAL neighborValue = pRegion->GetPixel(neighborIdx);
-						if (neighborValue < 0.5) {  // Neighbor outside structure
-							isBoundary = true;
-							break;
-						}
-					} else {
-						isBoundary = true;  // Edge of volume
-						break;
-					}
-				}
-				if (isBoundary) break;
-			}
-
-			if (isBoundary) {
-				++boundaryCount;
-			}
+	// cached on the structure, once per level
+	const VolumeReal* pDistMap = pStructure->GetDistanceMap(level);
+	if (!pDistMap) return 0.0;
+
+	// Shell estimate from the signed distance map: the voxels within a band of
+	// half-width w around the surface have volume ~ 2 * w * A. The map measures
+	// to the nearest voxel of the other side, not to the surface itself, so it
+	// overstates the surface distance by ~h/2; a band |d| <= 1.5h therefore
+	// holds about one voxel layer either side, i.e. 2 * h * A.
+	VolumeReal::SpacingType spacing = pDistMap->GetSpacing();
+	const REAL h = pow(spacing[0] * spacing[1] * spacing[2], 1.0 / 3.0);  // mm
+	const REAL bandHalfWidth = 1.5 * h;
+
+	const VOXEL_REAL* pDist = pDistMap->GetBufferPointer();
+	const int nVoxels = (int) pDistMap->GetBufferedRegion().GetNumberOfPixels();
+	int shellCount = 0;
+	for (int n = 0; n < nVoxels; ++n) {
+		if (fabs(pDist[n]) <= bandHalfWidth) {
+			++shellCount;
 		}
 	}
 
-	// Approximate surface area (rough estimate)
-	// Each boundary voxel contributes approximately one face area
-	REAL avgFaceArea = (spacing[0] * spacing[1] + spacing[1] * spacing[2] +
-	                    spacing[0] * spacing[2]) / 3.0;  // mm^2
+	REAL shellVolume = shellCount * spacing[0] * spacing[1] * spacing[2];  // mm^3
 
 	// Convert to cm^2
-	REAL surfaceAreaCM2 = (boundaryCount * avgFaceArea) / 100.0;
+	REAL surfaceAreaCM2 = (shellVolume / (2.0 * h)) / 100.0;
 
 	return surfaceAreaCM2;
 }
@@ -13,6 +13,13 @@
 
 namespace dH {
 
+// the optimizer's default sigma for a level (see PlanOptimizer.cpp): 8.0 at
+//	level 0, 0.4x per level
+static REAL DefaultLevelSigma(int nLevel)
+{
+	return 8.0 * pow(0.4, nLevel);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // EXAMPLE 1: Basic integration in PlanOptimizer::SetupPrescription
 ///////////////////////////////////////////////////////////////////////////////
@@ -44,12 +51,12 @@ void PlanOptimizer_Example_SetupPrescription_WithAdaptiveSigma(
 	std::vector<REAL> adaptiveSigmas = sigmaEst.EstimatePyramidSigmas(
 		pPlan,
 		pPresc,
-		PlanPyramid::MAX_SCALES);
+		PlanPyramid::GetLevelCount(pPlan));
 
 	// Use estimated sigmas in prescription setup
 	const REAL GBinSigma = 0.2;  // Keep constant
 
-	for (int nLevel = 0; nLevel < PlanPyramid::MAX_SCALES; nLevel++) {
+	for (int nLevel = 0; nLevel < PlanPyramid::GetLevelCount(pPlan); nLevel++) {
 		// Use adaptive sigma instead of hard-coded default
 		const REAL sigma = adaptiveSigmas[nLevel];
 
@@ -68,7 +75,7 @@ void PlanOptimizer_Example_SetupPrescription_WithAdaptiveSigma(
 		pOptimizer->set_f_tolerance(cgTol);
 
 		// Apply slope variance correction (disabled at coarsest level)
-		if (nLevel == PlanPyramid::MAX_SCALES-1)
+		if (nLevel == PlanPyramid::GetLevelCount(pPlan)-1)
 			pPresc->SetTransformSlopeVariance(false);
 
 		pPresc->SetGBinVar(varMin, varMax);
@@ -77,7 +84,7 @@ void PlanOptimizer_Example_SetupPrescription_WithAdaptiveSigma(
 		TRACE("Level %d: Adaptive Sigma = %.3f (was %.3f)\n",
 			nLevel,
 			sigma,
-			DEFAULT_LEVELSIGMA[nLevel]);
+			DefaultLevelSigma(nLevel));
 	}
 }
 
@@ -191,28 +198,25 @@ private:
 
 void Example_CompareDefaultVsAdaptive(CPlan* pPlan, Prescription* pPresc)
 {
-	// Default sigmas (current hard-coded values)
-	const REAL DEFAULT_LEVELSIGMA[] = {8.0, 3.2, 1.3, 0.5, 0.25};
-
 	// Estimate adaptive sigmas
 	SigmaEstimator sigmaEst;
 	std::vector<REAL> adaptiveSigmas = sigmaEst.EstimatePyramidSigmas(
 		pPlan,
 		pPresc,
-		PlanPyramid::MAX_SCALES);
+		PlanPyramid::GetLevelCount(pPlan));
 
 	// Print comparison
 	TRACE("\n===== Sigma Comparison =====\n");
 	TRACE("Level | Default | Adaptive | Difference\n");
 	TRACE("------|---------|----------|------------\n");
 
-	for (int i = 0; i < PlanPyramid::MAX_SCALES; i++) {
-		REAL diff = adaptiveSigmas[i] - DEFAULT_LEVELSIGMA[i];
-		REAL pctDiff = 100.0 * diff / DEFAULT_LEVELSIGMA[i];
+	for (int i = 0; i < PlanPyramid::GetLevelCount(pPlan); i++) {
+		REAL diff = adaptiveSigmas[i] - DefaultLevelSigma(i);
+		REAL pctDiff = 100.0 * diff / DefaultLevelSigma(i);
 
 		TRACE("  %d   |  %.3f  |  %.3f   | %+.3f (%+.1f%%)\n",
 			i,
-			DEFAULT_LEVELSIGMA[i],
+			DefaultLevelSigma(i),
 			adaptiveSigmas[i],
 			diff,
 			pctDiff);
@@ -220,7 +224,7 @@ void Example_CompareDefaultVsAdaptive(CPlan* pPlan, Prescription* pPresc)
 	TRACE("============================\n\n");
 
 	// Could run optimization twice and compare results:
-	// 1. With DEFAULT_LEVELSIGMA
+	// 1. With the default sigmas
 	// 2. With adaptiveSigmas
 	// Then compare convergence speed, final cost, etc.
 }
@@ -246,14 +250,13 @@ void Example_RegistryControlledAdaptiveSigma(CPlan* pPlan, Prescription* pPresc)
 		sigmas = sigmaEst.EstimatePyramidSigmas(
 			pPlan,
 			pPresc,
-			PlanPyramid::MAX_SCALES);
+			PlanPyramid::GetLevelCount(pPlan));
 
 		TRACE("Using adaptive sigma estimation\n");
 	} else {
-		// Use default hard-coded values
-		const REAL DEFAULT_LEVELSIGMA[] = {8.0, 3.2, 1.3, 0.5, 0.25};
-		sigmas.assign(DEFAULT_LEVELSIGMA,
-		              DEFAULT_LEVELSIGMA + PlanPyramid::MAX_SCALES);
+		// Use the default values
+		for (int i = 0; i < PlanPyramid::GetLevelCount(pPlan); i++)
+			sigmas.push_back(DefaultLevelSigma(i));
 
 		TRACE("Using default sigma values\n");
 	}
@@ -325,21 +328,18 @@ void Example_HybridSigmaStrategy(CPlan* pPlan, Prescription* pPresc)
 
 	// Estimate adaptive sigmas
 	std::vector<REAL> adaptiveSigmas = sigmaEst.EstimatePyramidSigmas(
-		pPlan, pPresc, PlanPyramid::MAX_SCALES);
-
-	// Default sigmas
-	const REAL DEFAULT_LEVELSIGMA[] = {8.0, 3.2, 1.3, 0.5, 0.25};
+		pPlan, pPresc, PlanPyramid::GetLevelCount(pPlan));
 
 	// Hybrid: Use adaptive for coarse levels, default for fine levels
-	std::vector<REAL> hybridSigmas(PlanPyramid::MAX_SCALES);
+	std::vector<REAL> hybridSigmas(PlanPyramid::GetLevelCount(pPlan));
 
-	for (int i = 0; i < PlanPyramid::MAX_SCALES; i++) {
+	for (int i = 0; i < PlanPyramid::GetLevelCount(pPlan); i++) {
 		if (i < 3) {
 			// Coarse levels: use adaptive (more important for global structure)
 			hybridSigmas[i] = adaptiveSigmas[i];
 		} else {
 			// Fine levels: use proven defaults (less risk)
-			hybridSigmas[i] = DEFAULT_LEVELSIGMA[i];
+			hybridSigmas[i] = DefaultLevelSigma(i);
 		}
 
 		TRACE("Level %d: Hybrid sigma = %.3f\n", i, hybridSigmas[i]);
@@ -363,7 +363,7 @@ To integrate SigmaEstimator into production code:
 
 4. Modify PlanOptimizer.cpp:
    a) #include "SigmaEstimator.h" at top
-   b) In SetupPrescription(), replace DEFAULT_LEVELSIGMA with
+   b) In SetupPrescription(), replace GetDefaultLevelSigma with
       adaptive estimation (see Example 1)
    c) Add registry key "UseAdaptiveSigma" to enable/disable
 
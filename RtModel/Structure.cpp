@@ -6,8 +6,11 @@
 #include <itkImageRegionIterator.h>
 #include <itkResampleImageFilter.h>
 
+#include <algorithm>
+
 #include <Structure.h>
 #include <Series.h>
+#include <DistanceTransform.h>
 
 namespace dH
 {
@@ -19,13 +22,16 @@ Structure::Structure()
 	, m_Type(eNONE)
 	, m_Priority(1)
 	, m_bRecalcRegion(true)
+	, m_bExplicitRegion(false)
+	, m_conformRegions(0)
+	, m_nScales(DEFAULT_SCALES)
 	// constructs a structure
 {
 	m_pRegion0 = VolumeReal::New();
 	m_pPyramid = PyramidType::New(); 
 
 	m_pPyramid->SetInput(m_pRegion0);
-	m_pPyramid->SetNumberOfLevels(MAX_SCALES);
+	m_pPyramid->SetNumberOfLevels(m_nScales);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -73,17 +79,49 @@ Structure::AddContour(Structure::PolygonType::Pointer pPoly, REAL refDist)
 	// adds a new contour to the structure
 {
 	m_arrContours.insert(std::make_pair(refDist, pPoly));
+
+	// contours changed, so region (and the resampled copies) are stale
+	m_bRecalcRegion = true;
+	m_bExplicitRegion = false;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+int
+	Structure::GetScaleCount() const
+{
+	return m_nScales;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+void
+	Structure::SetScaleCount(int nScales)
+	// sets the depth of the region pyramid; a calculated region is 
+	//	re-filtered, as the pyramid's outputs are re-ordered
+{
+	nScales = std::max(nScales, 1);
+	if (nScales == m_nScales)
+	{
+		return;
+	}
+
+	m_nScales = nScales;
+	m_pPyramid->SetNumberOfLevels(m_nScales);
+	if (!m_bRecalcRegion)
+	{
+		OnRegionCalculated();
+	}
+
+}	// Structure::SetScaleCount
 
 ///////////////////////////////////////////////////////////////////////////////
 const VolumeReal * 
 	Structure::GetRegion(int nScale)
 	// forms a new region and returns at requested scale
 {
-	if (nScale >= MAX_SCALES)
+	if (nScale >= m_nScales)
 	{
-		nScale = MAX_SCALES-1;
+		nScale = m_nScales-1;
 	}
 
 	if (m_bRecalcRegion)
@@ -97,185 +135,247 @@ const VolumeReal *
 	}
 
 	// return m_pPyramid->GetOutput(nScale-1);
-	return m_pPyramid->GetOutput(MAX_SCALES-1 - nScale);
+	return m_pPyramid->GetOutput(m_nScales-1 - nScale);
 
 }
 
+///////////////////////////////////////////////////////////////////////////////
+void
+	Structure::SetRegion(const VolumeReal *pRegion)
+	// sets the base region from a volume, in place of the contours
+{
+	CopyImage<VOXEL_REAL,3>(pRegion, m_pRegion0);
+	m_bExplicitRegion = true;
+	OnRegionCalculated();
+
+}	// Structure::SetRegion
+
 ///////////////////////////////////////////////////////////////////////////////
 void
 	Structure::CalcRegion()
 	// forms the base level region
 {
-	// set size of region
-	ConformTo<VOXEL_REAL,3>(GetSeries()->GetDensity(), m_pRegion0);
-	ContoursToRegion(m_pRegion0);
+	// the series rasterizes all of its structures together, so that priority
+	//	exclusion happens in the same pass
+	GetSeries()->CalcRegions();
 
-	// now exclude
-	for (int nAt = 0; nAt < GetSeries()->GetStructureCount(); nAt++)
-	{
-		Structure *pOtherStruct = GetSeries()->GetStructureAt(nAt);
-		if (GetPriority() > pOtherStruct->GetPriority())
-		{
-			const VolumeReal *pExclRegion = pOtherStruct->GetRegion(0);
-			ConstVolumeRealIterator iterExcl(pExclRegion, pExclRegion->GetBufferedRegion());
-			VolumeRealIterator iter(m_pRegion0, m_pRegion0->GetBufferedRegion());
-			for ( iter.GoToBegin(), iterExcl.GoToBegin(); !iterExcl.IsAtEnd();
-				++iter, ++iterExcl)
-			{
-				if (iterExcl.Get() > 0.0)
-					iter.Set(0.0);
-			}
-		}
-	}
+}
 
+///////////////////////////////////////////////////////////////////////////////
+void
+	Structure::OnRegionCalculated()
+	// updates the pyramid and cached copies from a new base region
+{
 	// update the pyramid
+	m_pRegion0->Modified();
 	m_pPyramid->Update();
 
+	// the conform regions were resampled from the old region
+	m_conformRegions.Invalidate();
+	m_arrDistanceMaps.clear();
+
 	m_bRecalcRegion = false;
 
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-VolumeReal * 
-		Structure::GetConformRegion(itk::ImageBase<3> *pVolume)
-		// forms / returns a resampled region for a given basis
+const VolumeReal *
+	Structure::GetDistanceMap(int nLevel)
+	// forms / returns the signed distance map for the region at a level
 {
-	// search for closest level in structure's pyramid
-	int nLevel = -1;
-	itk::Vector<REAL> vDosePixelSpacing = pVolume->GetSpacing();
-	itk::Vector<REAL> vRegionPixelSpacing;
-	do
+	// same clamp as GetRegion, so that one map serves the levels it aliases
+	nLevel = std::min(nLevel, m_nScales-1);
+
+	const VolumeReal *pRegion = GetRegion(nLevel);
+	if (nLevel >= (int) m_arrDistanceMaps.size())
 	{
-		nLevel++;
-		vRegionPixelSpacing = GetRegion(nLevel)->GetSpacing();
-	} while (
-		(vRegionPixelSpacing[0] < vDosePixelSpacing[0] * 0.9
-		|| vRegionPixelSpacing[1]  < vDosePixelSpacing[1] * 0.9)
-		&& nLevel < MAX_SCALES);
-
-	// now resample to the requested resolution
-
-	itk::ResampleImageFilter<VolumeReal, VolumeReal>::Pointer resampler = 
-		itk::ResampleImageFilter<VolumeReal, VolumeReal>::New();
-	resampler->SetInput(GetRegion(nLevel));
-
-	typedef itk::AffineTransform<REAL, 3> TransformType;
-	TransformType::Pointer transform = TransformType::New();
-	transform->SetIdentity();
-	resampler->SetTransform(transform);
-
-	typedef itk::LinearInterpolateImageFunction<VolumeReal, REAL> InterpolatorType;
-	InterpolatorType::Pointer interpolator = InterpolatorType::New();
-	resampler->SetInterpolator( interpolator );
-
-	VolumeReal::Pointer pPointToVolume = static_cast<VolumeReal*>(pVolume);
-	resampler->SetOutputParametersFromImage(pPointToVolume);
-	resampler->Update();
-	m_arrResamplers.push_back(resampler);
-	return resampler->GetOutput();
-}
+		m_arrDistanceMaps.resize(nLevel + 1);
+	}
 
-typedef itk::PolygonSpatialObject<2> PolygonType;
+	VolumeReal::Pointer& pDistanceMap = m_arrDistanceMaps[nLevel];
+	if (pDistanceMap.IsNull())
+	{
+		pDistanceMap = VolumeReal::New();
+		ConformTo<VOXEL_REAL,3>(pRegion, pDistanceMap);
 
-///////////////////////////////////////////////////////////////////////////////
-// CreateRegion
-// 
-// Creates a region (bit mask) from a polygon
-///////////////////////////////////////////////////////////////////////////////
-template<class VOXEL_TYPE>
-void CreateRegionForPolygonSpatialObject(const CArray<PolygonType *, PolygonType *>& arrPolygons,
-				  itk::Image<VOXEL_TYPE,3> *pRegion, int nSlice)
-{
-	CDC dc;
-	BOOL bRes = dc.CreateCompatibleDC(NULL);
+		const int nSize[3] = 
+		{
+			(int) pRegion->GetBufferedRegion().GetSize()[0],
+			(int) pRegion->GetBufferedRegion().GetSize()[1],
+			(int) pRegion->GetBufferedRegion().GetSize()[2],
+		};
+		const double vSpacing[3] = 
+		{
+			pRegion->GetSpacing()[0],
+			pRegion->GetSpacing()[1],
+			pRegion->GetSpacing()[2],
+		};
+
+		// voxels more than half covered count as inside
+		SignedDistanceMap<VOXEL_REAL>(pRegion->GetBufferPointer(), 0.5, 
+			nSize, vSpacing, pDistanceMap->GetBufferPointer());
+		pDistanceMap->Modified();
+	}
 
-	CBitmap bitmap;
-	bRes = bitmap.CreateBitmap(pRegion->GetBufferedRegion().GetSize()[0], 
-		pRegion->GetBufferedRegion().GetSize()[1], 1, 1, NULL);
+	return pDistanceMap;
+}
 
-	CBitmap *pOldBitmap = (CBitmap *) dc.SelectObject(&bitmap);
-	dc.SelectStockObject(WHITE_PEN);
-	dc.SelectStockObject(WHITE_BRUSH);
+///////////////////////////////////////////////////////////////////////////////
+void
+	Structure::AccountMemory(MemoryReport& report)
+	// adds the regions, distance map and resampled regions to a memory report
+{
+	const MemoryOwner owner(-1, -1, m_strName);
 
-	itk::Point<REAL,3> vOrigin = pRegion->GetOrigin();
-	itk::Vector<REAL,3> vSpacing = pRegion->GetSpacing();
-	for (int nAtPoly = 0; nAtPoly < arrPolygons.GetSize(); nAtPoly++)
+	report.AddImage(MEMORY_REGION, owner, m_pRegion0.GetPointer());
+	for (unsigned int nLevel = 0; nLevel < m_pPyramid->GetNumberOfOutputs(); nLevel++)
 	{
-		// static 
-			CArray<CPoint, CPoint&> arrPoints;
-		arrPoints.SetSize(arrPolygons[nAtPoly]->GetNumberOfPoints/*GetVertexCount*/());
-		for (int nAt = 0; nAt < arrPolygons[nAtPoly]->GetNumberOfPoints/*GetVertexCount*/(); nAt++)
+		report.AddImage(MEMORY_REGION, owner, m_pPyramid->GetOutput(nLevel));
+	}
+	for (size_t nLevel = 0; nLevel < m_arrDistanceMaps.size(); nLevel++)
+	{
+		if (m_arrDistanceMaps[nLevel].IsNotNull())
 		{
-			itk::SpatialObjectPoint<2> vVert = *(arrPolygons[nAtPoly]->GetPoint/*GetVertexAt*/(nAt));
-			//vVert[0] = (vVert[0] - vOrigin[0]) / vSpacing[0];
-			//vVert[1] = (vVert[1] - vOrigin[1]) / vSpacing[1];
-
-			arrPoints[nAt].x = (vVert.GetPositionInObjectSpace()[0] - vOrigin[0]) / vSpacing[0];
-			arrPoints[nAt].y = (vVert.GetPositionInObjectSpace()[1] - vOrigin[1]) / vSpacing[1];
+			report.AddImage(MEMORY_REGION, owner, m_arrDistanceMaps[nLevel].GetPointer());
 		}
-		dc.Polygon(arrPoints.GetData(), arrPolygons[nAtPoly]->GetNumberOfPoints/*GetVertexCount*/());
 	}
 
-	// finished with DC
-	dc.SelectObject(pOldBitmap);
-	dc.DeleteDC();
+	m_conformRegions.AccountMemory(report, owner);
+}
 
-	// now get the bitmap descriptor (for scan width
-	BITMAP bm;
-	bitmap.GetBitmap(&bm);
+///////////////////////////////////////////////////////////////////////////////
+void
+	Structure::CalcMarginRegion(const itk::Vector<REAL,3>& vMargin, 
+			VolumeReal *pMarginRegion)
+	// a voxel is in the margin region if it lies within the ellipsoid with
+	//	semi-axes vMargin of some region voxel.  Scaling each axis by 1 / margin
+	//	turns that into a unit-distance test on one distance transform.
+	//	mixed signs take a grow pass, then a shrink pass.
+{
+	const VolumeReal *pRegion = GetRegion(0);
+	ConformTo<VOXEL_REAL,3>(pRegion, pMarginRegion);
 
-	// resize the buffer
-	// static 
-		CArray<BYTE, BYTE> arrBuffer;
-	arrBuffer.SetSize(pRegion->GetBufferedRegion().GetSize()[1] * bm.bmWidthBytes);
-	int nByteCount = bitmap.GetBitmapBits((DWORD) arrBuffer.GetSize(), arrBuffer.GetData());
+	const int nSize[3] = 
+	{
+		(int) pRegion->GetBufferedRegion().GetSize()[0],
+		(int) pRegion->GetBufferedRegion().GetSize()[1],
+		(int) pRegion->GetBufferedRegion().GetSize()[2],
+	};
+
+	// a margin with mixed signs grows along its positive axes, then shrinks
+	//	along its negative ones.  each pass scales by its own components; a 
+	//	component not in the pass allows no movement along its axis
+	auto scaledSpacing = [&](double sign, double vScaledSpacing[3]) -> bool
+	{
+		bool bAny = false;
+		for (int nAxis = 0; nAxis < 3; nAxis++)
+		{
+			const bool bInPass = sign * vMargin[nAxis] > 0.0;
+			vScaledSpacing[nAxis] = bInPass
+				? pRegion->GetSpacing()[nAxis] / fabs(vMargin[nAxis])
+				: 1e6;
+			bAny = bAny || bInPass;
+		}
+		return bAny;
+	};
 
-	// now populate region
-	// DON'T CLEAR REGION HERE -- this is called multiple times
-	// pRegion->FillBuffer(0.0); 
+	const int nCount = nSize[0] * nSize[1] * nSize[2];
+	std::vector<double> arrSqDist(nCount);
+	const VOXEL_REAL *pRegionVoxels = pRegion->GetBufferPointer();
+	VOXEL_REAL *pMarginVoxels = pMarginRegion->GetBufferPointer();
+	std::copy(pRegionVoxels, pRegionVoxels + nCount, pMarginVoxels);
 
-	int nStride = pRegion->GetBufferedRegion().GetSize()[0];
-	int nStrideZ = pRegion->GetBufferedRegion().GetSize()[1] * nStride;
-	// now populate the region
-	for (int nY = 0; nY < pRegion->GetBufferedRegion().GetSize()[1]; nY++)
+	double vScaledSpacing[3];
+	if (scaledSpacing(1.0, vScaledSpacing))
+	{
+		// grow: within unit distance of the region
+		SquaredDistanceTransform(pMarginVoxels, nSize, vScaledSpacing,
+			[](VOXEL_REAL value) { return value > 0.5; }, &arrSqDist[0]);
+		for (int nAt = 0; nAt < nCount; nAt++)
+		{
+			pMarginVoxels[nAt] = (arrSqDist[nAt] <= 1.0) ? 1.0f : 0.0f;
+		}
+	}
+	if (scaledSpacing(-1.0, vScaledSpacing))
 	{
-		for (int nX = 0; nX < pRegion->GetBufferedRegion().GetSize()[0]; nX++)
+		// shrink: region voxels more than unit distance from the outside
+		SquaredDistanceTransform(pMarginVoxels, nSize, vScaledSpacing,
+			[](VOXEL_REAL value) { return !(value > 0.5); }, &arrSqDist[0]);
+		for (int nAt = 0; nAt < nCount; nAt++)
 		{
-			if ((arrBuffer[nY * bm.bmWidthBytes + nX / 8] >> (7 - nX % 8)) & 0x01)
+			pMarginVoxels[nAt] = (pMarginVoxels[nAt] > 0.5 && arrSqDist[nAt] > 1.0) 
+				? 1.0f : 0.0f;
+		}
+	}
+	pMarginRegion->Modified();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+VolumeReal * 
+		Structure::GetConformRegion(itk::ImageBase<3> *pVolume)
+		// forms / returns a resampled region for a given basis
+{
+	// search for closest level in structure's pyramid.  A dose grid coarser
+	//	than the coarsest scale adds a scale, while that scale is still more 
+	//	than a voxel across
+	int nLevel = -1;
+	itk::Vector<REAL> vDosePixelSpacing = pVolume->GetSpacing();
+	itk::Vector<REAL> vRegionPixelSpacing;
+	bool bDoseCoarser = false;
+	do
+	{
+		nLevel++;
+		if (nLevel == m_nScales)
+		{
+			const VolumeReal::SizeType& size = GetRegion(nLevel-1)->GetBufferedRegion().GetSize();
+			if (size[0] <= 1 && size[1] <= 1)
 			{
-				// (*pRegion)[0][nY][nX] 
-				pRegion->GetBufferPointer()[nSlice * nStrideZ + nY * nStride + nX]
-					= (VOXEL_TYPE) 1.0;
+				nLevel--;
+				break;
 			}
+			SetScaleCount(nLevel+1);
 		}
-	}
 
-	// done with bitmap
-	bitmap.DeleteObject();
+		vRegionPixelSpacing = GetRegion(nLevel)->GetSpacing();
+		bDoseCoarser = (vRegionPixelSpacing[0] < vDosePixelSpacing[0] * 0.9
+			|| vRegionPixelSpacing[1]  < vDosePixelSpacing[1] * 0.9);
+	} while (bDoseCoarser);
 
-}	
+	// now resample to the requested resolution; this is computed once per
+	//	grid, until the region is recalculated
+	return m_conformRegions.GetResampled(GetRegion(nLevel), pVolume);
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 void 
-	Structure::ContoursToRegion(VolumeReal *pRegion)
-		// converts the contours to a region
+	Structure::ContoursToSlicePolygons(const VolumeReal *pBasis,
+			std::vector< std::vector<RasterPolygon> >& arrSlicePolygons)
+	// converts contours to voxel coordinates, bucketed by slice.  One pass over
+	//	the contours; a contour belongs to the slice nearest its z position
 {
-	// clear region before drawing any contours
-	pRegion->FillBuffer(0.0); 
+	const itk::Point<REAL,3> vOrigin = pBasis->GetOrigin();
+	const itk::Vector<REAL,3> vSpacing = pBasis->GetSpacing();
+	const int nSlices = (int) pBasis->GetBufferedRegion().GetSize()[2];
+
+	arrSlicePolygons.clear();
+	arrSlicePolygons.resize(nSlices);
 
-	for (int nSlice = 0; nSlice < pRegion->GetBufferedRegion().GetSize()[2]; nSlice++)
+	for (ContourMapType::iterator iterAt = m_arrContours.begin(); 
+		iterAt != m_arrContours.end(); iterAt++)
 	{
-		REAL slicePos = pRegion->GetOrigin()[2] + pRegion->GetSpacing()[2] * nSlice;
-		CArray<PolygonType *, PolygonType *> arrContours;
-		for (int nAt = 0; nAt < GetContourCount(); nAt++)
+		int nSlice = Round<int>((iterAt->first - vOrigin[2]) / vSpacing[2]);
+		if (nSlice < 0 || nSlice >= nSlices)
+			continue;
+
+		PolygonType *pPoly = iterAt->second;
+		RasterPolygon poly(pPoly->GetNumberOfPoints());
+		for (int nAt = 0; nAt < (int) poly.size(); nAt++)
 		{
-			REAL zPos = GetContourRefDist(nAt);
-			if (IsApproxEqual(zPos, slicePos, pRegion->GetSpacing()[2] / 2.0))
-			{
-				arrContours.Add(GetContour(nAt));
-			}
+			itk::SpatialObjectPoint<2> vVert = *(pPoly->GetPoint(nAt));
+			poly[nAt].x = (vVert.GetPositionInObjectSpace()[0] - vOrigin[0]) / vSpacing[0];
+			poly[nAt].y = (vVert.GetPositionInObjectSpace()[1] - vOrigin[1]) / vSpacing[1];
 		}
-		CreateRegionForPolygonSpatialObject(arrContours, pRegion, nSlice);
+		arrSlicePolygons[nSlice].push_back(poly);
 	}
 }
 
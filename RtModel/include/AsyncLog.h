@@ -0,0 +1,415 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#pragma once
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dH
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// log levels: a record is kept if its level is at or below both the compile-
+//	time ceiling DH_LOG_MAX_LEVEL and the runtime level (BRIMSTONE_LOG_LEVEL,
+//	default LOG_LEVEL_INFO)
+///////////////////////////////////////////////////////////////////////////////
+enum LogLevel
+{
+	LOG_LEVEL_NONE = 0,
+	LOG_LEVEL_INFO = 1,		// once per optimizer iteration
+	LOG_LEVEL_DEBUG = 2,	// log sections
+	LOG_LEVEL_TRACE = 3,	// vectors, and per-VOI detail of each evaluation
+};
+
+// records above the ceiling compile to nothing
+#ifndef DH_LOG_MAX_LEVEL
+#ifdef _DEBUG
+#define DH_LOG_MAX_LEVEL 3
+#else
+#define DH_LOG_MAX_LEVEL 2
+#endif
+#endif
+
+// the runtime level
+extern std::atomic<int> g_nLogLevel;
+
+///////////////////////////////////////////////////////////////////////////////
+// IsLogEnabled
+//
+// the one branch a disabled record costs
+///////////////////////////////////////////////////////////////////////////////
+inline bool
+	IsLogEnabled(int nLevel)
+{
+	return nLevel <= DH_LOG_MAX_LEVEL
+		&& nLevel <= g_nLogLevel.load(std::memory_order_relaxed);
+
+}	// IsLogEnabled
+
+// runtime level accessors
+void SetLogLevel(int nLevel);
+int GetLogLevel();
+
+///////////////////////////////////////////////////////////////////////////////
+// record layout in the ring: a header, then the payload, padded so each
+//	record starts on a LOG_RECORD_ALIGN boundary
+///////////////////////////////////////////////////////////////////////////////
+enum LogRecordType
+{
+	LOG_RECORD_PAD = 0,				// skip to the end of the ring
+	LOG_RECORD_BEGIN_SECTION = 1,	// payload: section name
+	LOG_RECORD_END_SECTION = 2,		// no payload
+	LOG_RECORD_MESSAGE = 3,			// payload: text
+	LOG_RECORD_VECTOR = 4,			// payload: LogVectorHeader, label, values
+};
+
+struct LogRecordHeader
+{
+	unsigned int m_nBytes;			// whole record, header included
+	unsigned short m_nType;
+	unsigned short m_nLevel;
+	unsigned long long m_nTicks;	// steady_clock ticks at the call
+};
+
+struct LogVectorHeader
+{
+	unsigned int m_nLabelBytes;		// label, padded to 8 bytes
+	unsigned int m_nCount;			// number of doubles after the label
+};
+
+const size_t LOG_RECORD_ALIGN = sizeof(LogRecordHeader);
+
+///////////////////////////////////////////////////////////////////////////////
+// class LogRing
+//
+// single-producer / single-consumer byte ring: the owning thread appends
+//	records, the drain thread consumes them.  No locks; when the ring is full
+//	the record is dropped and counted, so logging never blocks the caller.
+///////////////////////////////////////////////////////////////////////////////
+class LogRing
+{
+public:
+	explicit LogRing(size_t nCapacity);
+
+	// reserves space for a record with nPayload bytes, and fills in its
+	//	header; returns a pointer to the payload, or NULL if the ring is full
+	char *Reserve(int nType, int nLevel, size_t nPayload);
+
+	// publishes the record last reserved
+	void Commit();
+
+	// hands each published record to func(header, payload), then frees them
+	template<class FUNC>
+	void Drain(FUNC func);
+
+	// bytes published but not yet drained
+	size_t GetPending() const
+	{
+		return (size_t) (m_nHead.load(std::memory_order_acquire)
+			- m_nTail.load(std::memory_order_acquire));
+	}
+
+	size_t GetCapacity() const { return m_arrBuffer.size(); }
+	unsigned long long GetDroppedCount() const { return m_nDropped.load(); }
+
+	// set when the owning thread exits; the ring is freed once drained
+	std::atomic<bool> m_bRetired;
+
+	// small index, for telling threads apart in the output
+	int m_nThread;
+
+private:
+	std::vector<char> m_arrBuffer;
+	size_t m_nMask;
+
+	// monotonic positions; offsets into the buffer are these & m_nMask
+	std::atomic<unsigned long long> m_nHead;
+	std::atomic<unsigned long long> m_nTail;
+
+	// head after the reserved record, published by Commit
+	unsigned long long m_nReservedHead;
+
+	// sections begun and not yet ended
+	size_t m_nOpenSections;
+
+	std::atomic<unsigned long long> m_nDropped;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+template<class FUNC>
+void
+	LogRing::Drain(FUNC func)
+{
+	unsigned long long nTail = m_nTail.load(std::memory_order_relaxed);
+	const unsigned long long nHead = m_nHead.load(std::memory_order_acquire);
+	while (nTail < nHead)
+	{
+		const LogRecordHeader *pHeader =
+			(const LogRecordHeader *) &m_arrBuffer[(size_t) (nTail & m_nMask)];
+		if (pHeader->m_nType != LOG_RECORD_PAD)
+			func(*pHeader, (const char *) (pHeader + 1));
+		nTail += pHeader->m_nBytes;
+	}
+	m_nTail.store(nTail, std::memory_order_release);
+
+}	// LogRing::Drain
+
+///////////////////////////////////////////////////////////////////////////////
+// class LogSink
+//
+// receives drained records, on the drain thread
+///////////////////////////////////////////////////////////////////////////////
+class LogSink
+{
+public:
+	virtual ~LogSink() {}
+
+	virtual void Write(int nThread, const LogRecordHeader& header, const char *pPayload) = 0;
+	virtual void Flush() {}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// class XmlLogSink
+//
+// formats records as the old synchronous log did (<log_section> elements,
+//	TraceVector text), to a file or, with no file, to the debug output
+///////////////////////////////////////////////////////////////////////////////
+class XmlLogSink : public LogSink
+{
+public:
+	explicit XmlLogSink(const char *pszFileName = NULL);
+	virtual ~XmlLogSink();
+
+	virtual void Write(int nThread, const LogRecordHeader& header, const char *pPayload);
+	virtual void Flush();
+
+private:
+	void Output(const char *pszText);
+
+	FILE *m_pFile;
+	std::vector<char> m_arrText;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// class BinaryLogSink
+//
+// writes the records unformatted, each preceded by its thread index; much
+//	cheaper to drain than the XML, for profiling runs
+///////////////////////////////////////////////////////////////////////////////
+class BinaryLogSink : public LogSink
+{
+public:
+	explicit BinaryLogSink(const char *pszFileName);
+	virtual ~BinaryLogSink();
+
+	virtual void Write(int nThread, const LogRecordHeader& header, const char *pPayload);
+	virtual void Flush();
+
+private:
+	FILE *m_pFile;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// class AsyncLog
+//
+// the process-wide logger: each thread appends to its own LogRing, and a
+//	background thread drains the rings to the sink.  The sink is chosen by
+//	BRIMSTONE_LOG_FILE: unset gives XML to the debug output, a name ending in
+//	.bin gives a BinaryLogSink, anything else an XML file.
+///////////////////////////////////////////////////////////////////////////////
+class AsyncLog
+{
+public:
+	static AsyncLog& GetInstance();
+
+	// replaces the sink, after draining everything pending to the old one
+	void SetSink(std::unique_ptr<LogSink> pSink);
+
+	// record writers; callers check IsLogEnabled first (the macros do).
+	//	BeginSection returns false if the record was dropped, in which case
+	//	the section must not be ended
+	bool BeginSection(int nLevel, const char *pszName);
+	bool BeginSection(int nLevel, const wchar_t *pszName);
+	void EndSection(int nLevel);
+	void Message(int nLevel, const char *pszText);
+	void Message(int nLevel, const wchar_t *pszText);
+	void MessageV(int nLevel, const char *pszFormat, va_list args);
+	template<class TYPE, class CHAR_TYPE>
+	void Vector(int nLevel, const CHAR_TYPE *pszLabel, const TYPE *pValues, int nCount);
+
+	// drains all rings to the sink now, and flushes it
+	void Flush();
+
+	// records lost to full rings
+	unsigned long long GetDroppedCount();
+
+private:
+	AsyncLog();
+	~AsyncLog();
+
+	// the calling thread's ring, created on first use
+	LogRing *GetThreadRing();
+
+	// writes a record whose payload is a (possibly wide) string
+	template<class CHAR_TYPE>
+	bool WriteString(int nType, int nLevel, const CHAR_TYPE *pszText);
+
+	// wakes the drain thread if the ring is filling up
+	void OnCommit(LogRing *pRing);
+
+	void DrainLoop();
+	void DrainAll();
+
+	// all live rings
+	std::mutex m_mutexRings;
+	std::vector< std::shared_ptr<LogRing> > m_arrRings;
+	int m_nNextThread;
+
+	// records dropped by rings since freed
+	unsigned long long m_nRetiredDropped;
+
+	// the sink, and the lock serializing drains
+	std::mutex m_mutexDrain;
+	std::unique_ptr<LogSink> m_pSink;
+
+	// the drain thread
+	std::mutex m_mutexWake;
+	std::condition_variable m_cvWake;
+	bool m_bStop;
+	std::thread m_drainThread;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// narrow copy of a label or message; the logged text is ASCII
+///////////////////////////////////////////////////////////////////////////////
+inline size_t LogStringLength(const char *psz) { return strlen(psz); }
+inline size_t LogStringLength(const wchar_t *psz) { return wcslen(psz); }
+
+template<class CHAR_TYPE>
+inline void
+	CopyLogString(const CHAR_TYPE *pszSource, size_t nLength, char *pDest)
+{
+	for (size_t nAt = 0; nAt < nLength; nAt++)
+		pDest[nAt] = (char) pszSource[nAt];
+	pDest[nLength] = '\0';
+}
+
+///////////////////////////////////////////////////////////////////////////////
+template<class CHAR_TYPE>
+bool
+	AsyncLog::WriteString(int nType, int nLevel, const CHAR_TYPE *pszText)
+{
+	const size_t nLength = LogStringLength(pszText);
+	LogRing *pRing = GetThreadRing();
+	char *pPayload = pRing->Reserve(nType, nLevel, nLength + 1);
+	if (pPayload == NULL)
+		return false;
+
+	CopyLogString(pszText, nLength, pPayload);
+	pRing->Commit();
+	OnCommit(pRing);
+
+	return true;
+
+}	// AsyncLog::WriteString
+
+///////////////////////////////////////////////////////////////////////////////
+template<class TYPE, class CHAR_TYPE>
+void
+	AsyncLog::Vector(int nLevel, const CHAR_TYPE *pszLabel, const TYPE *pValues, int nCount)
+	// copies the raw values; formatting happens on the drain thread
+{
+	const size_t nLength = LogStringLength(pszLabel);
+	const unsigned int nLabelBytes = (unsigned int) ((nLength + 1 + 7) & ~(size_t) 7);
+	LogRing *pRing = GetThreadRing();
+	char *pPayload = pRing->Reserve(LOG_RECORD_VECTOR, nLevel,
+		sizeof(LogVectorHeader) + nLabelBytes + nCount * sizeof(double));
+	if (pPayload == NULL)
+		return;
+
+	LogVectorHeader header;
+	header.m_nLabelBytes = nLabelBytes;
+	header.m_nCount = (unsigned int) nCount;
+	memcpy(pPayload, &header, sizeof(header));
+	CopyLogString(pszLabel, nLength, pPayload + sizeof(header));
+
+	double *pDest = (double *) (pPayload + sizeof(header) + nLabelBytes);
+	for (int nAt = 0; nAt < nCount; nAt++)
+		pDest[nAt] = (double) pValues[nAt];
+
+	pRing->Commit();
+	OnCommit(pRing);
+
+}	// AsyncLog::Vector
+
+///////////////////////////////////////////////////////////////////////////////
+// free-function front ends: each is one branch when its level is disabled
+///////////////////////////////////////////////////////////////////////////////
+template<class CHAR_TYPE>
+inline void
+	LogMessage(int nLevel, const CHAR_TYPE *pszText)
+{
+	if (IsLogEnabled(nLevel))
+		AsyncLog::GetInstance().Message(nLevel, pszText);
+}
+
+// printf-style; called through the LogMessageF macro below
+void LogMessageFormat(int nLevel, const char *pszFormat, ...);
+
+template<class TYPE, class CHAR_TYPE>
+inline void
+	LogVector(int nLevel, const CHAR_TYPE *pszLabel, const TYPE *pValues, int nCount)
+{
+	if (IsLogEnabled(nLevel))
+		AsyncLog::GetInstance().Vector(nLevel, pszLabel, pValues, nCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// class LogSectionScope
+//
+// begins a section on construction and ends it on destruction, if enabled
+///////////////////////////////////////////////////////////////////////////////
+class LogSectionScope
+{
+public:
+	template<class CHAR_TYPE>
+	LogSectionScope(int nLevel, const CHAR_TYPE *pszName)
+		: m_nLevel(nLevel)
+		, m_bEnabled(IsLogEnabled(nLevel))
+	{
+		if (m_bEnabled)
+			m_bEnabled = AsyncLog::GetInstance().BeginSection(m_nLevel, pszName);
+	}
+
+	~LogSectionScope()
+	{
+		if (m_bEnabled)
+			AsyncLog::GetInstance().EndSection(m_nLevel);
+	}
+
+private:
+	int m_nLevel;
+	bool m_bEnabled;
+};
+
+}	// namespace dH
+
+///////////////////////////////////////////////////////////////////////////////
+// LogMessageF
+//
+// printf-style record.  A macro, so that the level is checked before the
+//	arguments are evaluated: a disabled record doesn't build them (e.g.
+//	GetName().c_str()).  nLevel is evaluated twice.
+///////////////////////////////////////////////////////////////////////////////
+#define LogMessageF(nLevel, ...) \
+	((void) (dH::IsLogEnabled(nLevel) \
+		&& (dH::LogMessageFormat(nLevel, __VA_ARGS__), true)))
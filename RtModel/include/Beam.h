@@ -2,10 +2,14 @@
 // $Id: Beam.h 600 2008-09-14 16:46:15Z dglane001 $
 #pragma once
 
+#include <memory>
+#include <mutex>
 #include <vector>
 using namespace std;
 
 #include <ItkUtils.h>
+#include <MemoryAccount.h>
+#include <SparseBeamlet.h>
 using namespace itk;
 
 namespace dH
@@ -14,6 +18,27 @@ namespace dH
 // forward declaration
 class Plan;
 
+/**
+ * supplies beamlets on demand, so that a plan read from a container only
+ * loads the beamlets that are actually used
+ */
+class BeamletSource
+{
+public:
+	virtual ~BeamletSource() {}
+
+	/** loads beamlet nAt (an index, not a shift) of a beam at a pyramid level */
+	virtual VolumeReal::Pointer LoadBeamlet(int nBeam, int nLevel, int nAt) = 0;
+
+	/** for a source that holds its beamlets sparse: sets up a view of 
+		beamlet nAt, without expanding it; false if not supported */
+	virtual bool LoadSparseBeamlet(int nBeam, int nLevel, int nAt, 
+		SparseBeamlet& beamlet) 
+	{ 
+		return false; 
+	}
+};
+
 /**
  * represents a single treatment beam
  */
@@ -46,6 +71,20 @@ public:
 	int GetBeamletCount();
 	VolumeReal *GetBeamlet(int nShift);
 
+	/** the beamlet as its non-zero voxels, if the beamlet source holds it 
+		that way (NULL otherwise); unlike GetBeamlet, this doesn't expand it */
+	const SparseBeamlet *GetSparseBeamlet(int nShift);
+
+	/** sets nCount beamlets to be loaded from the source on first access */
+	void SetBeamletSource(std::shared_ptr<BeamletSource> pSource,
+		int nBeam, int nLevel, int nCount);
+
+	/** appends calculated beamlets */
+	void AddBeamlets(const std::vector<VolumeReal::Pointer>& arrBeamlets);
+
+	/** frees the voxels of the loaded beamlets, keeping their geometry */
+	void ReleaseBeamlets();
+
 	/** intensity map accessors */
 	typedef itk::Image<VOXEL_REAL, 1> IntensityMap;
 	IntensityMap * GetIntensityMap() const;
@@ -54,9 +93,17 @@ public:
 	/** call to deal with intensity map changes */
 	void OnIntensityMapChanged();
 
+	/** call when the beamlets were recalculated in place */
+	void OnBeamletsChanged();
+
 	/** the computed dose for this beam (NULL if no dose exists) */
 	virtual VolumeReal *GetDoseMatrix();
 
+	/** adds the loaded beamlets and the dose to a memory report, attributed
+		to this beam at the given level; beamlets not yet loaded from the
+		beamlet source are not counted */
+	void AccountMemory(MemoryReport& report, int nLevel, int nBeam);
+
 protected:
 	/** GenBeamlets must access this */
 	friend void GenBeamlets(Beam *pBeam);
@@ -76,11 +123,26 @@ private:
 	/** flag to recalculate dose */
 	mutable bool m_bRecalcDose;
 
-public:
+	/** returns beamlet nAt, loading it from the beamlet source if needed */
+	VolumeReal *GetBeamletAt(int nAt);
+	const SparseBeamlet *GetSparseBeamletAt(int nAt);
+
+	/** source for beamlets not yet loaded, and the beam / level they are for */
+	std::shared_ptr<BeamletSource> m_pBeamletSource;
+	int m_nSourceBeam;
+	int m_nSourceLevel;
+
+	/** guards loading from the beamlet source */
+	std::mutex m_mutexBeamlets;
 
 	/** the beamlets for the beam */
 	std::vector< VolumeReal::Pointer > m_arrBeamlets;
 
+	/** views of the source's sparse beamlets, set up on first access */
+	std::vector< SparseBeamlet > m_arrSparseBeamlets;
+
+public:
+
 	/** flag for recalc of beamlets */
 	bool m_bRecalcBeamlets;
 
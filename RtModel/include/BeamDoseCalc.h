@@ -24,6 +24,12 @@ public:
 	void InitCalcBeamlets();
 	void CalcBeamlet(int nBeamlet);
 
+	// calculates the dose for a beamlet, without adding it to the beam; the
+	//		beamlet is as wide as the plan's beamlet spacing, on the beam's
+	//		dose grid (so on a coarse pyramid level, a wider beamlet on a
+	//		coarser grid)
+	VolumeReal::Pointer CalcBeamletDose(int nBeamlet);
+
 	// sets the rectangular region for the current beamlet, in IEC beam coordinates on
 	//		the isocentric plane
 	void SetBeamletMinMax(const Vector<REAL,2>& vMin_in,
@@ -74,6 +80,9 @@ private:
 	// minimum number of rays to use per voxel (on top boundary)
 	REAL m_raysPerVoxel;
 
+	// beamlet spacing (from the plan, at InitCalcBeamlets)
+	REAL m_beamletSpacing;
+
 	// initialize surface integral of fluence 
 	REAL m_fluenceSurfIntegral;
 
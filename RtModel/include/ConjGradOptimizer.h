@@ -7,6 +7,8 @@
 //#include "Optimizer.h"
 #include <vnl/vnl_nonlinear_minimizer.h>
 #include "ObjectiveFunction.h"
+#include <MemoryAccount.h>
+#include <OptimizerCheckpoint.h>
 
 // subordinate brent optimizer
 // #include "BrentOptimizer.h"
@@ -31,6 +33,15 @@ public:
 
 	DeclareMember(LineOptimizerTolerance, REAL);
 
+	// cap on the CG iterations of one minimize (the multigrid smoothing
+	//		passes run only a few)
+	DeclareMember(MaxIterations, int);
+
+	// if set, minimize continues from the adaptive variance of the last
+	//		call (of the same dimension) rather than re-initializing it, so 
+	//		the objective doesn't change between successive short passes
+	DeclareMember(KeepAdaptiveVariance, bool);
+
 	// optimize the objective function
 	// virtual const CVectorN<>& 
 	vnl_nonlinear_minimizer::ReturnCodes minimize(vnl_vector<REAL>& vInit);
@@ -44,6 +55,12 @@ public:
 	//	to call again -- minimize() re-initializes at its start.
 	void PrepareAdaptiveVariance(int nDim) { InitializeDynamicCovariance(nDim); }
 
+	// initializes the adaptive-variance state from a previous run's AV 
+	//	(GetAdaptiveVariance), clamped to the variance range; with 
+	//	KeepAdaptiveVariance set, the next minimize starts from it (for 
+	//	warm-started re-optimization)
+	void RestoreAdaptiveVariance(const CVectorN<>& vAdaptVariance);
+
 	// used to enable explicit free energy calculation
 	void SetComputeFreeEnergy(bool bComputeFreeEnergy);
 
@@ -72,7 +89,21 @@ public:
 	// outer loop (see HIERARCHICAL_BAYES_DESIGN.md, Step 1).
 	const CVectorN<>& GetAdaptiveVariance() const { return m_vAdaptVariance; }
 
+	// adds the covariance matrices and vectors to a memory report
+	void AccountMemory(dH::MemoryReport& report, const dH::MemoryOwner& owner) const;
+
+	// if set, minimize hands its state to the checkpoint every few 
+	//		iterations (NULL for none)
+	void SetCheckpoint(dH::OptimizerCheckpoint *pCheckpoint) { m_pCheckpoint = pCheckpoint; }
+
+	// restores a checkpointed state: the next minimize (of the same 
+	//		dimension) continues from it, ignoring its initial vector
+	void SetResumeState(const dH::OptimizerState& state);
+
 protected:
+	// the state after nIterations iterations, for a checkpoint
+	void GetState(dH::OptimizerState& state, int nIterations) const;
+
 	void InitializeDynamicCovariance(int nDim);
 	void UpdateDynamicCovariance();
 	REAL ComputeEntropyFromCovariance(const vnl_matrix<REAL>& covar);
@@ -108,6 +139,11 @@ private:
 	OptimizerCallback *m_pCallbackFunc;
 	void *m_pCallbackParam;
 
+	// checkpoint for the state, and the iteration to resume at (-1 for a 
+	//		new minimize)
+	dH::OptimizerCheckpoint *m_pCheckpoint;
+	int m_nResumeIteration;
+
 };	// class DynamicCovarianceOptimizer
 
 
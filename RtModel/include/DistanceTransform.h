@@ -0,0 +1,176 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#pragma once
+
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <ParallelFor.h>
+
+namespace dH
+{
+
+// stands in for infinite distance; large, but squares without overflow in double
+const double EDT_INF = 1e20;
+
+///////////////////////////////////////////////////////////////////////////////
+// DistanceTransform1D
+//
+// One pass of the Felzenszwalb-Huttenlocher transform: computes
+//	d(p) = min_q ( (spacing * (p - q))^2 + f(q) )
+//	for a sampled function f, by building the lower envelope of the parabolas
+//	rooted at each sample.  Linear time.  f and d may have any stride, so the
+//	same routine runs along x, y and z.  arrV / arrZ are scratch.
+///////////////////////////////////////////////////////////////////////////////
+inline void DistanceTransform1D(const double *f, int nCount, double spacing,
+								double *d, std::vector<int>& arrV, std::vector<double>& arrZ)
+{
+	arrV.resize(nCount);
+	arrZ.resize(nCount + 1);
+
+	// positions of the samples
+	#define POS(q) (spacing * (double) (q))
+
+	// build the lower envelope, skipping samples at infinity
+	int k = -1;
+	for (int q = 0; q < nCount; q++)
+	{
+		if (f[q] >= EDT_INF)
+			continue;
+
+		if (k < 0)
+		{
+			k = 0;
+			arrV[0] = q;
+			arrZ[0] = -EDT_INF;
+			arrZ[1] = EDT_INF;
+			continue;
+		}
+
+		// pop parabolas hidden by the new one; arrZ[0] is -infinity, so this
+		//	stops at k == 0
+		const int v0 = arrV[k];
+		double s = ((f[q] + POS(q) * POS(q)) - (f[v0] + POS(v0) * POS(v0)))
+			/ (2.0 * (POS(q) - POS(v0)));
+		while (s <= arrZ[k])
+		{
+			k--;
+			const int v = arrV[k];
+			s = ((f[q] + POS(q) * POS(q)) - (f[v] + POS(v) * POS(v)))
+				/ (2.0 * (POS(q) - POS(v)));
+		}
+
+		k++;
+		arrV[k] = q;
+		arrZ[k] = s;
+		arrZ[k + 1] = EDT_INF;
+	}
+
+	if (k < 0)
+	{
+		std::fill(d, d + nCount, EDT_INF);
+		return;
+	}
+
+	// read off the envelope
+	k = 0;
+	for (int q = 0; q < nCount; q++)
+	{
+		while (arrZ[k + 1] < POS(q))
+			k++;
+		const double dx = POS(q) - POS(arrV[k]);
+		d[q] = dx * dx + f[arrV[k]];
+	}
+
+	#undef POS
+
+}	// DistanceTransform1D
+
+///////////////////////////////////////////////////////////////////////////////
+// SquaredDistanceTransform
+//
+// Exact squared Euclidean distance (in the units of vSpacing) from each voxel
+//	of an nSize[0] x nSize[1] x nSize[2] volume to the nearest voxel for which
+//	bFeature(value) is true.  Three separable 1-D passes, each run in parallel
+//	over the rows it processes.  Voxels with no feature anywhere get EDT_INF.
+///////////////////////////////////////////////////////////////////////////////
+template<class VOXEL_TYPE, class FEATURE_PRED>
+void SquaredDistanceTransform(const VOXEL_TYPE *pVolume, const int nSize[3],
+							  const double vSpacing[3], FEATURE_PRED bFeature,
+							  double *pSqDist)
+{
+	const int nCount = nSize[0] * nSize[1] * nSize[2];
+	for (int nAt = 0; nAt < nCount; nAt++)
+	{
+		pSqDist[nAt] = bFeature(pVolume[nAt]) ? 0.0 : EDT_INF;
+	}
+
+	const int arrStride[3] = { 1, nSize[0], nSize[0] * nSize[1] };
+	for (int nAxis = 0; nAxis < 3; nAxis++)
+	{
+		// the other two axes enumerate the rows
+		const int nAxisA = (nAxis + 1) % 3;
+		const int nAxisB = (nAxis + 2) % 3;
+		const int nRows = nSize[nAxisA] * nSize[nAxisB];
+		const int nLength = nSize[nAxis];
+		const int nStride = arrStride[nAxis];
+
+		ParallelForChunks(nRows, [&](int nBegin, int nEnd)
+		{
+			std::vector<double> arrIn(nLength);
+			std::vector<double> arrOut(nLength);
+			std::vector<int> arrV;
+			std::vector<double> arrZ;
+			for (int nRow = nBegin; nRow < nEnd; nRow++)
+			{
+				double *pRow = pSqDist
+					+ (nRow % nSize[nAxisA]) * arrStride[nAxisA]
+					+ (nRow / nSize[nAxisA]) * arrStride[nAxisB];
+				for (int nAt = 0; nAt < nLength; nAt++)
+					arrIn[nAt] = pRow[nAt * nStride];
+
+				DistanceTransform1D(&arrIn[0], nLength, vSpacing[nAxis],
+					&arrOut[0], arrV, arrZ);
+
+				for (int nAt = 0; nAt < nLength; nAt++)
+					pRow[nAt * nStride] = std::min(arrOut[nAt], EDT_INF);
+			}
+		}, 64);
+	}
+
+}	// SquaredDistanceTransform
+
+///////////////////////////////////////////////////////////////////////////////
+// SignedDistanceMap
+//
+// Signed distance for a region (inside where value > threshold): outside
+//	voxels get the distance to the nearest inside voxel, inside voxels get
+//	minus the distance to the nearest outside voxel.  So the map is negative
+//	inside, positive outside, and no voxel is ever 0.  An empty or full region
+//	gives +/- sqrt(EDT_INF) everywhere.
+///////////////////////////////////////////////////////////////////////////////
+template<class VOXEL_TYPE>
+void SignedDistanceMap(const VOXEL_TYPE *pRegion, VOXEL_TYPE threshold,
+					   const int nSize[3], const double vSpacing[3], VOXEL_TYPE *pDist)
+{
+	const int nCount = nSize[0] * nSize[1] * nSize[2];
+	std::vector<double> arrToInside(nCount);
+	std::vector<double> arrToOutside(nCount);
+
+	SquaredDistanceTransform(pRegion, nSize, vSpacing,
+		[threshold](VOXEL_TYPE value) { return value > threshold; }, &arrToInside[0]);
+	SquaredDistanceTransform(pRegion, nSize, vSpacing,
+		[threshold](VOXEL_TYPE value) { return !(value > threshold); }, &arrToOutside[0]);
+
+	for (int nAt = 0; nAt < nCount; nAt++)
+	{
+		pDist[nAt] = (pRegion[nAt] > threshold)
+			? (VOXEL_TYPE) -sqrt(arrToOutside[nAt])
+			: (VOXEL_TYPE) sqrt(arrToInside[nAt]);
+	}
+
+}	// SignedDistanceMap
+
+}	// namespace dH
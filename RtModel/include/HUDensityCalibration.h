@@ -0,0 +1,64 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#if !defined(_HUDENSITYCALIBRATION_H__INCLUDED_)
+#define _HUDENSITYCALIBRATION_H__INCLUDED_
+
+#include <vector>
+
+namespace dH
+{
+
+/**
+ * HUDensityCalibration maps CT numbers (HU) to mass density, as a piecewise
+ * linear calibration curve measured for a particular scanner.  Values outside
+ * the table are clamped to the first / last density.
+ */
+class HUDensityCalibration
+{
+public:
+	HUDensityCalibration();
+
+	/** the built-in curve (matches the historical piecewise constants) */
+	static const HUDensityCalibration& GetDefault();
+
+	/** calibration points; HU must be strictly increasing */
+	int GetPointCount() const;
+	void GetPoint(int nAt, float *pHU, float *pDensity) const;
+	void ClearPoints();
+	void AddPoint(float hu, float density);
+
+	/** reads a two-column "HU density" text file; '#' starts a comment */
+	bool ReadFromFile(const char *pszFileName);
+
+	/** converts a single CT number */
+	float Convert(float hu) const;
+
+	/** converts a buffer of CT numbers, in parallel chunks */
+	void Convert(const float *pHU, float *pDensity, int nCount) const;
+
+	/** incremented whenever the curve changes, so consumers can tell a
+		cached conversion is stale */
+	unsigned long GetVersion() const { return m_nVersion; }
+
+private:
+	/** rebuilds the 1-HU lookup table from the calibration points */
+	void UpdateLUT();
+
+	/** the calibration curve */
+	std::vector<float> m_arrHU;
+	std::vector<float> m_arrDensity;
+
+	/** dense table sampled at 1 HU, from m_arrHU.front() to m_arrHU.back(),
+		plus one guard entry so interpolation never reads past the end */
+	std::vector<float> m_arrLUT;
+	float m_minHU;
+	float m_maxHU;
+
+	/** change counter */
+	unsigned long m_nVersion;
+
+};	// class HUDensityCalibration
+
+}	// namespace dH
+
+#endif // !defined(_HUDENSITYCALIBRATION_H__INCLUDED_)
@@ -2,8 +2,11 @@
 // $Id: Histogram.h 603 2008-09-14 16:58:43Z dglane001 $
 #pragma once
 
+#include <vector>
+
 #include <VectorN.h>
 #include <ItkUtils.h>
+#include <MemoryAccount.h>
 // #include <ModelObject.h>
 
 const REAL GBINS_BUFFER = R(8.0);
@@ -68,6 +71,16 @@ public:
 	const CVectorN<>& GetGBins() const;
 	const CVectorN<>& GetGBinMeans() const;
 
+	// bins each of a batch of volumes (congruent with the histogram's
+	//		volume), weighted by its var min / max fraction volumes as 
+	//		SetVarFracVolumes does, in one sweep of the region's voxels; 
+	//		arrGBins[nAt] is what GetGBins returns for arrVolumes[nAt].  The
+	//		histogram's own bins are left as they were
+	void GetGBinsBatch(const std::vector<VolumeReal::Pointer>& arrVolumes,
+		const std::vector<VolumeReal::Pointer>& arrVarFracLo,
+		const std::vector<VolumeReal::Pointer>& arrVarFracHi,
+		std::vector< CVectorN<> >& arrGBins) const;
+
 	// determines if the given dVolume is contributing to the masked region
 	bool IsContributing(int nElement);
 
@@ -81,6 +94,16 @@ public:
 	// called when region updated
 	void OnRegionChanged(); // CObservableEvent * pEvt, void * pParam);
 
+	// adds the helper volumes to a memory report
+	virtual void AccountMemory(dH::MemoryReport& report, 
+		const dH::MemoryOwner& owner) const;
+
+	// frees the helper volumes; they are recomputed on next use
+	virtual void ReleaseHelperVolumes();
+
+	// bytes the helper volumes take, for volumes of nVoxels voxels
+	static size_t EstimateHelperBytes(size_t nVoxels);
+
 protected:
 
 	// helpers
@@ -3,6 +3,8 @@
 #pragma once
 
 #include <Histogram.h>
+#include <SparseBeamlet.h>
+#include <mutex>
 
 class CHistogramWithGradient : public CHistogram
 {
@@ -16,16 +18,46 @@ public:
 	VolumeReal *Get_dVolume(int nAt, int *pnGroup = NULL) const;
 	int Add_dVolume(VolumeReal *p_dVolume, int nGroup);
 
-	// partial derivatives
+	// a sparse beamlet as a dVolume: its grid stands in as the dVolume, and
+	//		the binning reads only its non-zero voxels, so it is never expanded
+	int Add_dVolume(const dH::SparseBeamlet& beamlet, int nGroup);
+	const dH::SparseBeamlet *Get_dVolumeSparse(int nAt) const;
+
+	// partial derivatives; calls on one histogram are serialized, because
+	//		they share the group volumes, the lean product volume and the
+	//		convolution scratch. The returned bins are only valid until the
+	//		next call for the same dVolume.
 	const CVectorN<>& Get_dBins(int nAt) const;
 	const CVectorN<>& Get_dGBins(int nAt) const;
 
+	// lean mode: the dVolume x region products are not kept per dVolume,
+	//		but recomputed into a single volume as they are needed
+	void SetLean(bool bLean);
+	bool IsLean() const;
+
+	// adds the helper volumes to a memory report (the dVolumes themselves
+	//		belong to the beams)
+	virtual void AccountMemory(dH::MemoryReport& report, 
+		const dH::MemoryOwner& owner) const;
+
+	// frees the helper volumes, including the dVolume x region products
+	virtual void ReleaseHelperVolumes();
+
+	// bytes the helper volumes take, for nGroups groups and n_dVolumes 
+	//		dVolumes of nVoxels voxels
+	static size_t EstimateHelperBytes(size_t nVoxels, int nGroups, 
+		int n_dVolumes, bool bLean);
+
 	const CVectorN<>* vInput;
 	const CVectorN<>* vInputTrans;
 
 protected:
 	// helpers
 
+	// adds a dVolume, with its sparse form if it has one
+	int Insert_dVolume(VolumeReal *p_dVolume, int nGroup, 
+		const dH::SparseBeamlet *pSparse);
+
 	// calculates the bin volume, rotated for basis group N
 	const VolumeShort * GetBinVolume(int nAt) const;
 
@@ -62,11 +94,28 @@ protected:
 
 	// array of partial derivative volumes
 	std::vector< VolumeReal::Pointer > m_arr_dVolumes;
+
+	// their sparse forms (with a NULL grid for a dense dVolume)
+	std::vector< dH::SparseBeamlet > m_arr_dVolumesSparse;
 	CArray<int, int> m_arrVolumeGroups;
 
 	// array of partial derivative X region
 	std::vector< VolumeReal::Pointer > m_arr_dVolumes_x_Region;
 
+	// lean mode flag, and the one product volume used in lean mode, with 
+	//		the index of the dVolume it holds
+	bool m_bLean;
+	mutable VolumeReal::Pointer m_vol_dVolume_x_Region;
+	mutable int m_nAt_dVolume_x_Region;
+
+	// serializes Get_dBins / Get_dGBins (recursive, as Get_dGBins calls 
+	//		Get_dBins)
+	mutable std::recursive_mutex m_mutex_dBins;
+
+	// scratch for the dGBins convolutions
+	mutable CVectorN<> m_arr_dGBinsVarMin;
+	mutable CVectorN<> m_arr_dGBinsVarMax;
+
 	//// flags for recalc
 	//mutable CArray<bool, bool> m_arr_bRecompute_dVolumes_x_Region;
 
@@ -0,0 +1,143 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Plan.h>
+#include <MemoryAccount.h>
+
+namespace dH
+{
+
+/**
+ * a precomputed, sparse dose-influence matrix with per-structure voxel lists,
+ * as published for the CORT and TROTS benchmark cases (written by 
+ * pybrimstone.datasets.write_influence_matrix).  
+ *
+ * only voxels belonging to some structure matter to the optimizer, so the 
+ * matrix rows are remapped, as the file is read, onto a compact grid holding
+ * just those voxels; the columns are kept in compressed-sparse-column form.
+ * The plan's beams and the prescription read them as SparseBeamlet views
+ * (InfluenceBeamletSource); a column is only expanded onto the compact grid
+ * if something asks for it as a volume.
+ */
+class InfluenceMatrix
+{
+public:
+	InfluenceMatrix();
+
+	/** reads the matrix file, streaming the columns; false if the file is
+		missing, truncated or not an influence matrix */
+	bool Read(const char *pszFileName);
+
+	/** voxels (rows) in the file, and the structure voxels of the compact
+		grid */
+	int GetVoxelCount() const;
+	int GetCompactVoxelCount() const;
+
+	/** beamlets (columns), and the beams they belong to */
+	int GetBeamletCount() const;
+	int GetBeamCount() const;
+	int GetBeamOf(int nBeamlet) const;
+
+	/** non-zeros kept, on the compact grid */
+	size_t GetNonZeroCount() const;
+
+	/** the structures: name, type (Structure::StructType) and compact voxel 
+		indices */
+	int GetStructureCount() const;
+	const std::string& GetStructureName(int nAt) const;
+	int GetStructureType(int nAt) const;
+	const std::vector<int>& GetStructureVoxels(int nAt) const;
+
+	/** shapes a volume as the compact grid: one voxel per structure voxel,
+		padded to a box, with the plan's isocenter at its center.  ShapeGrid
+		sets just the geometry; FormGrid also allocates and zeros it */
+	void ShapeGrid(VolumeReal *pVolume) const;
+	void FormGrid(VolumeReal *pVolume) const;
+
+	/** expands a beamlet (column) onto the compact grid */
+	void ExpandBeamlet(int nBeamlet, VolumeReal *pVolume) const;
+
+	/** points a sparse beamlet at a column's rows and values */
+	void GetSparseBeamlet(int nBeamlet, SparseBeamlet& beamlet) const;
+
+	/** forms a structure's region on the compact grid */
+	void FormRegion(int nStructure, VolumeReal *pRegion) const;
+
+	/** sets up a single-level plan on the compact grid: a structure in the 
+		series for each of the matrix's, and a beam for each of its beams, 
+		with beamlets supplied from the matrix.  Beams are padded with empty
+		beamlets to a common, odd, beamlet count */
+	static bool SetupPlan(std::shared_ptr<const InfluenceMatrix> pMatrix, Plan *pPlan);
+
+	/** beamlets per beam in a plan set up by SetupPlan */
+	int GetPlanBeamletCount() const;
+
+	/** the column of beamlet nAt of a beam, in a plan set up by SetupPlan 
+		(-1 for padding) */
+	int GetPlanColumn(int nBeam, int nAt) const;
+
+	/** the plan state vector element holding a beamlet's weight, in a plan 
+		set up by SetupPlan */
+	int GetPlanElement(int nBeamlet) const;
+
+	/** adds the compressed columns to a memory report */
+	void AccountMemory(MemoryReport& report) const;
+
+private:
+	/** voxels in the file */
+	int m_nVoxels;
+
+	/** the compressed columns: for column n, m_arrRows / m_arrValues from
+		m_arrColumnStart[n] to m_arrColumnStart[n+1] */
+	std::vector<size_t> m_arrColumnStart;
+	std::vector<int> m_arrRows;
+	std::vector<float> m_arrValues;
+
+	/** beam of each beamlet */
+	std::vector<int> m_arrBeamOf;
+	int m_nBeams;
+
+	/** the structures, with their voxels on the compact grid */
+	struct StructureVoxels
+	{
+		std::string m_strName;
+		int m_nType;
+		std::vector<int> m_arrVoxels;
+	};
+	std::vector<StructureVoxels> m_arrStructures;
+	int m_nCompactVoxels;
+
+	/** columns of each beam, in order, the padded beamlet count, and each 
+		column's element in the plan state vector */
+	std::vector< std::vector<int> > m_arrBeamColumns;
+	int m_nPlanBeamletCount;
+	std::vector<int> m_arrPlanElement;
+};
+
+/**
+ * supplies a plan's beamlets from an influence matrix: as sparse views of
+ * its columns, or expanded onto its compact grid for callers that need a 
+ * volume
+ */
+class InfluenceBeamletSource : public BeamletSource
+{
+public:
+	InfluenceBeamletSource(std::shared_ptr<const InfluenceMatrix> pMatrix);
+
+	virtual VolumeReal::Pointer LoadBeamlet(int nBeam, int nLevel, int nAt);
+	virtual bool LoadSparseBeamlet(int nBeam, int nLevel, int nAt, 
+		SparseBeamlet& beamlet);
+
+private:
+	std::shared_ptr<const InfluenceMatrix> m_pMatrix;
+
+	/** the compact grid's geometry, shared by the sparse beamlets */
+	VolumeReal::Pointer m_pGrid;
+};
+
+}	// namespace dH
@@ -441,6 +441,18 @@ void
 	pTo->SetDirection(pFrom->GetDirection());
 }
 
+//////////////////////////////////////////////////////////////////////
+// frees the image's buffer; a later ConformTo reallocates it
+template<class VOXEL_TYPE, int DIM> INLINE
+void 
+	ReleaseImage(itk::Image<VOXEL_TYPE,DIM> *pImage)
+{
+	if (pImage != NULL)
+	{
+		pImage->Initialize();
+	}
+}
+
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
@@ -50,6 +50,10 @@ public:
 	// evaluates the term
 	virtual REAL Eval(CVectorN<> *pvGrad, const CArray<BOOL, BOOL>& arrInclude);
 
+	// evaluates the term at each of a batch of calculated GBins
+	virtual void EvalBatch(const std::vector< CVectorN<> >& arrCalcGBins,
+		CVectorN<>& vValues);
+
 	// over-ride to create subcopy
 	virtual VOITerm *Clone();
 
@@ -57,6 +61,9 @@ public:
 	void OnHistogramBinningChange(); // CObservableEvent *pSource = NULL, void *pVoid = NULL);
 
 private:
+	// the (weighted) divergence of calculated GBins from the target
+	REAL EvalGBins(const CVectorN<>& calcGPDF);
+
 	// DVPs
 	CMatrixNxM<> m_mDVPs;
 
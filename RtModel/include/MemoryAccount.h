@@ -0,0 +1,126 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#pragma once
+
+#include <stddef.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace dH
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// memory accounting: each owner of large buffers adds them to a MemoryReport
+//	(an AccountMemory method), attributed to a category and to the level,
+//	beam and structure they belong to.  A buffer reached from two owners --
+//	a beamlet that is also a histogram's dVolume, say -- is counted once, for
+//	the first.  PlanOptimizer::AccountMemory walks a whole optimization.
+//
+// the budget (BRIMSTONE_MEMORY_BUDGET_MB; unset or 0 is no budget) is what
+//	PlanOptimizer checks before it allocates, falling back to leaner modes
+//	when the budget would be exceeded
+///////////////////////////////////////////////////////////////////////////////
+enum MemoryCategory
+{
+	MEMORY_BEAMLETS = 0,		// beamlet volumes
+	MEMORY_DOSE = 1,			// dose matrices and sum volumes
+	MEMORY_HISTOGRAM = 2,		// histogram helper volumes
+	MEMORY_REGION = 3,			// structure regions and distance maps
+	MEMORY_RESAMPLE_CACHE = 4,	// cached resampled regions
+	MEMORY_OPTIMIZER = 5,		// optimizer matrices
+	MEMORY_CATEGORY_COUNT = 6,
+};
+
+// name of a category, for the report
+const char *GetMemoryCategoryName(int nCategory);
+
+///////////////////////////////////////////////////////////////////////////////
+// what a buffer belongs to; -1 / empty for parts that don't apply
+///////////////////////////////////////////////////////////////////////////////
+struct MemoryOwner
+{
+	MemoryOwner(int nLevel = -1, int nBeam = -1, const std::string& strStructure = std::string())
+		: m_nLevel(nLevel)
+		, m_nBeam(nBeam)
+		, m_strStructure(strStructure)
+	{
+	}
+
+	int m_nLevel;
+	int m_nBeam;
+	std::string m_strStructure;
+
+	bool operator<(const MemoryOwner& other) const
+	{
+		if (m_nLevel != other.m_nLevel)
+			return m_nLevel < other.m_nLevel;
+		if (m_nBeam != other.m_nBeam)
+			return m_nBeam < other.m_nBeam;
+		return m_strStructure < other.m_strStructure;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// class MemoryReport
+///////////////////////////////////////////////////////////////////////////////
+class MemoryReport
+{
+public:
+	MemoryReport();
+
+	// bytes held by one category / owner
+	struct Item
+	{
+		int m_nCategory;
+		MemoryOwner m_owner;
+		size_t m_nBytes;
+		int m_nBuffers;
+	};
+
+	// adds a buffer, unless it has already been added
+	void Add(int nCategory, const MemoryOwner& owner, const void *pBuffer, size_t nBytes);
+
+	// adds an image's pixel buffer (NULL or unallocated images add nothing)
+	template<class IMAGE>
+	void AddImage(int nCategory, const MemoryOwner& owner, const IMAGE *pImage)
+	{
+		if (pImage != NULL && pImage->GetBufferPointer() != NULL)
+		{
+			Add(nCategory, owner, pImage->GetBufferPointer(),
+				pImage->GetBufferedRegion().GetNumberOfPixels()
+					* sizeof(typename IMAGE::PixelType));
+		}
+	}
+
+	// totals
+	size_t GetTotal() const;
+	size_t GetTotal(int nCategory) const;
+
+	// per category / owner, ordered by category then owner
+	void GetItems(std::vector<Item>& arrItems) const;
+
+	// a table of the items, with the totals per category
+	std::string Format() const;
+
+private:
+	// buffers already counted
+	std::set<const void *> m_setBuffers;
+
+	// bytes and buffer count per category / owner
+	std::map<std::pair<int, MemoryOwner>, std::pair<size_t, int> > m_mapItems;
+
+	size_t m_arrCategoryTotals[MEMORY_CATEGORY_COUNT];
+	size_t m_nTotal;
+};
+
+// the budget, in bytes; 0 is no budget
+size_t GetMemoryBudget();
+void SetMemoryBudget(size_t nBytes);
+
+// true if there is a budget, and nBytes exceeds it
+bool IsOverMemoryBudget(size_t nBytes);
+
+}	// namespace dH
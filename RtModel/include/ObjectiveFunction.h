@@ -40,6 +40,15 @@ public:
 	// sets the OF to use adaptive variance
 	void SetAdaptiveVariance(CVectorN<> *pAV, REAL varMin, REAL varMax);
 
+	// sets a linear term for compute to subtract: f(x) - v.x, with gradient
+	//		g(x) - v.  Used for the multigrid coarse-level correction; an
+	//		empty vector (the default) is no term
+	void SetLinearCorrection(const CVectorN<>& vCorrection);
+
+	// count of evaluations through compute -- that is, by an optimizer
+	int GetEvaluationCount() const;
+	void ResetEvaluationCount();
+
 protected:
 	// pointer to adaptive variance vector, if enabled
 	CVectorN<> *m_pAV;
@@ -48,6 +57,12 @@ protected:
 	REAL m_varMin;
 	REAL m_varMax;
 
+	// the linear correction, if any
+	CVectorN<> m_vLinearCorrection;
+
+	// evaluations since the last reset
+	int m_nEvaluations;
+
 //private:
 //	// flag to indicate that gradient information is available
 //	BOOL m_bHasGradientInfo;
@@ -0,0 +1,166 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#pragma once
+
+#include <future>
+#include <string>
+#include <vector>
+
+#include <vnl/vnl_vector.h>
+#include <vnl/vnl_matrix.h>
+
+namespace dH
+{
+
+class VOITerm;
+
+///////////////////////////////////////////////////////////////////////////////
+// a prescription term's parameters, as written with a snapshot
+///////////////////////////////////////////////////////////////////////////////
+struct CheckpointTerm
+{
+	CheckpointTerm()
+		: m_weight(0.0)
+	{
+	}
+
+	std::string m_strStructure;
+
+	REAL m_weight;
+
+	// a KLDivTerm's dose-volume points, as (dose, volume) pairs; empty for 
+	//		other terms
+	std::vector<REAL> m_arrDVPs;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// the state of a DynamicCovarianceOptimizer between two iterations: with 
+//	the same prescription, minimize continues from it on the trajectory it
+//	would have taken uninterrupted
+///////////////////////////////////////////////////////////////////////////////
+struct OptimizerState
+{
+	OptimizerState()
+		: m_nLevel(0)
+		, m_nSchedule(0)
+		, m_nIteration(0)
+		, m_finalValue(0.0)
+		, m_bCalcVar(false)
+		, m_varMin(0.0)
+		, m_varMax(0.0)
+		, m_entropy(0.0)
+		, m_freeEnergy(0.0)
+	{
+	}
+
+	// the pyramid level being optimized
+	int m_nLevel;
+
+	// the finest level's schedule the run was under (PlanOptimizer's 
+	//		Multigrid), which a resumed run has to follow too
+	int m_nSchedule;
+
+	// iterations completed, which is the index of the next
+	int m_nIteration;
+
+	// the parameters and the objective there
+	vnl_vector<REAL> m_vParam;
+	REAL m_finalValue;
+
+	// the (negative) gradient and the conjugate direction
+	vnl_vector<REAL> m_vGrad;
+	vnl_vector<REAL> m_vDir;
+
+	// adaptive variance settings
+	bool m_bCalcVar;
+	REAL m_varMin;
+	REAL m_varMax;
+
+	// the directions searched so far: the first m_nIteration columns of the
+	//		optimizer's matrix (the rest are the identity's, and the 
+	//		orthogonal basis is rebuilt from these each iteration, so it 
+	//		isn't stored)
+	vnl_matrix<REAL> m_mSearchedDir;
+
+	// the adaptive variance
+	vnl_vector<REAL> m_vAdaptVariance;
+
+	// free energy diagnostics
+	REAL m_entropy;
+	REAL m_freeEnergy;
+
+	// the prescription's term parameters
+	std::vector<CheckpointTerm> m_arrTerms;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// class OptimizerCheckpoint
+//
+// writes snapshots of an optimization every few iterations, so that a run
+//	that is stopped (a pre-empted batch job) can be resumed 
+//	(PlanOptimizer::Resume).  The optimizer only copies its state; the file
+//	is written on a worker thread, to a temporary that then replaces the 
+//	last snapshot, so a snapshot on disk is always complete.  If the last 
+//	write is still in progress the new state is dropped rather than waited
+//	for.
+///////////////////////////////////////////////////////////////////////////////
+class OptimizerCheckpoint
+{
+public:
+	OptimizerCheckpoint(const std::string& strFileName, int nInterval);
+	~OptimizerCheckpoint();
+
+	const std::string& GetFileName() const { return m_strFileName; }
+
+	// iterations between snapshots
+	int GetInterval() const { return m_nInterval; }
+
+	// sets the level, the finest level's schedule, and the terms whose 
+	//		parameters are written with each snapshot (a level's terms 
+	//		don't change while it is optimized)
+	void SetLevel(int nLevel, int nSchedule, const std::vector<VOITerm*>& arrTerms);
+
+	// true if a snapshot is due once iteration nIteration (0-based) is done
+	bool IsDue(int nIteration) const;
+
+	// hands a state to the worker thread, which writes it with the level and
+	//		terms; the state is taken (swapped out)
+	void Write(OptimizerState& state);
+
+	// waits for the write in progress; false if any write failed
+	bool Flush();
+
+	// snapshots written, and dropped while a write was in progress
+	int GetWrittenCount() const { return m_nWritten; }
+	int GetDroppedCount() const { return m_nDropped; }
+
+	// the snapshot file format; false if the file is missing, truncated or
+	//		of another version
+	static bool WriteFile(const std::string& strFileName, const OptimizerState& state);
+	static bool ReadFile(const std::string& strFileName, OptimizerState& state);
+
+	// applies a snapshot's term parameters to the terms of the same structures
+	static void ApplyTerms(const OptimizerState& state, const std::vector<VOITerm*>& arrTerms);
+
+private:
+	// collects the result of a finished write
+	void CollectWrite();
+
+	std::string m_strFileName;
+	int m_nInterval;
+
+	// the level, schedule and term parameters, for the next state written
+	int m_nLevel;
+	int m_nSchedule;
+	std::vector<CheckpointTerm> m_arrTerms;
+
+	// the state being written, and the worker's result
+	OptimizerState m_stateWriting;
+	std::future<bool> m_futureWrite;
+
+	int m_nWritten;
+	int m_nDropped;
+	bool m_bFailed;
+};
+
+}	// namespace dH
@@ -0,0 +1,107 @@
+// Copyright (C) 2nd Messenger Systems - U. S. Patent 7,369,645
+#pragma once
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace dH
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// GetWorkerCount
+//
+// Number of worker threads used by ParallelForChunks. Read once from
+//	BRIMSTONE_THREADS, defaulting to std::thread::hardware_concurrency. Setting
+//	BRIMSTONE_THREADS=1 forces every parallel pass to run serially on the
+//	calling thread, which is the easiest way to rule threading out when a
+//	result looks wrong.
+///////////////////////////////////////////////////////////////////////////////
+inline int GetWorkerCount()
+{
+	static const int s_nWorkers = []() -> int
+	{
+		const char *pEnv = getenv("BRIMSTONE_THREADS");
+		int nWorkers = (pEnv != NULL) ? atoi(pEnv)
+			: (int) std::thread::hardware_concurrency();
+		return std::max(nWorkers, 1);
+	}();
+
+	return s_nWorkers;
+
+}	// GetWorkerCount
+
+///////////////////////////////////////////////////////////////////////////////
+// SetThreadWorkerLimit
+//
+// Caps the workers ParallelForChunks uses for passes started on the calling
+//	thread; 0 removes the cap. A caller that already runs several passes side
+//	by side (one per phase, say) gives each thread its share of
+//	GetWorkerCount, so the passes together don't oversubscribe the cores.
+//	Returns the previous cap.
+///////////////////////////////////////////////////////////////////////////////
+inline int& ThreadWorkerLimit()
+{
+	static thread_local int s_nLimit = 0;
+	return s_nLimit;
+
+}	// ThreadWorkerLimit
+
+inline int SetThreadWorkerLimit(int nLimit)
+{
+	const int nPrevious = ThreadWorkerLimit();
+	ThreadWorkerLimit() = std::max(nLimit, 0);
+	return nPrevious;
+
+}	// SetThreadWorkerLimit
+
+///////////////////////////////////////////////////////////////////////////////
+// ParallelForChunks
+//
+// Splits [0, nCount) into contiguous chunks and calls func(nBegin, nEnd) for
+//	each chunk, one chunk per worker. Chunks smaller than nMinChunk are not
+//	worth a thread, so small inputs run inline on the calling thread.
+//
+// func must only write to the part of the output owned by its chunk; nothing
+//	here synchronizes between chunks. Returns once all chunks are done.
+///////////////////////////////////////////////////////////////////////////////
+template<class FUNC>
+inline void ParallelForChunks(int nCount, FUNC func, int nMinChunk = 4096)
+{
+	if (nCount <= 0)
+		return;
+
+	int nWorkers = GetWorkerCount();
+	if (ThreadWorkerLimit() > 0)
+		nWorkers = std::min(nWorkers, ThreadWorkerLimit());
+
+	int nChunks = std::min(nWorkers,
+		(nCount + nMinChunk - 1) / std::max(nMinChunk, 1));
+	if (nChunks <= 1)
+	{
+		func(0, nCount);
+		return;
+	}
+
+	// the calling thread takes the first chunk, workers take the rest
+	const int nChunkSize = (nCount + nChunks - 1) / nChunks;
+	std::vector<std::thread> arrWorkers;
+	arrWorkers.reserve(nChunks - 1);
+	for (int nAtChunk = 1; nAtChunk < nChunks; nAtChunk++)
+	{
+		const int nBegin = nAtChunk * nChunkSize;
+		const int nEnd = std::min(nBegin + nChunkSize, nCount);
+		if (nBegin < nEnd)
+			arrWorkers.push_back(std::thread(func, nBegin, nEnd));
+	}
+
+	func(0, std::min(nChunkSize, nCount));
+
+	for (size_t nAt = 0; nAt < arrWorkers.size(); nAt++)
+		arrWorkers[nAt].join();
+
+}	// ParallelForChunks
+
+}	// namespace dH
@@ -59,7 +59,7 @@ public:
 	/** helper functions */
 	int GetTotalBeamletCount();
 
-	/** helper to get formatted mass density volume */
+	/** helper to get formatted mass density volume (cached on the series) */
 	VolumeReal * GetMassDensity();
 
 	/** the computed dose for this plan (NULL if no dose exists) */
@@ -68,9 +68,21 @@ public:
 	/** calls update on all internal histograms */
 	void UpdateAllHisto();
 
+	/** adds the beams, dose and histograms to a memory report, attributed
+		to the given pyramid level */
+	void AccountMemory(MemoryReport& report, int nLevel);
+
 	/** sets shape for dose matrix */
 	DECLARE_ATTRIBUTE_GI(DoseResolution, REAL);
 
+	/** pyramid parameters: the number of levels, each doubling the dose 
+		resolution, and the finest level's beamlets -- how many either side
+		of the central beamlet, and their spacing (mm).  Each coarser level
+		halves the count and doubles the spacing */
+	DECLARE_ATTRIBUTE(PyramidLevels, int);
+	DECLARE_ATTRIBUTE(MaxBeamletShift, int);
+	DECLARE_ATTRIBUTE(BeamletSpacing, REAL);
+
 	/** stores the energy dep kernel */
 	CEnergyDepKernel * m_pKernel;
 
@@ -80,10 +92,6 @@ protected:
 	/** the plan's beams */
 	std::vector< dH::Beam::Pointer > m_arrBeams;
 
-private:
-	/** storing resampled mass density */
-	VolumeReal::Pointer m_pMassDensity;
-
 public:
 	/** the dose matrix for the plan */
 	VolumeReal::Pointer m_pDose;
@@ -0,0 +1,145 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#pragma once
+
+#include <stdio.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace dH
+{
+
+/**
+ * PlanContainer is a single-file store of named binary chunks, used to hold a
+ * plan's XML together with its volumes (beamlets, intensity maps, dose).
+ *
+ * Layout (little-endian):
+ *		header		64 bytes: magic, version, offset / size of the index
+ *		chunks		each starting on a CHUNK_ALIGN boundary
+ *		index		key, content hash, offset, stored / raw size, codec
+ *
+ * Chunks are content-addressed: a chunk whose content matches one already
+ * written is stored once, and both keys point at it (so the many all-zero
+ * beamlets of a plan cost one chunk).  The hash only finds candidates; their
+ * bytes are compared before a chunk is shared.  Float data is stored with a
+ * zero-run codec, since beamlets are mostly zero outside their path.  Raw
+ * chunks are aligned, so the file can be memory-mapped and read in place.
+ */
+class PlanContainer
+{
+public:
+	/** chunk codecs */
+	enum Codec
+	{
+		CODEC_RAW = 0,
+		CODEC_SPARSE_FLOAT = 1,
+	};
+
+	/** chunk offsets are multiples of this */
+	static const int CHUNK_ALIGN = 64;
+
+	/** index entry for a chunk */
+	struct Entry
+	{
+		unsigned long long m_nHash;
+		unsigned long long m_nOffset;
+		unsigned long long m_nStoredBytes;
+		unsigned long long m_nRawBytes;
+		unsigned int m_nHeaderBytes;
+		unsigned int m_nCodec;
+	};
+
+	/** 64-bit FNV-1a, used as the content address */
+	static unsigned long long Hash(const void *pData, size_t nBytes,
+		unsigned long long nSeed = 14695981039346656037ULL);
+
+	/** zero-run encoding of a float array: (zero count, literal count, literals)* */
+	static void EncodeSparseFloats(const float *pData, size_t nCount,
+		std::vector<char>& arrEncoded);
+	static bool DecodeSparseFloats(const char *pEncoded, size_t nBytes,
+		float *pData, size_t nCount);
+};
+
+/**
+ * writes a plan container
+ */
+class PlanContainerWriter
+{
+public:
+	PlanContainerWriter();
+	~PlanContainerWriter();
+
+	/** creates the file */
+	bool Open(const char *pszFileName);
+
+	/** writes a chunk of raw bytes */
+	bool WriteChunk(const std::string& strKey, const void *pData, size_t nBytes);
+
+	/** writes a chunk of a raw header followed by float data; the floats are
+		stored sparse if that is smaller */
+	bool WriteFloatChunk(const std::string& strKey,
+		const void *pHeader, size_t nHeaderBytes,
+		const float *pData, size_t nCount);
+
+	/** writes the index and closes the file; false if any write failed */
+	bool Close();
+
+	/** number of keys, and number of distinct chunks actually stored */
+	int GetKeyCount() const { return (int) m_mapIndex.size(); }
+	int GetStoredChunkCount() const { return (int) m_mapStored.size(); }
+
+private:
+	/** appends an encoded chunk, or points at an identical stored one */
+	bool AddChunk(const std::string& strKey, unsigned long long nHash,
+		const std::vector<char>& arrStored, unsigned long long nRawBytes,
+		unsigned int nHeaderBytes, unsigned int nCodec);
+
+	/** true if the stored chunk holds exactly these encoded bytes */
+	bool IsStored(const PlanContainer::Entry& entry,
+		const std::vector<char>& arrStored, unsigned int nCodec);
+
+	FILE *m_pFile;
+	unsigned long long m_nOffset;
+
+	/** cleared by the first failed write */
+	bool m_bOK;
+
+	/** key -> entry */
+	std::map<std::string, PlanContainer::Entry> m_mapIndex;
+
+	/** content hash -> entries, for de-duplication; more than one if the
+		hashes of different chunks collide */
+	std::multimap<unsigned long long, PlanContainer::Entry> m_mapStored;
+};
+
+/**
+ * reads a plan container; chunks are read on request, so a reader can be
+ * kept open to load beamlets lazily.  Thread-safe.
+ */
+class PlanContainerReader
+{
+public:
+	PlanContainerReader();
+	~PlanContainerReader();
+
+	/** opens the file and reads the index */
+	bool Open(const char *pszFileName);
+
+	/** index query */
+	bool HasChunk(const std::string& strKey) const;
+
+	/** reads and decodes a chunk */
+	bool ReadChunk(const std::string& strKey, std::vector<char>& arrData);
+
+private:
+	FILE *m_pFile;
+	std::map<std::string, PlanContainer::Entry> m_mapIndex;
+
+	/** guards the file position */
+	std::mutex m_mutex;
+};
+
+}	// namespace dH
@@ -2,6 +2,9 @@
 // $Id: PlanOptimizer.h 603 2008-09-14 16:58:43Z dglane001 $
 #pragma once
 
+#include <memory>
+#include <string>
+
 #include <Prescription.h>
 #include <PlanPyramid.h>
 
@@ -27,16 +30,99 @@ public:
 	// reference to the plan pyramid manager
 	DECLARE_ATTRIBUTE_PTR(Pyramid, PlanPyramid);
 
-	// accessors for the prescription objects
+	// number of levels (the plan's PyramidLevels)
+	int GetLevelCount();
+
+	// accessors for the prescription objects; a coarse level is built 
+	//		(beamlets, prescription with clones of the terms, optimizer) on 
+	//		first access
 	Prescription *GetPrescription(int nLevel);
 	DynamicCovarianceOptimizer *GetOptimizer(int nLevel);
 
+	// true if the level's prescription and optimizer exist
+	bool IsLevelBuilt(int nLevel) const;
+
+	// frees a coarse level's prescription, optimizer and beamlets; it is
+	//		rebuilt if accessed again
+	void ReleaseLevel(int nLevel);
+
+	// if set (the default), Optimize releases each coarse level once the 
+	//		next finer one has started; BRIMSTONE_RELEASE_LEVELS=0 keeps 
+	//		them, unless over a memory budget
+	DECLARE_ATTRIBUTE(ReleaseLevels, bool);
+
 	// handles cloning to separate layers
 	void AddStructureTerm(VOITerm *pST);
 
+	// removes the structure's term from each level that has been built
+	void RemoveStructureTerm(Structure *pStruct);
+
+	// schedule for the finest level: MULTIGRID_NONE optimizes it once, 
+	//		after the coarser levels (one-way coarse-to-fine); V and W run 
+	//		multigrid cycles through the coarser levels, with the coarse 
+	//		problems corrected to match the restricted fine gradient.  The
+	//		value is the number of coarse visits per cycle
+	enum MultigridSchedule
+	{
+		MULTIGRID_NONE = 0,
+		MULTIGRID_V = 1,
+		MULTIGRID_W = 2,
+	};
+
+	// the schedule (BRIMSTONE_MULTIGRID = V or W; default none)
+	DECLARE_ATTRIBUTE(Multigrid, int);
+
+	// the schedule the finest level runs under: none for a single level
+	int GetSchedule();
+
+	// CG iterations before and after each coarse correction (BRIMSTONE_MG_SMOOTH)
+	DECLARE_ATTRIBUTE(SmoothingIterations, int);
+
+	// most cycles at the finest level (BRIMSTONE_MG_CYCLES)
+	DECLARE_ATTRIBUTE(MaxCycles, int);
+
 	// performs the optimization (calls sub-levels first)
 	bool Optimize(CVectorN<>& vInit, OptimizerCallback *pFunc, void *pParam);
 
+	// with a file, Optimize writes a snapshot of each level's run every 
+	//		nInterval iterations, and removes it once done 
+	//		(BRIMSTONE_CHECKPOINT, BRIMSTONE_CHECKPOINT_INTERVAL); an empty
+	//		name for none.  Multigrid cycles aren't snapshotted: the last
+	//		snapshot under them is the last coarse level's
+	void SetCheckpoint(const std::string& strFileName, int nInterval);
+	OptimizerCheckpoint *GetCheckpoint() { return m_pCheckpoint.get(); }
+
+	// continues the optimization that the checkpoint's snapshot is of, from
+	//		the snapshot's level, iteration and prescription parameters; 
+	//		false if there is no usable snapshot (the caller then Optimizes),
+	//		including one taken under another schedule, or the callback 
+	//		requested termination
+	bool Resume(CVectorN<>& vResult, OptimizerCallback *pFunc, void *pParam);
+
+	// what changed since a previous optimization, for ReOptimize
+	enum ReOptimizeChange
+	{
+		CHANGE_NONE = 0,
+		CHANGE_PRESCRIPTION = 1,	// term parameters (doses, weights)
+		CHANGE_STRUCTURE = 2,		// structure regions (contours, margins)
+		CHANGE_DENSITY = 4,			// the density volume
+	};
+
+	// re-optimizes from a previous solution (the level 0 weights vState, 
+	//		and the optimizer's adaptive variance vAdaptVariance after it; 
+	//		empty to start from the maximum variance), after the changes 
+	//		nChanged.  Only the histograms of the changed structures 
+	//		(pChangedStructures; NULL for all) are set up again, and the 
+	//		beamlets only for a density change.  The optimization resumes at
+	//		nStartLevel rather than the coarsest level; returns false if the
+	//		callback requested termination
+	bool ReOptimize(CVectorN<>& vState, const CVectorN<>& vAdaptVariance,
+		int nChanged, const vector<Structure*> *pChangedStructures,
+		OptimizerCallback *pFunc, void *pParam, int nStartLevel = 0);
+
+	// objective evaluations at a level, during the last Optimize
+	int GetEvaluationCount(int nLevel);
+
 	// transfers state vector from plan
 	void GetStateVectorFromPlan(CVectorN<>& vState);
 	void SetStateVectorToPlan(const CVectorN<>& vState);
@@ -44,10 +130,57 @@ public:
 	// transfers state vector from level n+1 to level n
 	void InvFilterStateVector(int nScale, const CVectorN<>& vIn, CVectorN<>& vOut);
 
+	// transfers state vector from level n-1 to level n, by the transpose of
+	//		InvFilterStateVector (averaged, for weights, if bAverage)
+	void FilterStateVector(int nScale, const CVectorN<>& vIn, CVectorN<>& vOut, 
+		bool bAverage);
+
+	// adds the memory held at every level -- beams, prescriptions and 
+	//		optimizers -- to a report
+	void AccountMemory(MemoryReport& report);
+	MemoryReport GetMemoryReport();
+
+	// frees coarse-level caches, then switches histograms to lean mode,
+	//		until the memory held (plus nReserve bytes) is within the budget;
+	//		returns false, and logs the report, if it can't get there
+	bool EnforceMemoryBudget(size_t nReserve = 0);
+
 protected:
+	// estimates the bytes a new structure term's histograms add, summed 
+	//		over the levels
+	size_t EstimateStructureTermBytes(bool bLean);
+
 	// helper to set up the prescription
 	void SetupPrescription();
 
+	// creates the prescription and optimizer for a level
+	void BuildLevel(int nLevel);
+
+	// adds the terms held back while the finest level's beamlets were being
+	//		calculated in the background (waiting for them)
+	void BindPendingTerms();
+
+	// updates a coarse level's terms from the finest level's, and the 
+	//		pending ones
+	void UpdateLevelTerms(int nLevel);
+
+	// the finest level's terms and the pending ones
+	void GetBaseTerms(vector<VOITerm*>& arrTerms);
+
+	// multigrid cycles at the finest level, from the optimizer parameters vX;
+	//		false if the callback requested termination
+	bool MultigridOptimize(CVectorN<>& vX);
+
+	// one cycle at nLevel, on that level's optimizer parameters
+	bool MultigridCycle(int nLevel, CVectorN<>& vX);
+
+	// a CG pass at a level of at most nIterations (0 for the optimizer's 
+	//		own limit); false if the callback requested termination
+	bool Smooth(int nLevel, CVectorN<>& vX, int nIterations);
+
+	// the level's objective (and gradient), as its optimizer sees it
+	REAL EvaluateLevel(int nLevel, const CVectorN<>& vX, CVectorN<> *pGrad);
+
 	// initial state vector
 	void GetInitStateVector(CVectorN<>& vInit);
 
@@ -62,6 +195,14 @@ protected:
 private:
 	// pointers to the other prescription objects
 	vector< std::pair<dH::Prescription*, DynamicCovarianceOptimizer*> > m_arrPrescriptions;
+
+	// terms added while the pyramid's base beamlets are pending; the coarse
+	//		levels have their clones, level 0 gets them from BindPendingTerms
+	vector<VOITerm*> m_arrPendingTerms;
+
+	// the snapshots, and the state the next Optimize resumes from
+	std::unique_ptr<OptimizerCheckpoint> m_pCheckpoint;
+	std::unique_ptr<OptimizerState> m_pResumeState;
 };
 
 }	// namespace dH
\ No newline at end of file
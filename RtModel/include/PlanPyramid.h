@@ -2,8 +2,13 @@
 // $Id: PlanPyramid.h 647 2009-11-05 21:52:59Z dglane001 $
 #pragma once
 
+#include <future>
+#include <memory>
+
 #include <Plan.h>
 
+class CBeamDoseCalc;
+
 namespace dH
 {
 
@@ -18,35 +23,95 @@ public:
 	PlanPyramid(CPlan *pPlan);
 	~PlanPyramid(void);
 
-	// constant represent number of sub-scales
-	static const int MAX_SCALES = 4; // Structure::MAX_SCALES-1;
-
 	// accessor to the Plan object
 	DECLARE_ATTRIBUTE_PTR_GI(Plan, CPlan);
 
-	// getter for sub-plans
+	// if set, each coarse level's beamlets are calculated directly on its own
+	//		dose grid (CBeamDoseCalc, at the level's beamlet spacing) rather 
+	//		than filtered down from the finer levels, so they don't need the 
+	//		finest level's (BRIMSTONE_DIRECT_BEAMLETS)
+	DECLARE_ATTRIBUTE(DirectBeamlets, bool);
+
+	// number of levels, from the plan's PyramidLevels; at most as many as
+	//		leave the coarsest level a beamlet either side of the central one
+	int GetLevelCount();
+	static int GetLevelCount(CPlan *pPlan);
+
+	// getter for sub-plans; a level's plan, beams and intensity maps are 
+	//		set up on first access, its beamlets by CalcLevelBeamlets
 	CPlan *GetPlan(int nLevel);
 
-	// helper to calculate sub beamlets
+	// helper to calculate sub beamlets, for all levels
 	void CalcPencilSubBeamlets(int nBeam = -1);
 
+	// calculates a level's beamlets, and those of the finer levels they are
+	//		filtered from, where they aren't current
+	void CalcLevelBeamlets(int nLevel, int nBeam = -1);
+
+	// true if a level's beamlets are current for all beams
+	bool IsLevelCurrent(int nLevel);
+
+	// frees a level's beamlets (the beamlet images are kept, empty, for 
+	//		the next CalcLevelBeamlets to refill)
+	void ReleaseLevel(int nLevel);
+
+	// starts calculating a level's beamlets on a background thread (a 
+	//		future): for level 0 the beams that have none, for a direct 
+	//		coarse level the beams that aren't current.  Until the level is
+	//		waited for its beams are left as they are, so the other levels
+	//		can be calculated and optimized meanwhile
+	void StartLevelBeamlets(int nLevel);
+
+	// true while a level's background calculation hasn't been collected
+	bool IsLevelPending(int nLevel) const;
+
+	// waits for a level's background calculation, and moves its beamlets 
+	//		into the level's beams (CalcLevelBeamlets does this first)
+	void WaitLevelBeamlets(int nLevel);
+
+	// recalculates the finest level's beamlets in place (after the density
+	//		changed), and marks the coarser levels' stale
+	void RecalcBeamlets();
+
 	// helper function to transfer intensity maps from one level
 	//		to next
 	void InvFiltIntensityMap(int nLevel, const CBeam::IntensityMap * vWeights,
 								CBeam::IntensityMap * vFiltWeights);
 
+	// the transpose of InvFiltIntensityMap: restricts a level nLevel-1 map
+	//		to level nLevel.  With bAverage, each coarse element is normalized
+	//		by its weights (full weighting, for restricting intensities); 
+	//		without, it is the plain transpose (for restricting gradients)
+	void RestrictIntensityMap(int nLevel, const CBeam::IntensityMap * vFineWeights,
+								CBeam::IntensityMap * vWeights, bool bAverage);
+
 protected:
-	// array of plans (= plan pyramid)
+	// sets up a level's plan and beams to match the level above
+	void SetupLevel(int nLevel);
+
+	// filters one beam's beamlets from level nLevel-1 to nLevel
+	void CalcSubBeamlets(int nLevel, int nBeam);
+
+	// calculates one beam's beamlets at nLevel on the level's own grid
+	void CalcDirectBeamlets(int nLevel, int nBeam);
+
+	// array of plans (= plan pyramid), built up to the deepest level used
 	vector<CPlan*> m_arrPlans;
 
+	// per level, per beam: whether the beamlets are current
+	vector< vector<bool> > m_arrCurrent;
+
+	// per level, the background calculation: the beamlets for each of the
+	//		beams in m_arrPendingBeams
+	vector< std::future< vector< vector<VolumeReal::Pointer> > > > m_arrFutureBeamlets;
+	vector< vector<int> > m_arrPendingBeams;
+
 	//// helper function to set up filter matrix
 	//const CMatrixNxM<>& GetFilterMat(int nLevel);
 
 	// filter for intensity maps
 	CVectorN<> m_vWeightFilter;
 
-	//// corresponding filter matrix 
-	//CMatrixNxM<> m_mFilter[MAX_SCALES - 1];
 };
 
 }	// namespace dH
@@ -1,23 +1,46 @@
 #pragma once
 
+#include <memory>
+#include <sstream>
+
 #include <itkXMLFile.h>
 
 #include <Plan.h>
+#include <PlanContainer.h>
 #include <Prescription.h>
 
 namespace dH
 {
 
 /**
- *
+ * reads a plan container written by PlanXmlWriter.  The plan XML is parsed
+ * by GenerateOutputInformation; beamlets are not read then, but are loaded by
+ * each beam on first access, from the container, which stays open while any
+ * of the plan's beams refers to it.
  */
 class PlanXmlReader 
 	: public XMLReader<Plan>
 {
 public:
+	PlanXmlReader();
+
+	/** itk typedefs */
+	typedef PlanXmlReader Self;
+	typedef XMLReader<Plan> Superclass;
+	typedef SmartPointer<Self> Pointer;
+
+	itkNewMacro(Self);
+
+	/** series the plan is on; must be set before reading for the dose
+		resolution and gantry angles to be applied */
+	DECLARE_ATTRIBUTE_PTR(Series, dH::Series);
+
 	/** determine whether a file can be opened and read */
 	virtual int CanReadFile(const char* name);
 
+	/** opens the container and parses its plan XML */
+	virtual void GenerateOutputInformation();
+
 	/** called from XML parser with start-of-element information. */
 	virtual void StartElement(const char * name,const char **atts);
 
@@ -28,18 +51,31 @@ public:
 	virtual void CharacterDataHandler(const char *inData, int inLength);
 
 private:
+	/** the open container */
+	std::shared_ptr<PlanContainerReader> m_pContainer;
+
+	/** the plan being read */
+	Plan::Pointer m_pPlan;
+
 	/** current character data for the open element */
 	std::string m_currentCharacterData;
 
-	/** stores the current beam */
+	/** stores the current beam, and its index */
 	CBeam::Pointer m_pCurrentBeam;
+	int m_nCurrentBeam;
+
+	/** the current beamlet's index, and the beam's beamlet keys by index */
+	int m_nCurrentBeamlet;
+	std::vector<std::string> m_arrCurrentBeamletKeys;
 
 	/** stores current beamlet's position */
 	Beam::IntensityMap::PointType m_currentBeamletPosition;
 };
 
 /**
- *
+ * writes a plan as a single container file (see PlanContainer): the plan XML
+ * is one chunk, and each beamlet, intensity map and the plan dose are others,
+ * referenced from the XML by key
  */
 class PlanXmlWriter
 	: public XMLWriterBase<Plan>
@@ -47,15 +83,19 @@ class PlanXmlWriter
 public:
 	PlanXmlWriter();
 
+	/** itk typedefs */
+	typedef PlanXmlWriter Self;
+	typedef XMLWriterBase<Plan> Superclass;
+	typedef SmartPointer<Self> Pointer;
+
+	itkNewMacro(Self);
+
 	/** Return non-zero if the filename given is writeable. */
 	virtual int CanWriteFile(const char* name);
 
 	/** accessors for data path */
 	void SetImageSeriesPath(const std::string& strPath);
 
-	/** accessors for data path */
-	void SetPlanDataPath(const std::string& strPath);
-
 	/** Write the XML file, based on the Input Object */
 	virtual int WriteFile();
 
@@ -78,9 +118,10 @@ public:
 	/** write out calculated DVHs */
 	void WriteDVHs(Plan * pPlan);
 
-	/** write a start element with an attribute  */
+	/** write a start element with up to two attributes  */
 	void WriteStartElement(const char *name);
-	void WriteStartElement(const char *name, const char *attribute, const char *attribute_value);
+	void WriteStartElement(const char *name, const char *attribute, const char *attribute_value,
+		const char *attribute2 = "", const char *attribute2_value = "");
 	void WriteEndElement(const char *name);
 
 	/** write a single element with character data */
@@ -90,26 +131,23 @@ public:
 	void WriteElement(const char *name, REAL real_data);
 
 private:
-	std::ofstream m_output;
+	/** the plan XML, stored as a chunk once complete */
+	std::ostringstream m_output;
+
+	/** the container being written */
+	PlanContainerWriter m_container;
+
 	std::string m_strImageSeriesPath;
-	std::string m_strPlanDataPath;
 
 	int m_nLevel;
 	bool m_bEolBeforeEndElement;
 };
 
 //////////////////////////////////////////////////////////////////////////////
-void 
+inline void
 	PlanXmlWriter::SetImageSeriesPath(const std::string& strPath)
 {
 	m_strImageSeriesPath = strPath;
 }
 
-//////////////////////////////////////////////////////////////////////////////
-void 
-	PlanXmlWriter::SetPlanDataPath(const std::string& strPath)
-{
-	m_strPlanDataPath = strPath;
 }
-
-}
\ No newline at end of file
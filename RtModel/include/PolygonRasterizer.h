@@ -0,0 +1,137 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#pragma once
+
+#include <math.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace dH
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// polygon in voxel coordinates: voxel (nX, nY) is centered at (nX, nY) and
+//	covers [nX-0.5, nX+0.5] x [nY-0.5, nY+0.5]
+///////////////////////////////////////////////////////////////////////////////
+struct RasterPoint
+{
+	double x;
+	double y;
+};
+typedef std::vector<RasterPoint> RasterPolygon;
+
+///////////////////////////////////////////////////////////////////////////////
+// RasterizeCoverage
+//
+// Scanline fill of a set of polygons into a nWidth x nHeight slice, writing
+//	the fraction of each voxel's area that is covered.  Each polygon is filled
+//	even-odd, and the polygons are unioned (as repeated GDI Polygon calls did).
+//
+// Coverage is exact in x: each span's overlap with a voxel is computed
+//	analytically.  In y it is sampled on nSubRows scanlines per voxel row, so
+//	nSubRows = 1 gives the binary mask of the voxel centers' row, and the error
+//	falls as 1 / nSubRows.
+//
+// The slice is overwritten.  arrSpans is scratch, passed in so that a caller
+//	filling many slices on one thread does not reallocate it.
+///////////////////////////////////////////////////////////////////////////////
+template<class VOXEL_TYPE>
+void RasterizeCoverage(const std::vector<const RasterPolygon *>& arrPolygons,
+					   int nWidth, int nHeight, VOXEL_TYPE *pSlice, int nSubRows,
+					   std::vector< std::pair<double, double> >& arrSpans)
+{
+	std::fill(pSlice, pSlice + nWidth * nHeight, (VOXEL_TYPE) 0);
+	if (arrPolygons.empty())
+		return;
+
+	// row range covered by the polygons
+	double minY = 1e30;
+	double maxY = -1e30;
+	for (size_t nAtPoly = 0; nAtPoly < arrPolygons.size(); nAtPoly++)
+	{
+		const RasterPolygon& poly = *arrPolygons[nAtPoly];
+		for (size_t nAt = 0; nAt < poly.size(); nAt++)
+		{
+			minY = std::min(minY, poly[nAt].y);
+			maxY = std::max(maxY, poly[nAt].y);
+		}
+	}
+	const int nRowBegin = std::max(0, (int) floor(minY + 0.5));
+	const int nRowEnd = std::min(nHeight - 1, (int) floor(maxY + 0.5));
+
+	const double subRowWeight = 1.0 / (double) nSubRows;
+	std::vector<double> arrCrossings;
+	for (int nY = nRowBegin; nY <= nRowEnd; nY++)
+	{
+		VOXEL_TYPE *pRow = pSlice + nY * nWidth;
+		for (int nSub = 0; nSub < nSubRows; nSub++)
+		{
+			const double y = (double) nY - 0.5 + ((double) nSub + 0.5) * subRowWeight;
+
+			// collect the spans of every polygon on this scanline
+			arrSpans.clear();
+			for (size_t nAtPoly = 0; nAtPoly < arrPolygons.size(); nAtPoly++)
+			{
+				const RasterPolygon& poly = *arrPolygons[nAtPoly];
+				arrCrossings.clear();
+				for (size_t nAt = 0; nAt < poly.size(); nAt++)
+				{
+					const RasterPoint& v0 = poly[nAt];
+					const RasterPoint& v1 = poly[(nAt + 1) % poly.size()];
+
+					// half-open in y, so a vertex on the scanline counts once
+					if ((v0.y <= y && y < v1.y) || (v1.y <= y && y < v0.y))
+					{
+						arrCrossings.push_back(v0.x
+							+ (y - v0.y) * (v1.x - v0.x) / (v1.y - v0.y));
+					}
+				}
+				std::sort(arrCrossings.begin(), arrCrossings.end());
+				for (size_t nAt = 0; nAt + 1 < arrCrossings.size(); nAt += 2)
+				{
+					arrSpans.push_back(std::make_pair(arrCrossings[nAt], arrCrossings[nAt + 1]));
+				}
+			}
+
+			// union the spans, then accumulate their overlap with each voxel
+			std::sort(arrSpans.begin(), arrSpans.end());
+			size_t nAtSpan = 0;
+			while (nAtSpan < arrSpans.size())
+			{
+				double x0 = arrSpans[nAtSpan].first;
+				double x1 = arrSpans[nAtSpan].second;
+				for (nAtSpan++; nAtSpan < arrSpans.size()
+					&& arrSpans[nAtSpan].first <= x1; nAtSpan++)
+				{
+					x1 = std::max(x1, arrSpans[nAtSpan].second);
+				}
+
+				x0 = std::max(x0, -0.5);
+				x1 = std::min(x1, (double) nWidth - 0.5);
+				if (x0 >= x1)
+					continue;
+
+				const int nX0 = (int) floor(x0 + 0.5);
+				const int nX1 = std::min(nWidth - 1, (int) floor(x1 + 0.5));
+				for (int nX = nX0; nX <= nX1; nX++)
+				{
+					const double overlap = std::min(x1, (double) nX + 0.5)
+						- std::max(x0, (double) nX - 0.5);
+					if (overlap > 0.0)
+						pRow[nX] += (VOXEL_TYPE) (overlap * subRowWeight);
+				}
+			}
+		}
+
+		// guard against accumulated round-off above full coverage
+		for (int nX = 0; nX < nWidth; nX++)
+		{
+			pRow[nX] = std::min(pRow[nX], (VOXEL_TYPE) 1);
+		}
+	}
+
+}	// RasterizeCoverage
+
+}	// namespace dH
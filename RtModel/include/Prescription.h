@@ -39,6 +39,9 @@ public:
 	// independent terms of the function
 	VOITerm *GetStructureTerm(Structure *pStruct);
 
+	// all of the terms
+	void GetStructureTerms(vector<VOITerm*>& arrTerms) const;
+
 	// accessors for the structure terms
 	void AddStructureTerm(VOITerm *pST);
 	void RemoveStructureTerm(Structure *pStruct);
@@ -46,6 +49,10 @@ public:
 	// updates term parameters from another CPrescription object
 	void UpdateTerms(Prescription *pPresc);
 
+	// adds a clone of each of another prescription's terms (for a level 
+	//		that is built after its terms were added)
+	void CloneTerms(Prescription *pPresc);
+
 	// sets up adaptive variance
 	void SetGBinVar(REAL varMin, REAL varMax);
 
@@ -56,6 +63,17 @@ public:
 	virtual REAL operator()(const CVectorN<>& vInput, 
 		CVectorN<> *pGrad = NULL) const;
 
+	// evaluates the objective function at each of a batch of points: 
+	//		vValues[nAt] for arrInputs[nAt].  Without gradients, the doses of 
+	//		all the points are formed in one pass over the beamlets, and each 
+	//		term's histograms of all of them binned in one sweep of its 
+	//		region; this holds five dose-grid volumes per point, so callers 
+	//		bound the batch.  With gradients (pGrads), the points are 
+	//		evaluated in turn, as the dBins are of one point at a time.
+	//		GetLastKL / GetLastEntropy then refer to the last point
+	void EvaluateBatch(const std::vector< CVectorN<> >& arrInputs,
+		CVectorN<>& vValues, std::vector< CVectorN<> > *pGrads = NULL) const;
+
 	// flag to indicate whether the transform slope variance correction should be applied
 	DECLARE_ATTRIBUTE(TransformSlopeVariance, bool);
 
@@ -64,6 +82,27 @@ public:
 		const CVectorN<>& vInputTrans,
 		const CArray<BOOL, BOOL>& arrInclude) const;
 
+	// CalcSumSigmoid for a batch of points, in one pass over the beamlets: 
+	//		forms each point's sum, and var min / max fraction volumes, 
+	//		leaving the histogram's volume as it was
+	void CalcSumSigmoidBatch(CHistogramWithGradient *pHisto, 
+		const std::vector< CVectorN<> >& arrInputs,
+		const std::vector< CVectorN<> >& arrInputTrans,
+		const CArray<BOOL, BOOL>& arrInclude,
+		std::vector<VolumeReal::Pointer>& arrSum,
+		std::vector<VolumeReal::Pointer>& arrMinVar,
+		std::vector<VolumeReal::Pointer>& arrMaxVar) const;
+
+	// a beamlet's binning variance: its adaptive variance, adjusted for the
+	//		transform slope if TransformSlopeVariance, within [varMin, varMax]
+	REAL CalcActualVariance(int nElem, const CVectorN<>& vInput,
+		const CVectorN<>& vInputTrans) const;
+
+	// the entropy regularizer's entropy at an input; with pGrad, subtracts
+	//		weight times its gradient
+	REAL EvalEntropy(const CVectorN<>& vInput, REAL weight, 
+		CVectorN<> *pGrad) const;
+
 	// transform function from linear to other parameter space
 	virtual void Transform(CVectorN<> *pvInOut) const;
 	virtual void dTransform(CVectorN<> *pvInOut) const;
@@ -75,9 +114,25 @@ public:
 	// helper to update the histogram regions
 	void UpdateHistogramRegions();
 
+	// updates the histogram region of one structure's term (after the 
+	//		structure has changed); false if there is no term for it
+	bool UpdateHistogramRegion(Structure *pStruct);
+
 	// helper to set up element include flags
 	void SetElementInclude();
 
+	// adds the sum and helper volumes, the terms' histograms and the 
+	//		structures to a memory report, attributed to the given level
+	void AccountMemory(MemoryReport& report, int nLevel) const;
+
+	// sets lean mode on all the terms' histograms (see 
+	//		CHistogramWithGradient::SetLean)
+	void SetLean(bool bLean);
+
+	// frees the helper volumes (here and in the histograms); they are 
+	//		recomputed on the next evaluation
+	void ReleaseCaches();
+
 	// breakdown of the most recent operator() evaluation into its KL and
 	//	softmax-entropy parts, when the entropy regularizer is active
 	//	(F = KL - w*entropy). Used by the sweep instrumentation to report the
@@ -0,0 +1,209 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace dH
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// the per-stage profiler: scoped timers on the optimizer's hot paths, kept in
+//	per-thread buffers and tagged with the pyramid level and CG iteration at
+//	the time.  Disabled, a scope costs one relaxed load.  Enabled by setting
+//	BRIMSTONE_PROFILE to the name of a Chrome trace (chrome://tracing or
+//	Perfetto) to write at the end of each optimization, or from Python.
+///////////////////////////////////////////////////////////////////////////////
+
+// whether scopes record
+extern std::atomic<bool> g_bProfileEnabled;
+
+///////////////////////////////////////////////////////////////////////////////
+// IsProfileEnabled
+///////////////////////////////////////////////////////////////////////////////
+inline bool
+	IsProfileEnabled()
+{
+	return g_bProfileEnabled.load(std::memory_order_relaxed);
+
+}	// IsProfileEnabled
+
+///////////////////////////////////////////////////////////////////////////////
+// one timed scope
+///////////////////////////////////////////////////////////////////////////////
+struct ProfileEvent
+{
+	const char *m_pszStage;			// static string
+	unsigned long long m_nStart;	// profiler ticks
+	unsigned long long m_nEnd;
+	unsigned long long m_nBytes;	// bytes the stage touched, if known
+	int m_nLevel;					// pyramid level, -1 if unset
+	int m_nIteration;				// CG iteration, -1 if unset
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// a block of a thread's events.  The owning thread fills it, publishing each
+//	event by storing the count; readers load the count first, so they never
+//	see a partly written event.
+///////////////////////////////////////////////////////////////////////////////
+struct ProfileBlock
+{
+	static const size_t EVENT_COUNT = 1024;
+
+	ProfileEvent m_arrEvents[EVENT_COUNT];
+	std::atomic<size_t> m_nCount;
+	unsigned long long m_nFirst;	// index in the buffer of the first event
+	ProfileBlock *m_pNext;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// a thread's events, as a list of blocks.  Recording takes no lock: the list
+//	only changes under the profiler's lock (once per block, and on reset),
+//	which readers also hold, and the owning thread alone writes the events.
+///////////////////////////////////////////////////////////////////////////////
+struct ProfileBuffer
+{
+	ProfileBuffer();
+	~ProfileBuffer();
+
+	// events published so far, including any discarded
+	unsigned long long GetPublishedCount() const;
+
+	// frees the leading blocks holding only discarded events; the tail is
+	//	freed too only if the owning thread is done with it
+	void FreeDiscardedBlocks(bool bIncludeTail);
+
+	ProfileBlock *m_pHead;
+	ProfileBlock *m_pTail;
+	unsigned long long m_nNextFirst;	// index of the next block's first event
+	unsigned long long m_nDiscarded;	// events before this were reset
+	int m_nThread;					// small id for the trace
+	std::atomic<bool> m_bRetired;	// owning thread has exited
+};
+
+///////////////////////////////////////////////////////////////////////////////
+class Profiler
+{
+public:
+	// the one profiler
+	static Profiler& GetInstance();
+
+	// turn recording on or off; enabling starts the trace clock if not started
+	void Enable(bool bEnable);
+
+	// discards recorded events
+	void Reset();
+
+	// context stamped on each event
+	void SetLevel(int nLevel);
+	void SetIteration(int nIteration);
+	int GetLevel() const;
+	int GetIteration() const;
+
+	// the profiler clock: the TSC under MSVC, else steady_clock nanoseconds
+	static unsigned long long GetTicks();
+
+	// appends an event to the calling thread's buffer
+	void Record(const ProfileEvent& event);
+
+	// writes the events as Chrome trace JSON ("X" complete events, in
+	//	microseconds); false if the file couldn't be written
+	bool WriteChromeTrace(const char *pszFileName);
+
+	// per-stage, per-level table of count, total, mean, max and bytes
+	std::string GetSummary();
+
+	// total events recorded
+	size_t GetEventCount();
+
+private:
+	Profiler();
+
+	// the calling thread's buffer, registered on first use
+	ProfileBuffer *GetThreadBuffer();
+
+	// appends a block to a full buffer, freeing the discarded ones
+	ProfileBlock *AddBlock(ProfileBuffer *pBuffer);
+
+	// copies out every buffer's events, tagged with their thread
+	void CollectEvents(std::vector<std::pair<int, ProfileEvent> >& arrEvents);
+
+	// ticks per microsecond, timed against steady_clock over a fixed
+	//	interval when the profiler is constructed
+	double GetTicksPerMicrosecond() const;
+	static double CalibrateTicks();
+
+	std::atomic<int> m_nLevel;
+	std::atomic<int> m_nIteration;
+
+	// ticks at the start of the trace, and their rate
+	unsigned long long m_nStartTicks;
+	double m_ticksPerMicrosecond;
+
+	// all threads' buffers, including those of exited threads with events
+	std::mutex m_mutexBuffers;
+	std::vector<std::shared_ptr<ProfileBuffer> > m_arrBuffers;
+	int m_nNextThread;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// times the enclosing block as a stage
+///////////////////////////////////////////////////////////////////////////////
+class ProfileScope
+{
+public:
+	ProfileScope(const char *pszStage, size_t nBytes = 0)
+		: m_pszStage(NULL)
+		, m_nStart(0)
+		, m_nBytes(nBytes)
+	{
+		if (IsProfileEnabled())
+		{
+			m_pszStage = pszStage;
+			m_nStart = Profiler::GetTicks();
+		}
+	}
+
+	~ProfileScope()
+	{
+		if (m_pszStage != NULL)
+		{
+			ProfileEvent event;
+			event.m_nEnd = Profiler::GetTicks();
+			event.m_nStart = m_nStart;
+			event.m_pszStage = m_pszStage;
+			event.m_nBytes = m_nBytes;
+			Profiler& profiler = Profiler::GetInstance();
+			event.m_nLevel = profiler.GetLevel();
+			event.m_nIteration = profiler.GetIteration();
+			profiler.Record(event);
+		}
+	}
+
+	// adds to the bytes attributed to the stage, once they are known
+	void AddBytes(size_t nBytes)
+	{
+		m_nBytes += nBytes;
+	}
+
+private:
+	const char *m_pszStage;
+	unsigned long long m_nStart;
+	unsigned long long m_nBytes;
+};
+
+}	// namespace dH
+
+// times the rest of the enclosing block as the named stage
+#define PROFILE_SCOPE(stage) \
+	dH::ProfileScope __profile_scope(stage)
+
+// as PROFILE_SCOPE, attributing the given number of bytes to the stage; the
+//	bytes are only evaluated when profiling is enabled
+#define PROFILE_SCOPE_BYTES(stage, bytes) \
+	dH::ProfileScope __profile_scope(stage, \
+		dH::IsProfileEnabled() ? (size_t) (bytes) : 0)
@@ -0,0 +1,166 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <itkResampleImageFilter.h>
+#include <itkAffineTransform.h>
+#include <itkLinearInterpolateImageFunction.h>
+
+#include <MemoryAccount.h>
+
+namespace dH
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// class ResampleCache
+//
+// holds resampled copies of a source volume, one per target grid.  A grid is
+//	identified by its origin, spacing, region and direction, so two volumes on
+//	the same grid (e.g. every beam's dose matrix in a plan) share one resample.
+//	An entry is recomputed when the source's MTime moves past the MTime it was
+//	computed from; anything that writes the source buffer directly must call
+//	Modified() on it.
+//
+// An entry keeps its volume when it is recomputed, so a pointer handed out
+//	earlier sees the new data.  Eviction (nMaxEntries > 0) frees the oldest
+//	volume, so callers that keep raw pointers should use an unbounded cache.
+///////////////////////////////////////////////////////////////////////////////
+class ResampleCache
+{
+public:
+	ResampleCache(int nMaxEntries = 8)
+		: m_nMaxEntries(nMaxEntries)
+	{
+	}
+
+	// returns the source resampled (identity transform, linear interpolation)
+	//	onto the grid of pBasis; the returned volume is owned by the cache and
+	//	stays valid until the cache is cleared or the entry is evicted
+	VolumeReal *GetResampled(const VolumeReal *pSource, const itk::ImageBase<3> *pBasis)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		Entry *pEntry = NULL;
+		for (size_t nAt = 0; nAt < m_arrEntries.size(); nAt++)
+		{
+			if (m_arrEntries[nAt].IsSameGrid(pBasis))
+			{
+				pEntry = &m_arrEntries[nAt];
+				break;
+			}
+		}
+
+		if (pEntry == NULL)
+		{
+			// evict the oldest entry if full
+			if (m_nMaxEntries > 0 && (int) m_arrEntries.size() >= m_nMaxEntries)
+				m_arrEntries.erase(m_arrEntries.begin());
+
+			m_arrEntries.push_back(Entry());
+			pEntry = &m_arrEntries.back();
+			pEntry->m_pVolume = VolumeReal::New();
+			ConformTo<VOXEL_REAL,3>(pBasis, pEntry->m_pVolume);
+		}
+
+		if (pEntry->m_pSource != pSource
+			|| pEntry->m_nSourceMTime < pSource->GetMTime())
+		{
+			typedef itk::ResampleImageFilter<VolumeReal, VolumeReal> ResamplerType;
+			ResamplerType::Pointer resampler = ResamplerType::New();
+			resampler->SetInput(pSource);
+
+			typedef itk::AffineTransform<REAL, 3> TransformType;
+			TransformType::Pointer transform = TransformType::New();
+			transform->SetIdentity();
+			resampler->SetTransform(transform);
+
+			typedef itk::LinearInterpolateImageFunction<VolumeReal, REAL> InterpolatorType;
+			InterpolatorType::Pointer interpolator = InterpolatorType::New();
+			resampler->SetInterpolator(interpolator);
+
+			resampler->SetOutputParametersFromImage(pEntry->m_pVolume);
+			resampler->Update();
+			CopyImage<VOXEL_REAL, 3>(resampler->GetOutput(), pEntry->m_pVolume);
+
+			pEntry->m_pSource = pSource;
+			pEntry->m_nSourceMTime = pSource->GetMTime();
+		}
+
+		return pEntry->m_pVolume;
+	}
+
+	// drops all entries
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_arrEntries.clear();
+	}
+
+	// number of cached grids
+	int GetEntryCount() const
+	{
+		return (int) m_arrEntries.size();
+	}
+
+	// drops the cached data, but keeps the volumes (and so the pointers
+	//	handed out) alive; each entry is recomputed on its next request
+	void Invalidate()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t nAt = 0; nAt < m_arrEntries.size(); nAt++)
+		{
+			m_arrEntries[nAt].m_pSource = NULL;
+		}
+	}
+
+	// adds the cached volumes to a memory report
+	void AccountMemory(MemoryReport& report, const MemoryOwner& owner)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t nAt = 0; nAt < m_arrEntries.size(); nAt++)
+		{
+			report.AddImage(MEMORY_RESAMPLE_CACHE, owner, 
+				m_arrEntries[nAt].m_pVolume.GetPointer());
+		}
+	}
+
+private:
+	// one resampled copy
+	struct Entry
+	{
+		Entry()
+			: m_pSource(NULL)
+			, m_nSourceMTime(0)
+		{
+		}
+
+		// true if the basis is on the same grid as this entry
+		bool IsSameGrid(const itk::ImageBase<3> *pBasis) const
+		{
+			return m_pVolume->GetBufferedRegion() == pBasis->GetBufferedRegion()
+				&& m_pVolume->GetOrigin() == pBasis->GetOrigin()
+				&& m_pVolume->GetSpacing() == pBasis->GetSpacing()
+				&& m_pVolume->GetDirection() == pBasis->GetDirection();
+		}
+
+		// the resampled volume, which also carries the grid
+		VolumeReal::Pointer m_pVolume;
+
+		// source and source MTime the volume was computed from
+		const VolumeReal *m_pSource;
+		unsigned long m_nSourceMTime;
+	};
+
+	// the entries, oldest first
+	std::vector<Entry> m_arrEntries;
+	int m_nMaxEntries;
+
+	// guards the entries, for beamlet calculation on worker threads
+	std::mutex m_mutex;
+
+};	// class ResampleCache
+
+}	// namespace dH
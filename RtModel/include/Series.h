@@ -5,6 +5,9 @@
 
 #include <Structure.h>
 
+#include <HUDensityCalibration.h>
+#include <ResampleCache.h>
+
 namespace dH
 {
 
@@ -28,20 +31,58 @@ public:
 	VolumeReal *GetDensity();
 	void SetDensity(VolumeReal *pValue);
 
+	/** HU to mass density calibration, for the scanner that acquired the series */
+	const HUDensityCalibration& GetDensityCalibration() const;
+	void SetDensityCalibration(const HUDensityCalibration& calib);
+
+	/** mass density for the series, converted from the density volume through
+		the calibration; reconverted only when the density's MTime or the 
+		calibration changes (so direct writes to the density buffer must be 
+		followed by GetDensity()->Modified()) */
+	VolumeReal *GetMassDensity();
+
+	/** mass density resampled to the grid of pBasis (typically a dose matrix);
+		computed once per grid and shared by all plans on the series, including
+		the pyramid levels.  The result must not be modified. */
+	VolumeReal *GetMassDensityConformTo(const itk::ImageBase<3> *pBasis);
+
 	/** Structures for the series */
 	int GetStructureCount() const;
 	Structure * GetStructureAt(int nAt);
 	Structure * GetStructureFromName(const std::string &strName);
 	void AddStructure(Structure *pStruct);
 
+	/** rasterizes the base regions of all structures, with partial-volume 
+		coverage and priority exclusion, in one pass parallel over slices */
+	void CalcRegions();
+
+	/** per-voxel label: 1 + index of the highest priority structure covering
+		the voxel, or 0 if none */
+	VolumeShort *GetLabelVolume();
+
 private:
 	/** density volume for the series */
 	VolumeReal::Pointer m_pDensity;
 
+	/** the calibration */
+	HUDensityCalibration m_densityCalibration;
+
+	/** converted mass density, and what it was converted from */
+	VolumeReal::Pointer m_pMassDensity;
+	const VolumeReal *m_pMassDensitySource;
+	unsigned long m_nMassDensitySourceMTime;
+	unsigned long m_nMassDensityCalibVersion;
+
+	/** mass density resampled to dose grids */
+	ResampleCache m_massDensityResampled;
+
 	/** the structure array */
 	std::vector<Structure::Pointer> m_arrStructures;
+
+	/** label volume, from the last CalcRegions */
+	VolumeShort::Pointer m_pLabels;
 };
 
 }	// namespace dH
 
-#endif // !defined(_SERIES_H__INCLUDED_)
\ No newline at end of file
+#endif // !defined(_SERIES_H__INCLUDED_)
\ No newline at end of file
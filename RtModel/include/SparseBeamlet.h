@@ -0,0 +1,60 @@
+// Copyright (C) 2nd Messenger Systems
+// $Id$
+#pragma once
+
+#include <ItkUtils.h>
+
+namespace dH
+{
+
+/**
+ * a beamlet held as just its non-zero voxels.  The voxels and values are 
+ * owned by the beamlet source, which must outlive the beamlet; the grid 
+ * gives the beamlet's geometry, but its buffer is not allocated
+ */
+struct SparseBeamlet
+{
+	SparseBeamlet()
+		: m_pVoxels(NULL)
+		, m_pValues(NULL)
+		, m_nCount(0)
+	{
+	}
+
+	/** geometry of the beamlet (not allocated) */
+	VolumeReal::Pointer m_pGrid;
+
+	/** buffer offsets of the non-zero voxels, and their values */
+	const int *m_pVoxels;
+	const float *m_pValues;
+	size_t m_nCount;
+
+	/** adds weight times the beamlet to a volume conformed to the grid */
+	void Accumulate(REAL weight, VolumeReal *pVolume) const
+	{
+		VOXEL_REAL *pVoxels = pVolume->GetBufferPointer();
+		for (size_t nAt = 0; nAt < m_nCount; nAt++)
+		{
+			pVoxels[m_pVoxels[nAt]] += (VOXEL_REAL) (weight * m_pValues[nAt]);
+		}
+	}
+
+	/** adds each of nCount weights times the beamlet to the corresponding 
+		volume, reading the beamlet's voxels once */
+	void AccumulateBatch(const REAL *pWeights, VolumeReal * const *ppVolumes, 
+		int nCount) const
+	{
+		for (size_t nAt = 0; nAt < m_nCount; nAt++)
+		{
+			const int nVoxel = m_pVoxels[nAt];
+			const float value = m_pValues[nAt];
+			for (int nAtVolume = 0; nAtVolume < nCount; nAtVolume++)
+			{
+				ppVolumes[nAtVolume]->GetBufferPointer()[nVoxel] += 
+					(VOXEL_REAL) (pWeights[nAtVolume] * value);
+			}
+		}
+	}
+};
+
+}	// namespace dH
@@ -16,6 +16,9 @@ using namespace itk;
 #include <itkSpatialObjectToImageFilter.h>
 #include <itkJoinSeriesImageFilter.h>
 
+#include <ResampleCache.h>
+#include <PolygonRasterizer.h>
+
 namespace dH
 {
 
@@ -53,15 +56,41 @@ public:
 
 	void AddContour(PolygonType::Pointer pPoly, REAL refDist);
 
-	/** constant for maximum scales */
-	static const int MAX_SCALES = 5;
+	/** default number of region scales; GetConformRegion adds coarser 
+		scales when a dose grid asks for them */
+	static const int DEFAULT_SCALES = 5;
+
+	/** number of region scales, each halving the resolution */
+	int GetScaleCount() const;
+	void SetScaleCount(int nScales);
 
-	/** multi-scale region accessor */
+	/** multi-scale region accessor; levels past the last scale get the 
+		coarsest */
 	const VolumeReal * GetRegion(int nLevel);
 
-	/** forms / returns a region conformant to another volume */
+	/** sets the base region directly, for a structure given as voxels rather
+		than contours (as read with an InfluenceMatrix); the series keeps it,
+		even when priorities change, until contours are added */
+	void SetRegion(const VolumeReal *pRegion);
+
+	/** forms / returns a region conformant to another volume; the region is
+		cached per grid (origin, spacing, size, direction) and shared by all
+		callers on that grid, so it must not be modified */
 	VolumeReal * GetConformRegion(itk::ImageBase<3> *pVolume);
 
+	/** signed distance map (mm) for the region at a level: negative inside, 
+		positive outside.  Computed once per region and level, and cached */
+	const VolumeReal * GetDistanceMap(int nLevel = 0);
+
+	/** forms the base region grown by an anisotropic margin (mm along x, y, z),
+		as for PTV / PRV expansion; negative components contract, applied after
+		the positive ones grow */
+	void CalcMarginRegion(const itk::Vector<REAL,3>& vMargin, VolumeReal *pMarginRegion);
+
+	/** adds the regions, distance map and resampled regions to a memory 
+		report, attributed to this structure */
+	void AccountMemory(MemoryReport& report);
+
 	/** enum for structure type */
 	enum  StructType 
 	{ 
@@ -86,12 +115,19 @@ public:
 	DeclareMemberPtr(Series, dH::Series);
 
 protected:
+	/** the series computes the regions of all its structures in one pass */
+	friend class dH::Series;
 
 	/** region calc for base scale */
 	void CalcRegion();
 
-	/** helper - converts contours to a region */
-	void ContoursToRegion(VolumeReal *pRegion);
+	/** helper - converts the contours to voxel coordinates of pBasis, 
+		bucketed by the slice they lie on */
+	void ContoursToSlicePolygons(const VolumeReal *pBasis,
+		std::vector< std::vector<RasterPolygon> >& arrSlicePolygons);
+
+	/** called by the series once m_pRegion0 has been filled */
+	void OnRegionCalculated();
 
 private:
 	/** the structure's name */
@@ -114,16 +150,26 @@ private:
 	/** region (binary volume) representation (for base layer) */
 	VolumeReal::Pointer m_pRegion0;
 
-	/** pyramid for the regions */
+	/** pyramid for the regions, and its number of levels */
 	typedef MultiResolutionPyramidImageFilter<VolumeReal, VolumeReal> PyramidType;
 	PyramidType::Pointer m_pPyramid;
+	int m_nScales;
 
 	/** flag to indicate region recalc is needed */
 	bool m_bRecalcRegion;
 
-	/** stores cache of resampled regions */
-	typedef itk::ResampleImageFilter<VolumeReal, VolumeReal> ResampleFilterType;
-	std::vector< ResampleFilterType::Pointer > m_arrResamplers;
+	/** set by SetRegion: the series keeps the region rather than 
+		rasterizing the contours; cleared by AddContour */
+	bool m_bExplicitRegion;
+
+	/** cached signed distance maps, by level; a NULL entry is stale */
+	std::vector<VolumeReal::Pointer> m_arrDistanceMaps;
+
+	/** stores cache of resampled regions, one per grid; unbounded, because
+		histograms hold raw pointers to the regions.  The number of distinct 
+		grids is limited by the pyramid levels, so this does not grow with 
+		repeated optimizations */
+	ResampleCache m_conformRegions;
 
 };	// class Structure
 
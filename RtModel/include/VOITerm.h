@@ -36,6 +36,11 @@ public:
 	/// TODO: change CArray to std::vector
 	virtual REAL Eval(CVectorN<> *pvGrad, const CArray<BOOL, BOOL>& arrInclude) = 0;
 
+	// evaluates the term (without gradient) at each of a batch of 
+	//		calculated GBins, as binned by CHistogram::GetGBinsBatch
+	virtual void EvalBatch(const std::vector< CVectorN<> >& arrCalcGBins,
+		CVectorN<>& vValues) = 0;
+
 	// helper to create pyramid - constructs a copy, except with nScale + 1
 	virtual VOITerm *Clone() = 0;
 
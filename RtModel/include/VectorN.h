@@ -599,36 +599,14 @@ inline void Trace(LPTSTR label, double value)
 template<class TYPE>
 void 
 	TraceVector(LPTSTR label, const CVectorN<TYPE>& vTrace)
-	// helper function to output a vector for debugging
+	// helper function to output a vector for debugging; only the values are
+	//	copied here, the log's drain thread formats them
 {
-	CString str;
-	str.Format(_T("%s[%d] =\t<"), label, vTrace.GetDim());
-#ifdef TRACE_VECTOR_NUMERIC
-	for (int nAt = 0; nAt < vTrace.GetDim(); nAt++)
-	{
-		str.AppendFormat(_T("% .4lf|"), vTrace[nAt]);
-	}
-#else
-	double maxElement = -1e-20;
-	for (int nAt = 0; nAt < vTrace.GetDim(); nAt++)
-		maxElement = __max(maxElement, vTrace[nAt]);
-
-	str.AppendFormat(_T("% .4lf"), maxElement);
+	if (!dH::IsLogEnabled(dH::LOG_LEVEL_TRACE))
+		return;
 
-	for (int nAt = 0; nAt < vTrace.GetDim(); nAt++)
-	{
-		if (vTrace[nAt] < maxElement * 0.1)
-			str.AppendFormat(_T(" "));
-		else if (vTrace[nAt] < maxElement * 0.25)
-			str.AppendFormat(_T("."));
-		else if (vTrace[nAt] < maxElement * 0.85)
-			str.AppendFormat(_T(":"));
-		else
-			str.AppendFormat(_T("|"));
-	}
-#endif
-	str.AppendFormat(_T(">\n"));
-	OutputDebugString(str.GetBuffer());
+	dH::AsyncLog::GetInstance().Vector(dH::LOG_LEVEL_TRACE, label,
+		(const TYPE *) vTrace, vTrace.GetDim());
 
 }	// TraceVector
 
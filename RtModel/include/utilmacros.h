@@ -207,17 +207,18 @@ if (!(expr))				\
 	ATLASSERT(SUCCEEDED(hr));	\
 }
 
-// log file utilities
+// log file utilities: records go to the asynchronous logger, and cost one
+//	branch when their level is disabled
+#include <AsyncLog.h>
+
 #define BeginLogSection(section_name) { \
-	LPCTSTR __section_name = section_name; \
-	CString __formatMessage; \
-	__formatMessage.Format(_T("<log_section name=\"%s\">"), __section_name); \
-	OutputDebugString(__formatMessage.GetBuffer());
+	dH::LogSectionScope __log_section(dH::LOG_LEVEL_DEBUG, section_name);
 
-#define EndLogSection() \
-	OutputDebugString(_T("</log_section>\n")); }
+#define EndLogSection() }
 
-#define Log OutputDebugString
+#define Log(message) \
+	((void) (dH::IsLogEnabled(dH::LOG_LEVEL_INFO) \
+		&& (dH::AsyncLog::GetInstance().Message(dH::LOG_LEVEL_INFO, (LPCTSTR) (message)), true)))
 
 #endif
 
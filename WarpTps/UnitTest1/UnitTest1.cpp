@@ -113,6 +113,212 @@ namespace WarpTpsLib
 				Logger::WriteMessage("Done TestWarpAtLandmarks");
 			}
 
+			// tests that the presampled field (and a rectangle of it) resamples as Eval does
+			TEST_METHOD(TestPresampledFieldMatchesEval)
+			{
+				Logger::WriteMessage("TestPresampledFieldMatchesEval");
+
+				auto tpsTransform = new CTPSTransform();
+				tpsTransform->AddLandmark(CVectorD<3>(50.0, 50.0, 0.0), CVectorD<3>(55.0, 55.0, 0.0));
+				tpsTransform->AddLandmark(CVectorD<3>(50.0, 20.0, 0.0), CVectorD<3>(50.0, 15.0, 0.0));
+				tpsTransform->AddLandmark(CVectorD<3>(50.0, 80.0, 0.0), CVectorD<3>(50.0, 85.0, 0.0));
+				tpsTransform->AddLandmark(CVectorD<3>(20.0, 50.0, 0.0), CVectorD<3>(22.0, 48.0, 0.0));
+
+				const UINT width = 100, height = 100, bytesPerPixel = 3;
+				std::vector<BYTE> src(width * height * bytesPerPixel);
+				for (size_t nAt = 0; nAt < src.size(); nAt++)
+				{
+					src[nAt] = (BYTE)((nAt * 7919) % 251);
+				}
+
+				// the rectangle first, while the field is out of date
+				std::vector<BYTE> rect(src.size(), 0), field(src.size(), 0), raw(src.size(), 0);
+				tpsTransform->ResampleRawWithFieldRect(&src[0], &rect[0], bytesPerPixel, width, height,
+					width * bytesPerPixel, 1.0, 10, 30, 60, 70);
+				tpsTransform->ResampleRawWithField(&src[0], &field[0], bytesPerPixel, width, height,
+					width * bytesPerPixel, 1.0);
+				tpsTransform->ResampleRaw(&src[0], &raw[0], bytesPerPixel, width, height,
+					width * bytesPerPixel, 1.0);
+
+				// the field engine rounds differently from Eval in the last bits, which 
+				//		can flip a source pixel exactly at a half-pixel boundary
+				size_t nDiffer = 0;
+				for (size_t nAt = 0; nAt < src.size(); nAt++)
+				{
+					nDiffer += (field[nAt] != raw[nAt]) ? 1 : 0;
+				}
+				Assert::IsTrue(nDiffer * 100 <= src.size(), L"presampled field resamples as Eval");
+				for (UINT nRow = 0; nRow < height; nRow++)
+				{
+					for (UINT nCol = 0; nCol < width; nCol++)
+					{
+						const UINT nAt = (nRow * width + nCol) * bytesPerPixel;
+						const bool bInRect = nRow >= 30 && nRow < 70 && nCol >= 10 && nCol < 60;
+						Assert::IsTrue(bInRect ? rect[nAt] == field[nAt] : rect[nAt] == 0);
+					}
+				}
+
+				// after an edit, a rectangle brings only its tiles up to date; the next
+				//		full resample must still recompute the rest
+				tpsTransform->SetLandmark<1>(0, CVectorD<3>(58.0, 52.0, 0.0));
+				tpsTransform->ResampleRawWithFieldRect(&src[0], &rect[0], bytesPerPixel, width, height,
+					width * bytesPerPixel, 1.0, 0, 0, 40, 40);
+				tpsTransform->ResampleRawWithField(&src[0], &field[0], bytesPerPixel, width, height,
+					width * bytesPerPixel, 1.0);
+
+				auto freshTransform = new CTPSTransform();
+				for (int nLandmark = 0; nLandmark < tpsTransform->GetLandmarkCount(); nLandmark++)
+				{
+					freshTransform->AddLandmark(tpsTransform->GetLandmark<0>(nLandmark), 
+						tpsTransform->GetLandmark<1>(nLandmark));
+				}
+				std::vector<BYTE> fresh(src.size(), 0);
+				freshTransform->ResampleRawWithField(&src[0], &fresh[0], bytesPerPixel, width, height,
+					width * bytesPerPixel, 1.0);
+				nDiffer = 0;
+				for (size_t nAt = 0; nAt < src.size(); nAt++)
+				{
+					nDiffer += (field[nAt] != fresh[nAt]) ? 1 : 0;
+				}
+				Assert::IsTrue(nDiffer * 100 <= src.size(), L"full resample after a rectangle matches a fresh field");
+
+				Logger::WriteMessage("Done TestPresampledFieldMatchesEval");
+			}
+
+			// tests that landmark edits applied as updates of the inverse give the field
+			//		of a transform built from scratch
+			TEST_METHOD(TestIncrementalLandmarkEdits)
+			{
+				Logger::WriteMessage("TestIncrementalLandmarkEdits");
+
+				auto tpsTransform = new CTPSTransform();
+				tpsTransform->AddLandmark(CVectorD<3>(10.0, 10.0, 0.0), CVectorD<3>(12.0, 9.0, 0.0));
+				tpsTransform->AddLandmark(CVectorD<3>(90.0, 15.0, 0.0), CVectorD<3>(88.0, 14.0, 0.0));
+				tpsTransform->AddLandmark(CVectorD<3>(50.0, 90.0, 0.0), CVectorD<3>(52.0, 93.0, 0.0));
+				tpsTransform->AddLandmark(CVectorD<3>(40.0, 45.0, 0.0), CVectorD<3>(45.0, 40.0, 0.0));
+
+				// forms the inverse
+				CVectorD<3, REAL>::Point_t vOffset(0.0);
+				tpsTransform->Eval(CVectorD<3>(1.0, 1.0, 0.0).point(), vOffset, 1.0);
+
+				// move a source landmark, a target landmark, and add one
+				tpsTransform->SetLandmark<0>(3, CVectorD<3>(42.0, 47.0, 0.0));
+				tpsTransform->SetLandmark<1>(1, CVectorD<3>(85.0, 18.0, 0.0));
+				tpsTransform->AddLandmark(CVectorD<3>(70.0, 60.0, 0.0), CVectorD<3>(66.0, 62.0, 0.0));
+
+				auto freshTransform = new CTPSTransform();
+				for (int nLandmark = 0; nLandmark < tpsTransform->GetLandmarkCount(); nLandmark++)
+				{
+					freshTransform->AddLandmark(tpsTransform->GetLandmark<0>(nLandmark), 
+						tpsTransform->GetLandmark<1>(nLandmark));
+				}
+
+				for (REAL y = 0.0; y < 100.0; y += 12.5)
+				{
+					for (REAL x = 0.0; x < 100.0; x += 12.5)
+					{
+						CVectorD<3, REAL>::Point_t vUpdated(0.0), vFresh(0.0);
+						tpsTransform->Eval(CVectorD<3>(x, y, 0.0).point(), vUpdated, 1.0);
+						freshTransform->Eval(CVectorD<3>(x, y, 0.0).point(), vFresh, 1.0);
+						Assert::AreEqual(vFresh.get<0>(), vUpdated.get<0>(), 1e-6);
+						Assert::AreEqual(vFresh.get<1>(), vUpdated.get<1>(), 1e-6);
+					}
+				}
+
+				// large moves, one per recalculation, across a 500 x 500 image: without the
+				//		residual check, the updates drift to about 4e-5 px here
+				auto movedTransform = new CTPSTransform();
+				for (int nLandmark = 0; nLandmark < 12; nLandmark++)
+				{
+					const REAL x = 40.0 + 140.0 * (nLandmark % 4);
+					const REAL y = 60.0 + 170.0 * (nLandmark / 4);
+					movedTransform->AddLandmark(CVectorD<3>(x, y, 0.0), CVectorD<3>(x + 3.0, y - 2.0, 0.0));
+				}
+				for (int nMove = 0; nMove < 40; nMove++)
+				{
+					movedTransform->SetLandmark<0>(nMove % 12, CVectorD<3>(fmod(137.0 * nMove + 61.0, 500.0), 
+						fmod(251.0 * nMove + 17.0, 500.0), 0.0));
+					movedTransform->Eval(CVectorD<3>(1.0, 1.0, 0.0).point(), vOffset, 1.0);
+				}
+
+				auto freshMovedTransform = new CTPSTransform();
+				for (int nLandmark = 0; nLandmark < movedTransform->GetLandmarkCount(); nLandmark++)
+				{
+					freshMovedTransform->AddLandmark(movedTransform->GetLandmark<0>(nLandmark), 
+						movedTransform->GetLandmark<1>(nLandmark));
+				}
+
+				for (REAL y = 0.0; y < 500.0; y += 50.0)
+				{
+					for (REAL x = 0.0; x < 500.0; x += 50.0)
+					{
+						CVectorD<3, REAL>::Point_t vUpdated(0.0), vFresh(0.0);
+						movedTransform->Eval(CVectorD<3>(x, y, 0.0).point(), vUpdated, 1.0);
+						freshMovedTransform->Eval(CVectorD<3>(x, y, 0.0).point(), vFresh, 1.0);
+						Assert::AreEqual(vFresh.get<0>(), vUpdated.get<0>(), 1e-6);
+						Assert::AreEqual(vFresh.get<1>(), vUpdated.get<1>(), 1e-6);
+					}
+				}
+
+				Logger::WriteMessage("Done TestIncrementalLandmarkEdits");
+			}
+
+			TEST_METHOD(TestWarpModes)
+			{
+				Logger::WriteMessage("TestWarpModes");
+
+				// a jittered 6 x 6 grid of landmarks
+				auto classicTransform = new CTPSTransform();
+				auto treeTransform = new CTPSTransform();
+				auto compactTransform = new CTPSTransform();
+				for (int nY = 0; nY < 6; nY++)
+				{
+					for (int nX = 0; nX < 6; nX++)
+					{
+						CVectorD<3> vSource(15.0 + 30.0 * nX + (nY % 3), 15.0 + 30.0 * nY - (nX % 2) * 2.0, 0.0);
+						CVectorD<3> vTarget(vSource[0] + ((nX + nY) % 5) - 2.0, vSource[1] + ((nX * nY) % 7) - 3.0, 0.0);
+						classicTransform->AddLandmark(vSource, vTarget);
+						treeTransform->AddLandmark(vSource, vTarget);
+						compactTransform->AddLandmark(vSource, vTarget);
+					}
+				}
+				treeTransform->SetWarpMode(TPS_WARP_HIERARCHICAL);
+				compactTransform->SetWarpMode(TPS_WARP_WENDLAND);
+				compactTransform->SetSupportRadius(70.0);
+
+				// the Wendland warp still interpolates the landmarks
+				for (int nLandmark = 0; nLandmark < compactTransform->GetLandmarkCount(); nLandmark++)
+				{
+					CVectorD<3, REAL>::Point_t vOffset(0.0);
+					compactTransform->Eval(compactTransform->GetLandmark<0>(nLandmark).point(), vOffset, 1.0);
+					Assert::AreEqual(compactTransform->GetLandmark<1>(nLandmark)[0] 
+						- compactTransform->GetLandmark<0>(nLandmark)[0], vOffset.get<0>(), 1e-6);
+					Assert::AreEqual(compactTransform->GetLandmark<1>(nLandmark)[1] 
+						- compactTransform->GetLandmark<0>(nLandmark)[1], vOffset.get<1>(), 1e-6);
+				}
+				Assert::IsTrue(compactTransform->IsWeightSolveConverged() == TRUE);
+
+				// a landmark repeated with another target has no solution, which is 
+				//		reported rather than left in the weights
+				compactTransform->AddLandmark(compactTransform->GetLandmark<0>(0), CVectorD<3>(5.0, 5.0, 0.0));
+				Assert::IsTrue(compactTransform->IsWeightSolveConverged() == FALSE);
+
+				// and the hierarchical field approximates the classic one
+				for (REAL y = 0.0; y < 180.0; y += 12.5)
+				{
+					for (REAL x = 0.0; x < 180.0; x += 12.5)
+					{
+						CVectorD<3, REAL>::Point_t vClassic(0.0), vTree(0.0);
+						classicTransform->Eval(CVectorD<3>(x, y, 0.0).point(), vClassic, 1.0);
+						treeTransform->Eval(CVectorD<3>(x, y, 0.0).point(), vTree, 1.0);
+						Assert::AreEqual(vClassic.get<0>(), vTree.get<0>(), 1e-3);
+						Assert::AreEqual(vClassic.get<1>(), vTree.get<1>(), 1e-3);
+					}
+				}
+
+				Logger::WriteMessage("Done TestWarpModes");
+			}
+
 			TEST_METHOD(TestInverseWarpAtLandmark)
 			{
 			}
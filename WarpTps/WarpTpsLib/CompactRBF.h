@@ -0,0 +1,448 @@
+//////////////////////////////////////////////////////////////////////
+// CompactRBF.h: support for the compactly supported warp mode -- a
+//		spatial grid of landmarks and a sparse symmetric solve
+//
+// Copyright (C) 2002-2025 Derek Lane
+//////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+// REAL
+#include "MathUtil.h"
+
+//////////////////////////////////////////////////////////////////////
+// wendland_function
+//
+// the Wendland C2 function (1 - r/radius)^4 (4 r/radius + 1), which is
+//		positive definite in 2D and zero beyond radius
+//////////////////////////////////////////////////////////////////////
+inline REAL wendland_function(REAL r, const REAL k, const REAL radius)
+{
+	const REAL t = r / radius;
+	if (t >= 1.0)
+	{
+		return 0.0;
+	}
+	const REAL s = 1.0 - t;
+	return k * (s * s) * (s * s) * (4.0 * t + 1.0);
+}
+
+//////////////////////////////////////////////////////////////////////
+// class CLandmarkGrid
+//
+// buckets 2D points into square cells, so the points within a radius of
+//		a position are found by visiting the 3x3 surrounding cells
+//////////////////////////////////////////////////////////////////////
+class CLandmarkGrid
+{
+public:
+	// builds the grid over the points, with cells of the given size
+	void Build(const std::vector<REAL>& arrX, const std::vector<REAL>& arrY, REAL cellSize);
+
+	// calls func(nIndex) for each point in the cells around (x, y) -- a
+	//		superset of the points within the cell size of it
+	template<class FUNC>
+	void ForEachNear(REAL x, REAL y, FUNC func) const;
+
+private:
+	// the cell of a coordinate, clamped to the grid
+	int CellX(REAL x) const;
+	int CellY(REAL y) const;
+
+	REAL m_minX;
+	REAL m_minY;
+	REAL m_cellSize;
+	int m_nCellsX;
+	int m_nCellsY;
+
+	// bound on the cells along a side
+	static constexpr int MAX_CELLS = 1024;
+
+	// point indices sorted by cell, and the start of each cell's run
+	std::vector<int> m_arrIndex;
+	std::vector<int> m_arrCellStart;
+};
+
+//////////////////////////////////////////////////////////////////////
+// CLandmarkGrid::Build
+//
+// counting sort of the points into their cells
+//////////////////////////////////////////////////////////////////////
+inline void CLandmarkGrid::Build(const std::vector<REAL>& arrX, const std::vector<REAL>& arrY,
+	REAL cellSize)
+{
+	const int n = (int) arrX.size();
+	m_minX = n > 0 ? *std::min_element(arrX.begin(), arrX.end()) : 0.0;
+	m_minY = n > 0 ? *std::min_element(arrY.begin(), arrY.end()) : 0.0;
+	const REAL maxX = n > 0 ? *std::max_element(arrX.begin(), arrX.end()) : 0.0;
+	const REAL maxY = n > 0 ? *std::max_element(arrY.begin(), arrY.end()) : 0.0;
+
+	// larger cells still give a superset, so bound the grid to MAX_CELLS a side
+	//		for a radius far below the landmark spread
+	m_cellSize = std::max(cellSize, std::max(maxX - m_minX, maxY - m_minY) / MAX_CELLS);
+	m_nCellsX = (int) floor((maxX - m_minX) / m_cellSize) + 1;
+	m_nCellsY = (int) floor((maxY - m_minY) / m_cellSize) + 1;
+
+	m_arrCellStart.assign(m_nCellsX * m_nCellsY + 1, 0);
+	for (int nAt = 0; nAt < n; nAt++)
+	{
+		m_arrCellStart[CellY(arrY[nAt]) * m_nCellsX + CellX(arrX[nAt]) + 1]++;
+	}
+	for (size_t nCell = 1; nCell < m_arrCellStart.size(); nCell++)
+	{
+		m_arrCellStart[nCell] += m_arrCellStart[nCell - 1];
+	}
+
+	std::vector<int> arrFill(m_arrCellStart.begin(), m_arrCellStart.end() - 1);
+	m_arrIndex.resize(n);
+	for (int nAt = 0; nAt < n; nAt++)
+	{
+		m_arrIndex[arrFill[CellY(arrY[nAt]) * m_nCellsX + CellX(arrX[nAt])]++] = nAt;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// CLandmarkGrid::CellX / CellY
+//
+// cell coordinates, clamped to the grid
+//////////////////////////////////////////////////////////////////////
+inline int CLandmarkGrid::CellX(REAL x) const
+{
+	return std::max(0, std::min(m_nCellsX - 1, (int) floor((x - m_minX) / m_cellSize)));
+}
+
+inline int CLandmarkGrid::CellY(REAL y) const
+{
+	return std::max(0, std::min(m_nCellsY - 1, (int) floor((y - m_minY) / m_cellSize)));
+}
+
+//////////////////////////////////////////////////////////////////////
+// CLandmarkGrid::ForEachNear
+//
+// visits the points of the 3x3 cells around (x, y)
+//////////////////////////////////////////////////////////////////////
+template<class FUNC>
+inline void CLandmarkGrid::ForEachNear(REAL x, REAL y, FUNC func) const
+{
+	const int nCellX = CellX(x);
+	const int nCellY = CellY(y);
+	for (int nY = std::max(0, nCellY - 1); nY <= std::min(m_nCellsY - 1, nCellY + 1); nY++)
+	{
+		for (int nX = std::max(0, nCellX - 1); nX <= std::min(m_nCellsX - 1, nCellX + 1); nX++)
+		{
+			const int nCell = nY * m_nCellsX + nX;
+			for (int nAt = m_arrCellStart[nCell]; nAt < m_arrCellStart[nCell + 1]; nAt++)
+			{
+				func(m_arrIndex[nAt]);
+			}
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// class CSparseSymMatrix
+//
+// a sparse symmetric matrix in compressed-row form, with an incomplete
+//		Cholesky preconditioned conjugate gradient solve (for the positive
+//		definite compact kernel matrix)
+//////////////////////////////////////////////////////////////////////
+class CSparseSymMatrix
+{
+public:
+	// starts an n x n matrix with no entries
+	void Reset(int n);
+
+	// appends an entry to the current row; rows are filled in order, and
+	//		EndRow moves to the next one
+	void Add(int nCol, REAL value) { m_arrCol.push_back(nCol); m_arrValue.push_back(value); }
+	void EndRow() { m_arrRowStart.push_back((int) m_arrCol.size()); m_arrLowerDiag.clear(); }
+
+	// y = A x
+	void Multiply(const std::vector<REAL>& vX, std::vector<REAL>& vY) const;
+
+	// forms the preconditioner for SolveCG: the incomplete Cholesky factor
+	//		L L^T ~ A with L on the pattern of A's lower triangle, IC(0).  where
+	//		that breaks down (a pivot that isn't positive, as it can for a 
+	//		positive definite A that isn't diagonally dominant), the diagonal is
+	//		shifted up until it doesn't; L L^T then approximates A less closely,
+	//		but CG still solves A itself.  returns false if A has a diagonal 
+	//		entry that isn't positive (it can't be positive definite)
+	bool FactorPreconditioner();
+
+	// solves A x = b by conjugate gradients preconditioned with the factor
+	//		from FactorPreconditioner (formed first if it hasn't been), from 
+	//		x = 0, to a relative residual of tol.  returns the number of 
+	//		iterations, or -1 if it didn't converge (vX then holds the last 
+	//		iterate) or there is no factor
+	int SolveCG(const std::vector<REAL>& vB, std::vector<REAL>& vX, REAL tol, int nMaxIter);
+
+	// number of stored entries
+	int GetNonZeroCount() const { return (int) m_arrValue.size(); }
+
+	// the diagonal shift (relative to the diagonal) the preconditioner needed
+	REAL GetPreconditionerShift() const { return m_shift; }
+
+protected:
+	// z = (L L^T)^-1 r, by forward and back substitution
+	void Precondition(const std::vector<REAL>& vR, std::vector<REAL>& vZ) const;
+
+private:
+	int m_nDim;
+	std::vector<int> m_arrRowStart;
+	std::vector<int> m_arrCol;
+	std::vector<REAL> m_arrValue;
+
+	// the preconditioner's factor L: its strictly lower part in compressed-row
+	//		form, columns ascending, and its diagonal
+	std::vector<int> m_arrLowerStart;
+	std::vector<int> m_arrLowerCol;
+	std::vector<REAL> m_arrLowerValue;
+	std::vector<REAL> m_arrLowerDiag;
+	REAL m_shift;
+
+	// the first shift tried after a breakdown, and the number of doublings
+	//		after which the off-diagonal part is dropped (leaving Jacobi)
+	static constexpr REAL INITIAL_SHIFT = 1e-3;
+	static constexpr int MAX_SHIFT_DOUBLINGS = 12;
+};
+
+//////////////////////////////////////////////////////////////////////
+// CSparseSymMatrix::Reset
+//
+// clears to an empty n x n matrix
+//////////////////////////////////////////////////////////////////////
+inline void CSparseSymMatrix::Reset(int n)
+{
+	m_nDim = n;
+	m_arrRowStart.assign(1, 0);
+	m_arrCol.clear();
+	m_arrValue.clear();
+	m_arrLowerStart.clear();
+	m_arrLowerCol.clear();
+	m_arrLowerValue.clear();
+	m_arrLowerDiag.clear();
+	m_shift = 0.0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CSparseSymMatrix::Multiply
+//
+// row-wise product
+//////////////////////////////////////////////////////////////////////
+inline void CSparseSymMatrix::Multiply(const std::vector<REAL>& vX, std::vector<REAL>& vY) const
+{
+	vY.resize(m_nDim);
+	for (int nRow = 0; nRow < m_nDim; nRow++)
+	{
+		REAL sum = 0.0;
+		for (int nAt = m_arrRowStart[nRow]; nAt < m_arrRowStart[nRow + 1]; nAt++)
+		{
+			sum += m_arrValue[nAt] * vX[m_arrCol[nAt]];
+		}
+		vY[nRow] = sum;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// CSparseSymMatrix::FactorPreconditioner
+//
+// row-wise IC(0): L(i,k) = (A(i,k) - sum_j<k L(i,j) L(k,j)) / L(k,k) on the
+//		pattern of A, L(i,i) = sqrt(A(i,i) - sum_k<i L(i,k)^2)
+//////////////////////////////////////////////////////////////////////
+inline bool CSparseSymMatrix::FactorPreconditioner()
+{
+	// the lower triangle of A, sorted by column, and its diagonal
+	std::vector<REAL> vDiag(m_nDim, 0.0);
+	m_arrLowerDiag.clear();
+	m_arrLowerStart.assign(1, 0);
+	m_arrLowerCol.clear();
+	std::vector<REAL> arrLowerA;
+	std::vector<std::pair<int, REAL>> arrRow;
+	for (int nRow = 0; nRow < m_nDim; nRow++)
+	{
+		arrRow.clear();
+		for (int nAt = m_arrRowStart[nRow]; nAt < m_arrRowStart[nRow + 1]; nAt++)
+		{
+			if (m_arrCol[nAt] < nRow)
+			{
+				arrRow.push_back(std::make_pair(m_arrCol[nAt], m_arrValue[nAt]));
+			}
+			else if (m_arrCol[nAt] == nRow)
+			{
+				vDiag[nRow] += m_arrValue[nAt];
+			}
+		}
+		std::sort(arrRow.begin(), arrRow.end());
+		for (const auto& entry : arrRow)
+		{
+			m_arrLowerCol.push_back(entry.first);
+			arrLowerA.push_back(entry.second);
+		}
+		m_arrLowerStart.push_back((int) m_arrLowerCol.size());
+
+		if (!(vDiag[nRow] > 0.0))
+		{
+			return false;
+		}
+	}
+
+	m_arrLowerValue.resize(arrLowerA.size());
+	m_arrLowerDiag.resize(m_nDim);
+	m_shift = 0.0;
+	for (int nShift = 0; nShift <= MAX_SHIFT_DOUBLINGS; nShift++)
+	{
+		bool bPositive = true;
+		for (int nRow = 0; nRow < m_nDim && bPositive; nRow++)
+		{
+			REAL pivot = vDiag[nRow] * (1.0 + m_shift);
+			for (int nAt = m_arrLowerStart[nRow]; nAt < m_arrLowerStart[nRow + 1]; nAt++)
+			{
+				// the dot product of rows nRow and nCol of L, over the columns 
+				//		before nCol (both rows ascending)
+				const int nCol = m_arrLowerCol[nAt];
+				REAL sum = arrLowerA[nAt];
+				int nAtRow = m_arrLowerStart[nRow];
+				int nAtCol = m_arrLowerStart[nCol];
+				while (nAtRow < nAt && nAtCol < m_arrLowerStart[nCol + 1])
+				{
+					if (m_arrLowerCol[nAtRow] < m_arrLowerCol[nAtCol])
+					{
+						nAtRow++;
+					}
+					else if (m_arrLowerCol[nAtCol] < m_arrLowerCol[nAtRow])
+					{
+						nAtCol++;
+					}
+					else
+					{
+						sum -= m_arrLowerValue[nAtRow++] * m_arrLowerValue[nAtCol++];
+					}
+				}
+				m_arrLowerValue[nAt] = sum / m_arrLowerDiag[nCol];
+				pivot -= m_arrLowerValue[nAt] * m_arrLowerValue[nAt];
+			}
+
+			bPositive = pivot > 0.0;
+			if (bPositive)
+			{
+				m_arrLowerDiag[nRow] = sqrt(pivot);
+			}
+		}
+		if (bPositive)
+		{
+			return true;
+		}
+
+		m_shift = (m_shift == 0.0) ? INITIAL_SHIFT : 2.0 * m_shift;
+	}
+
+	// no shift tried gave a factor, so precondition with the diagonal alone
+	std::fill(m_arrLowerValue.begin(), m_arrLowerValue.end(), 0.0);
+	for (int nRow = 0; nRow < m_nDim; nRow++)
+	{
+		m_arrLowerDiag[nRow] = sqrt(vDiag[nRow]);
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CSparseSymMatrix::Precondition
+//
+// solves L y = r, then L^T z = y (by columns of L^T, i.e. rows of L)
+//////////////////////////////////////////////////////////////////////
+inline void CSparseSymMatrix::Precondition(const std::vector<REAL>& vR, std::vector<REAL>& vZ) const
+{
+	vZ.resize(m_nDim);
+	for (int nRow = 0; nRow < m_nDim; nRow++)
+	{
+		REAL sum = vR[nRow];
+		for (int nAt = m_arrLowerStart[nRow]; nAt < m_arrLowerStart[nRow + 1]; nAt++)
+		{
+			sum -= m_arrLowerValue[nAt] * vZ[m_arrLowerCol[nAt]];
+		}
+		vZ[nRow] = sum / m_arrLowerDiag[nRow];
+	}
+	for (int nRow = m_nDim - 1; nRow >= 0; nRow--)
+	{
+		vZ[nRow] /= m_arrLowerDiag[nRow];
+		for (int nAt = m_arrLowerStart[nRow]; nAt < m_arrLowerStart[nRow + 1]; nAt++)
+		{
+			vZ[m_arrLowerCol[nAt]] -= m_arrLowerValue[nAt] * vZ[nRow];
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// CSparseSymMatrix::SolveCG
+//
+// preconditioned conjugate gradients
+//////////////////////////////////////////////////////////////////////
+inline int CSparseSymMatrix::SolveCG(const std::vector<REAL>& vB, std::vector<REAL>& vX,
+	REAL tol, int nMaxIter)
+{
+	vX.assign(m_nDim, 0.0);
+	if ((int) m_arrLowerDiag.size() != m_nDim && !FactorPreconditioner())
+	{
+		return -1;
+	}
+
+	std::vector<REAL> vR(vB), vZ(m_nDim), vP(m_nDim), vAp(m_nDim);
+	REAL normB = 0.0;
+	for (int nAt = 0; nAt < m_nDim; nAt++)
+	{
+		normB += vB[nAt] * vB[nAt];
+	}
+	if (normB == 0.0)
+	{
+		return 0;
+	}
+
+	Precondition(vR, vZ);
+	REAL rz = 0.0;
+	for (int nAt = 0; nAt < m_nDim; nAt++)
+	{
+		vP[nAt] = vZ[nAt];
+		rz += vR[nAt] * vZ[nAt];
+	}
+
+	for (int nIter = 1; nIter <= nMaxIter; nIter++)
+	{
+		Multiply(vP, vAp);
+		REAL pAp = 0.0;
+		for (int nAt = 0; nAt < m_nDim; nAt++)
+		{
+			pAp += vP[nAt] * vAp[nAt];
+		}
+		const REAL alpha = rz / pAp;
+
+		REAL normR = 0.0;
+		for (int nAt = 0; nAt < m_nDim; nAt++)
+		{
+			vX[nAt] += alpha * vP[nAt];
+			vR[nAt] -= alpha * vAp[nAt];
+			normR += vR[nAt] * vR[nAt];
+		}
+		if (normR <= tol * tol * normB)
+		{
+			return nIter;
+		}
+
+		Precondition(vR, vZ);
+		REAL rzNext = 0.0;
+		for (int nAt = 0; nAt < m_nDim; nAt++)
+		{
+			rzNext += vR[nAt] * vZ[nAt];
+		}
+		const REAL beta = rzNext / rz;
+		rz = rzNext;
+		for (int nAt = 0; nAt < m_nDim; nAt++)
+		{
+			vP[nAt] = vZ[nAt] + beta * vP[nAt];
+		}
+	}
+
+	return -1;
+}
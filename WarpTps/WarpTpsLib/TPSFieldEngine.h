@@ -0,0 +1,1006 @@
+//////////////////////////////////////////////////////////////////////
+// TPSFieldEngine.h: interface for the CTPSFieldEngine class.
+//
+// Copyright (C) 2002-2025 Derek Lane
+//////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <complex>
+#include <numeric>
+
+// REAL
+#include "MathUtil.h"
+
+// wendland_function
+#include "CompactRBF.h"
+
+//////////////////////////////////////////////////////////////////////
+// the radial basis of the warp
+//////////////////////////////////////////////////////////////////////
+enum TPSWarpMode
+{
+	// k r^r_exp log r, every landmark contributes to every pixel
+	TPS_WARP_CLASSIC = 0,
+
+	// Wendland C2 kernel, zero beyond the support radius: a sparse solve,
+	//		and each pixel only sums the landmarks within the radius
+	TPS_WARP_WENDLAND = 1,
+
+	// classic kernel, with the field summed over a tree of the
+	//		landmarks: clusters far from a pixel (radius < theta * distance)
+	//		contribute through a multipole expansion about their centroid.  only
+	//		for r_exp = 2; other exponents are evaluated as classic
+	TPS_WARP_HIERARCHICAL = 2,
+};
+
+//////////////////////////////////////////////////////////////////////
+// class CTPSWorkerPool
+//
+// worker threads kept between EvalRect calls, so an interactive warp
+//		(an EvalRect per frame) doesn't start and join its threads every
+//		frame.  runs one job at a time; the calling thread takes part.
+//		a copy starts with no threads of its own
+//////////////////////////////////////////////////////////////////////
+class CTPSWorkerPool
+{
+public:
+	CTPSWorkerPool();
+	CTPSWorkerPool(const CTPSWorkerPool&) : CTPSWorkerPool() { }
+	CTPSWorkerPool& operator=(const CTPSWorkerPool&) { return *this; }
+	~CTPSWorkerPool();
+
+	// calls job on the calling thread and nThreads - 1 workers, and
+	//		returns once every call has returned
+	void Run(int nThreads, const std::function<void()>& job);
+
+private:
+	// waits for jobs; nGeneration is the last job the worker has seen
+	void WorkerLoop(int nWorker, unsigned nGeneration);
+
+	std::vector<std::thread> m_arrWorkers;
+
+	// held for the whole of a Run, so jobs don't overlap
+	std::mutex m_mutexRun;
+
+	// guards the job state below
+	std::mutex m_mutex;
+	std::condition_variable m_cvStart;
+	std::condition_variable m_cvDone;
+
+	// the current job, the workers it runs on, and how many are still in it
+	const std::function<void()> *m_pJob;
+	int m_nJobWorkers;
+	int m_nBusy;
+
+	// incremented for each job
+	unsigned m_nGeneration;
+	bool m_bStop;
+};
+
+//////////////////////////////////////////////////////////////////////
+// CTPSWorkerPool::CTPSWorkerPool
+//
+// constructs a pool with no threads; Run starts them as needed
+//////////////////////////////////////////////////////////////////////
+inline CTPSWorkerPool::CTPSWorkerPool()
+	: m_pJob(nullptr)
+	, m_nJobWorkers(0)
+	, m_nBusy(0)
+	, m_nGeneration(0)
+	, m_bStop(false)
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSWorkerPool::~CTPSWorkerPool
+//
+// stops and joins the workers
+//////////////////////////////////////////////////////////////////////
+inline CTPSWorkerPool::~CTPSWorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bStop = true;
+	}
+	m_cvStart.notify_all();
+	for (auto& worker : m_arrWorkers)
+	{
+		worker.join();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSWorkerPool::Run
+//
+// runs job on nThreads threads
+//////////////////////////////////////////////////////////////////////
+inline void CTPSWorkerPool::Run(int nThreads, const std::function<void()>& job)
+{
+	std::lock_guard<std::mutex> lockRun(m_mutexRun);
+	const int nWorkers = nThreads - 1;
+	if (nWorkers <= 0)
+	{
+		job();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		while ((int) m_arrWorkers.size() < nWorkers)
+		{
+			// a new worker waits for the job after the current generation
+			m_arrWorkers.emplace_back(&CTPSWorkerPool::WorkerLoop, this,
+				(int) m_arrWorkers.size(), m_nGeneration);
+		}
+		m_pJob = &job;
+		m_nJobWorkers = nWorkers;
+		m_nBusy = nWorkers;
+		m_nGeneration++;
+	}
+	m_cvStart.notify_all();
+
+	job();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_cvDone.wait(lock, [this] { return m_nBusy == 0; });
+	m_pJob = nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSWorkerPool::WorkerLoop
+//
+// runs each job this worker takes part in, until the pool stops
+//////////////////////////////////////////////////////////////////////
+inline void CTPSWorkerPool::WorkerLoop(int nWorker, unsigned nGeneration)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;)
+	{
+		m_cvStart.wait(lock, [&] { return m_bStop || m_nGeneration != nGeneration; });
+		if (m_bStop)
+		{
+			return;
+		}
+		nGeneration = m_nGeneration;
+
+		// jobs that need fewer threads leave the higher workers idle
+		if (nWorker >= m_nJobWorkers)
+		{
+			continue;
+		}
+
+		const std::function<void()> *pJob = m_pJob;
+		lock.unlock();
+		(*pJob)();
+		lock.lock();
+
+		if (--m_nBusy == 0)
+		{
+			m_cvDone.notify_one();
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// class CTPSFieldEngine
+//
+// evaluates a TPS offset field over a rectangle of pixels.  holds the
+//		landmark positions and weights as separate arrays, so the inner
+//		loop runs over a contiguous span of pixels per landmark (which
+//		the compiler vectorizes), and splits the rows over threads
+//////////////////////////////////////////////////////////////////////
+class CTPSFieldEngine
+{
+public:
+	// construction
+	CTPSFieldEngine();
+
+	// loads the landmark positions (dataset 0), the x- and y-weights and the
+	//		affine part: offset = (vAffineX[0] + vAffineX[1] x + vAffineX[2] y, ...)
+	void SetWeights(int n, const REAL *pX, const REAL *pY,
+		const REAL *pWx, const REAL *pWy, const REAL vAffineX[3], const REAL vAffineY[3]);
+
+	// sets the radial basis function parameters (as distance_function)
+	void SetKernel(REAL k, REAL r_exp);
+
+	// sets the warp mode, the Wendland support radius and the hierarchical
+	//		opening criterion (call before SetWeights, which builds the index)
+	void SetMode(TPSWarpMode mode, REAL supportRadius, REAL theta);
+
+	// number of threads for EvalRect (0 for one per hardware thread)
+	void SetThreadCount(int nThreads) { m_nThreads = nThreads; }
+
+	// evaluates the offsets of the pixels [nLeft, nRight) of row nY
+	void EvalRow(int nY, int nLeft, int nRight, REAL *pOffsetX, REAL *pOffsetY) const;
+
+	// evaluates the radial (non-affine) part of the offset at a point
+	void EvalRadial(REAL x, REAL y, REAL& offsetX, REAL& offsetY) const;
+
+	// evaluates the rectangle [nLeft, nRight) x [nTop, nBottom), calling
+	//		store(nY, nLeft, nRight, pOffsetX, pOffsetY) once per row.  rows
+	//		are evaluated concurrently, so store must only touch its own row
+	template<class STORE>
+	void EvalRect(int nLeft, int nTop, int nRight, int nBottom, STORE store) const;
+
+private:
+	// the kernel for a squared distance, k r^r_exp log r (0 at r == 0)
+	void EvalKernel(const REAL *pR2, REAL *pU, int nCount) const;
+
+	// the Wendland kernel for a span of squared distances (within the support)
+	void EvalCompactKernel(const REAL *pR2, REAL *pU, int nCount) const;
+
+	// the landmarks [nBegin, nEnd) (in y order) within the support of row y
+	void GetSupportRange(REAL y, int& nBegin, int& nEnd) const;
+
+	// builds the cluster tree over landmarks [nBegin, nEnd), reordering them;
+	//		returns the node index
+	int BuildTree(int nBegin, int nEnd);
+
+	// the radial part at a point by the cluster tree
+	void EvalTree(REAL x, REAL y, REAL& offsetX, REAL& offsetY) const;
+
+	// evaluates rows [nTop, nBottom) x [nLeft, nRight) by the cluster tree,
+	//		into row-major arrays
+	void EvalTreeRows(int nTop, int nBottom, int nLeft, int nRight, 
+		REAL *pOffsetX, REAL *pOffsetY) const;
+
+	// adds a node's expansion, shifted by D (the local center less the node
+	//		centroid), to a local expansion
+	void ShiftToLocal(int nNode, const std::complex<REAL>& D, std::complex<REAL> *pLocal) const;
+
+	// landmark positions and weights
+	std::vector<REAL> m_arrX;
+	std::vector<REAL> m_arrY;
+	std::vector<REAL> m_arrWx;
+	std::vector<REAL> m_arrWy;
+
+	// the affine part
+	REAL m_vAffineX[3];
+	REAL m_vAffineY[3];
+
+	// the radial basis parameters
+	REAL m_k;
+	REAL m_r_exp;
+
+	// the warp mode and its parameters
+	TPSWarpMode m_mode;
+	REAL m_supportRadius;
+	REAL m_theta;
+
+	// a cluster of landmarks [nBegin, nEnd): its centroid and radius, and its
+	//		two children (-1 for a leaf)
+	struct TreeNode
+	{
+		REAL cx, cy, radius;
+		int nBegin, nEnd;
+		int nChild[2];
+	};
+	std::vector<TreeNode> m_arrTree;
+
+	// the expansion coefficients of each node, EXPANSION_SIZE per node: for the 
+	//		x- then y-weights, the four log series of EvalTree, each as the log
+	//		coefficient followed by TREE_EXPANSION_ORDER inverse-power ones
+	std::vector<std::complex<REAL>> m_arrExpansion;
+
+	// the origin of the expansions' complex coordinates (the landmark centroid)
+	REAL m_originX;
+	REAL m_originY;
+
+	// leaf size and expansion order of the cluster tree, and the tile of pixels
+	//		that share a local expansion
+	static constexpr int TREE_LEAF_SIZE = 16;
+	static constexpr int TREE_EXPANSION_ORDER = 12;
+	static constexpr int EXPANSION_SIZE = 2 * 4 * (TREE_EXPANSION_ORDER + 1);
+	static constexpr int TREE_TILE_SIZE = 16;
+
+	// binomial coefficients C(k + l - 1, l) for the shift to a local expansion
+	REAL m_arrShiftBinomial[TREE_EXPANSION_ORDER + 1][TREE_EXPANSION_ORDER + 1];
+
+	// number of threads (0 for hardware concurrency)
+	int m_nThreads;
+
+	// the threads EvalRect runs on, kept between calls
+	mutable CTPSWorkerPool m_workerPool;
+
+	// pixels per span of the inner loop (bounds the stack buffers)
+	static constexpr int SPAN = 256;
+
+	// rectangles below this many pixel-landmark evaluations run on the
+	//		calling thread
+	static constexpr long long MIN_PARALLEL_WORK = 1 << 18;
+};
+
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::CTPSFieldEngine
+//
+// constructs an engine with no landmarks (a zero field)
+//////////////////////////////////////////////////////////////////////
+inline CTPSFieldEngine::CTPSFieldEngine()
+	: m_k(1.0)
+	, m_r_exp(2.0)
+	, m_mode(TPS_WARP_CLASSIC)
+	, m_supportRadius(100.0)
+	, m_theta(0.5)
+	, m_originX(0.0)
+	, m_originY(0.0)
+	, m_nThreads(0)
+{
+	for (int nL = 0; nL <= TREE_EXPANSION_ORDER; nL++)
+	{
+		for (int nK = 1; nK <= TREE_EXPANSION_ORDER; nK++)
+		{
+			// C(k + l - 1, l) as the product of (k + i - 1) / i
+			REAL binomial = 1.0;
+			for (int nI = 1; nI <= nL; nI++)
+			{
+				binomial *= (REAL) (nK + nI - 1) / (REAL) nI;
+			}
+			m_arrShiftBinomial[nL][nK] = binomial;
+		}
+		m_arrShiftBinomial[nL][0] = 0.0;
+	}
+	std::fill(m_vAffineX, m_vAffineX + 3, 0.0);
+	std::fill(m_vAffineY, m_vAffineY + 3, 0.0);
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::SetWeights
+//
+// loads the landmarks and weights
+//////////////////////////////////////////////////////////////////////
+inline void CTPSFieldEngine::SetWeights(int n, const REAL *pX, const REAL *pY,
+	const REAL *pWx, const REAL *pWy, const REAL vAffineX[3], const REAL vAffineY[3])
+{
+	m_arrX.assign(pX, pX + n);
+	m_arrY.assign(pY, pY + n);
+	m_arrWx.assign(pWx, pWx + n);
+	m_arrWy.assign(pWy, pWy + n);
+	std::copy(vAffineX, vAffineX + 3, m_vAffineX);
+	std::copy(vAffineY, vAffineY + 3, m_vAffineY);
+
+	m_arrTree.clear();
+	m_arrExpansion.clear();
+	if (m_mode == TPS_WARP_WENDLAND)
+	{
+		// sorted by y, so a row's landmarks are a contiguous range
+		std::vector<int> arrOrder(n);
+		for (int nAt = 0; nAt < n; nAt++)
+		{
+			arrOrder[nAt] = nAt;
+		}
+		std::sort(arrOrder.begin(), arrOrder.end(), 
+			[pY](int n1, int n2) { return pY[n1] < pY[n2]; });
+		for (int nAt = 0; nAt < n; nAt++)
+		{
+			m_arrX[nAt] = pX[arrOrder[nAt]];
+			m_arrY[nAt] = pY[arrOrder[nAt]];
+			m_arrWx[nAt] = pWx[arrOrder[nAt]];
+			m_arrWy[nAt] = pWy[arrOrder[nAt]];
+		}
+	}
+	else if (m_mode == TPS_WARP_HIERARCHICAL && m_r_exp == 2.0 && n > 0)
+	{
+		m_originX = std::accumulate(m_arrX.begin(), m_arrX.end(), 0.0) / n;
+		m_originY = std::accumulate(m_arrY.begin(), m_arrY.end(), 0.0) / n;
+		BuildTree(0, n);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::SetMode
+//
+// sets the warp mode
+//////////////////////////////////////////////////////////////////////
+inline void CTPSFieldEngine::SetMode(TPSWarpMode mode, REAL supportRadius, REAL theta)
+{
+	m_mode = mode;
+	m_supportRadius = supportRadius;
+	m_theta = theta;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::SetKernel
+//
+// sets the radial basis parameters
+//////////////////////////////////////////////////////////////////////
+inline void CTPSFieldEngine::SetKernel(REAL k, REAL r_exp)
+{
+	m_k = k;
+	m_r_exp = r_exp;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::EvalKernel
+//
+// evaluates the radial basis for a span of squared distances.  written
+//		in terms of r^2 (r^e log r = (r^2)^(e/2) log(r^2) / 2) and without
+//		branches: r^2 == 0 is replaced by 1, where the log is 0
+//////////////////////////////////////////////////////////////////////
+inline void CTPSFieldEngine::EvalKernel(const REAL *pR2, REAL *pU, int nCount) const
+{
+	const REAL halfK = 0.5 * m_k;
+	if (m_r_exp == 2.0)
+	{
+		for (int nAt = 0; nAt < nCount; nAt++)
+		{
+			const REAL r2 = pR2[nAt] > 0.0 ? pR2[nAt] : 1.0;
+			pU[nAt] = halfK * r2 * log(r2);
+		}
+	}
+	else
+	{
+		const REAL halfExp = 0.5 * m_r_exp;
+		for (int nAt = 0; nAt < nCount; nAt++)
+		{
+			const REAL r2 = pR2[nAt] > 0.0 ? pR2[nAt] : 1.0;
+			const REAL logR2 = log(r2);
+			pU[nAt] = halfK * exp(halfExp * logR2) * logR2;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::EvalRow
+//
+// evaluates a span of a row, one landmark at a time over SPAN pixels
+//////////////////////////////////////////////////////////////////////
+inline void CTPSFieldEngine::EvalRow(int nY, int nLeft, int nRight,
+	REAL *pOffsetX, REAL *pOffsetY) const
+{
+	REAL arrR2[SPAN];
+	REAL arrU[SPAN];
+
+	const REAL y = (REAL) nY;
+	if (!m_arrTree.empty())
+	{
+		EvalTreeRows(nY, nY + 1, nLeft, nRight, pOffsetX, pOffsetY);
+		return;
+	}
+
+	// the compact kernel only needs the landmarks within the support of the row
+	int nBegin = 0, nEnd = (int) m_arrX.size();
+	if (m_mode == TPS_WARP_WENDLAND)
+	{
+		GetSupportRange(y, nBegin, nEnd);
+	}
+
+	for (int nSpan = nLeft; nSpan < nRight; nSpan += SPAN)
+	{
+		const int nCount = std::min(SPAN, nRight - nSpan);
+		REAL *pOutX = pOffsetX + (nSpan - nLeft);
+		REAL *pOutY = pOffsetY + (nSpan - nLeft);
+
+		// start with the affine part
+		const REAL baseX = m_vAffineX[0] + m_vAffineX[2] * y;
+		const REAL baseY = m_vAffineY[0] + m_vAffineY[2] * y;
+		for (int nAt = 0; nAt < nCount; nAt++)
+		{
+			const REAL x = (REAL) (nSpan + nAt);
+			pOutX[nAt] = baseX + m_vAffineX[1] * x;
+			pOutY[nAt] = baseY + m_vAffineY[1] * x;
+		}
+
+		// add the weighted radial basis of each landmark
+		for (int nLandmark = nBegin; nLandmark < nEnd; nLandmark++)
+		{
+			const REAL dy = y - m_arrY[nLandmark];
+			const REAL dy2 = dy * dy;
+
+			// the pixels of the span that the landmark reaches
+			int nFrom = 0, nTo = nCount;
+			if (m_mode == TPS_WARP_WENDLAND)
+			{
+				const REAL halfWidth = sqrt(std::max(0.0, m_supportRadius * m_supportRadius - dy2));
+				nFrom = std::max(nFrom, (int) ceil(m_arrX[nLandmark] - halfWidth) - nSpan);
+				nTo = std::min(nTo, (int) floor(m_arrX[nLandmark] + halfWidth) - nSpan + 1);
+				if (nFrom >= nTo)
+				{
+					continue;
+				}
+			}
+
+			const REAL x0 = (REAL) nSpan - m_arrX[nLandmark];
+			for (int nAt = nFrom; nAt < nTo; nAt++)
+			{
+				const REAL dx = x0 + (REAL) nAt;
+				arrR2[nAt] = dx * dx + dy2;
+			}
+
+			if (m_mode == TPS_WARP_WENDLAND)
+			{
+				EvalCompactKernel(arrR2 + nFrom, arrU + nFrom, nTo - nFrom);
+			}
+			else
+			{
+				EvalKernel(arrR2 + nFrom, arrU + nFrom, nTo - nFrom);
+			}
+
+			const REAL wx = m_arrWx[nLandmark];
+			const REAL wy = m_arrWy[nLandmark];
+			for (int nAt = nFrom; nAt < nTo; nAt++)
+			{
+				pOutX[nAt] += wx * arrU[nAt];
+				pOutY[nAt] += wy * arrU[nAt];
+			}
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::EvalCompactKernel
+//
+// the Wendland kernel over a span of squared distances
+//////////////////////////////////////////////////////////////////////
+inline void CTPSFieldEngine::EvalCompactKernel(const REAL *pR2, REAL *pU, int nCount) const
+{
+	const REAL invRadius = 1.0 / m_supportRadius;
+	for (int nAt = 0; nAt < nCount; nAt++)
+	{
+		const REAL t = std::min(sqrt(pR2[nAt]) * invRadius, 1.0);
+		const REAL s = 1.0 - t;
+		pU[nAt] = m_k * (s * s) * (s * s) * (4.0 * t + 1.0);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::GetSupportRange
+//
+// binary search of the y-sorted landmarks
+//////////////////////////////////////////////////////////////////////
+inline void CTPSFieldEngine::GetSupportRange(REAL y, int& nBegin, int& nEnd) const
+{
+	nBegin = (int) (std::upper_bound(m_arrY.begin(), m_arrY.end(), y - m_supportRadius) - m_arrY.begin());
+	nEnd = (int) (std::lower_bound(m_arrY.begin(), m_arrY.end(), y + m_supportRadius) - m_arrY.begin());
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::EvalRadial
+//
+// the radial part of the offset at a single point
+//////////////////////////////////////////////////////////////////////
+inline void CTPSFieldEngine::EvalRadial(REAL x, REAL y, REAL& offsetX, REAL& offsetY) const
+{
+	offsetX = 0.0;
+	offsetY = 0.0;
+	if (!m_arrTree.empty())
+	{
+		EvalTree(x, y, offsetX, offsetY);
+		return;
+	}
+
+	int nBegin = 0, nEnd = (int) m_arrX.size();
+	if (m_mode == TPS_WARP_WENDLAND)
+	{
+		GetSupportRange(y, nBegin, nEnd);
+	}
+	for (int nLandmark = nBegin; nLandmark < nEnd; nLandmark++)
+	{
+		const REAL dx = x - m_arrX[nLandmark];
+		const REAL dy = y - m_arrY[nLandmark];
+		REAL r2 = dx * dx + dy * dy, u;
+		if (m_mode == TPS_WARP_WENDLAND)
+		{
+			EvalCompactKernel(&r2, &u, 1);
+		}
+		else
+		{
+			EvalKernel(&r2, &u, 1);
+		}
+		offsetX += m_arrWx[nLandmark] * u;
+		offsetY += m_arrWy[nLandmark] * u;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::BuildTree
+//
+// splits the landmarks at the median of the wider extent, down to 
+//		TREE_LEAF_SIZE, forming each node's expansion
+//////////////////////////////////////////////////////////////////////
+inline int CTPSFieldEngine::BuildTree(int nBegin, int nEnd)
+{
+	const int nNode = (int) m_arrTree.size();
+	m_arrTree.push_back(TreeNode());
+
+	TreeNode node;
+	node.nBegin = nBegin;
+	node.nEnd = nEnd;
+	node.nChild[0] = node.nChild[1] = -1;
+
+	// centroid, radius and extent
+	REAL minX = m_arrX[nBegin], maxX = minX, minY = m_arrY[nBegin], maxY = minY;
+	node.cx = node.cy = 0.0;
+	for (int nAt = nBegin; nAt < nEnd; nAt++)
+	{
+		node.cx += m_arrX[nAt];
+		node.cy += m_arrY[nAt];
+		minX = std::min(minX, m_arrX[nAt]);
+		maxX = std::max(maxX, m_arrX[nAt]);
+		minY = std::min(minY, m_arrY[nAt]);
+		maxY = std::max(maxY, m_arrY[nAt]);
+	}
+	node.cx /= (nEnd - nBegin);
+	node.cy /= (nEnd - nBegin);
+
+	node.radius = 0.0;
+	for (int nAt = nBegin; nAt < nEnd; nAt++)
+	{
+		const REAL dx = m_arrX[nAt] - node.cx;
+		const REAL dy = m_arrY[nAt] - node.cy;
+		node.radius = std::max(node.radius, sqrt(dx * dx + dy * dy));
+	}
+
+	if (nEnd - nBegin > TREE_LEAF_SIZE)
+	{
+		// order the range by the wider extent, and split at the median
+		const std::vector<REAL>& arrKey = (maxX - minX >= maxY - minY) ? m_arrX : m_arrY;
+		std::vector<int> arrOrder(nEnd - nBegin);
+		for (int nAt = nBegin; nAt < nEnd; nAt++)
+		{
+			arrOrder[nAt - nBegin] = nAt;
+		}
+		std::sort(arrOrder.begin(), arrOrder.end(), 
+			[&arrKey](int n1, int n2) { return arrKey[n1] < arrKey[n2]; });
+
+		// permute just this range, through copies of it (copying the whole
+		//		arrays at every node would make the build O(n^2))
+		const int nCount = nEnd - nBegin;
+		std::vector<REAL> arrX(nCount), arrY(nCount), arrWx(nCount), arrWy(nCount);
+		for (int nAt = 0; nAt < nCount; nAt++)
+		{
+			const int nFrom = arrOrder[nAt];
+			arrX[nAt] = m_arrX[nFrom];
+			arrY[nAt] = m_arrY[nFrom];
+			arrWx[nAt] = m_arrWx[nFrom];
+			arrWy[nAt] = m_arrWy[nFrom];
+		}
+		std::copy(arrX.begin(), arrX.end(), m_arrX.begin() + nBegin);
+		std::copy(arrY.begin(), arrY.end(), m_arrY.begin() + nBegin);
+		std::copy(arrWx.begin(), arrWx.end(), m_arrWx.begin() + nBegin);
+		std::copy(arrWy.begin(), arrWy.end(), m_arrWy.begin() + nBegin);
+
+		const int nMid = (nBegin + nEnd) / 2;
+		node.nChild[0] = BuildTree(nBegin, nMid);
+		node.nChild[1] = BuildTree(nMid, nEnd);
+	}
+
+	m_arrTree[nNode] = node;
+
+	// the expansion coefficients: the series' source factors are formed from
+	//		the landmark about the origin, t, and the powers from it about the
+	//		centroid.  (after the children, which reorder the range)
+	m_arrExpansion.resize(m_arrTree.size() * EXPANSION_SIZE);
+	std::complex<REAL> *pCoeff = &m_arrExpansion[nNode * EXPANSION_SIZE];
+	std::fill(pCoeff, pCoeff + EXPANSION_SIZE, 0.0);
+	for (int nAt = nBegin; nAt < nEnd; nAt++)
+	{
+		const std::complex<REAL> t(m_arrX[nAt] - m_originX, m_arrY[nAt] - m_originY);
+		const std::complex<REAL> tc(m_arrX[nAt] - node.cx, m_arrY[nAt] - node.cy);
+		const REAL w[2] = { m_arrWx[nAt], m_arrWy[nAt] };
+		for (int nDim = 0; nDim < 2; nDim++)
+		{
+			// the factors w, w t, w conj(t), w |t|^2
+			const std::complex<REAL> q[4] = { w[nDim], w[nDim] * t, 
+				w[nDim] * std::conj(t), w[nDim] * std::norm(t) };
+			for (int nSeries = 0; nSeries < 4; nSeries++)
+			{
+				std::complex<REAL> *pSeries = 
+					pCoeff + (nDim * 4 + nSeries) * (TREE_EXPANSION_ORDER + 1);
+				pSeries[0] += q[nSeries];
+				std::complex<REAL> qtk = q[nSeries];
+				for (int nK = 1; nK <= TREE_EXPANSION_ORDER; nK++)
+				{
+					qtk *= tc;
+					pSeries[nK] -= qtk / (REAL) nK;
+				}
+			}
+		}
+	}
+
+	return nNode;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::EvalTree
+//
+// sums the clusters, opening those too near the point.  in complex 
+//		coordinates z, t about the origin, 
+//			|z - t|^2 log |z - t| = Re[(|z|^2 - conj(z) t - z conj(t) + |t|^2) log(z - t)]
+//		so the field is k Re[|z|^2 F0 - conj(z) F1 - z F2 + F3], with F0..F3 the
+//		sums of w, w t, w conj(t), w |t|^2 times log(z - t).  about a cluster's
+//		centroid c, each is the multipole expansion
+//			sum q log(z - t) = (sum q) log(z - c) - sum_k (sum q (t - c)^k / k) (z - c)^-k
+//		truncated at TREE_EXPANSION_ORDER, with error ~ theta^order
+//////////////////////////////////////////////////////////////////////
+inline void CTPSFieldEngine::EvalTree(REAL x, REAL y, REAL& offsetX, REAL& offsetY) const
+{
+	REAL sum[2] = { 0.0, 0.0 };
+	const REAL halfK = 0.5 * m_k;
+	const std::complex<REAL> z(x - m_originX, y - m_originY);
+
+	int arrStack[64];
+	int nStack = 0;
+	arrStack[nStack++] = 0;
+	while (nStack > 0)
+	{
+		const int nNode = arrStack[--nStack];
+		const TreeNode& node = m_arrTree[nNode];
+		const std::complex<REAL> s(x - node.cx, y - node.cy);
+
+		if (node.radius * node.radius < m_theta * m_theta * std::norm(s))
+		{
+			// far enough: the multipole expansion about the centroid
+			const std::complex<REAL> logS = std::log(s);
+			const std::complex<REAL> invS = 1.0 / s;
+			const std::complex<REAL> *pCoeff = &m_arrExpansion[nNode * EXPANSION_SIZE];
+			for (int nDim = 0; nDim < 2; nDim++)
+			{
+				std::complex<REAL> F[4];
+				for (int nSeries = 0; nSeries < 4; nSeries++)
+				{
+					const std::complex<REAL> *pSeries = 
+						pCoeff + (nDim * 4 + nSeries) * (TREE_EXPANSION_ORDER + 1);
+					std::complex<REAL> series = 0.0;
+					for (int nK = TREE_EXPANSION_ORDER; nK >= 1; nK--)
+					{
+						series = (series + pSeries[nK]) * invS;
+					}
+					F[nSeries] = series + pSeries[0] * logS;
+				}
+				sum[nDim] += m_k * std::real(std::norm(z) * F[0] - std::conj(z) * F[1] 
+					- z * F[2] + F[3]);
+			}
+		}
+		else if (node.nChild[0] < 0)
+		{
+			// a near leaf: summed exactly
+			for (int nAt = node.nBegin; nAt < node.nEnd; nAt++)
+			{
+				const REAL dx = x - m_arrX[nAt];
+				const REAL dy = y - m_arrY[nAt];
+				const REAL r2 = dx * dx + dy * dy;
+				const REAL u = r2 > 0.0 ? halfK * r2 * log(r2) : 0.0;
+				sum[0] += m_arrWx[nAt] * u;
+				sum[1] += m_arrWy[nAt] * u;
+			}
+		}
+		else
+		{
+			arrStack[nStack++] = node.nChild[0];
+			arrStack[nStack++] = node.nChild[1];
+		}
+	}
+
+	offsetX = sum[0];
+	offsetY = sum[1];
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::ShiftToLocal
+//
+// with D = z0 - c, a multipole series a0 log(z - c) + sum_k a_k (z - c)^-k 
+//		about c is, for z = z0 + u, the local series sum_l b_l u^l with
+//			b_0 = a0 log D + sum_k a_k D^-k
+//			b_l = (-1)^l D^-l (-a0 / l + sum_k a_k C(k + l - 1, l) D^-k)
+//////////////////////////////////////////////////////////////////////
+inline void CTPSFieldEngine::ShiftToLocal(int nNode, const std::complex<REAL>& D, 
+	std::complex<REAL> *pLocal) const
+{
+	const int P = TREE_EXPANSION_ORDER;
+	const std::complex<REAL> logD = std::log(D);
+	const std::complex<REAL> invD = 1.0 / D;
+	std::complex<REAL> arrInvDk[P + 1];
+	arrInvDk[0] = 1.0;
+	for (int nK = 1; nK <= P; nK++)
+	{
+		arrInvDk[nK] = arrInvDk[nK - 1] * invD;
+	}
+
+	const std::complex<REAL> *pCoeff = &m_arrExpansion[nNode * EXPANSION_SIZE];
+	for (int nSeries = 0; nSeries < 8; nSeries++)
+	{
+		const std::complex<REAL> *pSeries = pCoeff + nSeries * (P + 1);
+		std::complex<REAL> *pOut = pLocal + nSeries * (P + 1);
+
+		std::complex<REAL> b0 = pSeries[0] * logD;
+		for (int nK = 1; nK <= P; nK++)
+		{
+			b0 += pSeries[nK] * arrInvDk[nK];
+		}
+		pOut[0] += b0;
+
+		for (int nL = 1; nL <= P; nL++)
+		{
+			std::complex<REAL> bl = pSeries[0] * (-1.0 / nL);
+			for (int nK = 1; nK <= P; nK++)
+			{
+				bl += pSeries[nK] * (m_arrShiftBinomial[nL][nK] * arrInvDk[nK]);
+			}
+			pOut[nL] += ((nL & 1) ? -1.0 : 1.0) * arrInvDk[nL] * bl;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::EvalTreeRows
+//
+// evaluates square tiles of TREE_TILE_SIZE pixels: the clusters well 
+//		separated from a tile (radius + tile radius < theta * distance) are
+//		shifted into a local expansion about its center, evaluated per pixel,
+//		and the leaves near it are summed exactly, a span of pixels at a time
+//////////////////////////////////////////////////////////////////////
+inline void CTPSFieldEngine::EvalTreeRows(int nTop, int nBottom, int nLeft, int nRight,
+	REAL *pOffsetX, REAL *pOffsetY) const
+{
+	const int P = TREE_EXPANSION_ORDER;
+	const int nWidth = nRight - nLeft;
+	std::complex<REAL> arrLocal[8 * (P + 1)];
+	std::vector<int> arrNear;
+	REAL arrR2[TREE_TILE_SIZE];
+	REAL arrU[TREE_TILE_SIZE];
+
+	for (int nTileTop = nTop; nTileTop < nBottom; nTileTop += TREE_TILE_SIZE)
+	{
+		const int nTileBottom = std::min(nTileTop + TREE_TILE_SIZE, nBottom);
+		for (int nTileLeft = nLeft; nTileLeft < nRight; nTileLeft += TREE_TILE_SIZE)
+		{
+			const int nTileRight = std::min(nTileLeft + TREE_TILE_SIZE, nRight);
+			const int nCount = nTileRight - nTileLeft;
+
+			// the tile's center and radius
+			const REAL x0 = 0.5 * (nTileLeft + nTileRight - 1);
+			const REAL y0 = 0.5 * (nTileTop + nTileBottom - 1);
+			const REAL tileRadius = 0.5 * sqrt((REAL) ((nCount - 1) * (nCount - 1) 
+				+ (nTileBottom - nTileTop - 1) * (nTileBottom - nTileTop - 1)));
+
+			// gather the local expansion and the near leaves
+			std::fill(arrLocal, arrLocal + 8 * (P + 1), 0.0);
+			arrNear.clear();
+			int arrStack[64];
+			int nStack = 0;
+			arrStack[nStack++] = 0;
+			while (nStack > 0)
+			{
+				const int nNode = arrStack[--nStack];
+				const TreeNode& node = m_arrTree[nNode];
+				const std::complex<REAL> D(x0 - node.cx, y0 - node.cy);
+				const REAL reach = node.radius + tileRadius;
+				if (reach * reach < m_theta * m_theta * std::norm(D))
+				{
+					ShiftToLocal(nNode, D, arrLocal);
+				}
+				else if (node.nChild[0] < 0)
+				{
+					arrNear.push_back(nNode);
+				}
+				else
+				{
+					arrStack[nStack++] = node.nChild[0];
+					arrStack[nStack++] = node.nChild[1];
+				}
+			}
+
+			for (int nY = nTileTop; nY < nTileBottom; nY++)
+			{
+				const REAL y = (REAL) nY;
+				REAL *pOutX = pOffsetX + (nY - nTop) * nWidth + (nTileLeft - nLeft);
+				REAL *pOutY = pOffsetY + (nY - nTop) * nWidth + (nTileLeft - nLeft);
+
+				// the local expansion, and the affine part
+				for (int nAt = 0; nAt < nCount; nAt++)
+				{
+					const REAL x = (REAL) (nTileLeft + nAt);
+					const std::complex<REAL> z(x - m_originX, y - m_originY);
+					const std::complex<REAL> u(x - x0, y - y0);
+					REAL sum[2];
+					for (int nDim = 0; nDim < 2; nDim++)
+					{
+						std::complex<REAL> F[4];
+						for (int nSeries = 0; nSeries < 4; nSeries++)
+						{
+							const std::complex<REAL> *pSeries = arrLocal + (nDim * 4 + nSeries) * (P + 1);
+							std::complex<REAL> series = pSeries[P];
+							for (int nL = P - 1; nL >= 0; nL--)
+							{
+								series = series * u + pSeries[nL];
+							}
+							F[nSeries] = series;
+						}
+						sum[nDim] = m_k * std::real(std::norm(z) * F[0] - std::conj(z) * F[1] 
+							- z * F[2] + F[3]);
+					}
+					pOutX[nAt] = sum[0] + m_vAffineX[0] + m_vAffineX[1] * x + m_vAffineX[2] * y;
+					pOutY[nAt] = sum[1] + m_vAffineY[0] + m_vAffineY[1] * x + m_vAffineY[2] * y;
+				}
+
+				// the near leaves, a landmark at a time over the row of the tile
+				for (int nNode : arrNear)
+				{
+					const TreeNode& node = m_arrTree[nNode];
+					for (int nLandmark = node.nBegin; nLandmark < node.nEnd; nLandmark++)
+					{
+						const REAL dy = y - m_arrY[nLandmark];
+						const REAL dy2 = dy * dy;
+						const REAL dx0 = (REAL) nTileLeft - m_arrX[nLandmark];
+						for (int nAt = 0; nAt < nCount; nAt++)
+						{
+							const REAL dx = dx0 + (REAL) nAt;
+							arrR2[nAt] = dx * dx + dy2;
+						}
+
+						EvalKernel(arrR2, arrU, nCount);
+
+						const REAL wx = m_arrWx[nLandmark];
+						const REAL wy = m_arrWy[nLandmark];
+						for (int nAt = 0; nAt < nCount; nAt++)
+						{
+							pOutX[nAt] += wx * arrU[nAt];
+							pOutY[nAt] += wy * arrU[nAt];
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSFieldEngine::EvalRect
+//
+// evaluates a rectangle, rows handed out to the threads one at a time
+//////////////////////////////////////////////////////////////////////
+template<class STORE>
+inline void CTPSFieldEngine::EvalRect(int nLeft, int nTop, int nRight, int nBottom,
+	STORE store) const
+{
+	const int nWidth = nRight - nLeft;
+	const int nRows = nBottom - nTop;
+	if (nWidth <= 0 || nRows <= 0)
+	{
+		return;
+	}
+
+	// the cluster tree evaluates bands of rows, so its tiles are square
+	const int nBand = m_arrTree.empty() ? 1 : TREE_TILE_SIZE;
+	auto evalRows = [&](std::atomic<int> *pNextRow)
+	{
+		std::vector<REAL> arrOffsetX(nWidth * nBand), arrOffsetY(nWidth * nBand);
+		for (int nY = pNextRow->fetch_add(nBand); nY < nBottom; nY = pNextRow->fetch_add(nBand))
+		{
+			const int nBandBottom = std::min(nY + nBand, nBottom);
+			if (nBand > 1)
+			{
+				EvalTreeRows(nY, nBandBottom, nLeft, nRight, &arrOffsetX[0], &arrOffsetY[0]);
+			}
+			else
+			{
+				EvalRow(nY, nLeft, nRight, &arrOffsetX[0], &arrOffsetY[0]);
+			}
+			for (int nRow = nY; nRow < nBandBottom; nRow++)
+			{
+				store(nRow, nLeft, nRight, 
+					&arrOffsetX[(nRow - nY) * nWidth], &arrOffsetY[(nRow - nY) * nWidth]);
+			}
+		}
+	};
+
+	// one thread per hardware thread, but not more than the work warrants
+	int nThreads = m_nThreads > 0 ? m_nThreads
+		: std::max(1, (int) std::thread::hardware_concurrency());
+	const long long work = (long long) nWidth * nRows * (m_arrX.size() + 1);
+	nThreads = (int) std::min<long long>(nThreads,
+		std::max<long long>(1, work / MIN_PARALLEL_WORK));
+	nThreads = std::min(nThreads, (nRows + nBand - 1) / nBand);
+
+	std::atomic<int> nextRow(nTop);
+	m_workerPool.Run(nThreads, [&] { evalRows(&nextRow); });
+}
@@ -13,6 +13,9 @@
 // model object base class
 #include "ModelObject.h"
 
+// evaluates the presampled field
+#include "TPSFieldEngine.h"
+
 //////////////////////////////////////////////////////////////////////
 // class CTPSTransform
 // 
@@ -52,6 +55,7 @@ public:
 	void SetRExponent(float r_exp) 
 	{ 
 		m_r_exp = r_exp; 
+		m_bRecalcMatrix = TRUE;
 		m_bRecalc = TRUE;
 		m_bRecalcPresample = TRUE;
 	}
@@ -59,10 +63,56 @@ public:
 	void SetK(float k)
 	{
 		m_k = k;
+		m_bRecalcMatrix = TRUE;
+		m_bRecalc = TRUE;
+		m_bRecalcPresample = TRUE;
+	}
+
+	// selects the radial basis: the classic TPS kernel, the compactly supported
+	//		Wendland kernel, or the classic kernel with the field evaluated 
+	//		hierarchically (see TPSWarpMode)
+	void SetWarpMode(TPSWarpMode mode)
+	{
+		m_warpMode = mode;
+		m_bRecalc = TRUE;
+		m_bRecalcPresample = TRUE;
+	}
+
+	// sets the support radius of the Wendland kernel; a radius that isn't 
+	//		positive is ignored (the kernel would be zero everywhere)
+	void SetSupportRadius(float radius)
+	{
+		if (!(radius > 0.0f)) {
+			return;
+		}
+		m_supportRadius = radius;
 		m_bRecalc = TRUE;
 		m_bRecalcPresample = TRUE;
 	}
 
+	// sets the opening criterion of the hierarchical field: a cluster of landmarks
+	//		is expanded about its centroid when its radius is below theta times its
+	//		distance, so smaller theta is more accurate and slower
+	void SetApproxTheta(float theta)
+	{
+		m_approxTheta = theta;
+		m_bRecalc = TRUE;
+		m_bRecalcPresample = TRUE;
+	}
+
+	// whether the current weights solved their system: FALSE if the Wendland 
+	//		solve didn't converge (the weights are then its last iterates, which
+	//		don't map the landmarks exactly onto their targets) or its kernel 
+	//		matrix wasn't positive definite (the weights are then zero).  brings
+	//		the weights up to date first
+	BOOL IsWeightSolveConverged()
+	{
+		if (m_bRecalc) {
+			RecalcWeights();
+		}
+		return m_bWeightsConverged;
+	}
+
 	// evaluates the field at a point
 	// returns the offset vector, so the mapped point can be derived by adding the position and offset
 	void Eval(const CVectorD<3>::Point_t& vPos, CVectorD<3>::Point_t& vOffset, float percent);
@@ -73,13 +123,62 @@ public:
 	// resample pixels
 	void ResampleRawWithField(LPBYTE pSrcPixels, LPBYTE pDstPixels, UINT bytesPerPixel, UINT width, UINT height, UINT stride, float percent);
 
+	// resamples only the pixels [nLeft, nRight) x [nTop, nBottom) (bottom-up rows, as
+	//		the presampled field), e.g. the part of the view a dragged landmark repaints. 
+	//		if the field is out of date, only the tiles of it under that rectangle are 
+	//		recomputed, and the rest stay marked for recalculation
+	void ResampleRawWithFieldRect(LPBYTE pSrcPixels, LPBYTE pDstPixels, UINT bytesPerPixel, UINT width, UINT height, UINT stride, float percent,
+		int nLeft, int nTop, int nRight, int nBottom);
+
+	// the presampled field engine (e.g. to set its thread count)
+	CTPSFieldEngine& GetFieldEngine() { return m_fieldEngine; }
+
 protected:
 	// recalculates the TPS from the landmarks
 	void RecalcWeights();
 
+	// brings m_mL_inv up to date with the landmark edits since it was formed, by
+	//		low-rank updates (false if it must be re-inverted instead)
+	bool UpdateInverse();
+
+	// rank-2 update of m_mL_inv for a moved source landmark, given the change in
+	//		its column of L
+	bool UpdateInverseMove(int nIndex, const ublas::vector<REAL>& vDelta);
+
+	// bordered update of m_mL_inv for a landmark added at nIndex, given its 
+	//		column of the enlarged L
+	bool UpdateInverseAdd(int nIndex, const ublas::vector<REAL>& vCol);
+
+	// checks the updated m_mL_inv against L for the given source landmarks, by
+	//		the residual of a solve (false if it must be re-inverted instead)
+	bool CheckInverse(const vector<REAL>& arrX, const vector<REAL>& arrY) const;
+
+	// forms the column of L for landmark nIndex of the given positions
+	void FormColumn(const vector<REAL>& arrX, const vector<REAL>& arrY, int nIndex, 
+		ublas::vector<REAL>& vCol) const;
+
+	// solves for the Wendland weights (radial and affine) by sparse solves with
+	//		the compact kernel matrix, in place of m_mL_inv.  returns false if
+	//		a solve failed (see IsWeightSolveConverged)
+	bool SolveCompactWeights(const ublas::vector<REAL>& vHx, const ublas::vector<REAL>& vHy);
+
 	// used to construct the presampled vector field
 	void Presample(int width, int height);
 
+	// sizes the presampled vector field, flagging it for recalculation if changed
+	void SetPresampleSize(int width, int height);
+
+	// recomputes the out-of-date tiles of the presampled vector field under a
+	//		rectangle, and marks them current
+	void UpdatePresampleRect(int nLeft, int nTop, int nRight, int nBottom);
+
+	// computes a rectangle of the presampled vector field
+	void PresampleRect(int nLeft, int nTop, int nRight, int nBottom);
+
+	// resamples a rectangle through the presampled vector field
+	void ResampleFieldRect(LPBYTE pSrcPixels, LPBYTE pDstPixels, UINT bytesPerPixel, UINT width, UINT height, UINT stride, float percent,
+		int nLeft, int nTop, int nRight, int nBottom);
+
 private:
 	// the array of landmarks
 	vector<tuple<CVectorD<3>, CVectorD<3>>> m_arrLandmarkTuples;
@@ -89,9 +188,36 @@ private:
 	int m_presampledWidth;
 	int m_presampledHeight;
 
+	// which PRESAMPLE_TILE_SIZE tiles of the presampled field are current (row
+	//		major); only meaningful while m_bRecalcPresample is clear
+	vector<char> m_arrPresampleTileCurrent;
+	static constexpr int PRESAMPLE_TILE_SIZE = 64;
+
+	// the weights in structure-of-arrays form, for the presampled field
+	CTPSFieldEngine m_fieldEngine;
+
 	// stores the inverse of the distance matrix
 	ublas::matrix<REAL> m_mL_inv;
 
+	// the source landmarks and radial basis parameters m_mL_inv was formed for
+	vector<REAL> m_arrInverseX;
+	vector<REAL> m_arrInverseY;
+	float m_inverse_r_exp;
+	float m_inverse_k;
+
+	// number of low-rank updates applied since m_mL_inv was last inverted; after
+	//		MAX_INVERSE_UPDATES it is re-inverted, so rounding doesn't accumulate
+	int m_nInverseUpdates;
+	static constexpr int MAX_INVERSE_UPDATES = 64;
+
+	// an update whose pivot is below this (relative) is replaced by re-inversion
+	static constexpr REAL INVERSE_UPDATE_TOLERANCE = 1e-10;
+
+	// updates whose check solve has a residual above this (relative to the 
+	//		right-hand side) are replaced by re-inversion.  a fresh inverse gives
+	//		about 1e-8 for landmarks 500 px apart; a corrupted one 1e-4 and up
+	static constexpr REAL INVERSE_RESIDUAL_TOLERANCE = 1e-6;
+
 	// the final weight vectors
 	ublas::vector<REAL> m_vWx;
 	ublas::vector<REAL> m_vWy;
@@ -100,6 +226,17 @@ private:
 	float m_r_exp;
 	float m_k;
 
+	// the warp mode, with the Wendland support radius and hierarchical theta
+	TPSWarpMode m_warpMode;
+	float m_supportRadius;
+	float m_approxTheta;
+
+	// relative residual of the Wendland solves
+	static constexpr REAL COMPACT_SOLVE_TOLERANCE = 1e-12;
+
+	// set if the last weight solve converged
+	BOOL m_bWeightsConverged;
+
 	// flag to indicate that recalculation of the TPS is needed
 	BOOL m_bRecalcMatrix;
 	BOOL m_bRecalc;
@@ -138,13 +275,20 @@ inline double distance_function(const CVectorD<3>::Point_t& vL1, const CVectorD<
 // constructs a CTPSTransform object with the given name
 //////////////////////////////////////////////////////////////////////
 inline CTPSTransform::CTPSTransform()
-	: m_bRecalcMatrix(TRUE)
-	, m_bRecalc(TRUE)
-	, m_bRecalcPresample(TRUE)
-	, m_presampledWidth(0)
+	: m_presampledWidth(0)
 	, m_presampledHeight(0)
-	, m_k(1.0)
+	, m_inverse_r_exp(2.0)
+	, m_inverse_k(1.0)
+	, m_nInverseUpdates(0)
 	, m_r_exp(2.0)
+	, m_k(1.0)
+	, m_warpMode(TPS_WARP_CLASSIC)
+	, m_supportRadius(100.0)
+	, m_approxTheta(0.5)
+	, m_bWeightsConverged(TRUE)
+	, m_bRecalcMatrix(TRUE)
+	, m_bRecalc(TRUE)
+	, m_bRecalcPresample(TRUE)
 {
 }
 
@@ -296,19 +440,29 @@ inline void CTPSTransform::Eval(const CVectorD<3>::Point_t& vPos, CVectorD<3>::P
 		RecalcWeights();
 	}
 
-	// add the weight vector displacements
-	for (int nAt = 0; nAt < n; nAt++)
+	if (m_warpMode != TPS_WARP_CLASSIC)
+	{
+		// the field engine holds the compact / hierarchical structures
+		REAL offsetX, offsetY;
+		m_fieldEngine.EvalRadial(vPos.get<X>(), vPos.get<Y>(), offsetX, offsetY);
+		bg::add_point(vOffset, CVectorD<3, REAL>::Point_t(offsetX * percent, offsetY * percent));
+	}
+	else
 	{
-		CVectorD<3, REAL>::Point_t vL0;
-		std::tie(vL0, ignore) = GetLandmarkTuple(nAt);
+		// add the weight vector displacements
+		for (int nAt = 0; nAt < n; nAt++)
+		{
+			CVectorD<3, REAL>::Point_t vL0;
+			std::tie(vL0, ignore) = GetLandmarkTuple(nAt);
 
-		// distance to the first landmark
-		double d = distance_function(vPos, vL0, m_k, m_r_exp);
+			// distance to the first landmark
+			double d = distance_function(vPos, vL0, m_k, m_r_exp);
 
-		// add weight vector displacements
-		CVectorD<3,REAL>::Point_t displacement(m_vWx(nAt), m_vWy(nAt));
-		bg::multiply_value(displacement, d * percent);
-		bg::add_point(vOffset, displacement);
+			// add weight vector displacements
+			CVectorD<3,REAL>::Point_t displacement(m_vWx(nAt), m_vWy(nAt));
+			bg::multiply_value(displacement, d * percent);
+			bg::add_point(vOffset, displacement);
+		}
 	}
 
 	// add the affine displacements
@@ -330,31 +484,129 @@ inline void CTPSTransform::Eval(const CVectorD<3>::Point_t& vPos, CVectorD<3>::P
 // resamples a source image through the transform
 //////////////////////////////////////////////////////////////////////
 inline void CTPSTransform::Presample(int width, int height)
+{
+	SetPresampleSize(width, height);
+
+	UpdatePresampleRect(0, 0, width, height);
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSTransform::SetPresampleSize
+// 
+// sizes the presampled vector field
+//////////////////////////////////////////////////////////////////////
+inline void CTPSTransform::SetPresampleSize(int width, int height)
 {
 	if (width != m_presampledWidth
 		|| height != m_presampledHeight) {
 		m_presampledWidth = width;
 		m_presampledHeight = height;
 		m_presampledOffsets.resize(width * height);
+		m_arrPresampleTileCurrent.resize(
+			((width + PRESAMPLE_TILE_SIZE - 1) / PRESAMPLE_TILE_SIZE)
+			* ((height + PRESAMPLE_TILE_SIZE - 1) / PRESAMPLE_TILE_SIZE));
 		m_bRecalcPresample = TRUE;
 	}
+}
 
+//////////////////////////////////////////////////////////////////////
+// CTPSTransform::UpdatePresampleRect
+// 
+// brings the tiles of the presampled field under a rectangle up to date.
+//		m_bRecalcPresample marks every tile out of date; it is cleared here,
+//		with the tiles not yet recomputed remembered in m_arrPresampleTileCurrent
+//////////////////////////////////////////////////////////////////////
+inline void CTPSTransform::UpdatePresampleRect(int nLeft, int nTop, int nRight, int nBottom)
+{
+	const int nTilesX = (m_presampledWidth + PRESAMPLE_TILE_SIZE - 1) / PRESAMPLE_TILE_SIZE;
 	if (m_bRecalcPresample) {
-		// position of the destination
-		CVectorD<3>::Point_t vDstPos(0.0, 0.0, 0.0);
-
-		// for each pixel in the image
-		for (int dstAtY = 0; vDstPos.get<Y>() < height; dstAtY++) {
-			bg::set<X>(vDstPos, 0.0);
-			for (int dstAtX = 0; vDstPos.get<X>() < width; dstAtX++) {
-				Eval(vDstPos, m_presampledOffsets[dstAtY * m_presampledWidth + dstAtX], 1.0);
-				bg::set<X>(vDstPos, vDstPos.get<X>() + 1.0);
+		std::fill(m_arrPresampleTileCurrent.begin(), m_arrPresampleTileCurrent.end(), 0);
+		m_bRecalcPresample = FALSE;
+	}
+
+	nLeft = std::max(nLeft, 0);
+	nTop = std::max(nTop, 0);
+	nRight = std::min(nRight, m_presampledWidth);
+	nBottom = std::min(nBottom, m_presampledHeight);
+	if (nLeft >= nRight || nTop >= nBottom) {
+		return;
+	}
+
+	const int nTileLeft = nLeft / PRESAMPLE_TILE_SIZE;
+	const int nTileTop = nTop / PRESAMPLE_TILE_SIZE;
+	const int nTileRight = (nRight + PRESAMPLE_TILE_SIZE - 1) / PRESAMPLE_TILE_SIZE;
+	const int nTileBottom = (nBottom + PRESAMPLE_TILE_SIZE - 1) / PRESAMPLE_TILE_SIZE;
+
+	// whole tiles are computed, so a tile is either current or not.  if none
+	//		under the rectangle is current (the usual case after an edit), they
+	//		go to the field engine as one rectangle
+	bool bAnyCurrent = false;
+	for (int nTileY = nTileTop; nTileY < nTileBottom; nTileY++) {
+		for (int nTileX = nTileLeft; nTileX < nTileRight; nTileX++) {
+			bAnyCurrent = bAnyCurrent || m_arrPresampleTileCurrent[nTileY * nTilesX + nTileX];
+		}
+	}
+	if (!bAnyCurrent) {
+		PresampleRect(nTileLeft * PRESAMPLE_TILE_SIZE, nTileTop * PRESAMPLE_TILE_SIZE,
+			nTileRight * PRESAMPLE_TILE_SIZE, nTileBottom * PRESAMPLE_TILE_SIZE);
+	}
+
+	// otherwise each run of out-of-date tiles along a row of tiles
+	for (int nTileY = nTileTop; nTileY < nTileBottom; nTileY++) {
+		char *pTileRow = &m_arrPresampleTileCurrent[nTileY * nTilesX];
+		for (int nTileX = nTileLeft; nTileX < nTileRight; nTileX++) {
+			if (!bAnyCurrent || pTileRow[nTileX]) {
+				pTileRow[nTileX] = 1;
+				continue;
 			}
-			bg::set<Y>(vDstPos, vDstPos.get<Y>() + 1.0);
+
+			int nRunEnd = nTileX;
+			while (nRunEnd < nTileRight && !pTileRow[nRunEnd]) {
+				pTileRow[nRunEnd++] = 1;
+			}
+			PresampleRect(nTileX * PRESAMPLE_TILE_SIZE, nTileY * PRESAMPLE_TILE_SIZE,
+				nRunEnd * PRESAMPLE_TILE_SIZE, (nTileY + 1) * PRESAMPLE_TILE_SIZE);
+			nTileX = nRunEnd - 1;
 		}
+	}
+}
 
-		m_bRecalcPresample = FALSE;
+//////////////////////////////////////////////////////////////////////
+// CTPSTransform::PresampleRect
+// 
+// evaluates the field (at percent = 1) over a rectangle of the presampled 
+//		vector field, through the field engine
+//////////////////////////////////////////////////////////////////////
+inline void CTPSTransform::PresampleRect(int nLeft, int nTop, int nRight, int nBottom)
+{
+	nLeft = std::max(nLeft, 0);
+	nTop = std::max(nTop, 0);
+	nRight = std::min(nRight, m_presampledWidth);
+	nBottom = std::min(nBottom, m_presampledHeight);
+
+	// Eval is zero without at least three landmarks
+	if (GetLandmarkCount() < 3) {
+		for (int dstAtY = nTop; dstAtY < nBottom; dstAtY++) {
+			for (int dstAtX = nLeft; dstAtX < nRight; dstAtX++) {
+				bg::assign_zero(m_presampledOffsets[dstAtY * m_presampledWidth + dstAtX]);
+			}
+		}
+		return;
+	}
+
+	// see if a recalc is needed
+	if (m_bRecalc) {
+		RecalcWeights();
 	}
+
+	m_fieldEngine.EvalRect(nLeft, nTop, nRight, nBottom,
+		[this](int nY, int nRowLeft, int nRowRight, const REAL *pOffsetX, const REAL *pOffsetY) {
+			CVectorD<3>::Point_t *pRow = &m_presampledOffsets[nY * m_presampledWidth];
+			for (int dstAtX = nRowLeft; dstAtX < nRowRight; dstAtX++) {
+				pRow[dstAtX] = CVectorD<3>::Point_t(pOffsetX[dstAtX - nRowLeft], 
+					pOffsetY[dstAtX - nRowLeft], 0.0);
+			}
+		});
 }
 
 //
@@ -433,17 +685,57 @@ inline void CTPSTransform::ResampleRawWithField(LPBYTE pSrcPixels, LPBYTE pDstPi
 		RecalcWeights();
 	}
 
-	// if there are no landmarks, then no presampled vector field
-	if (m_bRecalcPresample
-		|| m_presampledWidth != width
-		|| m_presampledHeight != height) {
+	// brings any out-of-date tiles of the field up to date
+	Presample(width, height);
 
-		Presample(width, height);
-	}
+	ResampleFieldRect(pSrcPixels, pDstPixels, bytesPerPixel, width, height, stride, percent,
+		0, 0, (int) width, (int) height);
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSTransform::ResampleRawWithFieldRect
+//
+// resamples a rectangle of raw pixels using the presampled vector field,
+//		computing only that rectangle of the field if it is out of date
+//////////////////////////////////////////////////////////////////////
+inline void CTPSTransform::ResampleRawWithFieldRect(LPBYTE pSrcPixels, LPBYTE pDstPixels,
+	UINT bytesPerPixel,
+	UINT width,
+	UINT height,
+	UINT stride,
+	float percent,
+	int nLeft, int nTop, int nRight, int nBottom)
+{
+	SetPresampleSize(width, height);
+
+	nLeft = std::max(nLeft, 0);
+	nTop = std::max(nTop, 0);
+	nRight = std::min(nRight, (int) width);
+	nBottom = std::min(nBottom, (int) height);
+
+	// the tiles outside the rectangle stay out of date, for the next full resample
+	UpdatePresampleRect(nLeft, nTop, nRight, nBottom);
+
+	ResampleFieldRect(pSrcPixels, pDstPixels, bytesPerPixel, width, height, stride, percent,
+		nLeft, nTop, nRight, nBottom);
+}
 
+//////////////////////////////////////////////////////////////////////
+// CTPSTransform::ResampleFieldRect
+//
+// resamples a rectangle of raw pixels through the presampled vector field
+//////////////////////////////////////////////////////////////////////
+inline void CTPSTransform::ResampleFieldRect(LPBYTE pSrcPixels, LPBYTE pDstPixels,
+	UINT bytesPerPixel,
+	UINT width,
+	UINT height,
+	UINT stride,
+	float percent,
+	int nLeft, int nTop, int nRight, int nBottom)
+{
 	CVectorD<3>::Point_t vSrcPos(0.0, 0.0, 0.0);
-	for (int dstAtY = 0; dstAtY < (int)height; dstAtY++) {
-		for (int dstAtX = 0; dstAtX < (int)width; dstAtX++) {
+	for (int dstAtY = nTop; dstAtY < nBottom; dstAtY++) {
+		for (int dstAtX = nLeft; dstAtX < nRight; dstAtX++) {
 			// compute the destination position
 			int nDstY = height - dstAtY - 1;
 			int nDstIndex = bytesPerPixel * dstAtX
@@ -486,7 +778,12 @@ inline void CTPSTransform::RecalcWeights()
 		return;
 	}
 
-	if (m_bRecalcMatrix) {
+	// the Wendland weights come from a sparse solve, not the inverse (which then
+	//		stays flagged, for a switch back to the classic kernel)
+	const bool bCompact = m_warpMode == TPS_WARP_WENDLAND;
+
+	// landmark edits since the last inversion are applied as updates where possible
+	if (!bCompact && m_bRecalcMatrix && !UpdateInverse()) {
 		// stores the L matrix
 		ublas::matrix<REAL> mL(n + 3, n + 3);
 
@@ -524,6 +821,19 @@ inline void CTPSTransform::RecalcWeights()
 		// form the inverse of L
 		m_mL_inv.resize(n + 3, n + 3);
 		invert(mL, m_mL_inv);
+		m_nInverseUpdates = 0;
+	}
+
+	if (!bCompact && m_bRecalcMatrix) {
+		// remember what the inverse was formed for
+		m_arrInverseX.resize(n);
+		m_arrInverseY.resize(n);
+		for (int nAt = 0; nAt < n; nAt++) {
+			m_arrInverseX[nAt] = GetLandmark<0>(nAt)[0];
+			m_arrInverseY[nAt] = GetLandmark<0>(nAt)[1];
+		}
+		m_inverse_k = m_k;
+		m_inverse_r_exp = m_r_exp;
 
 		m_bRecalcMatrix = FALSE;
 	}
@@ -544,9 +854,342 @@ inline void CTPSTransform::RecalcWeights()
 		vHy(nAtLandmark) = 0.0;
 	}
 
-	m_vWx = ublas::prod(m_mL_inv, vHx);
-	m_vWy = ublas::prod(m_mL_inv, vHy);
+	if (bCompact) {
+		m_bWeightsConverged = SolveCompactWeights(vHx, vHy);
+	} else {
+		m_vWx = ublas::prod(m_mL_inv, vHx);
+		m_vWy = ublas::prod(m_mL_inv, vHy);
+		m_bWeightsConverged = TRUE;
+	}
+
+	// hand the landmarks and weights to the field engine as arrays
+	vector<REAL> arrX(n), arrY(n);
+	for (nAtLandmark = 0; nAtLandmark < n; nAtLandmark++) {
+		arrX[nAtLandmark] = GetLandmark<0>(nAtLandmark)[0];
+		arrY[nAtLandmark] = GetLandmark<0>(nAtLandmark)[1];
+	}
+	const REAL vAffineX[3] = { m_vWx(n + 0), m_vWx(n + 1), m_vWx(n + 2) };
+	const REAL vAffineY[3] = { m_vWy(n + 0), m_vWy(n + 1), m_vWy(n + 2) };
+	m_fieldEngine.SetKernel(m_k, m_r_exp);
+	m_fieldEngine.SetMode(m_warpMode, m_supportRadius, m_approxTheta);
+	m_fieldEngine.SetWeights(n, &arrX[0], &arrY[0], &m_vWx(0), &m_vWy(0), vAffineX, vAffineY);
 
 	// unset flag
 	m_bRecalc = FALSE;
 }
+
+//////////////////////////////////////////////////////////////////////
+// CTPSTransform::UpdateInverse
+// 
+// applies the source landmark moves and additions since m_mL_inv was 
+//		formed as rank-2 (move) and bordered (add) updates, O(n^2) each. 
+//		target landmark moves only change the right-hand side, so need no
+//		update at all
+//////////////////////////////////////////////////////////////////////
+inline bool CTPSTransform::UpdateInverse()
+{
+	auto n = GetLandmarkCount();
+	int nOld = (int) m_arrInverseX.size();
+	if (nOld < 3 || n < nOld
+		|| (int) m_mL_inv.size1() != nOld + 3
+		|| m_k != m_inverse_k || m_r_exp != m_inverse_r_exp) {
+		return false;
+	}
+
+	// find the source landmarks that have moved
+	vector<int> arrMoved;
+	for (int nAt = 0; nAt < nOld; nAt++) {
+		if (GetLandmark<0>(nAt)[0] != m_arrInverseX[nAt]
+			|| GetLandmark<0>(nAt)[1] != m_arrInverseY[nAt]) {
+			arrMoved.push_back(nAt);
+		}
+	}
+
+	// re-invert periodically, or if there are too many edits to be worth it
+	int nUpdates = (int) arrMoved.size() + (n - nOld);
+	if (m_nInverseUpdates + nUpdates > MAX_INVERSE_UPDATES) {
+		return false;
+	}
+
+	// apply the edits one at a time, to the positions the inverse is for
+	vector<REAL> arrX(m_arrInverseX), arrY(m_arrInverseY);
+	ublas::vector<REAL> vOldCol, vNewCol;
+	for (int nMoved : arrMoved) {
+		FormColumn(arrX, arrY, nMoved, vOldCol);
+		arrX[nMoved] = GetLandmark<0>(nMoved)[0];
+		arrY[nMoved] = GetLandmark<0>(nMoved)[1];
+		FormColumn(arrX, arrY, nMoved, vNewCol);
+		if (!UpdateInverseMove(nMoved, vNewCol - vOldCol)) {
+			return false;
+		}
+	}
+	for (int nAdded = nOld; nAdded < n; nAdded++) {
+		arrX.push_back(GetLandmark<0>(nAdded)[0]);
+		arrY.push_back(GetLandmark<0>(nAdded)[1]);
+		FormColumn(arrX, arrY, nAdded, vNewCol);
+		if (!UpdateInverseAdd(nAdded, vNewCol)) {
+			return false;
+		}
+	}
+
+	// a pivot can pass the tolerance and still lose most of its digits (a large
+	//		move, next to another landmark), so the result is checked against L
+	if (!CheckInverse(arrX, arrY)) {
+		return false;
+	}
+
+	m_nInverseUpdates += nUpdates;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSTransform::UpdateInverseMove
+// 
+// moving landmark k changes row and column k of L (symmetric, and the
+//		diagonal stays 0): L' = L + e_k d^T + d e_k^T.  by Woodbury, with
+//		p = L^-1 e_k and q = L^-1 d,
+//			L'^-1 = L^-1 - [p q] C^-1 [q p]^T,  C = I + [d e_k]^T [p q]
+//////////////////////////////////////////////////////////////////////
+inline bool CTPSTransform::UpdateInverseMove(int nIndex, const ublas::vector<REAL>& vDelta)
+{
+	ublas::vector<REAL> vP = ublas::column(m_mL_inv, nIndex);
+	ublas::vector<REAL> vQ = ublas::prod(m_mL_inv, vDelta);
+
+	// the 2x2 capacitance matrix (d^T p == q_k, as L^-1 is symmetric)
+	const REAL c11 = 1.0 + vQ(nIndex);
+	const REAL c12 = ublas::inner_prod(vDelta, vQ);
+	const REAL c21 = vP(nIndex);
+	const REAL c22 = 1.0 + vQ(nIndex);
+	const REAL det = c11 * c22 - c12 * c21;
+	if (fabs(det) <= INVERSE_UPDATE_TOLERANCE * (fabs(c11 * c22) + fabs(c12 * c21))) {
+		return false;
+	}
+
+	// rows of C^-1 [q p]^T
+	ublas::vector<REAL> vY0 = (c22 * vQ - c12 * vP) / det;
+	ublas::vector<REAL> vY1 = (c11 * vP - c21 * vQ) / det;
+	m_mL_inv -= ublas::outer_prod(vP, vY0) + ublas::outer_prod(vQ, vY1);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSTransform::UpdateInverseAdd
+// 
+// adding a landmark borders L with its column b (and a 0 diagonal).  with
+//		the new row / column moved last, the inverse is
+//			[ L^-1 + L^-1 b b^T L^-1 / s,  -L^-1 b / s ]
+//			[ -b^T L^-1 / s,               1 / s       ],  s = -b^T L^-1 b
+//		which is then permuted so the new landmark is at nIndex, ahead of
+//		the affine rows
+//////////////////////////////////////////////////////////////////////
+inline bool CTPSTransform::UpdateInverseAdd(int nIndex, const ublas::vector<REAL>& vCol)
+{
+	const int nSize = (int) m_mL_inv.size1();
+
+	// the new column, without its diagonal, in the current ordering
+	ublas::vector<REAL> vB(nSize);
+	for (int nAt = 0; nAt < nSize; nAt++) {
+		vB(nAt) = vCol(nAt < nIndex ? nAt : nAt + 1);
+	}
+
+	ublas::vector<REAL> vAb = ublas::prod(m_mL_inv, vB);
+	const REAL s = -ublas::inner_prod(vB, vAb);
+	if (fabs(s) <= INVERSE_UPDATE_TOLERANCE * ublas::norm_2(vB) * ublas::norm_2(vAb)) {
+		return false;
+	}
+
+	// maps an index of the enlarged matrix to the current one (-1 for the new landmark)
+	auto oldIndex = [nIndex](int nAt) { 
+		return nAt < nIndex ? nAt : (nAt == nIndex ? -1 : nAt - 1); 
+	};
+
+	ublas::matrix<REAL> mNew(nSize + 1, nSize + 1);
+	for (int nAtRow = 0; nAtRow < nSize + 1; nAtRow++) {
+		const int nOldRow = oldIndex(nAtRow);
+		for (int nAtCol = 0; nAtCol < nSize + 1; nAtCol++) {
+			const int nOldCol = oldIndex(nAtCol);
+			if (nOldRow >= 0 && nOldCol >= 0) {
+				mNew(nAtRow, nAtCol) = m_mL_inv(nOldRow, nOldCol) + vAb(nOldRow) * vAb(nOldCol) / s;
+			} else if (nOldRow >= 0) {
+				mNew(nAtRow, nAtCol) = -vAb(nOldRow) / s;
+			} else if (nOldCol >= 0) {
+				mNew(nAtRow, nAtCol) = -vAb(nOldCol) / s;
+			} else {
+				mNew(nAtRow, nAtCol) = 1.0 / s;
+			}
+		}
+	}
+	m_mL_inv.swap(mNew);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSTransform::CheckInverse
+// 
+// solves L y = v through m_mL_inv, for a fixed v, and checks the residual
+//		|L y - v| against |v| (infinity norms).  L is formed a column at a 
+//		time, so the check is O(n^2), as is each update
+//////////////////////////////////////////////////////////////////////
+inline bool CTPSTransform::CheckInverse(const vector<REAL>& arrX, 
+	const vector<REAL>& arrY) const
+{
+	const int n = (int) arrX.size();
+
+	ublas::vector<REAL> vV(n + 3);
+	for (int nAt = 0; nAt < n + 3; nAt++) {
+		vV(nAt) = 1.0 + (REAL) (nAt % 3);
+	}
+	const ublas::vector<REAL> vY = ublas::prod(m_mL_inv, vV);
+
+	// the landmark rows of L are its columns (L is symmetric)
+	REAL maxResidual = 0.0;
+	ublas::vector<REAL> vCol;
+	for (int nAt = 0; nAt < n; nAt++) {
+		FormColumn(arrX, arrY, nAt, vCol);
+		maxResidual = std::max(maxResidual, fabs(ublas::inner_prod(vCol, vY) - vV(nAt)));
+	}
+
+	// and the affine rows are [Q^T 0]
+	REAL vAffine[3] = { 0.0, 0.0, 0.0 };
+	for (int nAt = 0; nAt < n; nAt++) {
+		vAffine[0] += vY(nAt);
+		vAffine[1] += arrX[nAt] * vY(nAt);
+		vAffine[2] += arrY[nAt] * vY(nAt);
+	}
+	for (int nRow = 0; nRow < 3; nRow++) {
+		maxResidual = std::max(maxResidual, fabs(vAffine[nRow] - vV(n + nRow)));
+	}
+
+	return maxResidual <= INVERSE_RESIDUAL_TOLERANCE * ublas::norm_inf(vV);
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSTransform::SolveCompactWeights
+// 
+// with K the (sparse, positive definite) Wendland matrix and Q the 
+//		[1 x y] rows of the landmarks, the system [K Q; Q^T 0][w; a] = [h; 0]
+//		is solved by a = (Q^T K^-1 Q)^-1 Q^T K^-1 h, w = K^-1 (h - Q a), so 
+//		only K is solved with (five right-hand sides: hx, hy and Q), all
+//		preconditioned by one incomplete Cholesky factor of K
+//////////////////////////////////////////////////////////////////////
+inline bool CTPSTransform::SolveCompactWeights(const ublas::vector<REAL>& vHx, 
+	const ublas::vector<REAL>& vHy)
+{
+	auto n = GetLandmarkCount();
+
+	vector<REAL> arrX(n), arrY(n);
+	for (int nAt = 0; nAt < n; nAt++) {
+		arrX[nAt] = GetLandmark<0>(nAt)[0];
+		arrY[nAt] = GetLandmark<0>(nAt)[1];
+	}
+
+	// K, row by row from the landmarks within the support
+	CLandmarkGrid grid;
+	grid.Build(arrX, arrY, m_supportRadius);
+	CSparseSymMatrix mK;
+	mK.Reset(n);
+	for (int nRow = 0; nRow < n; nRow++) {
+		grid.ForEachNear(arrX[nRow], arrY[nRow], [&](int nCol) {
+			const REAL r = sqrt((arrX[nCol] - arrX[nRow]) * (arrX[nCol] - arrX[nRow])
+				+ (arrY[nCol] - arrY[nRow]) * (arrY[nCol] - arrY[nRow]));
+			if (r < m_supportRadius) {
+				mK.Add(nCol, wendland_function(r, m_k, m_supportRadius));
+			}
+		});
+		mK.EndRow();
+	}
+
+	// K is positive definite unless k isn't positive; then there are no 
+	//		weights to solve for, so the field is left at zero
+	m_vWx = ublas::zero_vector<REAL>(n + 3);
+	m_vWy = ublas::zero_vector<REAL>(n + 3);
+	if (!mK.FactorPreconditioner()) {
+		return false;
+	}
+
+	// Z = K^-1 [hx hy 1 x y]
+	vector<REAL> arrRhs[5] = { vector<REAL>(n), vector<REAL>(n), 
+		vector<REAL>(n, 1.0), arrX, arrY };
+	for (int nAt = 0; nAt < n; nAt++) {
+		arrRhs[0][nAt] = vHx(nAt);
+		arrRhs[1][nAt] = vHy(nAt);
+	}
+	// (conjugate gradients take at most n steps in exact arithmetic; closely 
+	//		spaced landmarks make K ill-conditioned, so allow for rounding).  a
+	//		solve that doesn't converge (K is singular for coincident landmarks)
+	//		leaves its last iterate, and is reported
+	vector<REAL> arrZ[5];
+	bool bConverged = true;
+	for (int nRhs = 0; nRhs < 5; nRhs++) {
+		if (mK.SolveCG(arrRhs[nRhs], arrZ[nRhs], COMPACT_SOLVE_TOLERANCE, 2 * n + 100) < 0) {
+			bConverged = false;
+		}
+	}
+
+	// S = Q^T K^-1 Q, and Q^T K^-1 h
+	ublas::matrix<REAL> mS(3, 3), mS_inv(3, 3);
+	ublas::vector<REAL> vQtZx(3), vQtZy(3);
+	for (int nRow = 0; nRow < 3; nRow++) {
+		for (int nCol = 0; nCol < 3; nCol++) {
+			mS(nRow, nCol) = 0.0;
+			for (int nAt = 0; nAt < n; nAt++) {
+				mS(nRow, nCol) += arrRhs[2 + nRow][nAt] * arrZ[2 + nCol][nAt];
+			}
+		}
+		vQtZx(nRow) = 0.0;
+		vQtZy(nRow) = 0.0;
+		for (int nAt = 0; nAt < n; nAt++) {
+			vQtZx(nRow) += arrRhs[2 + nRow][nAt] * arrZ[0][nAt];
+			vQtZy(nRow) += arrRhs[2 + nRow][nAt] * arrZ[1][nAt];
+		}
+	}
+	// S is singular for collinear landmarks, which don't fix an affine part
+	if (!invert(mS, mS_inv)) {
+		mS_inv = ublas::zero_matrix<REAL>(3, 3);
+		bConverged = false;
+	}
+	const ublas::vector<REAL> vAx = ublas::prod(mS_inv, vQtZx);
+	const ublas::vector<REAL> vAy = ublas::prod(mS_inv, vQtZy);
+
+	// w = K^-1 h - K^-1 Q a, followed by a
+	m_vWx.resize(n + 3);
+	m_vWy.resize(n + 3);
+	for (int nAt = 0; nAt < n; nAt++) {
+		m_vWx(nAt) = arrZ[0][nAt];
+		m_vWy(nAt) = arrZ[1][nAt];
+		for (int nQ = 0; nQ < 3; nQ++) {
+			m_vWx(nAt) -= arrZ[2 + nQ][nAt] * vAx(nQ);
+			m_vWy(nAt) -= arrZ[2 + nQ][nAt] * vAy(nQ);
+		}
+	}
+	for (int nQ = 0; nQ < 3; nQ++) {
+		m_vWx(n + nQ) = vAx(nQ);
+		m_vWy(n + nQ) = vAy(nQ);
+	}
+
+	return bConverged;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CTPSTransform::FormColumn
+// 
+// forms a column of L (as RecalcWeights fills it) from landmark positions
+//////////////////////////////////////////////////////////////////////
+inline void CTPSTransform::FormColumn(const vector<REAL>& arrX, const vector<REAL>& arrY, 
+	int nIndex, ublas::vector<REAL>& vCol) const
+{
+	const int n = (int) arrX.size();
+	vCol.resize(n + 3);
+
+	const CVectorD<3>::Point_t vL(arrX[nIndex], arrY[nIndex], 0.0);
+	for (int nAt = 0; nAt < n; nAt++) {
+		vCol(nAt) = (nAt != nIndex)
+			? distance_function(CVectorD<3>::Point_t(arrX[nAt], arrY[nAt], 0.0), vL, m_k, m_r_exp)
+			: 0.0;
+	}
+	vCol(n + 0) = 1.0;
+	vCol(n + 1) = arrX[nIndex];
+	vCol(n + 2) = arrY[nIndex];
+}
@@ -103,6 +103,46 @@ void resample_with_field_numpy(CTPSTransform& self,
     self.ResampleRawWithField(src_ptr, dst_ptr, channels, width, height, stride, percent);
 }
 
+// Wrapper for ResampleRawWithFieldRect to work with numpy arrays
+void resample_with_field_rect_numpy(CTPSTransform& self,
+                                    py::array_t<uint8_t> src_array,
+                                    py::array_t<uint8_t> dst_array,
+                                    py::tuple rect,
+                                    float percent) {
+
+    // Get buffer info
+    py::buffer_info src_info = src_array.request();
+    py::buffer_info dst_info = dst_array.request();
+
+    // Validate dimensions
+    if (src_info.ndim != 3 || dst_info.ndim != 3) {
+        throw std::runtime_error("Source and destination arrays must be 3D (height, width, channels)");
+    }
+    if (rect.size() != 4) {
+        throw std::invalid_argument("rect must be (left, top, right, bottom)");
+    }
+
+    int height = static_cast<int>(src_info.shape[0]);
+    int width = static_cast<int>(src_info.shape[1]);
+    int channels = static_cast<int>(src_info.shape[2]);
+
+    // Validate destination array matches source dimensions
+    if (dst_info.shape[0] != height || dst_info.shape[1] != width || dst_info.shape[2] != channels) {
+        throw std::runtime_error("Destination array must have same dimensions as source");
+    }
+
+    // Get pointers to data
+    uint8_t* src_ptr = static_cast<uint8_t*>(src_info.ptr);
+    uint8_t* dst_ptr = static_cast<uint8_t*>(dst_info.ptr);
+
+    // Calculate stride (bytes per row)
+    size_t stride = width * channels;
+
+    // Call the actual ResampleRawWithFieldRect function
+    self.ResampleRawWithFieldRect(src_ptr, dst_ptr, channels, width, height, stride, percent,
+        rect[0].cast<int>(), rect[1].cast<int>(), rect[2].cast<int>(), rect[3].cast<int>());
+}
+
 // Main pybind11 module definition
 PYBIND11_MODULE(_warptps_core, m) {
     m.doc() = "WarpTPS Python bindings - Thin Plate Spline transformations for image warping";
@@ -135,6 +175,13 @@ PYBIND11_MODULE(_warptps_core, m) {
         .def_property_readonly("y", [](const CVectorD<3>& v) { return v[1]; })
         .def_property_readonly("z", [](const CVectorD<3>& v) { return v[2]; });
 
+    // radial basis of the warp
+    py::enum_<TPSWarpMode>(m, "WarpMode")
+        .value("CLASSIC", TPS_WARP_CLASSIC)
+        .value("WENDLAND", TPS_WARP_WENDLAND)
+        .value("HIERARCHICAL", TPS_WARP_HIERARCHICAL)
+        .export_values();
+
     // CTPSTransform class bindings
     py::class_<CTPSTransform>(m, "TPSTransform")
         .def(py::init<>(), "Create a new TPS transform")
@@ -176,6 +223,31 @@ PYBIND11_MODULE(_warptps_core, m) {
              py::arg("k"),
              "Set the radial basis function scaling factor (default: 1.0)")
 
+        .def("set_warp_mode", &CTPSTransform::SetWarpMode,
+             py::arg("mode"),
+             "Set the radial basis: WarpMode.CLASSIC (default), WarpMode.WENDLAND\n"
+             "(compactly supported, sparse) or WarpMode.HIERARCHICAL (classic kernel,\n"
+             "field evaluated by a multipole expansion over a landmark tree)")
+
+        .def("set_support_radius", [](CTPSTransform& self, float radius) {
+                 if (!(radius > 0.0f))
+                     throw std::invalid_argument("Support radius must be positive");
+                 self.SetSupportRadius(radius);
+             },
+             py::arg("radius"),
+             "Set the support radius of the Wendland kernel, in pixels (default: 100.0)")
+
+        .def("set_approx_theta", &CTPSTransform::SetApproxTheta,
+             py::arg("theta"),
+             "Set the opening criterion of the hierarchical field; smaller is more\n"
+             "accurate and slower (default: 0.5)")
+
+        .def("weights_converged",
+             [](CTPSTransform& self) { return self.IsWeightSolveConverged() != FALSE; },
+             "Whether the weight solve converged (recalculating the weights if\n"
+             "needed). False if the Wendland solve didn't converge, e.g. for\n"
+             "coincident landmarks, or if its kernel matrix isn't positive definite")
+
         // Evaluation
         .def("eval",
              [](CTPSTransform& self, py::tuple pos, float percent) {
@@ -220,6 +292,16 @@ PYBIND11_MODULE(_warptps_core, m) {
              "    destination: numpy array (height, width, channels) dtype=uint8\n"
              "    percent: morphing percentage (0.0 to 1.0)")
 
+        .def("resample_with_field_rect", &resample_with_field_rect_numpy,
+             py::arg("source"), py::arg("destination"), py::arg("rect"), py::arg("percent") = 1.0f,
+             "Resample only a rectangle of the image through the presampled field,\n"
+             "computing just that part of the field if landmarks have changed\n"
+             "Args:\n"
+             "    source: numpy array (height, width, channels) dtype=uint8\n"
+             "    destination: numpy array (height, width, channels) dtype=uint8\n"
+             "    rect: (left, top, right, bottom) in field coordinates (y up)\n"
+             "    percent: morphing percentage (0.0 to 1.0)")
+
         .def("__repr__", [](const CTPSTransform& self) {
             return "<TPSTransform with " + std::to_string(
                 const_cast<CTPSTransform&>(self).GetLandmarkCount()) + " landmarks>";
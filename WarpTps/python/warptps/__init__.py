@@ -35,6 +35,7 @@ try:
     from ._warptps_core import (
         TPSTransform as _TPSTransform,
         Vector3D,
+        WarpMode,
         version as _version,
     )
 except ImportError as e:
@@ -44,7 +45,7 @@ except ImportError as e:
     ) from e
 
 __version__ = "1.0.0"
-__all__ = ["TPSTransform", "Vector3D", "warp_image", "morph_images"]
+__all__ = ["TPSTransform", "Vector3D", "WarpMode", "warp_image", "morph_images"]
 
 
 class TPSTransform(_TPSTransform):
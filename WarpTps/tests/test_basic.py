@@ -224,5 +224,96 @@ def test_repr():
     assert "1 landmarks" in repr_str
 
 
+def test_resample_with_field_rect_matches_full():
+    """A rectangle resample matches the full resample inside the rectangle."""
+    import warptps
+    tps = warptps.TPSTransform()
+    tps.add_landmark_tuple((50, 50), (55, 55))
+    tps.add_landmark_tuple((50, 20), (50, 15))
+    tps.add_landmark_tuple((50, 80), (50, 85))
+    tps.add_landmark_tuple((20, 50), (22, 48))
+
+    rng = np.random.default_rng(0)
+    img = rng.integers(0, 255, size=(100, 100, 3), dtype=np.uint8)
+
+    # the field is out of date, so the rectangle computes only its part
+    part = np.zeros_like(img)
+    tps.resample_with_field_rect(img, part, (10, 30, 60, 70), 1.0)
+    full = np.zeros_like(img)
+    tps.resample_with_field(img, full, 1.0)
+
+    # field row y is image row height - y - 1
+    np.testing.assert_array_equal(part[30:70, 10:60], full[30:70, 10:60])
+    assert not part[:30].any() and not part[70:].any()
+
+
+def _grid_transform(mode):
+    """A transform with a jittered 6x6 grid of landmarks, in the given mode,
+    and its landmark pairs."""
+    import warptps
+    rng = np.random.default_rng(1)
+    tps = warptps.TPSTransform()
+    tps.set_warp_mode(mode)
+    pairs = []
+    for y in range(6):
+        for x in range(6):
+            src = (15 + 30 * x + rng.uniform(-3, 3), 15 + 30 * y + rng.uniform(-3, 3))
+            dst = (src[0] + rng.uniform(-4, 4), src[1] + rng.uniform(-4, 4))
+            tps.add_landmark_tuple(src, dst)
+            pairs.append((src, dst))
+    return tps, pairs
+
+
+def test_wendland_interpolates_landmarks():
+    """The compactly supported warp still maps each landmark to its target."""
+    import warptps
+    tps, pairs = _grid_transform(warptps.WarpMode.WENDLAND)
+    tps.set_support_radius(70.0)
+    for src, dst in pairs:
+        dx, dy, _ = tps.eval(src, 1.0)
+        assert dx == pytest.approx(dst[0] - src[0], abs=1e-6)
+        assert dy == pytest.approx(dst[1] - src[1], abs=1e-6)
+
+
+def test_wendland_reports_failed_solve():
+    """A landmark repeated with another target can't be interpolated; the
+    solve reports that instead of leaving unconverged weights unflagged."""
+    import warptps
+    tps, pairs = _grid_transform(warptps.WarpMode.WENDLAND)
+    tps.set_support_radius(70.0)
+    assert tps.weights_converged()
+    tps.add_landmark_tuple(pairs[0][0], (5.0, 5.0))
+    assert not tps.weights_converged()
+
+
+def test_support_radius_must_be_positive():
+    """A support radius that isn't positive is rejected."""
+    import warptps
+    tps = warptps.TPSTransform()
+    for radius in (0.0, -5.0):
+        with pytest.raises(ValueError):
+            tps.set_support_radius(radius)
+
+
+def test_hierarchical_matches_classic():
+    """The hierarchical field approximates the classic one to well under a pixel."""
+    import warptps
+    classic, _ = _grid_transform(warptps.WarpMode.CLASSIC)
+    tree, _ = _grid_transform(warptps.WarpMode.HIERARCHICAL)
+    tree.set_approx_theta(0.5)
+
+    rng = np.random.default_rng(2)
+    img = rng.integers(0, 255, size=(180, 180, 3), dtype=np.uint8)
+    expected = np.zeros_like(img)
+    classic.resample_with_field(img, expected, 1.0)
+    actual = np.zeros_like(img)
+    tree.resample_with_field(img, actual, 1.0)
+
+    # nearest-pixel lookups differ only where an offset is near a half pixel
+    assert np.mean(np.any(actual != expected, axis=2)) < 0.01
+    for pos in [(0.0, 0.0), (90.0, 45.0), (179.0, 120.0)]:
+        assert tree.eval(pos, 1.0) == pytest.approx(classic.eval(pos, 1.0), abs=1e-3)
+
+
 if __name__ == "__main__":
     pytest.main([__file__, "-v"])
@@ -0,0 +1,464 @@
+"""
+Reproducible benchmark of the planning pipeline on synthetic phantoms.
+
+Times each stage of a plan -- beamlet generation, kernel convolution, one
+objective evaluation with and without gradient, a full optimization and
+the I/O round-trip of the result -- on generated phantoms, sweeping the
+problem size one axis at a time, and writes the timings as JSON so they
+can be tracked across commits.
+
+RtModel itself is MFC/IPP-bound and builds only with MSVC (see
+BUILD_NATIVE.md), so this runs against the pure-Python port, which builds
+anywhere. Its stages correspond to the C++ ones:
+
+    stage               C++                                  Python
+    ------------------  -----------------------------------  ----------------------------------
+    terma               CBeamDoseCalc (TERMA ray trace)      TermaKernelDoseCalc.terma_for_beamlet
+    kernel_convolve     CEnergyDepKernel::CalcSphereConvolve gaussian_filter of the TERMA
+    eval_cost           Prescription::operator()(v, NULL)    Prescription.evaluate_cost_only
+    eval_grad           Prescription::operator()(v, &grad)   Prescription.evaluate
+    optimize            PlanOptimizer::Optimize              PhaseOptimizer (CG + dynamic cov.)
+    io_write, io_read   PlanXmlWriter / PlanXmlReader        np.savez / np.load of the plan
+
+The Python stages run on the NumPy numerics backend. When the compiled
+kernels (pybrimstone.numerics._kernels, numerics_kernels.cpp) are built,
+the C++ that runs on every platform is timed as well:
+
+    stage                   C++
+    ----------------------  ------------------------------------------------
+    dose_operator           (Python) TermaKernelDoseCalc.build_dose_operator
+    dose_operator_native    terma_dose_operator, the same operator in C++
+    eval_cost_native        Prescription.evaluate_cost_only, C++ histograms
+    eval_grad_native        Prescription.evaluate, C++ histograms and KL
+
+RtModel's own stages (CBeamDoseCalc, PlanOptimizer::Optimize) and its
+PlanContainer I/O aren't timed: RtModel and the rtmodel_core bindings only
+build with MSVC against MFC, and rtmodel_core doesn't bind the plan I/O.
+
+Phantoms (all with a spherical target at the center and OAR spheres set
+around it):
+
+    water       uniform density 1.0
+    lung_slab   water with a 0.25 g/cc slab across the beam path, upstream
+                of the target
+    bone_insert water with a 1.85 g/cc cylinder beside the target
+
+Beams are arranged about the y-axis at multiples of 90 degrees; the dose
+calculator traces along +z, so each beam's phantom is rotated into that
+frame and its dose rotated back.
+
+Usage:
+
+    python python/experiments/pipeline_benchmark.py --out bench.json
+    python python/experiments/pipeline_benchmark.py --quick --out bench.json
+
+Each result has the configuration, problem size, and for each stage the
+median and minimum wall time over the repeats, in seconds.
+"""
+
+from __future__ import annotations
+
+import json
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+import time
+from dataclasses import asdict, dataclass, replace
+from pathlib import Path
+from typing import Callable, Dict, List, Optional, Tuple
+
+import numpy as np
+from scipy.ndimage import gaussian_filter
+
+# Allow `python python/experiments/pipeline_benchmark.py` from repo root
+HERE = Path(__file__).resolve().parent
+sys.path.insert(0, str(HERE.parent))
+
+from pybrimstone import (
+    KLDivTerm,
+    PhaseOptimizer,
+    Prescription,
+    TermaKernelDoseCalc,
+)
+from pybrimstone.numerics import native_available, set_backend
+
+
+SCHEMA_VERSION = 1
+
+PHANTOMS = ("water", "lung_slab", "bone_insert")
+
+LUNG_DENSITY = 0.25
+BONE_DENSITY = 1.85
+
+
+# ---------------------------------------------------------------------------
+# Configuration
+# ---------------------------------------------------------------------------
+
+@dataclass(frozen=True)
+class BenchConfig:
+    """One point of the sweep."""
+
+    phantom: str = "water"
+    grid: int = 24                  # voxels per side
+    spacing_mm: float = 4.0
+    n_beams: int = 2                # 1..4, at 0/90/180/270 degrees
+    beamlets_per_side: int = 5      # beamlets per beam = beamlets_per_side^2
+    n_oars: int = 2
+    target_radius_frac: float = 0.2  # of the phantom width
+    cg_max_iter: int = 20
+    seed: int = 0
+
+    @property
+    def n_voxels(self) -> int:
+        return self.grid ** 3
+
+    @property
+    def n_beamlets(self) -> int:
+        return self.n_beams * self.beamlets_per_side ** 2
+
+
+BASE_CONFIG = BenchConfig()
+
+# each axis is swept with the others held at the base
+SWEEP_AXES: Dict[str, Tuple] = {
+    "phantom": PHANTOMS,
+    "grid": (16, 24, 32, 48),
+    "n_beams": (1, 2, 4),
+    "beamlets_per_side": (3, 5, 7, 9),
+    "n_oars": (1, 2, 4, 6),
+}
+
+QUICK_BASE_CONFIG = BenchConfig(grid=12, beamlets_per_side=3, cg_max_iter=5)
+
+QUICK_SWEEP_AXES: Dict[str, Tuple] = {
+    "phantom": PHANTOMS,
+    "grid": (8, 12),
+    "n_beams": (1, 2),
+}
+
+
+def sweep_configs(base: BenchConfig, axes: Dict[str, Tuple]) -> List[BenchConfig]:
+    """One-axis-at-a-time sweep about base, without duplicates."""
+    configs: List[BenchConfig] = []
+    for name, values in axes.items():
+        for value in values:
+            config = replace(base, **{name: value})
+            if config not in configs:
+                configs.append(config)
+    return configs
+
+
+# ---------------------------------------------------------------------------
+# Phantom
+# ---------------------------------------------------------------------------
+
+def make_phantom(config: BenchConfig) -> Tuple[np.ndarray, Dict[str, np.ndarray]]:
+    """
+    Returns (density, structures): density shape (grid, grid, grid), and
+    flattened {0,1} masks for "target" and "oar_<n>".
+    """
+    n = config.grid
+    if n < 4:
+        raise ValueError(f"grid must be at least 4, got {n}")
+    if config.phantom not in PHANTOMS:
+        raise ValueError(f"unknown phantom {config.phantom!r}; expected one of {PHANTOMS}")
+
+    idx = np.arange(n, dtype=np.float64)
+    X, Y, Z = np.meshgrid(idx, idx, idx, indexing="ij")
+    center = (n - 1) / 2.0
+    r_target = max(config.target_radius_frac * n, 1.0)
+
+    density = np.ones((n, n, n), dtype=np.float64)
+    if config.phantom == "lung_slab":
+        # across the beam path, between the entry surface and the target
+        z_lo = int(round(0.15 * n))
+        z_hi = max(int(round(center - r_target)) - 1, z_lo + 1)
+        density[:, :, z_lo:z_hi] = LUNG_DENSITY
+    elif config.phantom == "bone_insert":
+        # along z, beside the target
+        bx = center + 1.75 * r_target
+        r_bone = max(0.5 * r_target, 1.0)
+        density[(X - bx) ** 2 + (Y - center) ** 2 <= r_bone ** 2] = BONE_DENSITY
+
+    def sphere(cx, cy, cz, r):
+        return (((X - cx) ** 2 + (Y - cy) ** 2 + (Z - cz) ** 2) <= r * r).ravel().astype(float)
+
+    structures = {"target": sphere(center, center, center, r_target)}
+
+    # OARs on a ring in the xy-plane, clear of the target
+    rng = np.random.default_rng(config.seed)
+    r_oar = max(0.5 * r_target, 1.0)
+    d_oar = r_target + r_oar + 1.0
+    phase = rng.uniform(0.0, 2.0 * np.pi)
+    for n_oar in range(config.n_oars):
+        angle = phase + 2.0 * np.pi * n_oar / config.n_oars
+        structures[f"oar_{n_oar}"] = sphere(
+            center + d_oar * np.cos(angle), center + d_oar * np.sin(angle), center, r_oar)
+
+    return density, structures
+
+
+# ---------------------------------------------------------------------------
+# Stages
+# ---------------------------------------------------------------------------
+
+def _beam_frame(volume: np.ndarray, n_beam: int) -> np.ndarray:
+    """volume rotated so beam n_beam travels along +z"""
+    return np.rot90(volume, k=n_beam, axes=(0, 2))
+
+
+def _from_beam_frame(volume: np.ndarray, n_beam: int) -> np.ndarray:
+    return np.rot90(volume, k=-n_beam, axes=(0, 2))
+
+
+def _beamlet_centers(config: BenchConfig) -> np.ndarray:
+    """beamlet (x, y) centers spanning the target, in beam-frame voxels"""
+    n = config.grid
+    center = (n - 1) / 2.0
+    half = max(config.target_radius_frac * n, 1.0) * 1.2
+    offsets = np.linspace(-half, half, config.beamlets_per_side)
+    return np.array([[center + dx, center + dy] for dx in offsets for dy in offsets])
+
+
+def generate_beamlets(
+    config: BenchConfig,
+    density: np.ndarray,
+    centers: np.ndarray,
+    timings: Dict[str, float],
+) -> np.ndarray:
+    """
+    Builds the (n_voxels, n_beamlets) dose operator, accumulating the TERMA
+    and the kernel convolution times into timings.
+    """
+    # same kernel as TermaKernelDoseCalc.dose_for_beamlet, applied here so
+    #   the convolution is timed apart from the TERMA
+    kernel_sigma_mm = config.spacing_mm
+    sigma_voxels = kernel_sigma_mm / config.spacing_mm
+    columns = []
+    for n_beam in range(config.n_beams):
+        calc = TermaKernelDoseCalc(
+            _beam_frame(density, n_beam), centers,
+            beamlet_width_mm=config.spacing_mm * 1.5,
+            kernel_sigma_mm=kernel_sigma_mm,
+            voxel_spacing_mm=config.spacing_mm,
+        )
+        for n_beamlet in range(centers.shape[0]):
+            t0 = time.perf_counter()
+            terma = calc.terma_for_beamlet(n_beamlet)
+            t1 = time.perf_counter()
+            dose = gaussian_filter(terma, sigma=sigma_voxels)
+            t2 = time.perf_counter()
+            columns.append(_from_beam_frame(dose, n_beam).ravel())
+            timings["terma"] += t1 - t0
+            timings["kernel_convolve"] += t2 - t1
+
+    return np.column_stack(columns)
+
+
+def build_prescription(D: np.ndarray, structures: Dict[str, np.ndarray]) -> Prescription:
+    """target 0.6-0.8 and OARs under 0.3, in units of the mean target dose
+    at unit beamlet weight"""
+    target = structures["target"]
+    mean_target = float((D.sum(axis=1) * target).sum() / target.sum())
+    scale = 1.0 / mean_target if mean_target > 0 else 1.0
+
+    presc = Prescription(D * scale, use_transform=True)
+    presc.add_dose_term(KLDivTerm.from_interval(
+        target, dose_min=0.6, dose_max=0.8, weight=2.0,
+        bin_width=0.05, var_min=0.01, var_max=0.01,
+    ))
+    for name, mask in structures.items():
+        if name.startswith("oar_") and mask.sum() > 0:
+            presc.add_dose_term(KLDivTerm.from_interval(
+                mask, dose_min=0.0, dose_max=0.3, weight=1.0,
+                bin_width=0.05, var_min=0.01, var_max=0.01,
+            ))
+    return presc
+
+
+def _time_repeats(func: Callable[[], object], repeats: int) -> Dict[str, float]:
+    """runs func once untimed, then repeats times"""
+    func()
+    times = []
+    for _ in range(repeats):
+        t0 = time.perf_counter()
+        func()
+        times.append(time.perf_counter() - t0)
+    return {"median_s": float(np.median(times)), "min_s": float(np.min(times)),
+            "repeats": repeats}
+
+
+def _single(seconds: float) -> Dict[str, float]:
+    return {"median_s": float(seconds), "min_s": float(seconds), "repeats": 1}
+
+
+def _with_backend(name: str, func: Callable[[], object]) -> object:
+    """runs func with the given numerics backend selected"""
+    previous = set_backend(name)
+    try:
+        return func()
+    finally:
+        set_backend(previous)
+
+
+def _time_dose_operator(config: BenchConfig, density: np.ndarray,
+                        centers: np.ndarray) -> float:
+    """seconds to build every beam's sparse dose operator"""
+    t0 = time.perf_counter()
+    for n_beam in range(config.n_beams):
+        calc = TermaKernelDoseCalc(
+            _beam_frame(density, n_beam), centers,
+            beamlet_width_mm=config.spacing_mm * 1.5,
+            kernel_sigma_mm=config.spacing_mm,
+            voxel_spacing_mm=config.spacing_mm,
+        )
+        calc.build_dose_operator(sparse=True, rel_tol=1e-6)
+    return time.perf_counter() - t0
+
+
+def run_config(config: BenchConfig, repeats: int = 5) -> dict:
+    """Times every stage for one configuration."""
+    density, structures = make_phantom(config)
+    centers = _beamlet_centers(config)
+
+    gen_times = {"terma": 0.0, "kernel_convolve": 0.0}
+    t0 = time.perf_counter()
+    D = generate_beamlets(config, density, centers, gen_times)
+    t_generate = time.perf_counter() - t0
+
+    presc = build_prescription(D, structures)
+    n_params = D.shape[1]
+    params = np.random.default_rng(config.seed).normal(scale=0.5, size=n_params)
+
+    def python_stages():
+        stages = {
+            "beamlet_generation": _single(t_generate),
+            "terma": _single(gen_times["terma"]),
+            "kernel_convolve": _single(gen_times["kernel_convolve"]),
+            "eval_cost": _time_repeats(lambda: presc.evaluate_cost_only(params), repeats),
+            "eval_grad": _time_repeats(lambda: presc.evaluate(params), repeats),
+        }
+
+        opt = PhaseOptimizer(presc, n_params=n_params, max_iter=config.cg_max_iter, tol=1e-4)
+        t0 = time.perf_counter()
+        weights, variance = opt(prior=None)
+        stages["optimize"] = _single(time.perf_counter() - t0)
+        return stages, weights, variance
+
+    stages, weights, variance = _with_backend("python", python_stages)
+    final_cost = presc.evaluate_cost_only(weights)
+
+    # the compiled kernels, against the NumPy reference of the same stage
+    if native_available():
+        stages["dose_operator"] = _single(_with_backend(
+            "python", lambda: _time_dose_operator(config, density, centers)))
+        stages["dose_operator_native"] = _single(_with_backend(
+            "native", lambda: _time_dose_operator(config, density, centers)))
+        stages["eval_cost_native"] = _with_backend("native", lambda: _time_repeats(
+            lambda: presc.evaluate_cost_only(params), repeats))
+        stages["eval_grad_native"] = _with_backend("native", lambda: _time_repeats(
+            lambda: presc.evaluate(params), repeats))
+
+    # round-trip the plan: dose operator, structures and the result
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "plan.npz")
+        t0 = time.perf_counter()
+        np.savez(path, dose_operator=D, weights=weights, variance=variance, **structures)
+        t1 = time.perf_counter()
+        with np.load(path) as data:
+            loaded = {key: data[key] for key in data.files}
+        t2 = time.perf_counter()
+        n_bytes = os.path.getsize(path)
+    if not (np.array_equal(loaded["dose_operator"], D)
+            and np.array_equal(loaded["weights"], weights)):
+        raise RuntimeError("plan round-trip mismatch")
+    stages["io_write"] = _single(t1 - t0)
+    stages["io_read"] = _single(t2 - t1)
+
+    return {
+        "config": asdict(config),
+        "n_voxels": config.n_voxels,
+        "n_beamlets": config.n_beamlets,
+        "n_structures": len(structures),
+        "io_bytes": int(n_bytes),
+        "final_cost": float(final_cost),
+        "stages": stages,
+    }
+
+
+# ---------------------------------------------------------------------------
+# Driver
+# ---------------------------------------------------------------------------
+
+def _git_commit() -> str:
+    try:
+        return subprocess.check_output(
+            ["git", "rev-parse", "HEAD"], cwd=str(HERE),
+            stderr=subprocess.DEVNULL, text=True).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return ""
+
+
+def run_benchmark(configs: List[BenchConfig], repeats: int = 5, verbose: bool = True) -> dict:
+    """Runs the configs; returns the JSON-ready report."""
+    import scipy
+
+    results = []
+    for n_config, config in enumerate(configs):
+        result = run_config(config, repeats=repeats)
+        results.append(result)
+        if verbose:
+            stages = result["stages"]
+            print(f"[{n_config + 1}/{len(configs)}] {config.phantom:<11} "
+                  f"voxels={result['n_voxels']:<7} beamlets={result['n_beamlets']:<4} "
+                  f"structures={result['n_structures']:<2} "
+                  f"gen={stages['beamlet_generation']['median_s']:.3f}s "
+                  f"grad={stages['eval_grad']['median_s'] * 1e3:.2f}ms "
+                  f"opt={stages['optimize']['median_s']:.3f}s")
+
+    return {
+        "schema": SCHEMA_VERSION,
+        "commit": _git_commit(),
+        "timestamp": time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime()),
+        "host": {
+            "platform": platform.platform(),
+            "machine": platform.machine(),
+            "python": platform.python_version(),
+            "numpy": np.__version__,
+            "scipy": scipy.__version__,
+            "cpu_count": os.cpu_count(),
+            "native_kernels": native_available(),
+        },
+        "repeats": repeats,
+        "results": results,
+    }
+
+
+def main(argv: Optional[List[str]] = None) -> dict:
+    import argparse
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--out", type=str, default="pipeline_benchmark.json",
+                        help="JSON results file")
+    parser.add_argument("--quick", action="store_true",
+                        help="small sweep, for a smoke check")
+    parser.add_argument("--repeats", type=int, default=5,
+                        help="timed repeats of the objective evaluations")
+    args = parser.parse_args(argv)
+
+    if args.quick:
+        configs = sweep_configs(QUICK_BASE_CONFIG, QUICK_SWEEP_AXES)
+    else:
+        configs = sweep_configs(BASE_CONFIG, SWEEP_AXES)
+
+    report = run_benchmark(configs, repeats=args.repeats)
+    with open(args.out, "w") as f:
+        json.dump(report, f, indent=2)
+    print(f"Results for {len(configs)} configurations written to {args.out}")
+    return report
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,631 @@
+// Copyright (C) 2nd Messenger Systems
+// pybind11 kernels for pybrimstone.numerics
+//
+// Compiled versions of the histogram and KL primitives that the pure-Python
+// port (pybrimstone/numerics/histogram.py, kl_divergence.py, kl_term.py)
+// calls on every objective evaluation: Gaussian kernel, fractional binning,
+// GBin convolution and its adjoint, KL, and the whole KLDivTerm forward /
+// backward pass. Each function reproduces its Python reference exactly --
+// including NumPy's negative-index wrap in the binning -- so the Python
+// modules can dispatch here transparently (see numerics/backend.py).
+//
+// Also the TERMA + Gaussian-kernel beamlet dose operator of
+// pybrimstone/terma_kernel_dose.py, built in parallel over beamlets and
+// returned as CSC arrays.
+//
+// Portable: no MFC / ITK / VNL, only the header-only ParallelFor.h from
+// RtModel, so this builds with any C++17 compiler (setup.py builds it on
+// every platform). Loops over voxels and bins run on BRIMSTONE_THREADS
+// workers, with the GIL released.
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+
+#define _USE_MATH_DEFINES
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include "ParallelFor.h"
+
+namespace py = pybind11;
+
+typedef py::array_t<double, py::array::c_style | py::array::forcecast> DoubleArray;
+typedef py::array_t<int64_t, py::array::c_style> IndexArray;
+
+// matches numerics.kl_divergence.EPS
+static const double KL_EPS = 1e-5;
+
+// chunk sizes below which a loop stays on the calling thread
+static const int MIN_VOXEL_CHUNK = 16384;
+static const int MIN_BIN_CHUNK = 256;
+
+///////////////////////////////////////////////////////////////////////////////
+// helpers
+///////////////////////////////////////////////////////////////////////////////
+static const double *
+    Data1D(const DoubleArray& arr, const char *pszName, long *pnSize)
+{
+    if (arr.ndim() != 1)
+        throw std::invalid_argument(std::string(pszName) + " must be 1-dimensional");
+    *pnSize = (long) arr.shape(0);
+    return arr.data();
+}
+
+static DoubleArray
+    NewArray(long nSize)
+{
+    DoubleArray arr(nSize);
+    std::fill(arr.mutable_data(), arr.mutable_data() + nSize, 0.0);
+    return arr;
+}
+
+// splits [0, nCount) into fixed chunks of nChunkSize and calls 
+//	func(nChunk, nBegin, nEnd) for each, in parallel.  The chunks don't depend
+//	on the thread count, so per-chunk partial results, combined in chunk order
+//	once the loop is done, come out the same however the work was scheduled
+template<class FUNC>
+static void
+    ForEachChunk(long nCount, long nChunkSize, FUNC func)
+{
+    const long nChunks = (nCount + nChunkSize - 1) / nChunkSize;
+    dH::ParallelForChunks((int) nChunks, [&](int nFirst, int nLast)
+    {
+        for (long nChunk = nFirst; nChunk < nLast; nChunk++)
+            func(nChunk, nChunk * nChunkSize, std::min((nChunk + 1) * nChunkSize, nCount));
+    }, 1);
+}
+
+// a bin index as NumPy would index it: negative indices count from the end;
+//	-1 if NumPy would raise IndexError.  (The parallel loops can't throw, so
+//	they flag these and the caller raises once the loop is done)
+static inline long
+    WrapIndex(long nIndex, long nSize)
+{
+    if (nIndex < 0)
+        nIndex += nSize;
+    return (nIndex >= 0 && nIndex < nSize) ? nIndex : -1;
+}
+
+static void
+    CheckBinRange(const std::atomic<bool>& bOutOfRange)
+{
+    if (bOutOfRange)
+        throw py::index_error("bin index out of range");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// histogram primitives
+///////////////////////////////////////////////////////////////////////////////
+static DoubleArray
+    GaussianKernel(double sigma, double binWidth, double kernelWidth)
+    // bin_width * gauss(z * bin_width, sigma), z in [-N, N]
+{
+    const long nNeighborhood = (long) ceil(kernelWidth * sigma / binWidth);
+    const long nSize = (nNeighborhood >= 0) ? 2 * nNeighborhood + 1 : 0;
+    DoubleArray kernel = NewArray(nSize);
+    if (sigma <= 0.0)
+        return kernel;
+
+    const double norm = sigma * sqrt(2.0 * M_PI);
+    double *pKernel = kernel.mutable_data();
+    for (long nAt = 0; nAt < nSize; nAt++)
+    {
+        const double x = (double) (nAt - nNeighborhood) * binWidth / sigma;
+        pKernel[nAt] = binWidth * (exp(-0.5 * x * x) / norm);
+    }
+    return kernel;
+}
+
+// the bin position of each voxel, and the bin count (max low bin + 2)
+static long
+    ScaleToBins(const double *pDose, long nVoxels, double minValue, double binWidth,
+        std::vector<long>& arrLowBin, std::vector<double>& arrFrac)
+{
+    arrLowBin.resize(nVoxels);
+    arrFrac.resize(nVoxels);
+    if (nVoxels == 0)
+        throw std::invalid_argument("dose must not be empty");
+
+    std::vector<long> arrChunkMax((nVoxels + MIN_VOXEL_CHUNK - 1) / MIN_VOXEL_CHUNK, LONG_MIN);
+    ForEachChunk(nVoxels, MIN_VOXEL_CHUNK, [&](long nChunk, long nBegin, long nEnd)
+    {
+        long nChunkMax = LONG_MIN;
+        for (long nAt = nBegin; nAt < nEnd; nAt++)
+        {
+            const double binScaled = (pDose[nAt] - minValue) / binWidth;
+            const double lowBin = floor(binScaled);
+            arrLowBin[nAt] = (long) lowBin;
+            arrFrac[nAt] = binScaled - lowBin;
+            nChunkMax = std::max(nChunkMax, arrLowBin[nAt]);
+        }
+        arrChunkMax[nChunk] = nChunkMax;
+    });
+    const long nMaxBin = *std::max_element(arrChunkMax.begin(), arrChunkMax.end());
+
+    if (nMaxBin + 2 <= 0)
+        throw std::invalid_argument("dose is entirely below the bin range");
+    return nMaxBin + 2;
+}
+
+// fractional binning of the region's voxels into arrBins
+static void
+    AccumulateBins(const std::vector<long>& arrLowBin, const std::vector<double>& arrFrac,
+        const double *pRegion, std::vector<double>& arrBins)
+{
+    const long nBins = (long) arrBins.size();
+    const long nVoxels = (long) arrLowBin.size();
+
+    // one partial histogram per chunk, summed in chunk order below, so the
+    //	floating-point sum doesn't depend on which chunk finishes first
+    std::vector< std::vector<double> > arrChunkBins(
+        (nVoxels + MIN_VOXEL_CHUNK - 1) / MIN_VOXEL_CHUNK);
+    std::atomic<bool> bOutOfRange(false);
+    ForEachChunk(nVoxels, MIN_VOXEL_CHUNK, [&](long nChunk, long nBegin, long nEnd)
+    {
+        std::vector<double>& arrPartial = arrChunkBins[nChunk];
+        arrPartial.assign(nBins, 0.0);
+        for (long nAt = nBegin; nAt < nEnd; nAt++)
+        {
+            if (pRegion[nAt] <= 0.0)
+                continue;
+            const long nLow = WrapIndex(arrLowBin[nAt], nBins);
+            const long nHigh = WrapIndex(arrLowBin[nAt] + 1, nBins);
+            if (nLow < 0 || nHigh < 0)
+            {
+                bOutOfRange = true;
+                continue;
+            }
+            const double frac = arrFrac[nAt];
+            arrPartial[nLow] += (1.0 - frac) * pRegion[nAt];
+            arrPartial[nHigh] += frac * pRegion[nAt];
+        }
+    });
+    CheckBinRange(bOutOfRange);
+
+    for (size_t nChunk = 0; nChunk < arrChunkBins.size(); nChunk++)
+    {
+        for (long nAt = 0; nAt < nBins; nAt++)
+            arrBins[nAt] += arrChunkBins[nChunk][nAt];
+    }
+}
+
+// full linear convolution, as np.convolve
+static void
+    Convolve(const double *pIn, long nIn, const double *pKernel, long nKernel, double *pOut)
+{
+    if (nIn == 0 || nKernel == 0)
+        return;
+
+    const long nOut = nIn + nKernel - 1;
+    dH::ParallelForChunks((int) nOut, [&](int nBegin, int nEnd)
+    {
+        for (long nAt = nBegin; nAt < nEnd; nAt++)
+        {
+            const long nFrom = std::max(0L, nAt - nKernel + 1);
+            const long nTo = std::min(nIn - 1, nAt);
+            double sum = 0.0;
+            for (long nAtIn = nFrom; nAtIn <= nTo; nAtIn++)
+                sum += pIn[nAtIn] * pKernel[nAt - nAtIn];
+            pOut[nAt] = sum;
+        }
+    }, MIN_BIN_CHUNK);
+}
+
+// adjoint of the convolution: out[j] = sum_k kernel[k] * in[j + k], j < nOut
+static void
+    ConvolveAdjoint(const double *pIn, long nIn, const double *pKernel, long nKernel,
+        double *pOut, long nOut)
+{
+    dH::ParallelForChunks((int) nOut, [&](int nBegin, int nEnd)
+    {
+        for (long nAt = nBegin; nAt < nEnd; nAt++)
+        {
+            const long nTo = std::min(nKernel, nIn - nAt);
+            double sum = 0.0;
+            for (long nAtK = 0; nAtK < nTo; nAtK++)
+                sum += pKernel[nAtK] * pIn[nAt + nAtK];
+            pOut[nAt] = sum;
+        }
+    }, MIN_BIN_CHUNK);
+}
+
+static DoubleArray
+    HistogramBinDose(const DoubleArray& dose, const DoubleArray& region,
+        double minValue, double binWidth)
+{
+    long nVoxels = 0, nRegion = 0;
+    const double *pDose = Data1D(dose, "dose_values", &nVoxels);
+    const double *pRegion = Data1D(region, "region", &nRegion);
+    if (nRegion < nVoxels)
+        throw py::index_error("region is shorter than dose_values");
+
+    std::vector<double> arrBins;
+    {
+        py::gil_scoped_release release;
+        std::vector<long> arrLowBin;
+        std::vector<double> arrFrac;
+        arrBins.assign(ScaleToBins(pDose, nVoxels, minValue, binWidth, arrLowBin, arrFrac), 0.0);
+        AccumulateBins(arrLowBin, arrFrac, pRegion, arrBins);
+    }
+
+    DoubleArray bins = NewArray((long) arrBins.size());
+    std::copy(arrBins.begin(), arrBins.end(), bins.mutable_data());
+    return bins;
+}
+
+static DoubleArray
+    ConvGauss(const DoubleArray& in, const DoubleArray& kernel)
+{
+    long nIn = 0, nKernel = 0;
+    const double *pIn = Data1D(in, "buffer_in", &nIn);
+    const double *pKernel = Data1D(kernel, "kernel", &nKernel);
+    if (nIn == 0 || nKernel == 0)
+        throw std::invalid_argument("convolution inputs must not be empty");
+
+    DoubleArray out = NewArray(nIn + nKernel - 1);
+    double *pOut = out.mutable_data();
+    {
+        py::gil_scoped_release release;
+        Convolve(pIn, nIn, pKernel, nKernel, pOut);
+    }
+    return out;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// KL primitives
+///////////////////////////////////////////////////////////////////////////////
+static double
+    KLSum(const double *pP, long nP, const double *pQ, long nQ)
+    // sum_i p[i] * log(p[i] / (q[i] + EPS) + EPS), q zero past its end
+{
+    double total = 0.0;
+    for (long nAt = 0; nAt < nP; nAt++)
+    {
+        const double q = (nAt < nQ) ? pQ[nAt] : 0.0;
+        total += pP[nAt] * log(pP[nAt] / (q + KL_EPS) + KL_EPS);
+    }
+    return total;
+}
+
+static double
+    KLCalcOverTarget(const DoubleArray& calc, const DoubleArray& target)
+{
+    long nCalc = 0, nTarget = 0;
+    const double *pCalc = Data1D(calc, "calc_gpdf", &nCalc);
+    const double *pTarget = Data1D(target, "target_gpdf", &nTarget);
+    return KLSum(pCalc, nCalc, pTarget, nTarget);
+}
+
+static double
+    KLTargetOverCalc(const DoubleArray& calc, const DoubleArray& target)
+{
+    long nCalc = 0, nTarget = 0;
+    const double *pCalc = Data1D(calc, "calc_gpdf", &nCalc);
+    const double *pTarget = Data1D(target, "target_gpdf", &nTarget);
+    return KLSum(pTarget, nTarget, pCalc, nCalc);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// KLDivTerm.evaluate: cost and its gradient with respect to the dose
+///////////////////////////////////////////////////////////////////////////////
+static std::tuple<double, DoubleArray>
+    KLTermEvaluate(const DoubleArray& dose, const DoubleArray& mask,
+        double adjustedMin, double binWidth, const DoubleArray& kernel,
+        const DoubleArray& targetGBins, double regionSum, bool bCrossEntropy)
+{
+    long nVoxels = 0, nMask = 0, nKernel = 0, nTarget = 0;
+    const double *pDose = Data1D(dose, "dose", &nVoxels);
+    const double *pMask = Data1D(mask, "structure_mask", &nMask);
+    const double *pKernel = Data1D(kernel, "kernel", &nKernel);
+    const double *pTarget = Data1D(targetGBins, "target_gbins", &nTarget);
+    if (nMask != nVoxels)
+        throw std::invalid_argument("dose and structure_mask differ in shape");
+    if (nKernel == 0)
+        throw std::invalid_argument("kernel must not be empty");
+
+    DoubleArray grad = NewArray(nVoxels);
+    double *pGrad = grad.mutable_data();
+    double cost = 0.0;
+    {
+        py::gil_scoped_release release;
+
+        // forward: bin, convolve, normalize
+        std::vector<long> arrLowBin;
+        std::vector<double> arrFrac;
+        std::vector<double> arrBins(
+            ScaleToBins(pDose, nVoxels, adjustedMin, binWidth, arrLowBin, arrFrac), 0.0);
+        AccumulateBins(arrLowBin, arrFrac, pMask, arrBins);
+        const long nBins = (long) arrBins.size();
+
+        const long nPdf = nBins + nKernel - 1;
+        std::vector<double> arrPdf(nPdf);
+        Convolve(&arrBins[0], nBins, pKernel, nKernel, &arrPdf[0]);
+
+        // cost, and its derivative with respect to the GBins
+        std::vector<double> arrdGBins(nPdf);
+        for (long nAt = 0; nAt < nPdf; nAt++)
+        {
+            const double pdf = arrPdf[nAt] / regionSum;
+            const double target = (nAt < nTarget) ? pTarget[nAt] : 0.0;
+            double dpdf;
+            if (bCrossEntropy)
+            {
+                cost += target * log(target / (pdf + KL_EPS) + KL_EPS);
+                const double denom = target + KL_EPS * (pdf + KL_EPS);
+                dpdf = -target / ((denom > 0.0) ? denom : KL_EPS);
+            }
+            else
+            {
+                const double arg = pdf / (target + KL_EPS) + KL_EPS;
+                cost += pdf * log(arg);
+                dpdf = log(arg) + (pdf / (target + KL_EPS)) / arg;
+            }
+            arrdGBins[nAt] = dpdf / regionSum;
+        }
+
+        // backward through the convolution, then the fractional binning
+        std::vector<double> arrdBins(nBins);
+        ConvolveAdjoint(&arrdGBins[0], nPdf, pKernel, nKernel, &arrdBins[0], nBins);
+
+        // (the binning has already checked the bin range)
+        dH::ParallelForChunks((int) nVoxels, [&](int nBegin, int nEnd)
+        {
+            for (int nAt = nBegin; nAt < nEnd; nAt++)
+            {
+                if (pMask[nAt] <= 0.0)
+                    continue;
+                const long nLow = WrapIndex(arrLowBin[nAt], nBins);
+                const long nHigh = WrapIndex(arrLowBin[nAt] + 1, nBins);
+                pGrad[nAt] = (arrdBins[nHigh] - arrdBins[nLow]) * pMask[nAt] / binWidth;
+            }
+        }, MIN_VOXEL_CHUNK);
+    }
+
+    return std::make_tuple(cost, grad);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// TERMA + Gaussian kernel dose operator (TermaKernelDoseCalc)
+///////////////////////////////////////////////////////////////////////////////
+
+// scipy.ndimage.gaussian_filter1d weights: radius int(truncate * sigma + 0.5),
+//	normalized to sum 1.  Only the half from the center out is kept, as the
+//	kernel is symmetric
+static std::vector<double>
+    NdimageGaussianWeights(double sigma, double truncate)
+{
+    const long nRadius = (long) (truncate * sigma + 0.5);
+    std::vector<double> arrWeights(nRadius + 1);
+    double sum = 0.0;
+    for (long nAt = 0; nAt <= nRadius; nAt++)
+    {
+        arrWeights[nAt] = exp(-0.5 / (sigma * sigma) * (double) (nAt * nAt));
+        sum += (nAt == 0) ? arrWeights[nAt] : 2.0 * arrWeights[nAt];
+    }
+    for (long nAt = 0; nAt <= nRadius; nAt++)
+        arrWeights[nAt] /= sum;
+    return arrWeights;
+}
+
+// index of nAt after scipy's "reflect" boundary extension (d c b a | a b c d | d c b a)
+static inline long
+    ReflectIndex(long nAt, long nSize)
+{
+    const long nPeriod = 2 * nSize;
+    nAt %= nPeriod;
+    if (nAt < 0)
+        nAt += nPeriod;
+    return (nAt < nSize) ? nAt : nPeriod - 1 - nAt;
+}
+
+// correlates each line along nAxis of a C-order volume with the symmetric
+//	weights (half-kernel), reflect boundaries.  arrLine is scratch
+static void
+    FilterAxis(const double *pIn, double *pOut, const long arrDims[3], int nAxis,
+        const std::vector<double>& arrWeights, std::vector<double>& arrLine)
+{
+    long nOuter = 1, nInner = 1;
+    for (int nDim = 0; nDim < nAxis; nDim++)
+        nOuter *= arrDims[nDim];
+    for (int nDim = nAxis + 1; nDim < 3; nDim++)
+        nInner *= arrDims[nDim];
+    const long nLength = arrDims[nAxis];
+    const long nRadius = (long) arrWeights.size() - 1;
+
+    if (nInner > 1)
+    {
+        // lines are strided, so filter whole contiguous rows of nInner at once
+        for (long nAtOuter = 0; nAtOuter < nOuter; nAtOuter++)
+        {
+            const double *pInBlock = pIn + nAtOuter * nLength * nInner;
+            double *pOutBlock = pOut + nAtOuter * nLength * nInner;
+            for (long nAt = 0; nAt < nLength; nAt++)
+            {
+                double *pOutRow = pOutBlock + nAt * nInner;
+                const double *pInRow = pInBlock + nAt * nInner;
+                for (long nAtInner = 0; nAtInner < nInner; nAtInner++)
+                    pOutRow[nAtInner] = arrWeights[0] * pInRow[nAtInner];
+                for (long nAtW = 1; nAtW <= nRadius; nAtW++)
+                {
+                    const double weight = arrWeights[nAtW];
+                    const double *pInUp = pInBlock + ReflectIndex(nAt + nAtW, nLength) * nInner;
+                    const double *pInDown = pInBlock + ReflectIndex(nAt - nAtW, nLength) * nInner;
+                    for (long nAtInner = 0; nAtInner < nInner; nAtInner++)
+                        pOutRow[nAtInner] += weight * (pInUp[nAtInner] + pInDown[nAtInner]);
+                }
+            }
+        }
+        return;
+    }
+
+    // contiguous lines: extend each by nRadius reflected samples either side
+    arrLine.resize(nLength + 2 * nRadius);
+    for (long nAtOuter = 0; nAtOuter < nOuter; nAtOuter++)
+    {
+        const double *pInLine = pIn + nAtOuter * nLength;
+        for (long nAt = -nRadius; nAt < nLength + nRadius; nAt++)
+            arrLine[nAt + nRadius] = pInLine[ReflectIndex(nAt, nLength)];
+
+        const double *pLine = &arrLine[nRadius];
+        double *pOutLine = pOut + nAtOuter * nLength;
+        for (long nAt = 0; nAt < nLength; nAt++)
+        {
+            double sum = arrWeights[0] * pLine[nAt];
+            for (long nAtW = 1; nAtW <= nRadius; nAtW++)
+                sum += arrWeights[nAtW] * (pLine[nAt + nAtW] + pLine[nAt - nAtW]);
+            pOutLine[nAt] = sum;
+        }
+    }
+}
+
+// the sparse (n_voxels, n_beamlets) operator whose column b is
+//	gaussian_filter(profiles[b][:, :, None] * terma, sigma, truncate=truncate),
+//	raveled.  Entries at or below rel_tol times the column max are dropped
+static std::tuple<DoubleArray, IndexArray, IndexArray>
+    TermaDoseOperator(const DoubleArray& terma, const DoubleArray& profiles,
+        const DoubleArray& sigma, double truncate, double relTol)
+{
+    if (terma.ndim() != 3)
+        throw std::invalid_argument("terma must be 3-dimensional");
+    if (profiles.ndim() != 3
+        || profiles.shape(1) != terma.shape(0) || profiles.shape(2) != terma.shape(1))
+        throw std::invalid_argument("profiles must have shape (n_beamlets, nx, ny)");
+    long nSigma = 0;
+    const double *pSigma = Data1D(sigma, "sigma", &nSigma);
+    if (nSigma != 3)
+        throw std::invalid_argument("sigma must have 3 entries");
+    if (relTol < 0.0)
+        throw std::invalid_argument("rel_tol must be non-negative");
+
+    const long arrDims[3] = { (long) terma.shape(0), (long) terma.shape(1), (long) terma.shape(2) };
+    const long nPixels = arrDims[0] * arrDims[1];
+    const long nVoxels = nPixels * arrDims[2];
+    const long nBeamlets = (long) profiles.shape(0);
+    const double *pTerma = terma.data();
+    const double *pProfiles = profiles.data();
+
+    // gaussian_filter skips axes with sigma <= 1e-15
+    std::vector<double> arrWeights[3];
+    for (int nAxis = 0; nAxis < 3; nAxis++)
+        if (pSigma[nAxis] > 1e-15)
+            arrWeights[nAxis] = NdimageGaussianWeights(pSigma[nAxis], truncate);
+
+    std::vector<std::vector<int64_t> > arrRows(nBeamlets);
+    std::vector<std::vector<double> > arrValues(nBeamlets);
+    {
+        py::gil_scoped_release release;
+
+        // the lateral profile doesn't vary along z, so the z pass commutes 
+        //	with it and is done once on the shared TERMA
+        std::vector<double> arrTermaZ(pTerma, pTerma + nVoxels);
+        if (!arrWeights[2].empty())
+        {
+            dH::ParallelForChunks((int) arrDims[0], [&](int nBegin, int nEnd)
+            {
+                const long arrSlabDims[3] = { nEnd - nBegin, arrDims[1], arrDims[2] };
+                std::vector<double> arrLine;
+                const long nSlab = nBegin * arrDims[1] * arrDims[2];
+                FilterAxis(pTerma + nSlab, &arrTermaZ[nSlab],
+                    arrSlabDims, 2, arrWeights[2], arrLine);
+            }, 1);
+        }
+
+        dH::ParallelForChunks((int) nBeamlets, [&](int nBegin, int nEnd)
+        {
+            std::vector<double> arrDose(nVoxels), arrScratch(nVoxels), arrLine;
+            for (long nBeamlet = nBegin; nBeamlet < nEnd; nBeamlet++)
+            {
+                const double *pProfile = pProfiles + nBeamlet * nPixels;
+                for (long nPixel = 0; nPixel < nPixels; nPixel++)
+                    for (long nZ = 0; nZ < arrDims[2]; nZ++)
+                        arrDose[nPixel * arrDims[2] + nZ] = 
+                            pProfile[nPixel] * arrTermaZ[nPixel * arrDims[2] + nZ];
+
+                for (int nAxis = 0; nAxis < 2; nAxis++)
+                {
+                    if (arrWeights[nAxis].empty())
+                        continue;
+                    FilterAxis(&arrDose[0], &arrScratch[0], arrDims, nAxis, 
+                        arrWeights[nAxis], arrLine);
+                    arrDose.swap(arrScratch);
+                }
+
+                double maxDose = 0.0;
+                for (long nAt = 0; nAt < nVoxels; nAt++)
+                    maxDose = std::max(maxDose, fabs(arrDose[nAt]));
+                const double cutoff = relTol * maxDose;
+
+                std::vector<int64_t>& arrBeamletRows = arrRows[nBeamlet];
+                std::vector<double>& arrBeamletValues = arrValues[nBeamlet];
+                for (long nAt = 0; nAt < nVoxels; nAt++)
+                {
+                    if (fabs(arrDose[nAt]) > cutoff)
+                    {
+                        arrBeamletRows.push_back(nAt);
+                        arrBeamletValues.push_back(arrDose[nAt]);
+                    }
+                }
+            }
+        }, 1);
+    }
+
+    IndexArray indptr(nBeamlets + 1);
+    int64_t *pIndptr = indptr.mutable_data();
+    pIndptr[0] = 0;
+    for (long nBeamlet = 0; nBeamlet < nBeamlets; nBeamlet++)
+        pIndptr[nBeamlet + 1] = pIndptr[nBeamlet] + (int64_t) arrRows[nBeamlet].size();
+
+    DoubleArray data((long) pIndptr[nBeamlets]);
+    IndexArray indices((long) pIndptr[nBeamlets]);
+    for (long nBeamlet = 0; nBeamlet < nBeamlets; nBeamlet++)
+    {
+        std::copy(arrValues[nBeamlet].begin(), arrValues[nBeamlet].end(),
+            data.mutable_data() + pIndptr[nBeamlet]);
+        std::copy(arrRows[nBeamlet].begin(), arrRows[nBeamlet].end(),
+            indices.mutable_data() + pIndptr[nBeamlet]);
+
+        // release each column as it is copied, so the peak stays near one operator
+        std::vector<double>().swap(arrValues[nBeamlet]);
+        std::vector<int64_t>().swap(arrRows[nBeamlet]);
+    }
+
+    return std::make_tuple(data, indices, indptr);
+}
+
+PYBIND11_MODULE(_kernels, m) {
+    m.doc() = "Compiled histogram / KL and dose-operator kernels for pybrimstone.numerics";
+
+    m.def("make_gaussian_kernel", &GaussianKernel,
+          py::arg("sigma"), py::arg("bin_width"), py::arg("kernel_width"),
+          "Discrete Gaussian kernel (CHistogram::SetGBinVar)");
+    m.def("histogram_bin_dose", &HistogramBinDose,
+          py::arg("dose_values"), py::arg("region"), py::arg("min_value"), py::arg("bin_width"),
+          "Fractional dose binning (CHistogram::GetBins)");
+    m.def("conv_gauss", &ConvGauss,
+          py::arg("buffer_in"), py::arg("kernel"),
+          "Full linear convolution (CHistogram::ConvGauss)");
+    m.def("kl_divergence_calc_over_target", &KLCalcOverTarget,
+          py::arg("calc_gpdf"), py::arg("target_gpdf"));
+    m.def("kl_divergence_target_over_calc", &KLTargetOverCalc,
+          py::arg("calc_gpdf"), py::arg("target_gpdf"));
+    m.def("kl_term_evaluate", &KLTermEvaluate,
+          py::arg("dose"), py::arg("structure_mask"), py::arg("adjusted_min"),
+          py::arg("bin_width"), py::arg("kernel"), py::arg("target_gbins"),
+          py::arg("region_sum"), py::arg("cross_entropy"),
+          "KLDivTerm.evaluate: (cost, gradient with respect to dose)");
+    m.def("terma_dose_operator", &TermaDoseOperator,
+          py::arg("terma"), py::arg("profiles"), py::arg("sigma"),
+          py::arg("truncate"), py::arg("rel_tol"),
+          "TermaKernelDoseCalc operator as CSC (data, indices, indptr)");
+    m.def("set_thread_limit", &dH::SetThreadWorkerLimit,
+          py::arg("n_threads"),
+          "Cap the kernel threads for calls made from this Python thread "
+          "(0 = no cap); returns the previous cap");
+}
@@ -71,6 +71,7 @@ from .free_energy import (  # noqa: E402
 from .dvh_uncertainty import (  # noqa: E402
     compute_dose,
     compute_dvh,
+    compute_dvh_batch,
     compute_dvh_bands,
     dvh_uncertainty_bands,
     plot_dvh_bands,
@@ -84,7 +85,9 @@ from .datasets import (  # noqa: E402
     make_phase_optimizers,
     mask_from_voxel_list,
     planning_case_from_submatrices,
+    read_influence_matrix,
     synthesize_course,
+    write_influence_matrix,
 )
 
 __all__.extend([
@@ -106,6 +109,7 @@ __all__.extend([
     "total_free_energy",
     "compute_dose",
     "compute_dvh",
+    "compute_dvh_batch",
     "compute_dvh_bands",
     "dvh_uncertainty_bands",
     "plot_dvh_bands",
@@ -117,5 +121,7 @@ __all__.extend([
     "make_phase_optimizers",
     "mask_from_voxel_list",
     "planning_case_from_submatrices",
+    "read_influence_matrix",
     "synthesize_course",
+    "write_influence_matrix",
 ])
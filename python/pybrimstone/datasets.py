@@ -22,6 +22,10 @@ adapters that populate it from:
   * **TROTS** -- The Radiotherapy Optimization Test Set (Breedveld & Heijmen
     2017). MATLAB v7.3 (HDF5) files with per-structure sparse sub-matrices.
     ``load_trots_case`` (+ the format-agnostic ``planning_case_from_submatrices``).
+  * the **C++ engine** -- ``write_influence_matrix`` writes a case as the
+    streamed binary file ``dH::InfluenceMatrix`` reads, so the production
+    optimizer can run on the same benchmark cases (``read_influence_matrix``
+    reads one back).
   * **synthetic multi-phase courses** -- ``synthesize_course`` turns a single
     case into P per-phase cases with controlled intra-course variability. This
     is the bridge to the *Course* prior specifically: public benchmarks are
@@ -185,25 +189,12 @@ class PlanningCase:
             return forward
         return self.dose_matrix
 
-    def as_prescription_operator(
-        self,
-    ) -> Union[np.ndarray, Tuple[Callable, Callable]]:
+    def as_prescription_operator(self) -> DoseMatrix:
         """
-        Operator for ``Prescription``. Dense -> the matrix; sparse -> a
-        (forward, adjoint) callable pair, which Prescription accepts directly.
+        Operator for ``Prescription``: the dose matrix, dense or sparse
+        (Prescription keeps a sparse one as CSR, so batched evaluation
+        is one sparse matrix-matrix product).
         """
-        if self.is_sparse:
-            mat = self.dose_matrix
-
-            def forward(w: np.ndarray) -> np.ndarray:
-                return np.asarray(mat @ np.asarray(w, dtype=np.float64)).reshape(-1)
-
-            def adjoint(grad_dose: np.ndarray) -> np.ndarray:
-                return np.asarray(
-                    mat.T @ np.asarray(grad_dose, dtype=np.float64)
-                ).reshape(-1)
-
-            return (forward, adjoint)
         return self.dose_matrix
 
 
@@ -569,6 +560,170 @@ def _trots_read_sparse(f, group):  # pragma: no cover - needs real file
     return np.asarray(group, dtype=np.float64)
 
 
+# ---------------------------------------------------------------------------
+# Influence-matrix file (the C++ engine's ingestion path)
+# ---------------------------------------------------------------------------
+
+# File identification ('DHIM'), format version and end marker; these must
+# match RtModel/InfluenceMatrix.cpp.
+_INFLUENCE_MAGIC = 0x4D494844
+_INFLUENCE_VERSION = 1
+_INFLUENCE_END = 0x444E4521
+
+# Structure::StructType values.
+_STRUCT_TARGET = 1
+_STRUCT_OAR = 2
+
+
+def write_influence_matrix(
+    case: PlanningCase,
+    path: Union[str, Path],
+    beam_of_beamlet: Optional[Sequence[int]] = None,
+) -> Path:
+    """
+    Write a PlanningCase as an influence-matrix file for the C++ engine
+    (``dH::InfluenceMatrix::Read``), so CORT / TROTS cases loaded here can be
+    optimized by the production ``DynamicCovarianceOptimizer``.
+
+    The file is little-endian binary: a header (magic, version, n_voxels,
+    n_beamlets, n_structures as 32-bit ints), then per structure its name,
+    type (target if prescribed, else OAR) and 0-based voxel indices, then the
+    beam of each beamlet, then the matrix column by column (count, int32 row
+    indices, float32 values), so the reader can stream it without holding a
+    dense copy. Zero entries are not written.
+
+    Args:
+        case: the case to write.
+        path: output file.
+        beam_of_beamlet: beam index of each beamlet (0-based). Defaults to
+            ``case.meta["beam_of_beamlet"]`` if present, else a single beam.
+
+    Returns:
+        the path written.
+    """
+    path = Path(path)
+    n_voxels, n_beamlets = case.n_voxels, case.n_beamlets
+    if beam_of_beamlet is None:
+        beam_of_beamlet = case.meta.get("beam_of_beamlet")  # type: ignore[assignment]
+    beams = (
+        np.zeros(n_beamlets, dtype="<i4")
+        if beam_of_beamlet is None
+        else np.asarray(beam_of_beamlet, dtype="<i4").reshape(-1)
+    )
+    if beams.shape != (n_beamlets,):
+        raise ValueError(
+            f"beam_of_beamlet has {beams.size} entries, expected {n_beamlets}"
+        )
+    if beams.size and beams.min() < 0:
+        raise ValueError("beam indices must be non-negative")
+
+    dm = case.dose_matrix
+    if case.is_sparse:
+        dm = dm.tocsc()  # type: ignore[attr-defined]
+        dm.eliminate_zeros()
+
+    with open(path, "wb") as f:
+        np.array(
+            [_INFLUENCE_MAGIC, _INFLUENCE_VERSION], dtype="<u4"
+        ).tofile(f)
+        np.array(
+            [n_voxels, n_beamlets, len(case.structures)], dtype="<i4"
+        ).tofile(f)
+
+        for name, mask in case.structures.items():
+            encoded = name.encode("utf-8")
+            kind = _STRUCT_TARGET if name in case.prescription else _STRUCT_OAR
+            voxels = np.flatnonzero(mask).astype("<i4")
+            np.array([len(encoded)], dtype="<i4").tofile(f)
+            f.write(encoded)
+            np.array([kind, voxels.size], dtype="<i4").tofile(f)
+            voxels.tofile(f)
+
+        beams.tofile(f)
+
+        for col in range(n_beamlets):
+            if case.is_sparse:
+                lo, hi = dm.indptr[col], dm.indptr[col + 1]
+                rows = dm.indices[lo:hi]
+                values = dm.data[lo:hi]
+            else:
+                column = np.asarray(dm[:, col])
+                rows = np.flatnonzero(column)
+                values = column[rows]
+            np.array([rows.size], dtype="<i4").tofile(f)
+            np.asarray(rows, dtype="<i4").tofile(f)
+            np.asarray(values, dtype="<f4").tofile(f)
+
+        np.array([_INFLUENCE_END], dtype="<u4").tofile(f)
+
+    return path
+
+
+def read_influence_matrix(path: Union[str, Path]) -> PlanningCase:
+    """
+    Read an influence-matrix file back into a PlanningCase (sparse if scipy is
+    available), with ``meta["beam_of_beamlet"]`` set. Mirrors the C++ reader's
+    checks; mainly for verifying files before handing them to the engine.
+    """
+    path = Path(path)
+    buf = path.read_bytes()
+    pos = 0
+
+    def take(dtype: str, count: int) -> np.ndarray:
+        nonlocal pos
+        nbytes = np.dtype(dtype).itemsize * count
+        if count < 0 or pos + nbytes > len(buf):
+            raise ValueError(f"{path} is truncated")
+        arr = np.frombuffer(buf, dtype=dtype, count=count, offset=pos)
+        pos += nbytes
+        return arr
+
+    magic, version = take("<u4", 2)
+    if magic != _INFLUENCE_MAGIC or version != _INFLUENCE_VERSION:
+        raise ValueError(f"{path} is not an influence-matrix file")
+    n_voxels, n_beamlets, n_structures = (int(v) for v in take("<i4", 3))
+
+    structures: Dict[str, np.ndarray] = {}
+    targets: List[str] = []
+    for _ in range(n_structures):
+        (name_len,) = take("<i4", 1)
+        name = bytes(take("u1", int(name_len))).decode("utf-8")
+        kind, count = (int(v) for v in take("<i4", 2))
+        structures[name] = mask_from_voxel_list(take("<i4", count), n_voxels)
+        if kind == _STRUCT_TARGET:
+            targets.append(name)
+
+    beams = take("<i4", n_beamlets).copy()
+
+    rows_all, cols_all, vals_all = [], [], []
+    for col in range(n_beamlets):
+        (count,) = take("<i4", 1)
+        rows_all.append(take("<i4", int(count)))
+        vals_all.append(take("<f4", int(count)))
+        cols_all.append(np.full(int(count), col, dtype=np.int64))
+    (end,) = take("<u4", 1)
+    if end != _INFLUENCE_END:
+        raise ValueError(f"{path} is truncated")
+
+    D = influence_from_coo(
+        np.concatenate(rows_all) if rows_all else np.zeros(0, dtype=np.int64),
+        np.concatenate(cols_all) if cols_all else np.zeros(0, dtype=np.int64),
+        np.concatenate(vals_all).astype(np.float64) if vals_all else np.zeros(0),
+        shape=(n_voxels, n_beamlets),
+    )
+    return PlanningCase(
+        name=path.stem,
+        dose_matrix=D,
+        structures=structures,
+        meta={
+            "source": "influence_matrix",
+            "path": str(path),
+            "beam_of_beamlet": beams,
+            "targets": targets,
+        },
+    )
+
+
 # ---------------------------------------------------------------------------
 # Synthetic multi-phase course (the bridge to the Course prior)
 # ---------------------------------------------------------------------------
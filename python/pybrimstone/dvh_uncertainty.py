@@ -15,10 +15,17 @@ Pipeline:
 This is the deliverable that sells the MDDT story per the design doc:
 DVH-with-uncertainty bands instead of point-estimate DVH curves.
 
-The dose_operator can be either a 2-D matrix (linear dose-from-beamlets)
-or a callable that maps a beamlet vector to a dose vector. In the real
-brimstone pipeline this is the TERMA + spherical-kernel-convolution
-forward pass; in tests it's a small dense matrix.
+The dose_operator can be either a 2-D matrix (linear dose-from-beamlets,
+dense or scipy.sparse) or a callable that maps a beamlet vector to a dose
+vector. In the real brimstone pipeline this is the TERMA + spherical-
+kernel-convolution forward pass; in tests it's a small dense matrix.
+
+dvh_uncertainty_bands is batched: the samples' doses come from one
+matrix-matrix product per batch of samples, every structure's cumulative
+DVH for the whole batch is built from one bin lookup per voxel
+(compute_dvh_batch), and only the per-sample DVH curves -- not the
+doses -- are kept for the percentile reduction. compute_dvh and
+compute_dvh_bands remain the one-sample-at-a-time reference.
 
 matplotlib is imported lazily so this module is usable in headless or
 matplotlib-free environments.
@@ -39,15 +46,22 @@ def sample_phase_posterior(
     var_p: np.ndarray,
     n_samples: int,
     rng: np.random.Generator | None = None,
+    cov_factor: np.ndarray | None = None,
 ) -> np.ndarray:
     """
-    Draw N beamlet-weight samples from the diagonal Gaussian q(theta_p).
+    Draw N beamlet-weight samples from the Gaussian q(theta_p), with
+    covariance diag(var_p), or diag(var_p) + cov_factor @ cov_factor.T
+    when a low-rank factor is given.
 
     Args:
         mu_p: shape (n_beamlets,)
         var_p: shape (n_beamlets,), strictly positive
         n_samples: number of samples
         rng: optional np.random.Generator for reproducibility
+        cov_factor: optional shape (n_beamlets, rank) low-rank covariance
+            factor, e.g. the searched directions of the dynamic-covariance
+            optimizer scaled by their variance. The diagonal draws come
+            first, so the same rng without a factor gives the same samples.
 
     Returns:
         samples: shape (n_samples, n_beamlets)
@@ -65,10 +79,20 @@ def sample_phase_posterior(
     if n_samples < 1:
         raise ValueError(f"n_samples must be >= 1, got {n_samples}")
 
+    if cov_factor is not None:
+        cov_factor = np.asarray(cov_factor, dtype=np.float64)
+        if cov_factor.ndim != 2 or cov_factor.shape[0] != mu_p.size:
+            raise ValueError(
+                f"cov_factor must have shape (n_beamlets, rank), got {cov_factor.shape}"
+            )
+
     if rng is None:
         rng = np.random.default_rng()
     sigma = np.sqrt(var_p)
-    return mu_p[None, :] + rng.standard_normal((n_samples, mu_p.size)) * sigma[None, :]
+    samples = mu_p[None, :] + rng.standard_normal((n_samples, mu_p.size)) * sigma[None, :]
+    if cov_factor is not None:
+        samples += rng.standard_normal((n_samples, cov_factor.shape[1])) @ cov_factor.T
+    return samples
 
 
 def compute_dose(
@@ -80,6 +104,8 @@ def compute_dose(
 
     Accepts either:
       - a 2-D matrix of shape (n_voxels, n_beamlets) -- dose = D @ w
+      - a scipy.sparse matrix of that shape; a batch of samples is one
+        sparse matrix-matrix product
       - a callable taking (n_beamlets,) and returning (n_voxels,)
 
     Args:
@@ -97,6 +123,11 @@ def compute_dose(
                 f"dose_operator matrix must be 2-D, got shape {dose_operator.shape}"
             )
         return beamlet_weights @ dose_operator.T
+    if hasattr(dose_operator, "tocsr"):
+        # scipy.sparse (kept duck-typed, as in datasets.py)
+        if beamlet_weights.ndim == 1:
+            return np.asarray(dose_operator @ beamlet_weights).reshape(-1)
+        return np.asarray(dose_operator @ beamlet_weights.T).T
 
     if not callable(dose_operator):
         raise TypeError(
@@ -144,6 +175,72 @@ def compute_dvh(
     return counts / n_in_structure
 
 
+def compute_dvh_batch(
+    dose_samples: np.ndarray,
+    structures: Mapping[str, np.ndarray],
+    dose_bins: np.ndarray,
+) -> Mapping[str, np.ndarray]:
+    """
+    Cumulative DVHs of every structure for a batch of dose samples.
+
+    Same values as compute_dvh per (sample, structure), but each voxel's
+    dose is located among the bins once (binary search), per-structure
+    counts come from one bincount over the batch, and the cumulative DVH
+    is a reverse cumulative sum -- O(voxels * log bins) rather than
+    O(voxels * bins) per sample.
+
+    Args:
+        dose_samples: shape (n_samples, n_voxels)
+        structures: dict mapping structure name -> voxel mask
+        dose_bins: shape (n_bins,), monotone non-decreasing dose levels
+
+    Returns:
+        dict mapping structure name -> shape (n_samples, n_bins) DVHs.
+    """
+    dose_samples = np.asarray(dose_samples, dtype=np.float64)
+    if dose_samples.ndim != 2:
+        raise ValueError(
+            f"dose_samples must be 2-D (n_samples, n_voxels), got {dose_samples.shape}"
+        )
+    bins = np.asarray(dose_bins, dtype=np.float64)
+    if np.any(np.diff(bins) < 0):
+        raise ValueError("dose_bins must be monotone non-decreasing")
+    n_samples, n_voxels = dose_samples.shape
+    n_bins = bins.size
+
+    masks = {}
+    for name, mask in structures.items():
+        mask = np.asarray(mask).astype(bool)
+        if mask.shape != (n_voxels,):
+            raise ValueError(
+                f"{name}: mask shape {mask.shape} != dose shape ({n_voxels},)"
+            )
+        if not mask.any():
+            raise ValueError(f"{name}: structure_mask is empty (no voxels selected)")
+        masks[name] = mask
+    if not masks:
+        return {}
+
+    # levels[k, j]: how many bin levels are <= the dose of structure voxel j
+    # in sample k, i.e. the voxel counts toward DVH(dose_bins[i]) for i < level
+    union_idx = np.flatnonzero(np.logical_or.reduce(list(masks.values())))
+    levels = np.searchsorted(bins, dose_samples[:, union_idx], side="right")
+    column_of_voxel = np.full(n_voxels, -1)
+    column_of_voxel[union_idx] = np.arange(union_idx.size)
+    row_offset = (n_bins + 1) * np.arange(n_samples)[:, None]
+
+    out = {}
+    for name, mask in masks.items():
+        structure_levels = levels[:, column_of_voxel[mask]]
+        counts = np.bincount(
+            (structure_levels + row_offset).ravel(), minlength=n_samples * (n_bins + 1)
+        ).reshape(n_samples, n_bins + 1)
+        # at_or_above[:, j] = number of voxels with level >= j
+        at_or_above = counts[:, ::-1].cumsum(axis=1)[:, ::-1]
+        out[name] = at_or_above[:, 1:] / structure_levels.shape[1]
+    return out
+
+
 def compute_dvh_bands(
     dose_samples: np.ndarray,
     structure_mask: np.ndarray,
@@ -190,38 +287,61 @@ def dvh_uncertainty_bands(
     dose_bins: np.ndarray | None = None,
     percentiles: Sequence[float] = (5.0, 50.0, 95.0),
     rng: np.random.Generator | None = None,
+    cov_factor: np.ndarray | None = None,
+    batch_size: int = 256,
 ) -> Mapping[str, Tuple[np.ndarray, np.ndarray]]:
     """
     Full Step-5 pipeline: sample -> dose -> DVH -> percentile bands.
 
     Args:
         mu_p, var_p: converged per-phase posterior (or pooled mu_eta, var_eta).
-        dose_operator: ndarray matrix or callable.
+        dose_operator: ndarray / scipy.sparse matrix or callable.
         structures: dict mapping structure name -> voxel mask.
         n_samples: number of Monte Carlo draws.
         dose_bins: dose levels to evaluate DVH at. If None, computed from
-            the sample mean dose: linspace(0, 1.1*max(mean_dose), 100).
+            the mean dose (the dose of the mean sample, as the operator is
+            linear): linspace(0, 1.1*max(mean_dose), 100).
         percentiles: which percentiles to return.
         rng: optional np.random.Generator.
+        cov_factor: optional low-rank covariance factor; see
+            sample_phase_posterior.
+        batch_size: samples whose doses are computed (and held) at once.
+            Bounds memory at batch_size * n_voxels doses; the result
+            doesn't depend on it.
 
     Returns:
         dict mapping structure name -> (dose_bins, bands), where bands is
         shape (len(percentiles), len(dose_bins)).
     """
-    samples = sample_phase_posterior(mu_p, var_p, n_samples, rng=rng)
-    dose_samples = compute_dose(dose_operator, samples)
+    pct = np.asarray(percentiles, dtype=np.float64)
+    if np.any(pct < 0) or np.any(pct > 100):
+        raise ValueError(f"percentiles must be in [0, 100]; got {percentiles}")
+    if batch_size < 1:
+        raise ValueError(f"batch_size must be >= 1, got {batch_size}")
+
+    samples = sample_phase_posterior(
+        mu_p, var_p, n_samples, rng=rng, cov_factor=cov_factor
+    )
 
     if dose_bins is None:
-        mean_dose = dose_samples.mean(axis=0)
+        mean_dose = compute_dose(dose_operator, samples.mean(axis=0))
         max_d = float(mean_dose.max())
         dose_bins = np.linspace(0.0, 1.1 * max_d if max_d > 0 else 1.0, 100)
     dose_bins = np.asarray(dose_bins, dtype=np.float64)
 
-    out = {}
-    for name, mask in structures.items():
-        bands = compute_dvh_bands(dose_samples, mask, dose_bins, percentiles)
-        out[name] = (dose_bins, bands)
-    return out
+    per_sample = {
+        name: np.empty((n_samples, dose_bins.size)) for name in structures
+    }
+    for start in range(0, n_samples, batch_size):
+        stop = min(start + batch_size, n_samples)
+        dose_batch = compute_dose(dose_operator, samples[start:stop])
+        for name, dvhs in compute_dvh_batch(dose_batch, structures, dose_bins).items():
+            per_sample[name][start:stop] = dvhs
+
+    return {
+        name: (dose_bins, np.percentile(dvhs, pct, axis=0))
+        for name, dvhs in per_sample.items()
+    }
 
 
 def plot_dvh_bands(
@@ -14,15 +14,30 @@ m_vAdaptVariance from the C++ code -- a variance, not a std. To avoid
 ambiguity, this module uses `variances` as the parameter name; the math is
 expressed in terms of precision (= 1 / variance), which matches what
 CoursePriorTerm consumes anyway.
+
+The E-step's phase solves are independent given the current Course prior,
+so HierarchicalBayes can run them concurrently on a thread pool
+(n_workers, through workers.WorkerPool). The phases may share read-only data -- typically one dose
+matrix. Only the native numerics backend benefits: its kernels run with the
+GIL released, and each worker caps its kernel threads at its share of the
+cores (set_thread_limit) so P concurrent phases don't start P x cores
+threads. The Python backend spends its time in per-voxel loops that hold
+the GIL (about 92% of a phase solve on a 4000-voxel, 60-beamlet case:
+0.58 s of 0.63 s in KLDivTerm binning), so threads only add switching
+overhead -- 4 phases took 18-19 s on 4 workers against 16-19 s serially --
+and the E-step runs serially there whatever n_workers says. Results are
+collected in phase order and pooled exactly as in the serial loop, so a
+parallel run reproduces the serial one bit for bit.
 """
 
 from __future__ import annotations
 
-from typing import Callable, List, Sequence, Tuple
+from typing import Callable, List, Optional, Sequence, Tuple
 
 import numpy as np
 
 from .course_prior import CoursePriorTerm
+from .workers import WorkerPool, requested_workers, worker_count
 
 
 PhaseOptimizer = Callable[[CoursePriorTerm], Tuple[np.ndarray, np.ndarray]]
@@ -119,6 +134,16 @@ class HierarchicalBayes:
             and returns (mu_p, var_p) where var_p is m_vAdaptVariance shape.
         course_prior_terms: P CoursePriorTerm instances. Their target_mu and
             precision attributes are mutated by the driver after each pool.
+        n_workers: threads for the E-step. 1 (default) solves the phases
+            one after another on the calling thread; None uses one thread
+            per phase, up to os.cpu_count(). Only honoured on the native
+            backend, where each worker gets cores // n_workers kernel
+            threads; the Python backend always runs serially (see the
+            module docstring). With more than one worker the
+            phase optimizers must not share mutable state: each needs its
+            own instance (and, for PhaseOptimizer, its own Prescription,
+            since the driver's prior is installed into it). Dose matrices
+            and structure masks may be shared.
     """
 
     def __init__(
@@ -126,6 +151,7 @@ class HierarchicalBayes:
         phase_optimizers: List[PhaseOptimizer],
         course_prior_terms: List[CoursePriorTerm],
         normalize_variance: bool = False,
+        n_workers: Optional[int] = 1,
     ):
         if len(phase_optimizers) != len(course_prior_terms):
             raise ValueError(
@@ -134,12 +160,52 @@ class HierarchicalBayes:
             )
         if len(phase_optimizers) == 0:
             raise ValueError("need at least one phase")
+        if n_workers is not None and n_workers < 1:
+            raise ValueError(f"n_workers must be >= 1 or None, got {n_workers}")
 
         self.phase_optimizers = list(phase_optimizers)
         self.course_prior_terms = list(course_prior_terms)
         self.normalize_variance = bool(normalize_variance)
+        self.n_workers = n_workers
         self.history: List[dict] = []
 
+        # checked against the request, not the backend, so a setup that is
+        # only valid serially fails the same way on either backend
+        if self._requested_workers() > 1:
+            self._check_independent_phases()
+
+    def _requested_workers(self) -> int:
+        return requested_workers(self.n_workers, len(self.phase_optimizers))
+
+    def _worker_count(self) -> int:
+        """E-step threads: the request on the native backend, else 1."""
+        return worker_count(self.n_workers, len(self.phase_optimizers))
+
+    def _check_independent_phases(self) -> None:
+        """Concurrent phases must not mutate a shared optimizer or prescription."""
+        for what, objs in (
+            ("phase_optimizers", self.phase_optimizers),
+            ("phase optimizer prescriptions", [
+                getattr(opt, "prescription", None) for opt in self.phase_optimizers
+            ]),
+        ):
+            ids = [id(obj) for obj in objs if obj is not None]
+            if len(set(ids)) != len(ids):
+                raise ValueError(
+                    f"{what} must be distinct objects when phases run in parallel"
+                )
+
+    def _e_step(
+        self,
+        pool: WorkerPool,
+    ) -> Tuple[List[np.ndarray], List[np.ndarray]]:
+        """Solve every phase under its current prior; results in phase order."""
+        pairs = list(zip(self.phase_optimizers, self.course_prior_terms))
+        results = pool.map(lambda pair: pair[0](pair[1]), pairs)
+        mus = [np.asarray(mu_p, dtype=np.float64) for mu_p, _ in results]
+        variances = [np.asarray(var_p, dtype=np.float64) for _, var_p in results]
+        return mus, variances
+
     def run(self, max_outer_iters: int = 20, tol: float = 1e-4) -> dict:
         """
         Run coordinate ascent until mu_eta stabilizes or max_outer_iters.
@@ -156,43 +222,41 @@ class HierarchicalBayes:
         converged = False
         last_iter = 0
 
-        for outer_iter in range(max_outer_iters):
-            last_iter = outer_iter
-
-            # E-step
-            mus = []
-            variances = []
-            for opt, prior in zip(self.phase_optimizers, self.course_prior_terms):
-                mu_p, var_p = opt(prior)
-                mus.append(np.asarray(mu_p, dtype=np.float64))
-                variances.append(np.asarray(var_p, dtype=np.float64))
-
-            # M-step
-            mu_eta, var_eta = pool_phases(mus, variances, normalize=self.normalize_variance)
-            precision_eta = 1.0 / var_eta
-
-            # Update each phase's prior in place. The CoursePriorTerm holds
-            # the mutated arrays directly so subsequent E-steps see the new pull.
-            for prior in self.course_prior_terms:
-                prior.target_mu = mu_eta.copy()
-                prior.precision = precision_eta.copy()
-
-            self.history.append({
-                "outer_iter": outer_iter,
-                "mu_eta": mu_eta.copy(),
-                "var_eta": var_eta.copy(),
-                "phase_mus": [m.copy() for m in mus],
-                "phase_vars": [v.copy() for v in variances],
-            })
-
-            # Convergence test on mu_eta
-            if mu_eta_prev is not None:
-                denom = np.linalg.norm(mu_eta_prev) + 1e-10
-                rel_change = np.linalg.norm(mu_eta - mu_eta_prev) / denom
-                if rel_change < tol:
-                    converged = True
-                    break
-            mu_eta_prev = mu_eta.copy()
+        # one pool for the whole run; the priors the phases read only change
+        # between E-steps, on this thread
+        with WorkerPool(self._worker_count()) as pool:
+            for outer_iter in range(max_outer_iters):
+                last_iter = outer_iter
+
+                # E-step
+                mus, variances = self._e_step(pool)
+
+                # M-step
+                mu_eta, var_eta = pool_phases(mus, variances, normalize=self.normalize_variance)
+                precision_eta = 1.0 / var_eta
+
+                # Update each phase's prior in place. The CoursePriorTerm holds
+                # the mutated arrays directly so subsequent E-steps see the new pull.
+                for prior in self.course_prior_terms:
+                    prior.target_mu = mu_eta.copy()
+                    prior.precision = precision_eta.copy()
+
+                self.history.append({
+                    "outer_iter": outer_iter,
+                    "mu_eta": mu_eta.copy(),
+                    "var_eta": var_eta.copy(),
+                    "phase_mus": [m.copy() for m in mus],
+                    "phase_vars": [v.copy() for v in variances],
+                })
+
+                # Convergence test on mu_eta
+                if mu_eta_prev is not None:
+                    denom = np.linalg.norm(mu_eta_prev) + 1e-10
+                    rel_change = np.linalg.norm(mu_eta - mu_eta_prev) / denom
+                    if rel_change < tol:
+                        converged = True
+                        break
+                mu_eta_prev = mu_eta.copy()
 
         return {
             "mu_eta": mu_eta,
@@ -40,6 +40,7 @@ from .numerics import (
     make_gaussian_kernel,
     set_interval,
 )
+from .numerics.backend import native
 from .objective_terms import DoseObjectiveTerm
 
 
@@ -116,6 +117,19 @@ class KLDivTerm(DoseObjectiveTerm):
         dvps = set_interval(dose_min, dose_max, fraction=fraction, use_midpoint=use_midpoint)
         return cls(structure_mask=structure_mask, dvps=dvps, **kwargs)
 
+    def reweighted(self, voxel_weights: np.ndarray) -> "KLDivTerm":
+        """Same term over structure_mask * voxel_weights."""
+        return KLDivTerm(
+            self.structure_mask * np.asarray(voxel_weights, dtype=np.float64),
+            self.dvps,
+            weight=self.weight,
+            bin_width=self.bin_width,
+            min_dose=self.min_dose,
+            var_min=self.var_min,
+            var_max=self.var_max,
+            cross_entropy=self.cross_entropy,
+        )
+
     # ------------------------------------------------------------------
     # Target histogram setup
     # ------------------------------------------------------------------
@@ -172,6 +186,19 @@ class KLDivTerm(DoseObjectiveTerm):
                 f"dose shape {dose.shape} != structure_mask shape {self.structure_mask.shape}"
             )
 
+        kernels = native()
+        if kernels is not None:
+            return kernels.kl_term_evaluate(
+                dose,
+                self.structure_mask,
+                self.adjusted_min,
+                self.bin_width,
+                self.kernel_max,
+                self.target_gbins,
+                self.region_sum,
+                self.cross_entropy,
+            )
+
         bins, low_bin, _ = self._bin_dose(dose)
         gbins = conv_gauss(bins, self.kernel_max)
         pdf = gbins / self.region_sum
@@ -213,3 +240,92 @@ class KLDivTerm(DoseObjectiveTerm):
             grad[v] = (dbins[j + 1] - dbins[j]) * self.structure_mask[v] / self.bin_width
 
         return cost, grad
+
+    def evaluate_batch(
+        self, doses: np.ndarray, with_grad: bool = True
+    ) -> Tuple[np.ndarray, Optional[np.ndarray]]:
+        """
+        evaluate() for each row of doses (n_points, n_voxels) with one
+        pass over the voxels: the histograms of all rows are binned into
+        a single (n_points, n_bins) buffer, convolved and compared to the
+        target together. Rows are padded to the longest histogram; the
+        padding is masked out so each row matches evaluate() exactly.
+        """
+        doses = np.atleast_2d(np.asarray(doses, dtype=np.float64))
+        if doses.shape[1:] != self.structure_mask.shape:
+            raise ValueError(
+                f"doses shape {doses.shape} != (n_points,) + {self.structure_mask.shape}"
+            )
+        if native() is not None:
+            # the compiled kernel is already one pass per row
+            return super().evaluate_batch(doses, with_grad)
+
+        n_points = doses.shape[0]
+        K = self.kernel_max
+        n_k = K.size
+        rows = np.arange(n_points)[:, None]
+
+        bin_scaled = (doses - self.adjusted_min) / self.bin_width
+        low_bin = np.floor(bin_scaled).astype(np.int64)
+        frac = bin_scaled - low_bin
+
+        # per-row bin count as evaluate() sizes it (over all voxels)
+        n_bins = low_bin.max(axis=1) + 2
+        n_max = int(n_bins.max())
+
+        # negative bins wrap from the end of the row's histogram, as
+        # NumPy indexing does in evaluate()
+        active = self.structure_mask > 0
+        r = self.structure_mask[active]
+        lo = low_bin[:, active]
+        hi = lo + 1
+        lo = np.where(lo < 0, lo + n_bins[:, None], lo)
+        hi = np.where(hi < 0, hi + n_bins[:, None], hi)
+        if lo.size and min(lo.min(), hi.min()) < 0:
+            raise IndexError("dose below the histogram range")
+
+        offset = rows * n_max
+        frac_a = frac[:, active]
+        bins = np.bincount(
+            (lo + offset).ravel(), ((1.0 - frac_a) * r).ravel(), minlength=n_points * n_max
+        ) + np.bincount(
+            (hi + offset).ravel(), (frac_a * r).ravel(), minlength=n_points * n_max
+        )
+        bins = bins.reshape(n_points, n_max)
+
+        n_g = n_max + n_k - 1
+        gbins = np.zeros((n_points, n_g))
+        for k in range(n_k):
+            gbins[:, k : k + n_max] += K[k] * bins
+        pdf = gbins / self.region_sum
+
+        valid = np.arange(n_g)[None, :] < (n_bins + n_k - 1)[:, None]
+        target = np.zeros(n_g)
+        m = min(self.target_gbins.size, n_g)
+        target[:m] = self.target_gbins[:m]
+        target = np.where(valid, target, 0.0)
+
+        if self.cross_entropy:
+            costs = np.sum(target * np.log(target / (pdf + EPS) + EPS), axis=1)
+        else:
+            arg = pdf / (target + EPS) + EPS
+            costs = np.sum(pdf * np.log(arg), axis=1)
+        if not with_grad:
+            return costs, None
+
+        if self.cross_entropy:
+            denom = target + EPS * (pdf + EPS)
+            dpdf = -target / np.where(denom > 0, denom, EPS)
+        else:
+            dpdf = np.log(arg) + (pdf / (target + EPS)) / arg
+        dgbins = np.where(valid, dpdf, 0.0) / self.region_sum
+
+        dbins = np.zeros((n_points, n_max))
+        for k in range(n_k):
+            dbins += K[k] * dgbins[:, k : k + n_max]
+
+        grads = np.zeros_like(doses)
+        grads[:, active] = (
+            np.take_along_axis(dbins, hi, axis=1) - np.take_along_axis(dbins, lo, axis=1)
+        ) * r / self.bin_width
+        return costs, grads
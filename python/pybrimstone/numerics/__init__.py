@@ -12,8 +12,14 @@ Modules:
     parameter_transform Sigmoid optimizer-to-beamlet transform
                        (Prescription.cpp::Transform port)
     kl_divergence      DVP-to-target-bins + KL formulas (KLDivTerm port)
+    backend            selects the compiled kernels (_kernels) when built
 """
 
+from .backend import (
+    get_backend,
+    native_available,
+    set_backend,
+)
 from .histogram import (
     GBINS_KERNEL_WIDTH,
     compute_gbins,
@@ -42,6 +48,10 @@ from .kl_divergence import (
 )
 
 __all__ = [
+    # backend
+    "get_backend",
+    "native_available",
+    "set_backend",
     # histogram
     "GBINS_KERNEL_WIDTH",
     "compute_gbins",
@@ -0,0 +1,59 @@
+"""
+Backend selection for the numerical primitives.
+
+The histogram and KL primitives have a compiled implementation in the
+``pybrimstone.numerics._kernels`` extension (source:
+python/numerics_kernels.cpp) that reproduces the NumPy reference here to
+round-off, with multithreaded binning and convolution. When the extension
+is built the primitives dispatch to it; otherwise, or with
+``BRIMSTONE_NUMERICS=python`` in the environment, the NumPy reference runs.
+Running the test suites once with each setting checks both backends.
+"""
+
+from __future__ import annotations
+
+import os
+from types import ModuleType
+from typing import Optional
+
+try:
+    from . import _kernels as _native_module  # type: ignore[attr-defined]
+except ImportError:
+    _native_module = None
+
+_use_native = (
+    _native_module is not None
+    and os.environ.get("BRIMSTONE_NUMERICS", "").lower() != "python"
+)
+
+
+def native() -> Optional[ModuleType]:
+    """The compiled kernels if they are in use, else None."""
+    return _native_module if _use_native else None
+
+
+def native_available() -> bool:
+    """True if the compiled kernels were built."""
+    return _native_module is not None
+
+
+def get_backend() -> str:
+    """``"native"`` or ``"python"``."""
+    return "native" if _use_native else "python"
+
+
+def set_backend(name: str) -> str:
+    """
+    Select ``"native"`` or ``"python"``; returns the previous backend.
+    Selecting ``"native"`` raises ImportError if the extension isn't built.
+    """
+    global _use_native
+    if name not in ("native", "python"):
+        raise ValueError(f"unknown numerics backend {name!r}")
+    if name == "native" and _native_module is None:
+        raise ImportError(
+            "pybrimstone.numerics._kernels is not built; see BUILD_NATIVE.md"
+        )
+    previous = get_backend()
+    _use_native = name == "native"
+    return previous
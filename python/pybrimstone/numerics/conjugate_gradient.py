@@ -27,6 +27,35 @@ from scipy.optimize import minimize_scalar
 ITER_MAX = 500
 ZEPS = 1e-10
 
+# Line-search steps evaluated as one batch to bracket the minimum: the
+# points scipy's bracket() would walk through one at a time, downhill from
+# (0, 1) growing by the golden ratio, plus one step back.
+GOLDEN = 1.618034
+BRACKET_STEPS = np.concatenate((
+    [-1.0, 0.0],
+    np.cumsum(GOLDEN ** np.arange(8)),
+))
+
+
+def bracket_from_batch(
+    f_batch: Callable[[np.ndarray], np.ndarray],
+    point: np.ndarray,
+    direction: np.ndarray,
+) -> Optional[Tuple[float, float, float]]:
+    """
+    (a, b, c) with f(b) below f(a) and f(c), from one f_batch call on the
+    points point + lambda * direction for lambda in BRACKET_STEPS; None
+    if the lowest of them is at either end (the minimum isn't bracketed).
+    """
+    points = point[None, :] + BRACKET_STEPS[:, None] * direction[None, :]
+    values = np.asarray(f_batch(points), dtype=np.float64)
+    i = int(np.argmin(values))
+    if i == 0 or i == len(values) - 1:
+        return None
+    if not (values[i] < values[i - 1] and values[i] < values[i + 1]):
+        return None
+    return BRACKET_STEPS[i - 1], BRACKET_STEPS[i], BRACKET_STEPS[i + 1]
+
 
 def brent_line_minimize(
     f: Callable[[np.ndarray], float],
@@ -34,11 +63,17 @@ def brent_line_minimize(
     direction: np.ndarray,
     tol: float = 1e-4,
     max_step_norm: float | None = None,
+    f_batch: Optional[Callable[[np.ndarray], np.ndarray]] = None,
 ) -> Tuple[float, float]:
     """
     Line minimization along a direction. Matches vnl_brent_minimizer usage.
 
     Args:
+        f_batch: optional f over the rows of an (n_points, n) array (e.g.
+            Prescription.evaluate_batch's costs). When set, the minimum is
+            bracketed from one batch of steps (bracket_from_batch) rather
+            than by evaluating f one step at a time; if the batch doesn't
+            bracket it, Brent brackets as without f_batch.
         max_step_norm: optional cap on ||lambda * direction||. When set, the
             unconstrained Brent minimum is clipped so the step taken in
             parameter space has L2 norm <= max_step_norm. This is the
@@ -51,7 +86,12 @@ def brent_line_minimize(
     """
     def line_func(lam):
         return f(point + lam * direction)
-    result = minimize_scalar(line_func, method="brent", options={"xtol": tol})
+    bracket = None
+    if f_batch is not None:
+        bracket = bracket_from_batch(f_batch, point, direction)
+    result = minimize_scalar(
+        line_func, bracket=bracket, method="brent", options={"xtol": tol},
+    )
     lam = result.x
 
     if max_step_norm is not None:
@@ -128,6 +168,7 @@ def polak_ribiere_cg(
     callback: Optional[Callable] = None,
     adaptive_variance: Optional[Tuple[float, float]] = None,
     max_step_norm: float | None = None,
+    f_batch: Optional[Callable[[np.ndarray], np.ndarray]] = None,
 ) -> Tuple[np.ndarray, float, int, bool]:
     """
     Polak-Ribiere conjugate gradient minimization.
@@ -141,6 +182,8 @@ def polak_ribiere_cg(
             per-parameter variance is passed to the callback as
             sigma_weights. This is what the hierarchical-Bayes outer
             loop harvests for pooling.
+        f_batch: optional batched f, passed to brent_line_minimize to
+            bracket each line minimum from one batch of points.
         callback: optional callable invoked at each iteration with
             kwargs (iteration, x, f_val, sigma_weights). Return value
             is currently ignored (TODO: support early-stop return).
@@ -170,7 +213,9 @@ def polak_ribiere_cg(
 
     iteration = 0
     for iteration in range(max_iter):
-        lam, f_new = brent_line_minimize(f, x, d, tol=line_tol, max_step_norm=max_step_norm)
+        lam, f_new = brent_line_minimize(
+            f, x, d, tol=line_tol, max_step_norm=max_step_norm, f_batch=f_batch,
+        )
         x = x + lam * d
 
         if 2.0 * abs(f_val - f_new) <= tol * (abs(f_val) + abs(f_new) + ZEPS):
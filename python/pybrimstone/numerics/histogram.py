@@ -9,6 +9,8 @@ from __future__ import annotations
 
 import numpy as np
 
+from .backend import native
+
 
 GBINS_KERNEL_WIDTH = 8.0
 
@@ -40,6 +42,10 @@ def make_gaussian_kernel(
     bin_width factor makes the kernel sum approximately 1 (it's a
     Riemann sum of the continuous Gaussian).
     """
+    kernels = native()
+    if kernels is not None:
+        return kernels.make_gaussian_kernel(sigma, bin_width, kernel_width)
+
     neighborhood = int(np.ceil(kernel_width * sigma / bin_width))
     z_vals = np.arange(-neighborhood, neighborhood + 1)
     return bin_width * np.array([gauss(z * bin_width, sigma) for z in z_vals])
@@ -58,6 +64,10 @@ def histogram_bin_dose(
     proportional to the fractional position. Voxels with region <= 0
     are excluded.
     """
+    kernels = native()
+    if kernels is not None:
+        return kernels.histogram_bin_dose(dose_values, region, min_value, bin_width)
+
     bin_scaled = (dose_values - min_value) / bin_width
     low_bin = np.floor(bin_scaled).astype(int)
     frac = bin_scaled - low_bin
@@ -79,6 +89,9 @@ def histogram_bin_dose(
 
 def conv_gauss(buffer_in: np.ndarray, kernel: np.ndarray) -> np.ndarray:
     """Linear convolution matching CHistogram::ConvGauss."""
+    kernels = native()
+    if kernels is not None:
+        return kernels.conv_gauss(buffer_in, kernel)
     return np.convolve(buffer_in, kernel)
 
 
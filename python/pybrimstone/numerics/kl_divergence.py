@@ -19,6 +19,7 @@ from typing import Callable
 
 import numpy as np
 
+from .backend import native
 from .histogram import conv_gauss
 
 
@@ -124,6 +125,10 @@ def kl_divergence_calc_over_target(
     Matches C++ Eval:
         sum += calc[i] * log(calc[i] / (target[i] + EPS) + EPS)
     """
+    kernels = native()
+    if kernels is not None:
+        return kernels.kl_divergence_calc_over_target(calc_gpdf, target_gpdf)
+
     n = len(calc_gpdf)
     total = 0.0
     for i in range(n):
@@ -141,6 +146,10 @@ def kl_divergence_target_over_calc(
     KL(target || calc) -- the m_bTargetCrossEntropy = true mode.
     Matches the C++ Eval with the calc/target arguments swapped.
     """
+    kernels = native()
+    if kernels is not None:
+        return kernels.kl_divergence_target_over_calc(calc_gpdf, target_gpdf)
+
     n = len(target_gpdf)
     total = 0.0
     for i in range(n):
@@ -21,7 +21,7 @@ class.
 
 from __future__ import annotations
 
-from typing import Tuple
+from typing import Optional, Tuple
 
 import numpy as np
 
@@ -55,3 +55,29 @@ class DoseObjectiveTerm:
 
     def evaluate(self, dose: np.ndarray) -> Tuple[float, np.ndarray]:
         raise NotImplementedError
+
+    def evaluate_batch(
+        self, doses: np.ndarray, with_grad: bool = True
+    ) -> Tuple[np.ndarray, Optional[np.ndarray]]:
+        """
+        evaluate() for each row of doses (n_points, n_voxels): returns
+        (costs (n_points,), grads (n_points, n_voxels) or None). The
+        default evaluates the rows in turn; subclasses that can share the
+        pass over the voxels override it.
+        """
+        doses = np.atleast_2d(np.asarray(doses, dtype=np.float64))
+        costs = np.empty(doses.shape[0])
+        grads = np.empty_like(doses) if with_grad else None
+        for b, dose in enumerate(doses):
+            costs[b], g = self.evaluate(dose)
+            if grads is not None:
+                grads[b] = g
+        return costs, grads
+
+    def reweighted(self, voxel_weights: np.ndarray) -> "DoseObjectiveTerm":
+        """
+        Copy of the term with each voxel's contribution scaled by
+        voxel_weights (shape of dose). Used to express a bootstrap
+        resample without rebuilding the dose operator.
+        """
+        raise NotImplementedError
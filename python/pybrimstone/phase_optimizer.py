@@ -111,6 +111,12 @@ class PhaseOptimizer:
             _, g = self.prescription.evaluate(p)
             return g
 
+        # each line search brackets its minimum from one batch of points,
+        # whose doses come from one product with the dose matrix
+        def f_batch(P):
+            costs, _ = self.prescription.evaluate_batch(P, with_grad=False)
+            return costs
+
         # Default variance is var_max from the AV config. CG only fires
         # the callback after the AV update each iteration; if CG converges
         # in 0..1 iterations the callback may not run at all, so the
@@ -131,6 +137,7 @@ class PhaseOptimizer:
             max_iter=self.max_iter,
             tol=self.tol,
             max_step_norm=self.max_step_norm,
+            f_batch=f_batch,
         )
 
         # Variance lower-bounded to keep pool_phases / Course prior precision finite.
@@ -21,13 +21,14 @@ Backward:
                  + sum_j w_j * beamlet_term_j.evaluate(beamlets).grad
     grad_params  = grad_beamlet * d_transform(params)
 
-The dose_operator can be either a matrix (where dose = D @ w and the
-adjoint is D.T @ grad_dose) or a callable + matching adjoint callable.
+The dose_operator can be either a matrix, dense or scipy.sparse (where
+dose = D @ w and the adjoint is D.T @ grad_dose), or a callable +
+matching adjoint callable.
 """
 
 from __future__ import annotations
 
-from typing import Callable, List, Optional, Tuple, Union
+from typing import Callable, List, Optional, Sequence, Tuple, Union
 
 import numpy as np
 
@@ -37,7 +38,12 @@ from .objective_terms import BeamletObjectiveTerm, DoseObjectiveTerm
 
 DoseFn = Callable[[np.ndarray], np.ndarray]
 DoseAdjointFn = Callable[[np.ndarray], np.ndarray]
-DoseOperator = Union[np.ndarray, Tuple[DoseFn, DoseAdjointFn]]
+DoseOperator = Union[np.ndarray, Tuple[DoseFn, DoseAdjointFn]]  # or scipy.sparse
+
+
+def _is_sparse(x: object) -> bool:
+    """True for a scipy.sparse matrix, without importing scipy."""
+    return not isinstance(x, np.ndarray) and hasattr(x, "tocsr") and hasattr(x, "shape")
 
 
 class Prescription:
@@ -45,7 +51,8 @@ class Prescription:
     Composite objective over a plan.
 
     Args:
-        dose_operator: An (n_voxels, n_beamlets) matrix, OR a tuple
+        dose_operator: An (n_voxels, n_beamlets) matrix (ndarray or
+            scipy.sparse, kept as CSR), OR a tuple
             (forward, adjoint) of callables: forward(beamlets) -> dose,
             adjoint(grad_dose) -> grad_beamlet.
         use_transform: If True (default), optimizer parameters are
@@ -59,7 +66,9 @@ class Prescription:
         dose_operator: DoseOperator,
         use_transform: bool = True,
     ):
-        if isinstance(dose_operator, np.ndarray):
+        if _is_sparse(dose_operator):
+            dose_operator = dose_operator.tocsr()
+        if isinstance(dose_operator, np.ndarray) or _is_sparse(dose_operator):
             if dose_operator.ndim != 2:
                 raise ValueError(
                     f"matrix dose_operator must be 2-D, got shape {dose_operator.shape}"
@@ -78,7 +87,7 @@ class Prescription:
             self._dose_adjoint = adjoint
         else:
             raise TypeError(
-                "dose_operator must be an ndarray matrix or a "
+                "dose_operator must be a (dense or sparse) matrix or a "
                 "(forward, adjoint) callable tuple"
             )
 
@@ -100,18 +109,44 @@ class Prescription:
             raise TypeError(f"expected BeamletObjectiveTerm, got {type(term).__name__}")
         self.beamlet_terms.append(term)
 
+    def resampled(
+        self, voxel_weights: Optional[Sequence[np.ndarray]] = None
+    ) -> "Prescription":
+        """
+        A new Prescription sharing this one's dose operator (not copied)
+        and beamlet terms, with dose term i reweighted per voxel by
+        voxel_weights[i] (None keeps the dose terms as they are). Terms are
+        only read during evaluation, so resamples of one Prescription can
+        be evaluated concurrently.
+        """
+        if voxel_weights is not None and len(voxel_weights) != len(self.dose_terms):
+            raise ValueError(
+                f"need one voxel weight vector per dose term "
+                f"({len(self.dose_terms)}), got {len(voxel_weights)}"
+            )
+        if self._dose_matrix is not None:
+            operator: DoseOperator = self._dose_matrix
+        else:
+            operator = (self._dose_forward, self._dose_adjoint)
+        copy = Prescription(operator, use_transform=self.use_transform)
+        for i, term in enumerate(self.dose_terms):
+            copy.add_dose_term(term if voxel_weights is None else term.reweighted(voxel_weights[i]))
+        for term in self.beamlet_terms:
+            copy.add_beamlet_term(term)
+        return copy
+
     # ------------------------------------------------------------------
     # Dose forward / adjoint
     # ------------------------------------------------------------------
 
     def compute_dose(self, beamlets: np.ndarray) -> np.ndarray:
         if self._dose_matrix is not None:
-            return beamlets @ self._dose_matrix.T
+            return np.asarray(beamlets @ self._dose_matrix.T, dtype=np.float64)
         return np.asarray(self._dose_forward(beamlets), dtype=np.float64)
 
     def dose_adjoint(self, grad_dose: np.ndarray) -> np.ndarray:
         if self._dose_matrix is not None:
-            return grad_dose @ self._dose_matrix
+            return np.asarray(grad_dose @ self._dose_matrix, dtype=np.float64)
         return np.asarray(self._dose_adjoint(grad_dose), dtype=np.float64)
 
     # ------------------------------------------------------------------
@@ -163,3 +198,48 @@ class Prescription:
             c, _ = term.evaluate(beamlets)
             cost += term.weight * c
         return float(cost)
+
+    def evaluate_batch(
+        self, params: np.ndarray, with_grad: bool = True
+    ) -> Tuple[np.ndarray, Optional[np.ndarray]]:
+        """
+        evaluate() at each row of params (n_points, n_params): returns
+        (costs (n_points,), grads (n_points, n_params) or None). With a
+        matrix dose operator the doses of all rows come from one
+        matrix-matrix product (dense or sparse), and each dose term sees
+        the whole batch at once (DoseObjectiveTerm.evaluate_batch).
+        """
+        params = np.atleast_2d(np.asarray(params, dtype=np.float64))
+        beamlets = transform(params) if self.use_transform else params
+
+        if self._dose_matrix is not None:
+            doses = self.compute_dose(beamlets)
+        else:
+            doses = np.stack([self.compute_dose(w) for w in beamlets])
+
+        costs = np.zeros(params.shape[0])
+        grad_dose = np.zeros_like(doses) if with_grad else None
+        for term in self.dose_terms:
+            c, g = term.evaluate_batch(doses, with_grad)
+            costs += term.weight * c
+            if with_grad:
+                grad_dose += term.weight * g
+
+        if with_grad:
+            if self._dose_matrix is not None:
+                grad_beamlet = self.dose_adjoint(grad_dose)
+            else:
+                grad_beamlet = np.stack([self.dose_adjoint(g) for g in grad_dose])
+
+        for term in self.beamlet_terms:
+            for b, w in enumerate(beamlets):
+                c, g = term.evaluate(w)
+                costs[b] += term.weight * c
+                if with_grad:
+                    grad_beamlet[b] += term.weight * g
+
+        if not with_grad:
+            return costs, None
+        if self.use_transform:
+            return costs, grad_beamlet * d_transform(params)
+        return costs, grad_beamlet
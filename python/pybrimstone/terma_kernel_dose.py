@@ -42,15 +42,28 @@ Simplifications relative to a clinical TPS:
   - No heterogeneity correction beyond what density-weighted path-
     length naturally provides (i.e., no kernel scaling at material
     boundaries).
+
+build_dose_operator can also return the operator as a scipy.sparse CSC
+matrix. When pybrimstone.numerics._kernels is built it computes the
+sparse columns there, in parallel over beamlets, with the z pass of the
+separable kernel done once on the shared TERMA (the lateral profile does
+not vary along z); otherwise the per-beamlet loop below is the reference.
 """
 
 from __future__ import annotations
 
-from typing import Tuple
+from typing import Tuple, Union
 
 import numpy as np
+import scipy.sparse
 from scipy.ndimage import gaussian_filter
 
+from .numerics.backend import native
+
+
+# scipy.ndimage.gaussian_filter's default kernel radius, in sigmas
+GAUSSIAN_TRUNCATE = 4.0
+
 
 class TermaKernelDoseCalc:
     """
@@ -188,22 +201,77 @@ class TermaKernelDoseCalc:
     def dose_for_beamlet(self, b: int) -> np.ndarray:
         """3-D dose contribution = TERMA convolved with the Gaussian kernel."""
         terma = self.terma_for_beamlet(b)
-        return gaussian_filter(terma, sigma=self._kernel_sigma_voxels)
+        return gaussian_filter(
+            terma, sigma=self._kernel_sigma_voxels, truncate=GAUSSIAN_TRUNCATE
+        )
 
     # ------------------------------------------------------------------
     # Linear dose operator
     # ------------------------------------------------------------------
 
-    def build_dose_operator(self) -> np.ndarray:
+    def build_dose_operator(
+        self,
+        sparse: bool = False,
+        rel_tol: float = 0.0,
+    ) -> Union[np.ndarray, scipy.sparse.csc_matrix]:
         """
         Materialize the (n_voxels, n_beamlets) matrix D such that
         dose.ravel() = D @ beamlet_weights. Plug into Prescription
         directly: Prescription(D, use_transform=True).
+
+        Args:
+            sparse: return D as a scipy.sparse CSC matrix, which
+                Prescription also takes directly (it keeps it as CSR).
+                The compiled kernels, when built, are used for this
+                form only; the dense form is filled column by column,
+                without a sparse intermediate.
+            rel_tol: entries of a column at or below rel_tol times the
+                column's max are dropped (set to zero in the dense
+                result). The Gaussian tails never reach zero, so the
+                sparse operator only pays off with rel_tol > 0; 1e-6
+                keeps the dose to well within round-off of clinical use.
         """
+        if rel_tol < 0:
+            raise ValueError(f"rel_tol must be non-negative, got {rel_tol}")
         nx, ny, nz = self.density_volume.shape
         n_voxels = nx * ny * nz
         n_beamlets = self.beamlet_centers_2d.shape[0]
-        D = np.empty((n_voxels, n_beamlets), dtype=np.float64)
+
+        kernels = native() if sparse else None
+        if kernels is not None:
+            data, indices, indptr = kernels.terma_dose_operator(
+                self._terma_per_unit_fluence,
+                self._lateral_profile,
+                self._kernel_sigma_voxels,
+                GAUSSIAN_TRUNCATE,
+                float(rel_tol),
+            )
+            return scipy.sparse.csc_matrix(
+                (data, indices, indptr), shape=(n_voxels, n_beamlets)
+            )
+
+        if not sparse:
+            D = np.empty((n_voxels, n_beamlets), dtype=np.float64)
+            for b in range(n_beamlets):
+                column = self.dose_for_beamlet(b).ravel()
+                if rel_tol > 0:
+                    column[np.abs(column) <= rel_tol * np.abs(column).max()] = 0.0
+                D[:, b] = column
+            return D
+
+        data, indices = [], []
+        indptr = np.zeros(n_beamlets + 1, dtype=np.int64)
         for b in range(n_beamlets):
-            D[:, b] = self.dose_for_beamlet(b).ravel()
-        return D
+            column = self.dose_for_beamlet(b).ravel()
+            keep = np.flatnonzero(np.abs(column) > rel_tol * np.abs(column).max())
+            data.append(column[keep])
+            indices.append(keep)
+            indptr[b + 1] = indptr[b] + keep.size
+        return scipy.sparse.csc_matrix(
+            (
+                np.concatenate(data) if data else np.zeros(0),
+                np.concatenate(indices) if indices else np.zeros(0, dtype=np.int64),
+                indptr,
+            ),
+            shape=(n_voxels, n_beamlets),
+        )
@@ -0,0 +1,84 @@
+"""
+Worker threads for independent solves on the native numerics backend.
+
+HierarchicalBayes' E-step phases and BootstrapPhaseOptimizer's refits are
+independent solves that may share read-only data (a dose matrix, structure
+masks). Only the native backend gains from running them on threads: its
+kernels release the GIL, and each worker caps its kernel threads at its
+share of the cores (set_thread_limit) so W concurrent solves don't start
+W x cores threads. The Python backend's per-voxel loops hold the GIL, so
+there the solves run one after another on the calling thread whatever was
+requested (see hierarchical_bayes for the measurements). Results come back
+in task order, so a parallel run reproduces the serial one bit for bit.
+"""
+
+from __future__ import annotations
+
+import os
+from concurrent.futures import ThreadPoolExecutor
+from typing import Callable, Iterable, List, Optional, TypeVar
+
+from .numerics.backend import native
+
+
+T = TypeVar("T")
+R = TypeVar("R")
+
+
+def requested_workers(n_workers: Optional[int], n_tasks: int) -> int:
+    """Workers asked for (None: one per core), at most one per task."""
+    if n_workers is None:
+        return min(n_tasks, os.cpu_count() or 1)
+    return min(n_tasks, int(n_workers))
+
+
+def worker_count(n_workers: Optional[int], n_tasks: int) -> int:
+    """Threads to run on: the request on the native backend, else 1."""
+    if native() is None:
+        return 1
+    return requested_workers(n_workers, n_tasks)
+
+
+def kernel_threads_per_worker(n_workers: int) -> int:
+    """Each worker's share of the kernel threads (BRIMSTONE_THREADS or cores)."""
+    n_threads = int(os.environ.get("BRIMSTONE_THREADS", 0)) or os.cpu_count() or 1
+    return max(1, n_threads // n_workers)
+
+
+class WorkerPool:
+    """
+    Maps solves over n_workers threads, each with its capped share of the
+    native kernel threads; with one worker, maps serially on the calling
+    thread. Use as a context manager, so one pool can serve several maps.
+    """
+
+    def __init__(self, n_workers: int):
+        self.n_workers = max(1, int(n_workers))
+        self._executor: Optional[ThreadPoolExecutor] = None
+
+    def __enter__(self) -> "WorkerPool":
+        if self.n_workers > 1:
+            self._executor = ThreadPoolExecutor(max_workers=self.n_workers)
+        return self
+
+    def __exit__(self, *exc) -> bool:
+        if self._executor is not None:
+            self._executor.shutdown(wait=True)
+            self._executor = None
+        return False
+
+    def map(self, fn: Callable[[T], R], items: Iterable[T]) -> List[R]:
+        """fn over items, results in item order."""
+        if self._executor is None:
+            return [fn(item) for item in items]
+
+        kernels = native()
+        n_threads = kernel_threads_per_worker(self.n_workers)
+
+        def run(item):
+            # the cap is per thread, so set it on the pool thread itself
+            if kernels is not None:
+                kernels.set_thread_limit(n_threads)
+            return fn(item)
+
+        return list(self._executor.map(run, items))
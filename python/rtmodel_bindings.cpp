@@ -31,6 +31,8 @@
 #include "Structure.h"
 #include "VectorN.h"
 #include "ConjGradOptimizer.h"
+#include "Profiler.h"
+#include "MemoryAccount.h"
 
 namespace py = pybind11;
 using namespace dH;
@@ -87,6 +89,45 @@ public:
         return (*m_presc)(vInput, nullptr);
     }
 
+    // Evaluate a batch of points, one per row of x (n_points, n)
+    // Returns tuple: (values, gradients) -- gradients is None unless with_grad
+    std::tuple<py::array_t<double>, py::object> evaluate_batch(py::array_t<double> x, bool with_grad) {
+        py::buffer_info buf = x.request();
+
+        if (buf.ndim != 2)
+            throw std::runtime_error("Input must be 2-dimensional (n_points, n)");
+
+        const int nPoints = (int) buf.shape[0];
+        const int n = (int) buf.shape[1];
+        auto x_c = py::array_t<double, py::array::c_style | py::array::forcecast>::ensure(x);
+        const double* x_ptr = x_c.data();
+
+        std::vector< CVectorN<> > arrInputs(nPoints, CVectorN<>(n));
+        for (int nAt = 0; nAt < nPoints; nAt++) {
+            for (int i = 0; i < n; i++) {
+                arrInputs[nAt][i] = x_ptr[nAt * n + i];
+            }
+        }
+
+        CVectorN<> vValues;
+        std::vector< CVectorN<> > arrGrads;
+        m_presc->EvaluateBatch(arrInputs, vValues, with_grad ? &arrGrads : nullptr);
+
+        py::object grads = py::none();
+        if (with_grad) {
+            auto grads_np = py::array_t<double>({nPoints, n});
+            double* grad_ptr = grads_np.mutable_data();
+            for (int nAt = 0; nAt < nPoints; nAt++) {
+                for (int i = 0; i < n; i++) {
+                    grad_ptr[nAt * n + i] = arrGrads[nAt][i];
+                }
+            }
+            grads = grads_np;
+        }
+
+        return std::make_tuple(vector_to_numpy(vValues), grads);
+    }
+
     // Get dimension of the problem
     int get_dimension() const {
         return m_presc->get_number_of_unknowns();
@@ -129,6 +170,35 @@ CVectorN<> numpy_to_vector(py::array_t<double> arr) {
     return result;
 }
 
+// Helper to convert a memory report to a dict of totals and items
+py::dict memory_report_to_dict(const dH::MemoryReport& report) {
+    std::vector<dH::MemoryReport::Item> items;
+    report.GetItems(items);
+
+    py::list item_list;
+    for (size_t i = 0; i < items.size(); i++) {
+        py::dict item;
+        item["category"] = dH::GetMemoryCategoryName(items[i].m_nCategory);
+        item["level"] = items[i].m_owner.m_nLevel;
+        item["beam"] = items[i].m_owner.m_nBeam;
+        item["structure"] = items[i].m_owner.m_strStructure;
+        item["buffers"] = items[i].m_nBuffers;
+        item["bytes"] = items[i].m_nBytes;
+        item_list.append(item);
+    }
+
+    py::dict totals;
+    for (int nCategory = 0; nCategory < dH::MEMORY_CATEGORY_COUNT; nCategory++) {
+        totals[dH::GetMemoryCategoryName(nCategory)] = report.GetTotal(nCategory);
+    }
+
+    py::dict result;
+    result["total"] = report.GetTotal();
+    result["totals"] = totals;
+    result["items"] = item_list;
+    return result;
+}
+
 PYBIND11_MODULE(rtmodel_core, m) {
     m.doc() = "RtModel Python bindings for variational Bayes optimization";
 
@@ -162,7 +232,17 @@ PYBIND11_MODULE(rtmodel_core, m) {
         .def("get_number_of_unknowns", &Prescription::get_number_of_unknowns)
         .def("set_gbin_var", &Prescription::SetGBinVar,
              py::arg("var_min"), py::arg("var_max"),
-             "Set adaptive variance parameters");
+             "Set adaptive variance parameters")
+        .def("memory_report", [](const Prescription& presc, int level) {
+            dH::MemoryReport report;
+            presc.AccountMemory(report, level);
+            return memory_report_to_dict(report);
+        }, py::arg("level") = 0,
+           "Bytes held by the sum volume, histograms and structures, by owner")
+        .def("set_lean", &Prescription::SetLean, py::arg("lean") = true,
+             "Recompute dVolume x region products instead of storing them")
+        .def("release_caches", &Prescription::ReleaseCaches,
+             "Free helper volumes; they are recomputed on next evaluation");
 
     // Expose PrescriptionWrapper for easy Python optimization
     py::class_<PrescriptionWrapper>(m, "PrescriptionWrapper")
@@ -171,6 +251,9 @@ PYBIND11_MODULE(rtmodel_core, m) {
              "Evaluate objective function and gradient")
         .def("evaluate_value", &PrescriptionWrapper::evaluate_value,
              "Evaluate objective function value only")
+        .def("evaluate_batch", &PrescriptionWrapper::evaluate_batch,
+             py::arg("x"), py::arg("with_grad") = false,
+             "Evaluate the objective (and optionally gradient) at each row of x")
         .def("get_dimension", &PrescriptionWrapper::get_dimension)
         .def("get_prescription", &PrescriptionWrapper::get_prescription,
              py::return_value_policy::reference);
@@ -204,6 +287,28 @@ PYBIND11_MODULE(rtmodel_core, m) {
              "Per-parameter adaptive variance (sigma_weights). Required by "
              "the hierarchical-Bayes outer loop; see HIERARCHICAL_BAYES_DESIGN.md.");
 
+    // Per-stage profiler (see Profiler.h); also enabled by BRIMSTONE_PROFILE
+    m.def("profiler_enable", [](bool enable) {
+        dH::Profiler::GetInstance().Enable(enable);
+    }, py::arg("enable") = true, "Turn per-stage profiling on or off");
+    m.def("profiler_reset", []() {
+        dH::Profiler::GetInstance().Reset();
+    }, "Discard recorded profile events");
+    m.def("profiler_write_trace", [](const std::string& path) {
+        return dH::Profiler::GetInstance().WriteChromeTrace(path.c_str());
+    }, py::arg("path"), "Write recorded events as Chrome/Perfetto trace JSON");
+    m.def("profiler_summary", []() {
+        return dH::Profiler::GetInstance().GetSummary();
+    }, "Per-stage, per-level table of count, total, mean, max and bytes");
+
+    // Memory budget (see MemoryAccount.h); also set by BRIMSTONE_MEMORY_BUDGET_MB
+    m.def("memory_set_budget", [](size_t bytes) {
+        dH::SetMemoryBudget(bytes);
+    }, py::arg("bytes"), "Set the memory budget in bytes (0 for none)");
+    m.def("memory_get_budget", []() {
+        return dH::GetMemoryBudget();
+    }, "The memory budget in bytes (0 for none)");
+
     // Helper functions
     m.def("vector_to_numpy", &vector_to_numpy, "Convert CVectorN to numpy array");
     m.def("numpy_to_vector", &numpy_to_vector, "Convert numpy array to CVectorN");
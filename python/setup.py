@@ -1,11 +1,18 @@
 """
-Build script for rtmodel_core - pybind11 bindings for the RtModel C++ library.
+Build script for rtmodel_core - pybind11 bindings for the RtModel C++ library -
+and for pybrimstone.numerics._kernels, the compiled histogram / KL kernels.
 
 Copyright (C) 2nd Messenger Systems - U. S. Patent 7,369,645
 
-WINDOWS ONLY. RtModel is built against MFC (Dynamic linkage), Intel IPP, ITK
-and VNL, none of which compile with GCC/Clang, so this extension can only be
-produced with MSVC (the v143 toolset, matching RtModel.vcxproj).
+rtmodel_core is WINDOWS ONLY. RtModel is built against MFC (Dynamic linkage),
+Intel IPP, ITK and VNL, none of which compile with GCC/Clang, so this extension
+can only be produced with MSVC (the v143 toolset, matching RtModel.vcxproj).
+
+pybrimstone.numerics._kernels (numerics_kernels.cpp) has no RtModel library
+dependencies and is built on every platform; on Linux/macOS it is the only
+extension built. It is optional: if it fails to compile (or pybind11 is
+missing, off Windows), the install goes ahead with the pure-Python package,
+and pybrimstone.numerics falls back to its NumPy reference.
 
 Build model
 -----------
@@ -34,24 +41,23 @@ from pathlib import Path
 
 from setuptools import setup
 
+# ---------------------------------------------------------------------------
+# Platform guard -- rtmodel_core needs MSVC; elsewhere only the portable
+# numerics kernels are built.
+# ---------------------------------------------------------------------------
+IS_WINDOWS = sys.platform.startswith("win")
+
 try:
     from pybind11.setup_helpers import Pybind11Extension, build_ext
 except ImportError:  # pragma: no cover - build dependency
-    sys.exit(
-        "pybind11 is required to build rtmodel_core. Install the build "
-        "dependencies first:\n    pip install pybind11 setuptools wheel numpy"
-    )
-
-# ---------------------------------------------------------------------------
-# Platform guard -- fail early and clearly rather than deep inside the compiler.
-# ---------------------------------------------------------------------------
-if not sys.platform.startswith("win"):
-    sys.exit(
-        "rtmodel_core can only be built on Windows with MSVC.\n"
-        "RtModel depends on MFC, Intel IPP, ITK and VNL, which are not\n"
-        "available to GCC/Clang. On Linux/macOS use the pure-Python\n"
-        "'pybrimstone' package instead (no compiled extension required)."
-    )
+    if IS_WINDOWS:
+        sys.exit(
+            "pybind11 is required to build rtmodel_core. Install the build "
+            "dependencies first:\n    pip install pybind11 setuptools wheel numpy"
+        )
+    # only the optional kernels would be built; install without them
+    Pybind11Extension = None
+    from setuptools.command.build_ext import build_ext
 
 
 def env_path(name: str, default: str) -> str:
@@ -118,7 +124,11 @@ def lib_names(directory: str, patterns):
 # the failure is a clear message rather than an obscure linker error.
 libraries = ["RtModel"]
 rtmodel_lib = os.path.join(RTMODEL_LIB_DIR, "RtModel.lib")
-if not os.path.exists(rtmodel_lib) and "RTMODEL_SKIP_LIBCHECK" not in os.environ:
+if (
+    IS_WINDOWS
+    and not os.path.exists(rtmodel_lib)
+    and "RTMODEL_SKIP_LIBCHECK" not in os.environ
+):
     sys.exit(
         f"RtModel.lib not found at {rtmodel_lib}.\n"
         "Build it first (step 1 in this file's docstring), or point\n"
@@ -173,22 +183,48 @@ extra_compile_args = [
     "/wd4996",      # silence CRT/STL deprecation noise from old RtModel code
 ]
 
-ext_modules = [
-    Pybind11Extension(
-        "rtmodel_core",
-        sources=["rtmodel_bindings.cpp"],
-        include_dirs=include_dirs,
-        library_dirs=library_dirs,
-        libraries=libraries,
-        define_macros=define_macros,
-        extra_compile_args=extra_compile_args,
-        cxx_std=17,
-        language="c++",
-    ),
-]
+# The numerics kernels only need RtModel's header-only ParallelFor.h. They are
+# optional: a compile failure is reported as a warning and the package is
+# installed without them.
+ext_modules = []
+if Pybind11Extension is not None:
+    ext_modules.append(
+        Pybind11Extension(
+            "pybrimstone.numerics._kernels",
+            sources=["numerics_kernels.cpp"],
+            include_dirs=[RTMODEL_INCLUDE],
+            extra_compile_args=(
+                ["/O2", "/EHsc", "/MD"] if IS_WINDOWS else ["-O3"]
+            ),
+            cxx_std=17,
+            language="c++",
+            optional=True,
+        )
+    )
+else:
+    print(
+        "warning: pybind11 not found; pybrimstone.numerics._kernels is not "
+        "built (the NumPy reference is used instead)",
+        file=sys.stderr,
+    )
+
+if IS_WINDOWS:
+    ext_modules.append(
+        Pybind11Extension(
+            "rtmodel_core",
+            sources=["rtmodel_bindings.cpp"],
+            include_dirs=include_dirs,
+            library_dirs=library_dirs,
+            libraries=libraries,
+            define_macros=define_macros,
+            extra_compile_args=extra_compile_args,
+            cxx_std=17,
+            language="c++",
+        )
+    )
 
 # Package metadata (name, version, dependencies, ...) lives in pyproject.toml.
-# setup.py only contributes the compiled extension so the two don't collide.
+# setup.py only contributes the compiled extensions so the two don't collide.
 setup(
     ext_modules=ext_modules,
     cmdclass={"build_ext": build_ext},
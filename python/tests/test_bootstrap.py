@@ -9,6 +9,7 @@ multi-seed sweep that takes longer than a unit test should.
 """
 
 import sys
+import threading
 from pathlib import Path
 
 import numpy as np
@@ -16,7 +17,12 @@ import pytest
 
 sys.path.insert(0, str(Path(__file__).parent.parent))
 
-from pybrimstone.bootstrap import BootstrapPhaseOptimizer, subsample_mask
+from pybrimstone import workers
+from pybrimstone.bootstrap import (
+    BootstrapPhaseOptimizer,
+    subsample_mask,
+    subsample_voxel_weights,
+)
 from pybrimstone.course_prior import CoursePriorTerm
 from pybrimstone.dose_calc import gaussian_bump_dose_operator
 from pybrimstone.hierarchical_bayes import HierarchicalBayes
@@ -176,6 +182,163 @@ class TestBootstrapPhaseOptimizer:
         assert not np.allclose(var_a, var_b)
 
 
+# ---------------------------------------------------------------------------
+# Shared-data resampling
+# ---------------------------------------------------------------------------
+
+_OPT_KWARGS = dict(
+    n_bootstrap=6, max_iter=15, tol=1e-2,
+    adaptive_variance=(0.01, 0.1), bootstrap_seed=3,
+)
+
+
+class TestSharedDataBootstrap:
+    def test_voxel_weights_subsample_each_structure(self):
+        factory, _ = _make_factory()
+        p = factory(None)
+        small = np.zeros(125)
+        small[[0, 1]] = 1.0
+        p.add_dose_term(KLDivTerm.from_interval(
+            small, dose_min=0.0, dose_max=0.1, bin_width=0.05,
+        ))
+        w = subsample_voxel_weights(p, fraction=0.5, rng=np.random.default_rng(0))
+        assert len(w) == 2
+        assert all(set(np.unique(wi)) <= {0.0, 1.0} for wi in w)
+        # ceil(0.5 * 27) PTV voxels and ceil(0.5 * 2) of the small structure
+        assert int((w[0] * p.dose_terms[0].structure_mask).sum()) == 14
+        assert int((w[1] * small).sum()) == 1
+
+    def test_overlapping_structures_keep_their_fraction(self):
+        # two structures sharing most of their voxels: with one united
+        # weight vector each would keep the voxels the other drew too
+        n_voxels = 200
+        D = np.eye(n_voxels)[:, :4]
+        p = Prescription(D)
+        a = np.zeros(n_voxels)
+        a[:120] = 1.0
+        b = np.zeros(n_voxels)
+        b[20:140] = 1.0
+        for mask in (a, b):
+            p.add_dose_term(KLDivTerm.from_interval(
+                mask, dose_min=0.0, dose_max=0.1, bin_width=0.05,
+            ))
+        for seed in range(5):
+            w = subsample_voxel_weights(p, fraction=0.25, rng=np.random.default_rng(seed))
+            sub = p.resampled(w)
+            assert int(sub.dose_terms[0].structure_mask.sum()) == 30
+            assert int(sub.dose_terms[1].structure_mask.sum()) == 30
+
+    def test_voxel_weights_need_dose_terms(self):
+        factory, _ = _make_factory()
+        p = factory(None)
+        p.dose_terms.clear()
+        with pytest.raises(ValueError, match="no dose terms"):
+            subsample_voxel_weights(p, rng=np.random.default_rng(0))
+
+    def test_resampled_shares_dose_operator(self):
+        factory, _ = _make_factory()
+        p = factory(None)
+        w = subsample_voxel_weights(p, rng=np.random.default_rng(0))
+        sub = p.resampled(w)
+        assert sub._dose_matrix is p._dose_matrix
+        assert p.resampled().dose_terms[0] is p.dose_terms[0]
+        np.testing.assert_array_equal(
+            sub.dose_terms[0].structure_mask, p.dose_terms[0].structure_mask * w[0]
+        )
+        with pytest.raises(ValueError, match="per dose term"):
+            p.resampled(w + w)
+
+    def test_matches_factory_resampling(self):
+        # one structure: the voxel weights pick exactly the voxels the
+        # fixture factory's subsample_mask picks from the same rng
+        factory, n = _make_factory()
+        via_factory = BootstrapPhaseOptimizer(factory, n_params=n, **_OPT_KWARGS)
+        shared = BootstrapPhaseOptimizer.from_prescription(
+            factory(None), n_params=n, warm_start=False, **_OPT_KWARGS
+        )
+        mu_a, var_a = via_factory(prior=None)
+        mu_b, var_b = shared(prior=None)
+        np.testing.assert_array_equal(mu_a, mu_b)
+        np.testing.assert_array_equal(var_a, var_b)
+
+    @pytest.mark.parametrize("warm_start", [False, True])
+    def test_parallel_matches_serial(self, warm_start):
+        factory, n = _make_factory()
+        prior = CoursePriorTerm(target_mu=np.zeros(n), precision=0.1)
+        results = []
+        for n_workers in (1, 3):
+            opt = BootstrapPhaseOptimizer.from_prescription(
+                factory(None), n_params=n, warm_start=warm_start,
+                n_workers=n_workers, **_OPT_KWARGS
+            )
+            results.append(opt(prior=prior))
+        (mu_1, var_1), (mu_3, var_3) = results
+        np.testing.assert_array_equal(mu_1, mu_3)
+        np.testing.assert_array_equal(var_1, var_3)
+
+    def test_native_caps_kernel_threads_per_worker(self, monkeypatch):
+        limits = {}
+
+        class FakeKernels:
+            def set_thread_limit(self, n_threads):
+                limits[threading.get_ident()] = n_threads
+                return 0
+
+        kernels = FakeKernels()
+        monkeypatch.setattr(workers, "native", lambda: kernels)
+        monkeypatch.setenv("BRIMSTONE_THREADS", "8")
+        factory, n = _make_factory()
+        opt = BootstrapPhaseOptimizer.from_prescription(
+            factory(None), n_params=n, n_workers=3, **_OPT_KWARGS
+        )
+        assert opt._worker_count() == 3
+        opt(prior=None)
+        assert limits
+        assert threading.get_ident() not in limits
+        assert set(limits.values()) == {8 // 3}
+
+    def test_python_backend_runs_serially(self, monkeypatch):
+        monkeypatch.setattr(workers, "native", lambda: None)
+        threads = set()
+        factory, n = _make_factory()
+
+        def recording_factory(rng):
+            threads.add(threading.get_ident())
+            return factory(rng)
+
+        opt = BootstrapPhaseOptimizer(
+            recording_factory, n_params=n, n_workers=3, **_OPT_KWARGS
+        )
+        assert opt._worker_count() == 1
+        opt(prior=None)
+        assert threads == {threading.get_ident()}
+
+    def test_warm_start_runs_from_full_data_solution(self):
+        factory, n = _make_factory()
+        opt = BootstrapPhaseOptimizer.from_prescription(
+            factory(None), n_params=n, **_OPT_KWARGS
+        )
+        assert opt.warm_start
+        mu_p, var_p = opt(prior=None)
+        assert np.all(np.isfinite(mu_p))
+        assert np.all(var_p > 0)
+
+    def test_prescription_not_modified(self):
+        factory, n = _make_factory()
+        p = factory(None)
+        opt = BootstrapPhaseOptimizer.from_prescription(p, n_params=n, **_OPT_KWARGS)
+        opt(prior=CoursePriorTerm(target_mu=np.zeros(n), precision=0.1))
+        assert p.beamlet_terms == []
+        assert len(p.dose_terms) == 1
+
+    def test_rejects_bad_arguments(self):
+        factory, n = _make_factory()
+        with pytest.raises(ValueError, match="fraction"):
+            BootstrapPhaseOptimizer.from_prescription(factory(None), n, fraction=0.0)
+        with pytest.raises(ValueError, match="n_workers"):
+            BootstrapPhaseOptimizer(factory, n_params=n, n_workers=0)
+
+
 # ---------------------------------------------------------------------------
 # Integration with HierarchicalBayes
 # ---------------------------------------------------------------------------
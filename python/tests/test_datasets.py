@@ -26,7 +26,9 @@ from pybrimstone.datasets import (
     make_phase_optimizers,
     mask_from_voxel_list,
     planning_case_from_submatrices,
+    read_influence_matrix,
     synthesize_course,
+    write_influence_matrix,
 )
 from pybrimstone.dvh_uncertainty import compute_dose, dvh_uncertainty_bands
 from pybrimstone.hierarchical_bayes import HierarchicalBayes
@@ -335,6 +337,61 @@ class TestLoadCortCase:
             load_cort_case(case_dir, dose_key="NOPE")
 
 
+# ---------------------------------------------------------------------------
+# Influence-matrix file for the C++ engine -- write / read round trip
+# ---------------------------------------------------------------------------
+
+class TestInfluenceMatrixFile:
+    def test_round_trip_dense(self, tmp_path):
+        case = _toy_case(12, 5)
+        path = write_influence_matrix(
+            case, tmp_path / "toy.dhim", beam_of_beamlet=[0, 0, 1, 1, 1]
+        )
+        back = read_influence_matrix(path)
+        assert back.n_voxels == 12
+        assert back.n_beamlets == 5
+        recovered = back.dose_matrix.toarray() if back.is_sparse else back.dose_matrix
+        # values are stored single precision
+        assert np.allclose(recovered, case.dose_matrix, atol=1e-6)
+        for name, mask in case.structures.items():
+            assert np.array_equal(back.structures[name], mask)
+        assert back.meta["beam_of_beamlet"].tolist() == [0, 0, 1, 1, 1]
+        assert back.meta["targets"] == ["PTV"]
+
+    def test_round_trip_sparse_drops_zeros(self, tmp_path):
+        sp = pytest.importorskip("scipy.sparse")
+        D = np.array([[1.0, 0.0], [0.0, 0.0], [0.25, 2.0]])
+        case = PlanningCase(
+            name="sparse",
+            dose_matrix=sp.csr_matrix(D),
+            structures={"OAR": np.array([True, True, False])},
+        )
+        path = write_influence_matrix(case, tmp_path / "sparse.dhim")
+        back = read_influence_matrix(path)
+        assert back.dose_matrix.nnz == 3
+        assert np.allclose(back.dose_matrix.toarray(), D)
+        assert back.meta["beam_of_beamlet"].tolist() == [0, 0]
+        assert back.meta["targets"] == []
+
+    def test_bad_beam_count_raises(self, tmp_path):
+        with pytest.raises(ValueError, match="beam_of_beamlet"):
+            write_influence_matrix(
+                _toy_case(12, 5), tmp_path / "bad.dhim", beam_of_beamlet=[0, 1]
+            )
+
+    def test_truncated_file_raises(self, tmp_path):
+        path = write_influence_matrix(_toy_case(12, 5), tmp_path / "toy.dhim")
+        path.write_bytes(path.read_bytes()[:-8])
+        with pytest.raises(ValueError, match="truncated"):
+            read_influence_matrix(path)
+
+    def test_not_influence_file_raises(self, tmp_path):
+        path = tmp_path / "junk.dhim"
+        path.write_bytes(b"\0" * 64)
+        with pytest.raises(ValueError, match="not an influence-matrix"):
+            read_influence_matrix(path)
+
+
 # ---------------------------------------------------------------------------
 # End-to-end integration: case -> phases -> HierarchicalBayes / DVH bands
 # ---------------------------------------------------------------------------
@@ -26,6 +26,7 @@ from pybrimstone.dvh_uncertainty import (
     compute_dose,
     compute_dvh,
     compute_dvh_bands,
+    compute_dvh_batch,
     dvh_uncertainty_bands,
     plot_dvh_bands,
     sample_phase_posterior,
@@ -280,6 +281,106 @@ class TestDvhUncertaintyBandsPipeline:
             assert bins.size == 100
 
 
+# ---------------------------------------------------------------------------
+# Batched engine
+# ---------------------------------------------------------------------------
+
+class TestBatchedEngine:
+    @staticmethod
+    def _case(n_voxels=400, n_beamlets=12, seed=0):
+        rng = np.random.default_rng(seed)
+        D = np.abs(rng.normal(size=(n_voxels, n_beamlets)))
+        D[rng.uniform(size=D.shape) < 0.7] = 0.0
+        mu_p = np.abs(rng.normal(loc=1.0, scale=0.3, size=n_beamlets))
+        var_p = np.full(n_beamlets, 0.05)
+        structures = {
+            "PTV": rng.uniform(size=n_voxels) < 0.3,
+            "OAR": rng.uniform(size=n_voxels) < 0.2,  # overlaps the PTV
+            "Point": np.arange(n_voxels) == 7,
+        }
+        return D, mu_p, var_p, structures
+
+    def test_dvh_batch_matches_per_sample(self):
+        D, mu_p, var_p, structures = self._case()
+        samples = sample_phase_posterior(mu_p, var_p, 20, rng=np.random.default_rng(1))
+        doses = compute_dose(D, samples)
+        bins = np.concatenate([[0.0, 0.0], np.linspace(0.0, doses.max(), 50)])
+        bins.sort()
+        batch = compute_dvh_batch(doses, structures, bins)
+        for name, mask in structures.items():
+            assert batch[name].shape == (20, bins.size)
+            for k in range(20):
+                np.testing.assert_array_equal(
+                    batch[name][k], compute_dvh(doses[k], mask, bins)
+                )
+
+    def test_dvh_batch_rejects_unsorted_bins(self):
+        with pytest.raises(ValueError, match="non-decreasing"):
+            compute_dvh_batch(np.ones((2, 3)), {"A": np.ones(3)}, np.array([1.0, 0.0]))
+
+    def test_dvh_batch_rejects_empty_structure(self):
+        with pytest.raises(ValueError, match="empty"):
+            compute_dvh_batch(np.ones((2, 3)), {"A": np.zeros(3)}, np.array([0.0]))
+
+    @pytest.mark.parametrize("batch_size", [1, 7, 256])
+    def test_bands_match_reference(self, batch_size):
+        D, mu_p, var_p, structures = self._case()
+        bins = np.linspace(0.0, 8.0, 60)
+        result = dvh_uncertainty_bands(
+            mu_p, var_p, D, structures, n_samples=50, dose_bins=bins,
+            rng=np.random.default_rng(2), batch_size=batch_size,
+        )
+        doses = compute_dose(
+            D, sample_phase_posterior(mu_p, var_p, 50, rng=np.random.default_rng(2))
+        )
+        for name, mask in structures.items():
+            np.testing.assert_array_equal(
+                result[name][1], compute_dvh_bands(doses, mask, bins)
+            )
+
+    def test_sparse_operator_matches_dense(self):
+        scipy_sparse = pytest.importorskip("scipy.sparse")
+        D, mu_p, var_p, structures = self._case()
+        samples = sample_phase_posterior(mu_p, var_p, 9, rng=np.random.default_rng(3))
+        S = scipy_sparse.csc_matrix(D)
+        np.testing.assert_allclose(compute_dose(S, samples), compute_dose(D, samples))
+        np.testing.assert_allclose(compute_dose(S, samples[0]), compute_dose(D, samples[0]))
+        bins = np.linspace(0.0, 8.0, 40)
+        dense = dvh_uncertainty_bands(
+            mu_p, var_p, D, structures, n_samples=30, dose_bins=bins,
+            rng=np.random.default_rng(4),
+        )
+        sparse = dvh_uncertainty_bands(
+            mu_p, var_p, S, structures, n_samples=30, dose_bins=bins,
+            rng=np.random.default_rng(4),
+        )
+        for name in structures:
+            np.testing.assert_allclose(sparse[name][1], dense[name][1])
+
+    def test_low_rank_covariance(self):
+        mu_p = np.zeros(3)
+        var_p = np.full(3, 0.01)
+        factor = np.array([[1.0], [1.0], [0.0]])
+        samples = sample_phase_posterior(
+            mu_p, var_p, 40000, rng=np.random.default_rng(5), cov_factor=factor
+        )
+        expected = np.diag(var_p) + factor @ factor.T
+        np.testing.assert_allclose(np.cov(samples.T), expected, atol=0.03)
+
+    def test_low_rank_keeps_diagonal_draws(self):
+        mu_p = np.ones(4)
+        var_p = np.full(4, 0.2)
+        plain = sample_phase_posterior(mu_p, var_p, 5, rng=np.random.default_rng(6))
+        zero_factor = sample_phase_posterior(
+            mu_p, var_p, 5, rng=np.random.default_rng(6), cov_factor=np.zeros((4, 2))
+        )
+        np.testing.assert_array_equal(plain, zero_factor)
+
+    def test_rejects_bad_cov_factor(self):
+        with pytest.raises(ValueError, match="cov_factor"):
+            sample_phase_posterior(np.zeros(3), np.ones(3), 2, cov_factor=np.ones((2, 1)))
+
+
 # ---------------------------------------------------------------------------
 # Integration with HierarchicalBayes (Step 3) output
 # ---------------------------------------------------------------------------
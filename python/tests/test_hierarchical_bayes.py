@@ -11,6 +11,7 @@ Three test groups:
 """
 
 import sys
+import threading
 from pathlib import Path
 
 import numpy as np
@@ -19,6 +20,7 @@ import pytest
 sys.path.insert(0, str(Path(__file__).parent.parent))
 
 from pybrimstone.course_prior import CoursePriorTerm
+from pybrimstone import workers
 from pybrimstone.hierarchical_bayes import HierarchicalBayes, pool_phases
 
 # Import the Step-1 reference CG implementation for the integration test.
@@ -369,3 +371,96 @@ class TestHierarchicalBayesWithCG:
         for h in result["history"]:
             assert np.all(np.isfinite(h["var_eta"]))
             assert np.all(h["var_eta"] > 0)
+
+
+class _FakeKernels:
+    """Stands in for the native kernels; records each thread's cap."""
+
+    def __init__(self):
+        self.limits = {}
+
+    def set_thread_limit(self, n_threads):
+        self.limits[threading.get_ident()] = n_threads
+        return 0
+
+
+class TestParallelEStep:
+    """n_workers > 1 solves the phases concurrently; results must not change."""
+
+    @pytest.fixture(autouse=True)
+    def fake_native(self, monkeypatch):
+        # the pool is only used on the native backend
+        kernels = _FakeKernels()
+        monkeypatch.setattr(workers, "native", lambda: kernels)
+        return kernels
+
+    @staticmethod
+    def _run(n_workers, n_phases=6):
+        rng = np.random.default_rng(7)
+        zs = [rng.normal(size=4) for _ in range(n_phases)]
+        x0 = np.zeros(4)
+        phase_opts = [TestHierarchicalBayesWithCG._make_cg_phase(z, x0) for z in zs]
+        priors = [
+            CoursePriorTerm(target_mu=np.zeros(4), precision=0.5)
+            for _ in zs
+        ]
+        driver = HierarchicalBayes(phase_opts, priors, n_workers=n_workers)
+        return driver.run(max_outer_iters=8, tol=1e-6)
+
+    @pytest.mark.parametrize("n_workers", [3, None])
+    def test_parallel_matches_serial_exactly(self, n_workers):
+        serial = self._run(n_workers=1)
+        parallel = self._run(n_workers=n_workers)
+        assert parallel["outer_iters"] == serial["outer_iters"]
+        assert parallel["converged"] == serial["converged"]
+        np.testing.assert_array_equal(parallel["mu_eta"], serial["mu_eta"])
+        np.testing.assert_array_equal(parallel["var_eta"], serial["var_eta"])
+        for h_par, h_ser in zip(parallel["history"], serial["history"]):
+            for m_par, m_ser in zip(h_par["phase_mus"], h_ser["phase_mus"]):
+                np.testing.assert_array_equal(m_par, m_ser)
+
+    def test_native_caps_kernel_threads_per_worker(self, fake_native, monkeypatch):
+        monkeypatch.setenv("BRIMSTONE_THREADS", "8")
+        self._run(n_workers=3)
+        assert fake_native.limits
+        assert threading.get_ident() not in fake_native.limits
+        assert set(fake_native.limits.values()) == {8 // 3}
+
+    def test_python_backend_runs_serially(self, monkeypatch):
+        monkeypatch.setattr(workers, "native", lambda: None)
+        threads = set()
+
+        def phase(prior):
+            threads.add(threading.get_ident())
+            return np.zeros(2), np.ones(2)
+
+        priors = [CoursePriorTerm(target_mu=np.zeros(2), precision=1.0) for _ in range(3)]
+        driver = HierarchicalBayes([phase, lambda p: phase(p), lambda p: phase(p)],
+                                   priors, n_workers=3)
+        assert driver._worker_count() == 1
+        driver.run(max_outer_iters=2)
+        assert threads == {threading.get_ident()}
+
+    def test_phase_error_propagates(self):
+        def failing(prior):
+            raise RuntimeError("phase failed")
+
+        ok = TestHierarchicalBayes._analytical_phase(np.zeros(2))
+        priors = [CoursePriorTerm(target_mu=np.zeros(2), precision=1.0) for _ in range(2)]
+        driver = HierarchicalBayes([ok, failing], priors, n_workers=2)
+        with pytest.raises(RuntimeError, match="phase failed"):
+            driver.run(max_outer_iters=2)
+
+    def test_rejects_shared_optimizer(self):
+        opt = TestHierarchicalBayes._analytical_phase(np.zeros(2))
+        priors = [CoursePriorTerm(target_mu=np.zeros(2), precision=1.0) for _ in range(2)]
+        with pytest.raises(ValueError, match="distinct"):
+            HierarchicalBayes([opt, opt], priors, n_workers=2)
+        # serially the same callable may serve several phases
+        HierarchicalBayes([opt, opt], priors, n_workers=1).run(max_outer_iters=2)
+
+    def test_rejects_bad_worker_count(self):
+        opt = TestHierarchicalBayes._analytical_phase(np.zeros(2))
+        prior = CoursePriorTerm(target_mu=np.zeros(2), precision=1.0)
+        with pytest.raises(ValueError, match="n_workers"):
+            HierarchicalBayes([opt], [prior], n_workers=0)
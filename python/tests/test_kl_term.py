@@ -184,3 +184,38 @@ class TestKLDivTermCrossEntropy:
         c_default, _ = default_term.evaluate(dose)
         c_ce, _ = ce_term.evaluate(dose)
         assert not np.isclose(c_default, c_ce)
+
+
+# ---------------------------------------------------------------------------
+# Batched evaluation
+# ---------------------------------------------------------------------------
+
+class TestKLDivTermBatch:
+    """evaluate_batch must match evaluate() row by row."""
+
+    @pytest.mark.parametrize("cross_entropy", [False, True])
+    def test_batch_matches_rows(self, cross_entropy):
+        rng = np.random.default_rng(7)
+        term, _ = _basic_kl_term(rng, n_voxels=60, cross_entropy=cross_entropy)
+        # rows spanning different dose ranges give different histogram lengths
+        doses = rng.uniform(0.0, 1.0, size=(6, 60)) * np.linspace(0.3, 1.5, 6)[:, None]
+        costs, grads = term.evaluate_batch(doses)
+        assert costs.shape == (6,)
+        assert grads.shape == doses.shape
+        for b in range(6):
+            cost, grad = term.evaluate(doses[b])
+            assert costs[b] == pytest.approx(cost, rel=1e-10, abs=1e-12)
+            np.testing.assert_allclose(grads[b], grad, rtol=1e-8, atol=1e-12)
+
+    def test_cost_only(self):
+        rng = np.random.default_rng(8)
+        term, _ = _basic_kl_term(rng)
+        doses = rng.uniform(0.2, 1.1, size=(3, 40))
+        costs, grads = term.evaluate_batch(doses, with_grad=False)
+        assert grads is None
+        np.testing.assert_allclose(costs, term.evaluate_batch(doses)[0])
+
+    def test_rejects_shape_mismatch(self):
+        term, _ = _basic_kl_term()
+        with pytest.raises(ValueError, match="shape"):
+            term.evaluate_batch(np.zeros((2, 41)))
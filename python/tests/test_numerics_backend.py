@@ -0,0 +1,153 @@
+"""
+Tests for the numerics backend switch and the compiled kernels
+(pybrimstone.numerics._kernels, built from python/numerics_kernels.cpp).
+
+The parity tests run each primitive through both backends and require the
+compiled one to match the NumPy reference to round-off; they are skipped
+when the extension isn't built. The rest of the suite checks whichever
+backend is active -- run it again with BRIMSTONE_NUMERICS=python to cover
+the reference.
+"""
+
+import sys
+from pathlib import Path
+
+import numpy as np
+import pytest
+
+sys.path.insert(0, str(Path(__file__).parent.parent))
+
+from pybrimstone.kl_term import KLDivTerm
+from pybrimstone.terma_kernel_dose import TermaKernelDoseCalc
+from pybrimstone.numerics import (
+    conv_gauss,
+    get_backend,
+    histogram_bin_dose,
+    kl_divergence_calc_over_target,
+    kl_divergence_target_over_calc,
+    make_gaussian_kernel,
+    native_available,
+    set_interval,
+    set_backend,
+)
+
+
+requires_native = pytest.mark.skipif(
+    not native_available(), reason="pybrimstone.numerics._kernels not built"
+)
+
+
+def _both(fn, *args, **kwargs):
+    """fn evaluated with the python, then the native backend."""
+    previous = set_backend("python")
+    try:
+        ref = fn(*args, **kwargs)
+        set_backend("native")
+        fast = fn(*args, **kwargs)
+    finally:
+        set_backend(previous)
+    return ref, fast
+
+
+def _case(n_voxels, seed=0):
+    rng = np.random.default_rng(seed)
+    mask = (rng.uniform(size=n_voxels) > 0.4) * rng.choice([1.0, 0.5], n_voxels)
+    dose = rng.uniform(0.0, 1.2, size=n_voxels)
+    return dose, mask
+
+
+# ---------------------------------------------------------------------------
+# Backend switch
+# ---------------------------------------------------------------------------
+
+class TestBackendSwitch:
+    def test_python_always_selectable(self):
+        previous = set_backend("python")
+        try:
+            assert get_backend() == "python"
+        finally:
+            set_backend(previous)
+
+    def test_unknown_backend_raises(self):
+        with pytest.raises(ValueError, match="unknown"):
+            set_backend("fortran")
+
+    def test_native_unavailable_raises(self):
+        if native_available():
+            pytest.skip("native kernels are built")
+        with pytest.raises(ImportError):
+            set_backend("native")
+
+
+# ---------------------------------------------------------------------------
+# Parity: compiled kernels vs the NumPy reference
+# ---------------------------------------------------------------------------
+
+@requires_native
+class TestNativeParity:
+    @pytest.mark.parametrize("sigma", [0.0, 0.05, 0.1, 0.3])
+    def test_gaussian_kernel(self, sigma):
+        ref, fast = _both(make_gaussian_kernel, sigma, 0.02)
+        assert fast.shape == ref.shape
+        np.testing.assert_allclose(fast, ref, rtol=1e-12, atol=1e-15)
+
+    @pytest.mark.parametrize("n_voxels", [10, 5000, 200000])
+    def test_bin_dose(self, n_voxels):
+        dose, mask = _case(n_voxels)
+        ref, fast = _both(histogram_bin_dose, dose, mask, -0.8, 0.05)
+        assert fast.shape == ref.shape
+        np.testing.assert_allclose(fast, ref, rtol=1e-10, atol=1e-9)
+
+    def test_conv_gauss(self):
+        rng = np.random.default_rng(1)
+        bins = rng.uniform(size=300)
+        kernel = make_gaussian_kernel(0.1, 0.02)
+        ref, fast = _both(conv_gauss, bins, kernel)
+        assert fast.shape == ref.shape
+        np.testing.assert_allclose(fast, ref, rtol=1e-12, atol=1e-12)
+
+    @pytest.mark.parametrize(
+        "fn", [kl_divergence_calc_over_target, kl_divergence_target_over_calc]
+    )
+    def test_kl(self, fn):
+        rng = np.random.default_rng(2)
+        calc = rng.uniform(size=50)
+        calc /= calc.sum()
+        target = rng.uniform(size=40)
+        target /= target.sum()
+        ref, fast = _both(fn, calc, target)
+        assert fast == pytest.approx(ref, rel=1e-12, abs=1e-15)
+
+    @pytest.mark.parametrize("cross_entropy", [False, True])
+    @pytest.mark.parametrize("n_voxels", [40, 100000])
+    def test_kl_term_evaluate(self, cross_entropy, n_voxels):
+        dose, mask = _case(n_voxels, seed=3)
+        term = KLDivTerm(
+            mask, set_interval(0.4, 0.7), bin_width=0.05, cross_entropy=cross_entropy
+        )
+        (ref_cost, ref_grad), (cost, grad) = _both(term.evaluate, dose)
+        assert cost == pytest.approx(ref_cost, rel=1e-10, abs=1e-12)
+        np.testing.assert_allclose(grad, ref_grad, rtol=1e-8, atol=1e-12)
+
+    def test_wrapped_low_bin_matches_numpy(self):
+        # a dose one bin below the range lands in the last bin, as NumPy's
+        # negative indexing puts it
+        dose = np.array([-0.06, 0.3, 0.5])
+        mask = np.ones(3)
+        ref, fast = _both(histogram_bin_dose, dose, mask, 0.0, 0.1)
+        np.testing.assert_allclose(fast, ref, atol=1e-15)
+
+    @pytest.mark.parametrize("rel_tol", [0.0, 1e-6])
+    def test_terma_dose_operator(self, rel_tol):
+        # reflect boundaries with the kernel radius longer than the x axis
+        rng = np.random.default_rng(4)
+        calc = TermaKernelDoseCalc(
+            rng.uniform(0.2, 1.8, size=(3, 14, 16)),
+            beamlet_centers_2d=rng.uniform(0.0, 3.0, size=(5, 2)),
+            beamlet_width_mm=3.0, mu=0.05, kernel_sigma_mm=3.0,
+            voxel_spacing_mm=(1.0, 1.5, 2.0),
+        )
+        ref, fast = _both(calc.build_dose_operator, sparse=True, rel_tol=rel_tol)
+        assert fast.shape == ref.shape
+        assert fast.nnz == ref.nnz
+        np.testing.assert_allclose(fast.toarray(), ref.toarray(), rtol=1e-12, atol=1e-18)
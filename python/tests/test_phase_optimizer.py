@@ -50,6 +50,38 @@ class TestLibraryCGParity:
         assert all(r["sigma_weights"] is not None for r in records)
 
 
+class TestBatchedLineSearch:
+    """polak_ribiere_cg with f_batch brackets each line minimum from one batch."""
+
+    def test_bracket_from_batch(self):
+        from pybrimstone.numerics.conjugate_gradient import bracket_from_batch
+        calls = []
+
+        def f_batch(P):
+            calls.append(P.shape[0])
+            return np.sum((P - 3.0) ** 2, axis=1)
+
+        a, b, c = bracket_from_batch(f_batch, np.zeros(2), np.ones(2))
+        assert len(calls) == 1
+        assert a < b < c and a < 3.0 < c
+
+    def test_unbracketed_batch_falls_back(self):
+        from pybrimstone.numerics.conjugate_gradient import bracket_from_batch
+        f_batch = lambda P: -P[:, 0]  # decreasing along the whole ladder
+        assert bracket_from_batch(f_batch, np.zeros(1), np.ones(1)) is None
+
+    def test_matches_unbatched_cg(self):
+        A = np.array([[3.0, 0.5], [0.5, 1.0]])
+        f = lambda x: float(x @ A @ x)
+        grad = lambda x: 2.0 * A @ x
+        f_batch = lambda P: np.einsum("ij,jk,ik->i", P, A, P)
+        x0 = np.array([3.0, -4.0])
+        x_ref, _, _, _ = polak_ribiere_cg(f, grad, x0)
+        x_bat, _, _, conv = polak_ribiere_cg(f, grad, x0, f_batch=f_batch)
+        assert conv
+        assert np.allclose(x_bat, x_ref, atol=1e-3)
+
+
 class TestBoundedLineSearch:
     """
     Robustness fix for the sigmoid-saturation runaway documented in the
@@ -0,0 +1,102 @@
+"""
+Tests for the pipeline benchmark's phantoms, sweep and report.
+
+The timings themselves aren't checked -- only that the phantoms have the
+intended materials and structures, and that a run produces a complete,
+JSON-serializable report.
+"""
+
+import json
+import sys
+from pathlib import Path
+
+import numpy as np
+import pytest
+
+sys.path.insert(0, str(Path(__file__).parent.parent))
+
+from pybrimstone.numerics import native_available
+from experiments.pipeline_benchmark import (
+    BONE_DENSITY,
+    LUNG_DENSITY,
+    BenchConfig,
+    make_phantom,
+    run_benchmark,
+    sweep_configs,
+)
+
+
+TINY = BenchConfig(grid=8, beamlets_per_side=2, n_beams=2, cg_max_iter=2)
+
+
+class TestPhantom:
+    def test_water_is_uniform(self):
+        density, _ = make_phantom(TINY)
+        assert density.shape == (8, 8, 8)
+        assert np.all(density == 1.0)
+
+    def test_lung_slab_is_upstream_of_target(self):
+        config = BenchConfig(phantom="lung_slab", grid=16)
+        density, structures = make_phantom(config)
+        lung_z = np.where(np.any(density == LUNG_DENSITY, axis=(0, 1)))[0]
+        target = structures["target"].reshape(density.shape)
+        target_z = np.where(np.any(target > 0, axis=(0, 1)))[0]
+        assert lung_z.size > 0
+        assert lung_z.max() < target_z.min()
+
+    def test_bone_insert_misses_target(self):
+        config = BenchConfig(phantom="bone_insert", grid=16)
+        density, structures = make_phantom(config)
+        bone = (density == BONE_DENSITY).ravel()
+        assert bone.any()
+        assert not np.any(bone & (structures["target"] > 0))
+
+    def test_structures(self):
+        config = BenchConfig(grid=16, n_oars=4)
+        _, structures = make_phantom(config)
+        assert sorted(structures) == ["oar_0", "oar_1", "oar_2", "oar_3", "target"]
+        for mask in structures.values():
+            assert mask.shape == (16 ** 3,)
+            assert mask.sum() > 0
+        for n_oar in range(4):
+            assert not np.any((structures[f"oar_{n_oar}"] > 0) & (structures["target"] > 0))
+
+    def test_rejects_unknown_phantom(self):
+        with pytest.raises(ValueError, match="unknown phantom"):
+            make_phantom(BenchConfig(phantom="steel"))
+
+
+class TestSweep:
+    def test_one_axis_at_a_time_without_duplicates(self):
+        configs = sweep_configs(TINY, {"grid": (8, 12), "n_beams": (1, 2)})
+        # the base appears once, though both axes include it
+        assert configs == [
+            TINY,
+            BenchConfig(grid=12, beamlets_per_side=2, n_beams=2, cg_max_iter=2),
+            BenchConfig(grid=8, beamlets_per_side=2, n_beams=1, cg_max_iter=2),
+        ]
+
+
+class TestReport:
+    def test_report_is_complete_and_serializable(self):
+        report = run_benchmark([TINY], repeats=1, verbose=False)
+        report = json.loads(json.dumps(report))
+
+        assert report["schema"] == 1
+        (result,) = report["results"]
+        assert result["n_voxels"] == 8 ** 3
+        assert result["n_beamlets"] == 2 * 2 ** 2
+        assert result["io_bytes"] > 0
+        expected = {
+            "beamlet_generation", "terma", "kernel_convolve",
+            "eval_cost", "eval_grad", "optimize", "io_write", "io_read",
+        }
+        if native_available():
+            expected |= {
+                "dose_operator", "dose_operator_native",
+                "eval_cost_native", "eval_grad_native",
+            }
+        assert report["host"]["native_kernels"] == native_available()
+        assert set(result["stages"]) == expected
+        for stage in result["stages"].values():
+            assert stage["median_s"] >= 0.0
@@ -157,6 +157,78 @@ class TestPrescriptionGradient:
         assert np.allclose(ana, fd, atol=1e-3, rtol=1e-2)
 
 
+# ---------------------------------------------------------------------------
+# Batched evaluation
+# ---------------------------------------------------------------------------
+
+class TestPrescriptionBatch:
+    """evaluate_batch against per-point evaluate, for each operator form."""
+
+    @staticmethod
+    def _build(operator, use_transform=True):
+        rng = np.random.default_rng(5)
+        mask = np.zeros(20)
+        mask[:12] = 1.0
+        p = Prescription(operator, use_transform=use_transform)
+        p.add_dose_term(KLDivTerm.from_interval(
+            mask, 0.4, 0.8, bin_width=0.1, var_min=0.04, var_max=0.04,
+        ))
+        p.add_dose_term(KLDivTerm.from_interval(
+            1.0 - mask, 0.0, 0.3, bin_width=0.1, var_min=0.04, var_max=0.04,
+            weight=0.5, cross_entropy=True,
+        ))
+        p.add_beamlet_term(CoursePriorTerm(target_mu=rng.normal(size=5), precision=0.5))
+        return p
+
+    @staticmethod
+    def _matrix():
+        return np.abs(np.random.default_rng(6).normal(size=(20, 5))) * 0.3 + 0.05
+
+    def _check(self, p, params):
+        costs, grads = p.evaluate_batch(params)
+        assert costs.shape == (params.shape[0],)
+        assert grads.shape == params.shape
+        for b, x in enumerate(params):
+            cost, grad = p.evaluate(x)
+            assert costs[b] == pytest.approx(cost, rel=1e-10, abs=1e-12)
+            np.testing.assert_allclose(grads[b], grad, rtol=1e-8, atol=1e-12)
+
+    def test_matrix_operator(self):
+        params = np.random.default_rng(11).normal(size=(7, 5))
+        self._check(self._build(self._matrix()), params)
+
+    def test_sparse_operator(self):
+        sparse = pytest.importorskip("scipy.sparse")
+        params = np.random.default_rng(12).normal(size=(4, 5))
+        self._check(self._build(sparse.csr_matrix(self._matrix())), params)
+
+    def test_callable_operator(self):
+        D = self._matrix()
+        params = np.random.default_rng(13).uniform(0.1, 0.4, size=(3, 5))
+        p = self._build((lambda w: D @ w, lambda g: D.T @ g), use_transform=False)
+        self._check(p, params)
+
+    def test_cost_only(self):
+        p = self._build(self._matrix())
+        params = np.random.default_rng(14).normal(size=(3, 5))
+        costs, grads = p.evaluate_batch(params, with_grad=False)
+        assert grads is None
+        np.testing.assert_allclose(costs, [p.evaluate_cost_only(x) for x in params])
+
+    def test_grad_check_from_one_batch(self):
+        # all central-difference points of a gradient check in one call
+        p = self._build(self._matrix())
+        del p.dose_terms[1:]  # the KL term alone, as TestPrescriptionGradient
+        x0 = np.random.default_rng(15).normal(size=5) * 0.5
+        eps = 1e-4
+        steps = np.repeat(np.eye(5) * eps, 2, axis=0)
+        steps[1::2] *= -1.0
+        costs, _ = p.evaluate_batch(x0 + steps, with_grad=False)
+        fd = (costs[0::2] - costs[1::2]) / (2 * eps)
+        _, ana = p.evaluate(x0)
+        assert np.allclose(ana, fd, atol=1e-3, rtol=1e-2)
+
+
 # ---------------------------------------------------------------------------
 # Composition behavior
 # ---------------------------------------------------------------------------
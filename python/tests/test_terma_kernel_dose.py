@@ -256,6 +256,46 @@ class TestDoseOperator:
         assert np.allclose(D[:, 0], dose_b0.ravel())
 
 
+class TestSparseDoseOperator:
+    def _make(self, n_beamlets=3, shape=(10, 9, 12)):
+        rng = np.random.default_rng(0)
+        density = rng.uniform(0.5, 1.5, size=shape)
+        centers = rng.uniform(2.0, 7.0, size=(n_beamlets, 2))
+        return TermaKernelDoseCalc(
+            density, beamlet_centers_2d=centers,
+            beamlet_width_mm=2.0, mu=0.05, kernel_sigma_mm=2.0,
+            voxel_spacing_mm=(1.0, 1.5, 2.0),
+        )
+
+    def test_sparse_matches_dense(self):
+        calc = self._make()
+        D = calc.build_dose_operator()
+        S = calc.build_dose_operator(sparse=True)
+        assert S.format == "csc"
+        assert S.shape == D.shape
+        np.testing.assert_allclose(S.toarray(), D, rtol=1e-12, atol=1e-18)
+
+    def test_rel_tol_drops_small_entries(self):
+        calc = self._make(shape=(20, 20, 12))
+        D = calc.build_dose_operator()
+        S = calc.build_dose_operator(sparse=True, rel_tol=1e-3)
+        assert S.nnz < D.size
+        col_max = np.abs(D).max(axis=0)
+        kept = S.toarray()
+        assert np.all((kept == 0) | (np.abs(kept) > 1e-3 * col_max))
+        np.testing.assert_allclose(kept, D, atol=1e-3 * col_max.max())
+
+    def test_dense_rel_tol_matches_sparse(self):
+        calc = self._make()
+        S = calc.build_dose_operator(sparse=True, rel_tol=1e-4)
+        D = calc.build_dose_operator(rel_tol=1e-4)
+        np.testing.assert_allclose(S.toarray(), D, rtol=1e-12, atol=1e-18)
+
+    def test_rejects_negative_rel_tol(self):
+        with pytest.raises(ValueError, match="rel_tol"):
+            self._make().build_dose_operator(sparse=True, rel_tol=-1.0)
+
+
 # ---------------------------------------------------------------------------
 # Integration with Prescription
 # ---------------------------------------------------------------------------